@@ -163,6 +163,8 @@ local bins_extra_flags = { }
 local libs = { }
 local prebuilt_libs = { }
 
+local generated_files = { }
+
 local function flatten_into( res, t )
 	for _, x in ipairs( t ) do
 		if type( x ) == "table" then
@@ -281,6 +283,18 @@ function prebuilt_lib( lib_name, archives )
 	prebuilt_libs[ lib_name ] = archives or { lib_name }
 end
 
+-- a file made by running one of our bins, rebuilt when the bin or any of
+-- cfg.deps change
+function generated_file( file_name, cfg )
+	assert( type( cfg ) == "table", "cfg should be a table" )
+	assert( type( cfg.tool ) == "string", "cfg.tool should be a string" )
+	assert( not cfg.deps or type( cfg.deps ) == "table", "cfg.deps should be a table or nil" )
+	assert( not generated_files[ file_name ] )
+
+	generated_files[ file_name ] = cfg
+	cfg.deps = glob( cfg.deps or { } )
+end
+
 function global_cxxflags( flags )
 	cxxflags = cxxflags .. " " .. flags
 end
@@ -405,6 +419,12 @@ build %s: zig ggbuild/download_zig.sh
 		end
 	end
 
+printf( [[
+rule run
+    command = $tool $args
+    description = $out
+]] )
+
 	for _, flag in ipairs( objs_flags ) do
 		for name, cfg in pairs( objs ) do
 			if name:match( flag.pattern ) then
@@ -464,4 +484,17 @@ build %s: zig ggbuild/download_zig.sh
 
 		printf( "default %s", full_name )
 	end
+
+	printf()
+
+	for file_name, cfg in sort_by_key( generated_files ) do
+		local tool = output_dir .. cfg.tool .. bin_suffix
+		printf( "build %s: run | %s %s", file_name, tool, table.concat( cfg.deps, " " ) )
+		-- CreateProcess looks in the working directory but sh doesn't
+		printf( "    tool = %s%s", OS == "windows" and "" or "./", tool )
+		if cfg.args then
+			printf( "    args = %s", cfg.args )
+		end
+		printf( "default %s", file_name )
+	end
 end
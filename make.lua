@@ -47,7 +47,13 @@ require( "libs.yoga" )
 require( "libs.zstd" )
 
 require( "source.tools.bc4" )
+require( "source.tools.collisionpack" )
+require( "source.tools.deltabench" )
 require( "source.tools.dieselmap" )
+require( "source.tools.demotool" )
+require( "source.tools.drawbench" )
+require( "source.tools.jobbench" )
+require( "source.tools.netdict" )
 
 local platform_curl_libs = {
 	{ OS ~= "macos" and "curl" or nil },
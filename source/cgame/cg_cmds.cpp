@@ -166,6 +166,13 @@ static void CG_SC_SaveLoadout() {
 	}
 }
 
+static void CG_SC_NextMap() {
+	if( cgs.demoPlaying || Cmd_Argc() < 2 )
+		return;
+
+	CL_PrefetchMap( Cmd_Argv( 1 ) );
+}
+
 struct ServerCommand {
 	const char * name;
 	void ( *func )();
@@ -181,6 +188,7 @@ static const ServerCommand server_commands[] = {
 	{ "downloaddemo", CG_SC_DownloadDemo },
 	{ "changeloadout", CG_SC_ChangeLoadout },
 	{ "saveloadout", CG_SC_SaveLoadout },
+	{ "nextmap", CG_SC_NextMap },
 };
 
 void CG_GameCommand( const char * command ) {
@@ -27,12 +27,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 static RecordDemoContext record_demo_context = { };
 static s64 record_demo_gametime;
+static s64 record_demo_last_keyframe;
 static time_t record_demo_utc_time;
 static bool record_demo_waiting = false;
 static char * record_demo_filename = NULL;
 
 static DemoMetadata playing_demo_metadata;
-static msg_t playing_demo_contents = { };
+static DemoStream * playing_demo_stream;
+static Span< DemoKeyframe > playing_demo_keyframes;
 static bool playing_demo_paused;
 static bool playing_demo_seek;
 static bool playing_demo_seek_latch;
@@ -41,7 +43,7 @@ static s64 playing_demo_seek_time;
 static bool yolodemo;
 
 bool CL_DemoPlaying() {
-	return playing_demo_contents.data != NULL;
+	return playing_demo_stream != NULL;
 }
 
 bool CL_DemoPaused() {
@@ -66,18 +68,31 @@ void CL_WriteDemoMessage( msg_t msg, size_t offset ) {
 	WriteDemoMessage( &record_demo_context, msg, offset );
 }
 
-void CL_DemoBaseline( const snapshot_t * snap ) {
-	if( !record_demo_waiting || snap->delta )
-		return;
+void CL_DemoSnapshot( const snapshot_t * snap ) {
+	if( record_demo_waiting && !snap->delta ) {
+		record_demo_gametime = cls.gametime;
+		record_demo_utc_time = time( NULL );
+		record_demo_waiting = false;
 
-	record_demo_gametime = cls.gametime;
-	record_demo_utc_time = time( NULL );
-	record_demo_waiting = false;
+		defer { Free( sys_allocator, record_demo_filename ); };
 
-	defer { Free( sys_allocator, record_demo_filename ); };
+		TempAllocator temp = cls.frame_arena.temp();
+		StartRecordingDemo( &temp, &record_demo_context, record_demo_filename, cl.servercount, cl.snapFrameTime, client_gs.maxclients, cl_baselines );
+	}
 
-	TempAllocator temp = cls.frame_arena.temp();
-	StartRecordingDemo( &temp, &record_demo_context, record_demo_filename, cl.servercount, cl.snapFrameTime, client_gs.maxclients, cl_baselines );
+	if( record_demo_context.file == NULL )
+		return;
+
+	// the message this snap came in gets written after we return
+	if( !snap->delta ) {
+		AddDemoKeyframe( &record_demo_context, snap->serverTime );
+		record_demo_last_keyframe = snap->serverTime;
+	}
+	else if( snap->serverTime - record_demo_last_keyframe >= DEMO_KEYFRAME_INTERVAL ) {
+		CL_AddReliableCommand( ClientCommand_NoDelta );
+		// don't ask again while we wait for it
+		record_demo_last_keyframe = snap->serverTime;
+	}
 }
 
 void CL_Record_f() {
@@ -157,15 +172,17 @@ static void FreeDemoMetadata() {
 
 void CL_DemoCompleted() {
 	FreeDemoMetadata();
-	Free( sys_allocator, playing_demo_contents.data );
-	playing_demo_contents = { };
+	CloseDemoStream( sys_allocator, playing_demo_stream );
+	playing_demo_stream = NULL;
+	Free( sys_allocator, playing_demo_keyframes.ptr );
+	playing_demo_keyframes = { };
 
 	Com_Printf( "Demo completed\n" );
 }
 
 void CL_ReadDemoPackets() {
 	while( ( cl.receivedSnapNum <= 0 || !cl.snapShots[ cl.receivedSnapNum % ARRAY_COUNT( cl.snapShots ) ].valid || cl.snapShots[ cl.receivedSnapNum % ARRAY_COUNT( cl.snapShots ) ].serverTime < cl.serverTime ) ) {
-		msg_t msg = MSG_ReadMsg( &playing_demo_contents );
+		msg_t msg = ReadDemoMessage( playing_demo_stream );
 		if( msg.data == NULL ) {
 			CL_Disconnect( NULL );
 			return;
@@ -182,10 +199,22 @@ void CL_LatchedDemoJump() {
 	cls.gametime = playing_demo_seek_time;
 	cl.currentSnapNum = cl.pendingSnapNum = cl.receivedSnapNum = 0;
 
-	playing_demo_contents.readcount = 0;
-
 	CL_AdjustServerTime( 1 );
 
+	// start from the last keyframe before where we're going rather than
+	// replaying the whole demo. replaying from the start reparses the
+	// precache command which does this reset for us. keyframes come after
+	// serverdata/precache so we can only skip to them once we're in game
+	Optional< DemoKeyframe > keyframe = FindDemoKeyframe( playing_demo_keyframes, cl.serverTime );
+	if( keyframe.exists && cls.state == CA_ACTIVE ) {
+		SeekDemoStream( playing_demo_stream, keyframe.value );
+		CL_GameModule_Reset();
+		StopAllSounds( false );
+	}
+	else {
+		SeekDemoStream( playing_demo_stream, DemoKeyframe { } );
+	}
+
 	playing_demo_seek = true;
 	playing_demo_seek_latch = false;
 }
@@ -203,24 +232,10 @@ static void CL_StartDemo( const char * demoname, bool yolo ) {
 	}
 	defer { Free( sys_allocator, filename ); };
 
-	Span< u8 > demo = ReadFileBinary( sys_allocator, filename );
-	if( demo.ptr == NULL ) {
-		Com_Printf( S_COLOR_YELLOW "%s doesn't exist\n", filename );
-		return;
-	}
-	defer { Free( sys_allocator, demo.ptr ); };
-
-	Span< u8 > decompressed;
-	bool ok = true;
-	ok = ok && ReadDemoMetadata( sys_allocator, &playing_demo_metadata, demo );
-	ok = ok && DecompressDemo( sys_allocator, playing_demo_metadata, &decompressed, demo );
-	if( !ok ) {
-		Com_Printf( S_COLOR_YELLOW "Demo is corrupt\n" );
-		FreeDemoMetadata();
+	playing_demo_stream = OpenDemoStream( sys_allocator, filename, &playing_demo_metadata, &playing_demo_keyframes );
+	if( playing_demo_stream == NULL )
 		return;
-	}
 
-	playing_demo_contents = NewMSGReader( decompressed.ptr, decompressed.n, decompressed.n );
 	playing_demo_paused = false;
 	playing_demo_seek = false;
 	playing_demo_seek_latch = false;
@@ -24,7 +24,6 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "client/discord.h"
 #include "client/downloads.h"
 #include "client/gltf.h"
-#include "client/threadpool.h"
 #include "client/demo_browser.h"
 #include "client/server_browser.h"
 #include "client/livepp.h"
@@ -35,6 +34,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "qcommon/hash.h"
 #include "qcommon/fs.h"
 #include "qcommon/string.h"
+#include "qcommon/threadpool.h"
 #include "qcommon/time.h"
 #include "qcommon/version.h"
 #include "gameshared/gs_public.h"
@@ -126,7 +126,7 @@ static void CL_SendConnectPacket() {
 
 	TempAllocator temp = cls.frame_arena.temp();
 	Netchan_OutOfBandPrint( cls.socket, cls.serveraddress, "%s",
-		temp( "connect {} {} {} \"{}\"\n", APP_PROTOCOL_VERSION, cls.session_id, cls.challenge, Cvar_GetUserInfo() ) );
+		temp( "connect {} {} {} \"{}\" {}\n", APP_PROTOCOL_VERSION, cls.session_id, cls.challenge, Cvar_GetUserInfo(), Netchan_DictionaryID() ) );
 }
 
 /*
@@ -256,7 +256,7 @@ static void CL_Disconnect_SendCommand() {
 * This is also called on Com_Error, so it shouldn't cause any errors
 */
 void CL_Disconnect( const char *message ) {
-	CancelDownload(); // TODO: maybe shouldn't cancel when downloading a demo
+	CL_CancelDownload(); // TODO: maybe shouldn't cancel when downloading a demo
 
 	if( cls.state == CA_UNINITIALIZED ) {
 		return;
@@ -319,6 +319,41 @@ void CL_Changing_f() {
 	CL_SetClientState( CA_CONNECTED ); // not active anymore, but not disconnected
 }
 
+static bool AddDownloadedMap( const char * filename, Span< const u8 > compressed ) {
+	if( compressed.ptr == NULL )
+		return false;
+
+	Span< u8 > data;
+	defer { Free( sys_allocator, data.ptr ); };
+
+	if( !Decompress( filename, sys_allocator, compressed, &data ) ) {
+		Com_Printf( "Downloaded map is corrupt.\n" );
+		return false;
+	}
+
+	TempAllocator temp = cls.frame_arena.temp();
+	Span< const char > clean_filename = StripPrefix( StripExtension( filename ), "base/" );
+	if( !AddMap( data, temp( "{}", clean_filename ) ) ) {
+		Com_Printf( "Downloaded map is corrupt.\n" );
+		return false;
+	}
+
+	return true;
+}
+
+static void AddPrecachedMap( const char * filename, Span< const u8 > data ) {
+	if( AddDownloadedMap( filename, data ) ) {
+		CL_FinishConnect();
+	}
+	else {
+		CL_Disconnect( NULL );
+	}
+}
+
+static void AddPrefetchedMap( const char * filename, Span< const u8 > data ) {
+	AddDownloadedMap( filename, data );
+}
+
 /*
 * CL_ServerReconnect_f
 *
@@ -334,7 +369,11 @@ void CL_ServerReconnect_f() {
 		return;
 	}
 
-	CancelDownload();
+	// we were probably told to prefetch the map we're about to load, so let
+	// CL_Precache_f take it over
+	if( !CL_IsDownloading( AddPrefetchedMap ) ) {
+		CL_CancelDownload();
+	}
 
 	CL_StopRecording( true );
 
@@ -414,6 +453,7 @@ static void CL_ConnectionlessPacket( const NetAddress & address, msg_t * msg ) {
 		cls.rejected = false;
 
 		Netchan_Setup( &cls.netchan, address, cls.session_id );
+		Netchan_NegotiateDictionary( &cls.netchan, SpanToU64( MakeSpan( Cmd_Argv( 1 ) ), 0 ) );
 		CL_SetClientState( CA_HANDSHAKE );
 		CL_AddReliableCommand( ClientCommand_New );
 		return;
@@ -574,28 +614,6 @@ void CL_FinishConnect() {
 	MSG_WriteInt32( args, precache_spawncount );
 }
 
-static bool AddDownloadedMap( const char * filename, Span< const u8 > compressed ) {
-	if( compressed.ptr == NULL )
-		return false;
-
-	Span< u8 > data;
-	defer { Free( sys_allocator, data.ptr ); };
-
-	if( !Decompress( filename, sys_allocator, compressed, &data ) ) {
-		Com_Printf( "Downloaded map is corrupt.\n" );
-		return false;
-	}
-
-	TempAllocator temp = cls.frame_arena.temp();
-	Span< const char > clean_filename = StripPrefix( StripExtension( filename ), "base/" );
-	if( !AddMap( data, temp( "{}", clean_filename ) ) ) {
-		Com_Printf( "Downloaded map is corrupt.\n" );
-		return false;
-	}
-
-	return true;
-}
-
 /*
 * CL_Precache_f
 *
@@ -622,14 +640,19 @@ void CL_Precache_f() {
 
 	if( cl.map == NULL ) {
 		TempAllocator temp = cls.frame_arena.temp();
-		CL_DownloadFile( temp( "base/maps/{}.cdmap.zst", Cmd_Argv( 2 ) ), []( const char * filename, Span< const u8 > data ) {
-			if( AddDownloadedMap( filename, data ) ) {
-				CL_FinishConnect();
-			}
-			else {
-				CL_Disconnect( NULL );
-			}
-		} );
+		const char * path = temp( "base/maps/{}.cdmap.zst", mapname );
+
+		// this takes over a prefetch of the same map, but a prefetch of
+		// anything else has to make way
+		bool ok = CL_DownloadFile( path, AddPrecachedMap );
+		if( !ok && CL_IsDownloading() ) {
+			CL_CancelDownload();
+			ok = CL_DownloadFile( path, AddPrecachedMap );
+		}
+
+		if( !ok ) {
+			CL_Disconnect( NULL );
+		}
 
 		return;
 	}
@@ -637,6 +660,20 @@ void CL_Precache_f() {
 	CL_FinishConnect();
 }
 
+/*
+* CL_PrefetchMap
+*
+* The server tells us the next map as soon as it knows it, so we can
+* download it while the current match wraps up instead of on reconnect
+*/
+void CL_PrefetchMap( const char * name ) {
+	if( FindMap( StringHash( Hash64( name ) ) ) != NULL || CL_IsDownloading() )
+		return;
+
+	TempAllocator temp = cls.frame_arena.temp();
+	CL_DownloadFile( temp( "base/maps/{}.cdmap.zst", name ), AddPrefetchedMap );
+}
+
 static void CL_WriteConfiguration() {
 	TempAllocator temp = cls.frame_arena.temp();
 
@@ -898,7 +935,7 @@ void CL_Netchan_Transmit( msg_t * msg ) {
 	Netchan_PushAllFragments( cls.socket, &cls.netchan );
 
 	if( msg->cursize > 60 ) {
-		Netchan_CompressMessage( msg );
+		Netchan_CompressMessage( &cls.netchan, msg );
 	}
 
 	Netchan_Transmit( cls.socket, &cls.netchan, msg );
@@ -1136,8 +1173,6 @@ void CL_Init() {
 
 	cl_initialized = true;
 
-	InitThreadPool();
-
 	ThreadPoolDo( []( TempAllocator * temp, void * data ) {
 		InitAssets( temp );
 	} );
@@ -1208,8 +1243,6 @@ void CL_Shutdown() {
 
 	CL_ShutdownLocal();
 
-	ShutdownThreadPool();
-
 	Con_Shutdown();
 
 	ShutdownAssets();
@@ -26,6 +26,7 @@ static CollisionModelStorage collision_models;
 
 static void DeleteMap( Map * map ) {
 	Free( sys_allocator, const_cast< char * >( map->name ) );
+	Free( sys_allocator, map->decompressed_sections.ptr );
 	DeleteMapRenderData( map->render_data );
 }
 
@@ -62,7 +63,7 @@ bool AddMap( Span< const u8 > data, const char * path ) {
 
 	Map map = { };
 
-	DecodeMapResult res = DecodeMap( &map.data, data );
+	DecodeMapResult res = DecodeMap( &map.data, data, MapSectionMask_Game | MapSectionMask_Render, sys_allocator, &map.decompressed_sections );
 	if( res != DecodeMapResult_Ok ) {
 		return false;
 	}
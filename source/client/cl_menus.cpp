@@ -774,25 +774,32 @@ static void DemoBrowser() {
 	ImGui::BeginChild( "demos" );
 	ImGui::Columns( 5 );
 
-	for( const DemoBrowserEntry & demo : GetDemoBrowserEntries() ) {
-		bool clicked = ImGui::Selectable( demo.path, false, ImGuiSelectableFlags_SpanAllColumns | ImGuiSelectableFlags_AllowDoubleClick );
-		ImGui::NextColumn();
-		ImGui::Text( "%s", demo.server );
-		ImGui::NextColumn();
-		ImGui::Text( "%s", demo.map );
-		ImGui::NextColumn();
-		ImGui::Text( "%s", demo.date );
-		ImGui::NextColumn();
-
-		bool old_version = !StrEqual( demo.version, APP_VERSION );
-		ImGui::PushStyleColor( ImGuiCol_Text, old_version ? vec4_red : vec4_green );
-		ImGui::Text( "%s", demo.version );
-		ImGui::NextColumn();
-		ImGui::PopStyleColor();
-
-		if( clicked && ImGui::IsMouseDoubleClicked( 0 ) ) {
-			const char * cmd = yolodemo ? "yolodemo" : "demo";
-			Cbuf_Add( "{} \"{}\"", cmd, demo.path );
+	// only submit the rows that are on screen, people have a lot of demos
+	Span< const DemoBrowserEntry > demos = GetDemoBrowserEntries();
+	ImGuiListClipper clipper;
+	clipper.Begin( checked_cast< int >( demos.n ) );
+	while( clipper.Step() ) {
+		for( int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++ ) {
+			const DemoBrowserEntry & demo = demos[ i ];
+			bool clicked = ImGui::Selectable( demo.path, false, ImGuiSelectableFlags_SpanAllColumns | ImGuiSelectableFlags_AllowDoubleClick );
+			ImGui::NextColumn();
+			ImGui::Text( "%s", demo.server );
+			ImGui::NextColumn();
+			ImGui::Text( "%s", demo.map );
+			ImGui::NextColumn();
+			ImGui::Text( "%s", demo.date );
+			ImGui::NextColumn();
+
+			bool old_version = !StrEqual( demo.version, APP_VERSION );
+			ImGui::PushStyleColor( ImGuiCol_Text, old_version ? vec4_red : vec4_green );
+			ImGui::Text( "%s", demo.version );
+			ImGui::NextColumn();
+			ImGui::PopStyleColor();
+
+			if( clicked && ImGui::IsMouseDoubleClicked( 0 ) ) {
+				const char * cmd = yolodemo ? "yolodemo" : "demo";
+				Cbuf_Add( "{} \"{}\"", cmd, demo.path );
+			}
 		}
 	}
 
@@ -36,13 +36,21 @@ static DownloadInProgress download;
 static void OnDownloadDone( int http_status, Span< const u8 > data ) {
 	Com_Printf( "Download %s: %s (%i)\n", data.ptr != NULL ? "successful" : "failed", download.path, http_status );
 
-	download.callback( download.path, data );
+	// clear it first so the callback can cancel or start downloads
+	DownloadInProgress done = download;
+	download = { };
 
-	Free( sys_allocator, download.path );
-	download.path = NULL;
+	done.callback( done.path, data );
+
+	Free( sys_allocator, done.path );
 }
 
 bool CL_DownloadFile( const char * filename, DownloadCompleteCallback callback ) {
+	if( download.path != NULL && StrEqual( download.path, filename ) ) {
+		download.callback = callback;
+		return true;
+	}
+
 	if( download.path ) {
 		Com_Printf( "Already downloading something.\n" );
 		return false;
@@ -69,6 +77,16 @@ bool CL_DownloadFile( const char * filename, DownloadCompleteCallback callback )
 	return true;
 }
 
+bool CL_IsDownloading( DownloadCompleteCallback callback ) {
+	return download.path != NULL && ( callback == NULL || download.callback == callback );
+}
+
+void CL_CancelDownload() {
+	CancelDownload();
+	Free( sys_allocator, download.path );
+	download = { };
+}
+
 /*
 =====================================================================
 
@@ -135,7 +153,7 @@ static void CL_ParseFrame( msg_t *msg ) {
 
 	cl.receivedSnapNum = snap->serverFrame;
 
-	CL_DemoBaseline( snap );
+	CL_DemoSnapshot( snap );
 
 	if( cl_debug_timeDelta->integer ) {
 		if( oldSnap != NULL && ( oldSnap->serverFrame + 1 != snap->serverFrame ) ) {
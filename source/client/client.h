@@ -30,6 +30,7 @@
 #include "client/keys.h"
 #include "client/maps.h"
 #include "client/console.h"
+#include "client/snap_read.h"
 #include "client/sound.h"
 #include "client/renderer/types.h"
 
@@ -219,6 +220,7 @@ void CL_FinishConnect();
 void CL_ServerReconnect_f();
 void CL_Changing_f();
 void CL_Precache_f();
+void CL_PrefetchMap( const char * name );
 void CL_ServerDisconnect_f();
 
 void CL_ForceVsync( bool force );
@@ -254,7 +256,7 @@ void CL_WriteUcmdsToMessage( msg_t *msg );
 // cl_demo.c
 //
 void CL_WriteDemoMessage( msg_t msg, size_t offset );
-void CL_DemoBaseline( const snapshot_t * snap );
+void CL_DemoSnapshot( const snapshot_t * snap );
 void CL_DemoCompleted();
 void CL_PlayDemo_f();
 void CL_YoloDemo_f();
@@ -276,8 +278,11 @@ void CL_ParseServerMessage( msg_t *msg );
 
 using DownloadCompleteCallback = void ( * )( const char * filename, Span< const u8 > data );
 
+// asking for the file that's already downloading takes it over, i.e. cb gets
+// called instead of the original callback
 bool CL_DownloadFile( const char * filename, DownloadCompleteCallback cb );
-bool CL_IsDownloading();
+// only counts downloads with the given callback, if there is one
+bool CL_IsDownloading( DownloadCompleteCallback cb = NULL );
 void CL_CancelDownload();
 
 //
@@ -295,9 +300,3 @@ void CL_InitImGui();
 void CL_ShutdownImGui();
 void CL_ImGuiBeginFrame();
 void CL_ImGuiEndFrame();
-
-//
-// snap_read
-//
-void SNAP_ParseBaseline( msg_t *msg, SyncEntityState *baselines );
-snapshot_t *SNAP_ParseFrame( msg_t *msg, const snapshot_t *lastFrame, snapshot_t *backup, SyncEntityState *baselines, int showNet );
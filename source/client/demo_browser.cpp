@@ -1,7 +1,10 @@
 #include "qcommon/base.h"
 #include "qcommon/array.h"
 #include "qcommon/fs.h"
+#include "qcommon/hash.h"
 #include "qcommon/string.h"
+#include "qcommon/threadpool.h"
+#include "qcommon/threads.h"
 #include "qcommon/time.h"
 #include "client/client.h"
 #include "client/demo_browser.h"
@@ -9,12 +12,46 @@
 
 #include "nanosort/nanosort.hpp"
 
+/*
+ * getting a demo's details means opening it, which takes minutes when you
+ * have tens of thousands of them, so we keep what we read in demos/.index
+ * and only open demos that are new or changed since we last wrote it. the
+ * ones we do open get read on the thread pool
+ */
+
+// followed by num_demos DemoIndexEntrys, sorted by path
+struct DemoIndexHeader {
+	char magic[ 8 ];
+	u64 format_version;
+	u64 num_demos;
+};
+
+// demos we couldn't read are in there too so we don't retry them until
+// they change
+struct DemoIndexEntry {
+	u64 path; // StringHash of the path relative to demos
+	u64 size;
+	s64 modified_time;
+
+	bool have_details;
+	s64 utc_time;
+	char server[ sizeof( DemoBrowserEntry::server ) ];
+	char map[ sizeof( DemoBrowserEntry::map ) ];
+	char version[ sizeof( DemoBrowserEntry::version ) ];
+};
+
+constexpr const char DEMO_INDEX_MAGIC[ sizeof( DemoIndexHeader::magic ) ] = "cddemos";
+constexpr u64 DEMO_INDEX_FORMAT_VERSION = 1;
+
 static NonRAIIDynamicArray< DemoBrowserEntry > demos;
-static size_t metadata_load_cursor;
+static NonRAIIDynamicArray< size_t > demos_to_load;
+static size_t load_cursor;
+static bool index_dirty;
 
 void InitDemoBrowser() {
 	TracyZoneScoped;
 	demos.init( sys_allocator );
+	demos_to_load.init( sys_allocator );
 }
 
 static void ClearDemos() {
@@ -22,18 +59,25 @@ static void ClearDemos() {
 		Free( sys_allocator, demo.path );
 	}
 	demos.clear();
-	metadata_load_cursor = 0;
+	demos_to_load.clear();
+	load_cursor = 0;
+	index_dirty = false;
 }
 
 void ShutdownDemoBrowser() {
 	ClearDemos();
 	demos.shutdown();
+	demos_to_load.shutdown();
 }
 
 Span< const DemoBrowserEntry > GetDemoBrowserEntries() {
 	return demos.span();
 }
 
+static const char * DemoIndexPath( Allocator * a ) {
+	return ( *a )( "{}/demos/.index", HomeDirPath() );
+}
+
 // TODO: 1k might not be enough forever
 static Span< u8 > ReadFirst1kBytes( TempAllocator * temp, const char * path ) {
 	FILE * f = OpenFile( temp, path, OpenFile_Read );
@@ -50,28 +94,93 @@ static Span< u8 > ReadFirst1kBytes( TempAllocator * temp, const char * path ) {
 	return Span< u8 >( buf, n );
 }
 
+static void SetDemoDetails( DemoBrowserEntry * demo, s64 utc_time, Span< const char > server, Span< const char > map, Span< const char > version ) {
+	demo->have_details = true;
+	demo->utc_time = utc_time;
+	ggformat( demo->server, sizeof( demo->server ), "{}", server );
+	ggformat( demo->map, sizeof( demo->map ), "{}", map );
+	ggformat( demo->version, sizeof( demo->version ), "{}", version );
+	FormatTimestamp( demo->date, sizeof( demo->date ), "%Y-%m-%d %H:%M", utc_time );
+}
+
+static void LoadDemoDetailsJob( TempAllocator * temp, void * data ) {
+	DemoBrowserEntry * demo = &demos[ *( const size_t * ) data ];
+
+	const char * path = ( *temp )( "{}/demos/{}", HomeDirPath(), demo->path );
+	Span< u8 > first_1k = ReadFirst1kBytes( temp, path );
+
+	DemoMetadata metadata;
+	if( !ReadDemoMetadata( temp, &metadata, first_1k ) )
+		return;
+
+	SetDemoDetails( demo, metadata.utc_time, metadata.server, metadata.map, metadata.game_version );
+}
+
+static void WriteDemoIndex() {
+	TracyZoneScoped;
+
+	Span< DemoIndexEntry > entries = AllocSpan< DemoIndexEntry >( sys_allocator, demos.size() );
+	defer { Free( sys_allocator, entries.ptr ); };
+
+	for( size_t i = 0; i < demos.size(); i++ ) {
+		const DemoBrowserEntry & demo = demos[ i ];
+		DemoIndexEntry & entry = entries[ i ];
+		entry = { };
+		entry.path = StringHash( demo.path ).hash;
+		entry.size = demo.size;
+		entry.modified_time = demo.modified_time;
+		entry.have_details = demo.have_details;
+		entry.utc_time = demo.utc_time;
+		SafeStrCpy( entry.server, demo.server, sizeof( entry.server ) );
+		SafeStrCpy( entry.map, demo.map, sizeof( entry.map ) );
+		SafeStrCpy( entry.version, demo.version, sizeof( entry.version ) );
+	}
+
+	nanosort( entries.begin(), entries.end(), []( const DemoIndexEntry & a, const DemoIndexEntry & b ) {
+		return a.path < b.path;
+	} );
+
+	DemoIndexHeader header;
+	memcpy( header.magic, DEMO_INDEX_MAGIC, sizeof( header.magic ) );
+	header.format_version = DEMO_INDEX_FORMAT_VERSION;
+	header.num_demos = entries.n;
+
+	TempAllocator temp = cls.frame_arena.temp();
+
+	// write next to it and move it over so we never leave half an index
+	const char * path = DemoIndexPath( &temp );
+	const char * temp_path = temp( "{}.tmp", path );
+
+	FILE * file = OpenFile( &temp, temp_path, OpenFile_WriteOverwrite );
+	if( file == NULL )
+		return;
+
+	bool ok = WritePartialFile( file, &header, sizeof( header ) );
+	ok = ok && WritePartialFile( file, entries.ptr, entries.num_bytes() );
+	ok = CloseFile( file ) && ok;
+
+	if( !ok || !MoveFile( &temp, temp_path, path, MoveFile_DoReplace ) ) {
+		Com_Printf( "Couldn't write %s\n", path );
+	}
+}
+
 void DemoBrowserFrame() {
 	constexpr Time time_to_spend_per_frame = Milliseconds( 2 );
 	Time start_time = Now();
 
-	while( metadata_load_cursor < demos.size() && Now() - start_time < time_to_spend_per_frame ) {
-		DemoBrowserEntry * demo = &demos[ metadata_load_cursor ];
-		metadata_load_cursor++;
-
-		TempAllocator temp = cls.frame_arena.temp();
-
-		const char * path = temp( "{}/demos/{}", HomeDirPath(), demo->path );
-		Span< u8 > first_1k = ReadFirst1kBytes( &temp, path );
+	// a few demos per core at a time so we stay within the budget even when
+	// the disk is slow
+	size_t batch_size = GetCoreCount() * 4;
 
-		DemoMetadata metadata;
-		if( !ReadDemoMetadata( &temp, &metadata, first_1k ) )
-			continue;
+	while( load_cursor < demos_to_load.size() && Now() - start_time < time_to_spend_per_frame ) {
+		size_t n = Min2( batch_size, demos_to_load.size() - load_cursor );
+		ParallelFor( demos_to_load.span().slice( load_cursor, load_cursor + n ), LoadDemoDetailsJob );
+		load_cursor += n;
+	}
 
-		demo->have_details = true;
-		ggformat( demo->server, sizeof( demo->server ), "{}", metadata.server );
-		ggformat( demo->map, sizeof( demo->map ), "{}", metadata.map );
-		ggformat( demo->version, sizeof( demo->version ), "{}", metadata.game_version );
-		FormatTimestamp( demo->date, sizeof( demo->date ), "%Y-%m-%d %H:%M", metadata.utc_time );
+	if( index_dirty && load_cursor == demos_to_load.size() ) {
+		WriteDemoIndex();
+		index_dirty = false;
 	}
 }
 
@@ -99,14 +208,108 @@ static void FindDemosRecursive( TempAllocator * temp, DynamicString * path, size
 	}
 }
 
+static void GetDemoFileMetadataJob( TempAllocator * temp, void * data ) {
+	DemoBrowserEntry * demo = ( DemoBrowserEntry * ) data;
+
+	FileMetadata metadata;
+	if( GetFileMetadata( temp, ( *temp )( "{}/demos/{}", HomeDirPath(), demo->path ), &metadata ) ) {
+		demo->size = metadata.size;
+		demo->modified_time = metadata.modified_time;
+	}
+}
+
+template< size_t N >
+static bool IsNulTerminated( const char ( &str )[ N ] ) {
+	return memchr( str, '\0', N ) != NULL;
+}
+
+static bool DecodeDemoIndex( Span< const DemoIndexEntry > * index, Span< const u8 > data ) {
+	if( data.n < sizeof( DemoIndexHeader ) )
+		return false;
+
+	const DemoIndexHeader * header = align_cast< const DemoIndexHeader >( data.ptr );
+	if( memcmp( header->magic, DEMO_INDEX_MAGIC, sizeof( header->magic ) ) != 0 )
+		return false;
+
+	if( header->format_version != DEMO_INDEX_FORMAT_VERSION )
+		return false;
+
+	if( header->num_demos > ( data.n - sizeof( DemoIndexHeader ) ) / sizeof( DemoIndexEntry ) )
+		return false;
+
+	size_t entries_size = header->num_demos * sizeof( DemoIndexEntry );
+	Span< const DemoIndexEntry > entries = ( data + sizeof( DemoIndexHeader ) ).slice( 0, entries_size ).cast< const DemoIndexEntry >();
+
+	// the strings get printed straight out of the index
+	for( const DemoIndexEntry & entry : entries ) {
+		if( !IsNulTerminated( entry.server ) || !IsNulTerminated( entry.map ) || !IsNulTerminated( entry.version ) ) {
+			return false;
+		}
+	}
+
+	*index = entries;
+	return true;
+}
+
+static const DemoIndexEntry * FindDemoIndexEntry( Span< const DemoIndexEntry > index, StringHash path ) {
+	size_t lo = 0;
+	size_t hi = index.n;
+	while( lo < hi ) {
+		size_t mid = lo + ( hi - lo ) / 2;
+		if( index[ mid ].path == path.hash )
+			return &index[ mid ];
+
+		if( index[ mid ].path < path.hash ) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	return NULL;
+}
+
 void RefreshDemoBrowser() {
+	TracyZoneScoped;
+
 	ClearDemos();
 
-	TempAllocator temp = cls.frame_arena.temp();
-	DynamicString base( &temp, "{}/demos", HomeDirPath() );
-	FindDemosRecursive( &temp, &base, base.length() + 1 );
+	{
+		TempAllocator temp = cls.frame_arena.temp();
+		DynamicString base( &temp, "{}/demos", HomeDirPath() );
+		FindDemosRecursive( &temp, &base, base.length() + 1 );
+	}
 
 	nanosort( demos.begin(), demos.end(), []( const DemoBrowserEntry & a, const DemoBrowserEntry & b ) {
 		return !SortCStringsComparator( a.path, b.path );
 	} );
+
+	ParallelFor( demos.span(), GetDemoFileMetadataJob );
+
+	TempAllocator temp = cls.frame_arena.temp();
+	Span< u8 > index_data = ReadFileBinary( sys_allocator, DemoIndexPath( &temp ) );
+	defer { Free( sys_allocator, index_data.ptr ); };
+	// if it's missing or from an old version then everything gets loaded
+	Span< const DemoIndexEntry > index;
+	DecodeDemoIndex( &index, index_data );
+
+	size_t num_indexed = 0;
+	for( size_t i = 0; i < demos.size(); i++ ) {
+		DemoBrowserEntry * demo = &demos[ i ];
+
+		const DemoIndexEntry * entry = FindDemoIndexEntry( index, StringHash( demo->path ) );
+		if( entry == NULL || entry->size != demo->size || entry->modified_time != demo->modified_time ) {
+			demos_to_load.add( i );
+			continue;
+		}
+
+		num_indexed++;
+		if( entry->have_details ) {
+			SetDemoDetails( demo, entry->utc_time, MakeSpan( entry->server ), MakeSpan( entry->map ), MakeSpan( entry->version ) );
+		}
+	}
+
+	// rewrite it if anything got added, changed or deleted
+	index_dirty = num_indexed != index.n || demos_to_load.size() > 0;
 }
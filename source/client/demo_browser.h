@@ -4,8 +4,11 @@
 
 struct DemoBrowserEntry {
 	char * path;
+	u64 size;
+	s64 modified_time;
 
 	bool have_details;
+	s64 utc_time;
 	char server[ 64 ];
 	char map[ 64 ];
 	char date[ 32 ];
@@ -9,6 +9,7 @@ struct Map {
 	const char * name;
 	StringHash base_hash;
 	MapData data;
+	Span< u8 > decompressed_sections;
 	MapSharedRenderData render_data;
 };
 
@@ -4,6 +4,7 @@
 #include "qcommon/hash.h"
 #include "qcommon/string.h"
 #include "client/renderer/renderer.h"
+#include "client/renderer/draw_sort.h"
 
 #include "cgame/cg_local.h"
 
@@ -12,8 +13,6 @@
 #define GLFW_INCLUDE_NONE
 #include "glfw3/GLFW/glfw3.h"
 
-#include "nanosort/nanosort.hpp"
-
 #include "tracy/tracy/Tracy.hpp"
 #include "tracy/tracy/TracyOpenGL.hpp"
 
@@ -37,6 +36,7 @@ enum DrawCallType {
 
 struct DrawCall {
 	DrawCallType type;
+	DrawCallKey key;
 	PipelineState pipeline;
 	Mesh mesh;
 	u32 num_vertices;
@@ -82,7 +82,13 @@ static u32 ubo_offset_alignment;
 
 static float max_anisotropic_filtering;
 
-static PipelineState prev_pipeline;
+static NonRAIIDynamicArray< DrawSortItem > sort_items;
+static NonRAIIDynamicArray< DrawSortItem > sort_scratch;
+
+// what's currently bound, so we only diff the parts of the pipeline whose
+// keys changed
+static DrawCallKey prev_key;
+static PipelineState::Scissor prev_scissor;
 static VertexDescriptor prev_vertex_descriptor;
 static GLuint prev_fbo;
 static u32 prev_viewport_width;
@@ -209,6 +215,13 @@ static void VertexFormatToGL( VertexFormat format, GLenum * type, int * num_comp
 			*normalized = format == VertexFormat_U8x4_Norm;
 			break;
 
+		case VertexFormat_S8x4_Norm:
+			*type = GL_BYTE;
+			*num_components = 4;
+			*integral = true;
+			*normalized = true;
+			break;
+
 		case VertexFormat_U16x2:
 		case VertexFormat_U16x2_Norm:
 			*type = GL_UNSIGNED_SHORT;
@@ -257,7 +270,7 @@ static u32 VertexFormatDefaultStride( VertexFormat format ) {
 	VertexFormatToGL( format, &type, &num_components, &integral, &normalized );
 
 	u32 component_size = 0;
-	if( type == GL_UNSIGNED_BYTE ) {
+	if( type == GL_UNSIGNED_BYTE || type == GL_BYTE ) {
 		component_size = 1;
 	}
 	else if( type == GL_UNSIGNED_SHORT ) {
@@ -477,7 +490,12 @@ void InitRenderBackend() {
 
 	in_frame = false;
 
-	prev_pipeline = PipelineState();
+	sort_items.init( sys_allocator );
+	sort_scratch.init( sys_allocator );
+
+	prev_key = { };
+	prev_key.render_state = PackRenderState( PipelineState(), false );
+	prev_scissor = { };
 	prev_vertex_descriptor = { };
 	prev_fbo = 0;
 	prev_viewport_width = 0;
@@ -510,6 +528,9 @@ void ShutdownRenderBackend() {
 	}
 	render_passes.shutdown();
 
+	sort_items.shutdown();
+	sort_scratch.shutdown();
+
 	deferred_mesh_deletes.shutdown();
 	deferred_buffer_deletes.shutdown();
 	deferred_streaming_buffer_deletes.shutdown();
@@ -605,11 +626,103 @@ static bool operator==( const VertexAttribute & lhs, const VertexAttribute & rhs
 	return lhs.format == rhs.format && lhs.buffer == rhs.buffer && lhs.offset == rhs.offset;
 }
 
-static void SetPipelineState( const PipelineState & pipeline, bool cw_winding ) {
+static void SetRenderState( RenderState state, RenderState prev ) {
+	// alpha blending
+	if( state.blend_func != prev.blend_func ) {
+		if( state.blend_func == BlendFunc_Disabled ) {
+			glDisable( GL_BLEND );
+		}
+		else {
+			if( prev.blend_func == BlendFunc_Disabled ) {
+				glEnable( GL_BLEND );
+			}
+			if( state.blend_func == BlendFunc_Blend ) {
+				glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+			}
+			else {
+				glBlendFunc( GL_SRC_ALPHA, GL_ONE );
+			}
+		}
+	}
+
+	// depth testing
+	if( state.depth_func != prev.depth_func ) {
+		if( state.depth_func == DepthFunc_Disabled ) {
+			glDisable( GL_DEPTH_TEST );
+		}
+		else {
+			if( prev.depth_func == DepthFunc_Disabled ) {
+				glEnable( GL_DEPTH_TEST );
+			}
+			glDepthFunc( DepthFuncToGL( DepthFunc( state.depth_func ) ) );
+		}
+	}
+
+	// backface culling
+	if( state.cull_face != prev.cull_face ) {
+		if( state.cull_face == CullFace_Disabled ) {
+			glDisable( GL_CULL_FACE );
+		}
+		else {
+			if( prev.cull_face == CullFace_Disabled ) {
+				glEnable( GL_CULL_FACE );
+			}
+			glCullFace( state.cull_face == CullFace_Front ? GL_FRONT : GL_BACK );
+		}
+	}
+
+	// scissor test, the rect is set in SetPipelineState
+	if( state.scissor != prev.scissor ) {
+		if( state.scissor ) {
+			glEnable( GL_SCISSOR_TEST );
+		}
+		else {
+			glDisable( GL_SCISSOR_TEST );
+		}
+	}
+
+	// depth writing
+	if( state.write_depth != prev.write_depth ) {
+		glDepthMask( state.write_depth ? GL_TRUE : GL_FALSE );
+	}
+
+	// depth clamping
+	if( state.clamp_depth != prev.clamp_depth ) {
+		if( state.clamp_depth ) {
+			glEnable( GL_DEPTH_CLAMP );
+		}
+		else {
+			glDisable( GL_DEPTH_CLAMP );
+		}
+	}
+
+	// view weapon depth hack
+	if( state.view_weapon_depth_hack != prev.view_weapon_depth_hack ) {
+		float far = state.view_weapon_depth_hack ? 0.3f : 1.0f;
+		glDepthRange( 0.0f, far );
+	}
+
+	// polygon fill mode
+	if( state.wireframe != prev.wireframe ) {
+		if( state.wireframe ) {
+			glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
+			glEnable( GL_POLYGON_OFFSET_LINE );
+			glPolygonOffset( -1, -1 );
+		}
+		else {
+			glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
+			glDisable( GL_POLYGON_OFFSET_LINE );
+		}
+	}
+}
+
+static void SetPipelineState( const PipelineState & pipeline, const DrawCallKey & key ) {
 	TracyZoneScoped;
 	TracyGpuZone( "Set pipeline state" );
 
-	if( pipeline.shader != NULL && ( prev_pipeline.shader == NULL || pipeline.shader->program != prev_pipeline.shader->program ) ) {
+	DrawStateChanges changes = DiffDrawCallKeys( prev_key, key );
+
+	if( changes.program ) {
 		glUseProgram( pipeline.shader->program );
 	}
 
@@ -639,35 +752,37 @@ static void SetPipelineState( const PipelineState & pipeline, bool cw_winding )
 		}
 	}
 
-	// textures
-	for( size_t i = 0; i < ARRAY_COUNT( pipeline.shader->textures ); i++ ) {
-		u64 name_hash = pipeline.shader->textures[ i ];
-		const Texture * prev_texture = prev_bindings.textures[ i ];
-
-		bool found = prev_texture == NULL;
-		if( name_hash != 0 ) {
-			for( size_t j = 0; j < pipeline.num_textures; j++ ) {
-				if( pipeline.textures[ j ].name_hash == name_hash ) {
-					const Texture * texture = pipeline.textures[ j ].texture;
-					if( texture != prev_texture ) {
-						if( prev_texture != NULL && prev_texture->msaa_samples != texture->msaa_samples ) {
-							glBindTextureUnit( i, 0 );
-							glBindSampler( i, 0 );
+	// textures, which only change when the shader or the textures do
+	if( changes.textures ) {
+		for( size_t i = 0; i < ARRAY_COUNT( pipeline.shader->textures ); i++ ) {
+			u64 name_hash = pipeline.shader->textures[ i ];
+			const Texture * prev_texture = prev_bindings.textures[ i ];
+
+			bool found = prev_texture == NULL;
+			if( name_hash != 0 ) {
+				for( size_t j = 0; j < pipeline.num_textures; j++ ) {
+					if( pipeline.textures[ j ].name_hash == name_hash ) {
+						const Texture * texture = pipeline.textures[ j ].texture;
+						if( texture != prev_texture ) {
+							if( prev_texture != NULL && prev_texture->msaa_samples != texture->msaa_samples ) {
+								glBindTextureUnit( i, 0 );
+								glBindSampler( i, 0 );
+							}
+							glBindTextureUnit( i, texture->texture );
+							glBindSampler( i, GetSampler( pipeline.textures[ j ].sampler ).sampler );
+							prev_bindings.textures[ i ] = texture;
 						}
-						glBindTextureUnit( i, texture->texture );
-						glBindSampler( i, GetSampler( pipeline.textures[ j ].sampler ).sampler );
-						prev_bindings.textures[ i ] = texture;
+						found = true;
+						break;
 					}
-					found = true;
-					break;
 				}
 			}
-		}
 
-		if( !found && prev_texture != NULL ) {
-			glBindTextureUnit( i, 0 );
-			glBindSampler( i, 0 );
-			prev_bindings.textures[ i ] = NULL;
+			if( !found && prev_texture != NULL ) {
+				glBindTextureUnit( i, 0 );
+				glBindSampler( i, 0 );
+				prev_bindings.textures[ i ] = NULL;
+			}
 		}
 	}
 
@@ -702,105 +817,19 @@ static void SetPipelineState( const PipelineState & pipeline, bool cw_winding )
 		}
 	}
 
-	// alpha blending
-	if( pipeline.blend_func != prev_pipeline.blend_func ) {
-		if( pipeline.blend_func == BlendFunc_Disabled ) {
-			glDisable( GL_BLEND );
-		}
-		else {
-			if( prev_pipeline.blend_func == BlendFunc_Disabled ) {
-				glEnable( GL_BLEND );
-			}
-			if( pipeline.blend_func == BlendFunc_Blend ) {
-				glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-			}
-			else {
-				glBlendFunc( GL_SRC_ALPHA, GL_ONE );
-			}
-		}
-	}
-
-	// depth testing
-	if( pipeline.depth_func != prev_pipeline.depth_func ) {
-		if( pipeline.depth_func == DepthFunc_Disabled ) {
-			glDisable( GL_DEPTH_TEST );
-		}
-		else {
-			if( prev_pipeline.depth_func == DepthFunc_Disabled ) {
-				glEnable( GL_DEPTH_TEST );
-			}
-			glDepthFunc( DepthFuncToGL( pipeline.depth_func ) );
-		}
-	}
-
-	// backface culling
-	CullFace cull_face = pipeline.cull_face;
-	if( cull_face != CullFace_Disabled && cw_winding ) {
-		cull_face = cull_face == CullFace_Front ? CullFace_Back : CullFace_Front;
-	}
-
-	if( cull_face != prev_pipeline.cull_face ) {
-		if( cull_face == CullFace_Disabled ) {
-			glDisable( GL_CULL_FACE );
-		}
-		else {
-			if( prev_pipeline.cull_face == CullFace_Disabled ) {
-				glEnable( GL_CULL_FACE );
-			}
-			glCullFace( cull_face == CullFace_Front ? GL_FRONT : GL_BACK );
-		}
-	}
-
-	// scissor
-	if( pipeline.scissor != prev_pipeline.scissor ) {
-		if( !pipeline.scissor.exists ) {
-			glDisable( GL_SCISSOR_TEST );
-		}
-		else {
-			if( !prev_pipeline.scissor.exists ) {
-				glEnable( GL_SCISSOR_TEST );
-			}
-			PipelineState::Scissor s = pipeline.scissor.value;
-			glScissor( s.x, frame_static.viewport_height - s.y - s.h, s.w, s.h );
-		}
-	}
-
-	// depth writing
-	if( pipeline.write_depth != prev_pipeline.write_depth ) {
-		glDepthMask( pipeline.write_depth ? GL_TRUE : GL_FALSE );
-	}
-
-	// depth clamping
-	if( pipeline.clamp_depth != prev_pipeline.clamp_depth ) {
-		if( pipeline.clamp_depth ) {
-			glEnable( GL_DEPTH_CLAMP );
-		}
-		else {
-			glDisable( GL_DEPTH_CLAMP );
-		}
-	}
-
-	// view weapon depth hack
-	if( pipeline.view_weapon_depth_hack != prev_pipeline.view_weapon_depth_hack ) {
-		float far = pipeline.view_weapon_depth_hack ? 0.3f : 1.0f;
-		glDepthRange( 0.0f, far );
+	if( changes.render_state ) {
+		SetRenderState( key.render_state, prev_key.render_state );
 	}
 
-	// polygon fill mode
-	if( pipeline.wireframe != prev_pipeline.wireframe ) {
-		if( pipeline.wireframe ) {
-			glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
-			glEnable( GL_POLYGON_OFFSET_LINE );
-			glPolygonOffset( -1, -1 );
-		}
-		else {
-			glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
-			glDisable( GL_POLYGON_OFFSET_LINE );
-		}
+	if( key.render_state.scissor && ( !prev_key.render_state.scissor || !( pipeline.scissor.value == prev_scissor ) ) ) {
+		PipelineState::Scissor s = pipeline.scissor.value;
+		glScissor( s.x, frame_static.viewport_height - s.y - s.h, s.w, s.h );
+		prev_scissor = s;
 	}
 
-	prev_pipeline = pipeline;
-	prev_pipeline.cull_face = cull_face;
+	prev_key.program = key.program;
+	prev_key.render_state = key.render_state;
+	prev_key.textures_hash = key.textures_hash;
 }
 
 static void BindVertexDescriptorAndBuffers( const Mesh & mesh ) {
@@ -870,10 +899,6 @@ static void BindVertexDescriptorAndBuffers( const Mesh & mesh ) {
 	glVertexArrayElementBuffer( vao, mesh.index_buffer.buffer );
 }
 
-static bool SortDrawCall( const DrawCall & a, const DrawCall & b ) {
-	return a.pipeline.shader < b.pipeline.shader;
-}
-
 static void SubmitFramebufferBlit( const RenderPassConfig & pass ) {
 	RenderTarget src = pass.blit_source;
 	RenderTarget target = pass.target;
@@ -952,7 +977,7 @@ static void SubmitDrawCall( const DrawCall & dc ) {
 	if( dc.pipeline.shader->program == 0 )
 		return;
 
-	SetPipelineState( dc.pipeline, dc.mesh.cw_winding );
+	SetPipelineState( dc.pipeline, dc.key );
 
 	if( dc.type == DrawCallType_Compute ) {
 		TracyZoneScopedN( "Compute command" );
@@ -968,7 +993,10 @@ static void SubmitDrawCall( const DrawCall & dc ) {
 		return;
 	}
 
-	BindVertexDescriptorAndBuffers( dc.mesh );
+	if( dc.key.mesh_hash != prev_key.mesh_hash ) {
+		BindVertexDescriptorAndBuffers( dc.mesh );
+		prev_key.mesh_hash = dc.key.mesh_hash;
+	}
 
 	GLenum gl_index_format = dc.mesh.index_format == IndexFormat_U16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
 
@@ -996,16 +1024,40 @@ static void SubmitDrawCall( const DrawCall & dc ) {
 			glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
 		}
 	}
+}
 
-	{
-		TracyZoneScopedN( "Unbind buffers" );
+static void UnbindVertexBuffers() {
+	TracyZoneScoped;
+
+	for( size_t i = 0; i < ARRAY_COUNT( &Mesh::vertex_buffers ); i++ ) {
+		glVertexArrayVertexBuffer( vao, i, 0, 0, 0 );
+	}
 
-		// unbind buffers
-		for( size_t i = 0; i < ARRAY_COUNT( dc.mesh.vertex_buffers ); i++ ) {
-			glVertexArrayVertexBuffer( vao, i, 0, 0, 0 );
+	glVertexArrayElementBuffer( vao, 0 );
+
+	prev_key.mesh_hash = 0;
+}
+
+static void SubmitDrawCalls( const RenderPass & pass ) {
+	TracyZoneScoped;
+
+	if( !pass.config.sorted ) {
+		for( const DrawCall & draw : pass.draws ) {
+			SubmitDrawCall( draw );
 		}
+		return;
+	}
+
+	sort_items.resize( pass.draws.size() );
+	sort_scratch.resize( pass.draws.size() );
 
-		glVertexArrayElementBuffer( vao, 0 );
+	for( size_t i = 0; i < pass.draws.size(); i++ ) {
+		sort_items[ i ] = DrawSortItem { pass.draws[ i ].key.sort_key, u32( i ) };
+	}
+
+	Span< DrawSortItem > sorted = RadixSortDraws( sort_items.span(), sort_scratch.span() );
+	for( DrawSortItem item : sorted ) {
+		SubmitDrawCall( pass.draws[ item.draw ] );
 	}
 }
 
@@ -1018,31 +1070,23 @@ void RenderBackendSubmitFrame() {
 
 	size_t num_draw_calls_this_frame = 0;
 	for( u8 i = 0; i < num_render_passes; i++ ) {
-		RenderPass & pass = render_passes[ i ];
+		const RenderPass & pass = render_passes[ i ];
 		SetupRenderPass( pass.config );
-
-		if( pass.config.sorted ) {
-			TracyZoneScopedN( "Sort draw calls" );
-			nanosort( pass.draws.begin(), pass.draws.end(), SortDrawCall );
-		}
-
-		{
-			TracyZoneScopedN( "Submit draw calls" );
-			for( const DrawCall & draw : pass.draws ) {
-				SubmitDrawCall( draw );
-				num_draw_calls_this_frame++;
-			}
-		}
-
+		SubmitDrawCalls( pass );
+		num_draw_calls_this_frame += pass.draws.size();
 		FinishRenderPass();
 	}
 
+	// don't keep deleted buffers alive in the VAO
+	UnbindVertexBuffers();
+
 	{
 		// OBS captures the game with glBlitFramebuffer which gets
 		// nuked by scissor, so turn it off at the end of every frame
-		PipelineState no_scissor_test = prev_pipeline;
-		no_scissor_test.scissor = NONE;
-		SetPipelineState( no_scissor_test, true );
+		RenderState no_scissor_test = prev_key.render_state;
+		no_scissor_test.scissor = 0;
+		SetRenderState( no_scissor_test, prev_key.render_state );
+		prev_key.render_state = no_scissor_test;
 	}
 
 	RunDeferredDeletes();
@@ -1524,8 +1568,8 @@ void DeleteShader( Shader shader ) {
 	if( shader.program == 0 )
 		return;
 
-	if( prev_pipeline.shader != NULL && prev_pipeline.shader->program == shader.program ) {
-		prev_pipeline.shader = { };
+	if( prev_key.program == shader.program ) {
+		prev_key.program = 0;
 		glUseProgram( 0 );
 	}
 
@@ -1596,44 +1640,56 @@ void DrawInstancedMesh( const Mesh & mesh, const PipelineState & pipeline, u32 n
 	Assert( pipeline.pass != U8_MAX );
 	Assert( pipeline.shader != NULL );
 
+	RenderPass * pass = &render_passes[ pipeline.pass ];
+
 	DrawCall dc = { };
 	dc.type = DrawCallType_Normal;
+	dc.key = MakeDrawCallKey( pipeline, mesh, pass->draws.size() );
 	dc.mesh = mesh;
 	dc.pipeline = pipeline;
 	dc.num_vertices = num_vertices_override == 0 ? mesh.num_vertices : num_vertices_override;
 	dc.first_index = first_index;
 	dc.base_vertex = base_vertex;
 	dc.num_instances = num_instances;
-	render_passes[ pipeline.pass ].draws.add( dc );
+	pass->draws.add( dc );
 
 	num_vertices_this_frame += dc.num_vertices * num_instances;
 }
 
 void DrawMeshIndirect( const Mesh & mesh, const PipelineState & pipeline, GPUBuffer indirect ) {
+	RenderPass * pass = &render_passes[ pipeline.pass ];
+
 	DrawCall dc = { };
 	dc.type = DrawCallType_Indirect;
+	dc.key = MakeDrawCallKey( pipeline, mesh, pass->draws.size() );
 	dc.pipeline = pipeline;
 	dc.mesh = mesh;
 	dc.indirect = indirect;
-	render_passes[ pipeline.pass ].draws.add( dc );
+	pass->draws.add( dc );
 }
 
 void DispatchCompute( const PipelineState & pipeline, u32 x, u32 y, u32 z ) {
+	RenderPass * pass = &render_passes[ pipeline.pass ];
+
 	DrawCall dc = { };
 	dc.type = DrawCallType_Compute;
+	dc.key = MakeDrawCallKey( pipeline, Mesh(), pass->draws.size() );
 	dc.pipeline = pipeline;
 	dc.dispatch_size[ 0 ] = x;
 	dc.dispatch_size[ 1 ] = y;
 	dc.dispatch_size[ 2 ] = z;
-	render_passes[ pipeline.pass ].draws.add( dc );
+	pass->draws.add( dc );
 }
 
 void DispatchComputeIndirect( const PipelineState & pipeline, GPUBuffer indirect ) {
+	RenderPass * pass = &render_passes[ pipeline.pass ];
+
 	DrawCall dc = { };
 	dc.type = DrawCallType_IndirectCompute;
+	dc.key = MakeDrawCallKey( pipeline, Mesh(), pass->draws.size() );
 	dc.pipeline = pipeline;
 	dc.indirect = indirect;
-	render_passes[ pipeline.pass ].draws.add( dc );
+	pass->draws.add( dc );
 }
 
 void DownloadFramebuffer( void * buf ) {
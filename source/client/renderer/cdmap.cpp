@@ -6,13 +6,18 @@
 MapSharedRenderData NewMapRenderData( const MapData & map, const char * name ) {
 	TempAllocator temp = cls.frame_arena.temp();
 
+	bool quantized = ( map.vertex_encoding & MapVertexEncoding_Quantized ) != 0;
+	bool u16_indices = ( map.vertex_encoding & MapVertexEncoding_U16Indices ) != 0;
+
 	MeshConfig mesh_config = { };
 	mesh_config.name = name;
-	mesh_config.set_attribute( VertexAttribute_Position, NewGPUBuffer( map.vertex_positions, temp( "{} positions", name ) ) );
-	mesh_config.set_attribute( VertexAttribute_Normal, NewGPUBuffer( map.vertex_normals, temp( "{} normals", name ) ) );
+	mesh_config.set_attribute( VertexAttribute_Position, NewGPUBuffer( map.vertex_positions, temp( "{} positions", name ) ),
+		quantized ? Optional< VertexFormat >( VertexFormat_U16x4_Norm ) : NONE );
+	mesh_config.set_attribute( VertexAttribute_Normal, NewGPUBuffer( map.vertex_normals, temp( "{} normals", name ) ),
+		quantized ? Optional< VertexFormat >( VertexFormat_S8x4_Norm ) : NONE );
 	mesh_config.index_buffer = NewGPUBuffer( map.vertex_indices, temp( "{} indices", name ) );
-	mesh_config.index_format = IndexFormat_U32;
-	mesh_config.num_vertices = map.vertex_indices.n;
+	mesh_config.index_format = u16_indices ? IndexFormat_U16 : IndexFormat_U32;
+	mesh_config.num_vertices = map.vertex_indices.n / MapVertexIndexSize( map.vertex_encoding );
 
 	MapSharedRenderData shared = { };
 	shared.mesh = NewMesh( mesh_config );
@@ -33,20 +38,34 @@ void DrawMapModel( const DrawModelConfig & config, const MapSubModelRenderData *
 		return;
 
 	const Map * map = FindMap( render_data->base_hash );
+	bool quantized = ( map->data.vertex_encoding & MapVertexEncoding_Quantized ) != 0;
 
 	u32 first_mesh = map->data.models[ render_data->sub_model ].first_mesh;
 	for( u32 i = 0; i < map->data.models[ render_data->sub_model ].num_meshes; i++ ) {
 		const MapMesh & mesh = map->data.meshes[ i + first_mesh ];
 
+		// fold the dequantization into the model matrix. the scale is the
+		// same on every axis so it doesn't skew the normals
+		UniformBlock model_uniforms = frame_static.identity_model_uniforms;
+		UniformBlock transform_uniforms;
+		if( quantized ) {
+			Mat4 dequantize = Mat4Translation( mesh.position_offset ) * Mat4Scale( mesh.position_scale );
+			model_uniforms = UploadModelUniforms( dequantize );
+			transform_uniforms = UploadModelUniforms( transform * dequantize );
+		}
+		else {
+			transform_uniforms = UploadModelUniforms( transform );
+		}
+
 		for( u32 j = 0; j < frame_static.shadow_parameters.num_cascades; j++ ) {
 			PipelineState pipeline;
 			pipeline.pass = frame_static.shadowmap_pass[ j ];
 			pipeline.shader = &shaders.depth_only;
 			pipeline.clamp_depth = true;
 			pipeline.bind_uniform( "u_View", frame_static.shadowmap_view_uniforms[ j ] );
-			pipeline.bind_uniform( "u_Model", frame_static.identity_model_uniforms );
+			pipeline.bind_uniform( "u_Model", model_uniforms );
 
-			DrawMesh( map->render_data.mesh, pipeline, mesh.num_vertices, mesh.first_vertex_index );
+			DrawMesh( map->render_data.mesh, pipeline, mesh.num_vertices, mesh.first_vertex_index, mesh.base_vertex );
 		}
 
 		{
@@ -54,19 +73,19 @@ void DrawMapModel( const DrawModelConfig & config, const MapSubModelRenderData *
 			pipeline.pass = frame_static.world_opaque_prepass_pass;
 			pipeline.shader = &shaders.depth_only;
 			pipeline.bind_uniform( "u_View", frame_static.view_uniforms );
-			pipeline.bind_uniform( "u_Model", UploadModelUniforms( transform ) );
+			pipeline.bind_uniform( "u_Model", transform_uniforms );
 
-			DrawMesh( map->render_data.mesh, pipeline, mesh.num_vertices, mesh.first_vertex_index );
+			DrawMesh( map->render_data.mesh, pipeline, mesh.num_vertices, mesh.first_vertex_index, mesh.base_vertex );
 		}
 
 		{
 			PipelineState pipeline = MaterialToPipelineState( FindMaterial( StringHash( mesh.material ), &world_material ) );
 			pipeline.bind_uniform( "u_View", frame_static.view_uniforms );
-			pipeline.bind_uniform( "u_Model", frame_static.identity_model_uniforms );
+			pipeline.bind_uniform( "u_Model", model_uniforms );
 			pipeline.write_depth = false;
 			pipeline.depth_func = DepthFunc_Equal;
 
-			DrawMesh( map->render_data.mesh, pipeline, mesh.num_vertices, mesh.first_vertex_index );
+			DrawMesh( map->render_data.mesh, pipeline, mesh.num_vertices, mesh.first_vertex_index, mesh.base_vertex );
 		}
 	}
 }
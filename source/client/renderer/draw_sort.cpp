@@ -0,0 +1,133 @@
+#include "qcommon/base.h"
+#include "qcommon/hash.h"
+#include "client/renderer/draw_sort.h"
+
+static constexpr u32 SORT_KEY_SEQUENCE_BITS = 16;
+static constexpr u32 SORT_KEY_MESH_BITS = 13;
+static constexpr u32 SORT_KEY_TEXTURES_BITS = 12;
+static constexpr u32 SORT_KEY_RENDER_STATE_BITS = 11;
+static constexpr u32 SORT_KEY_SHADER_BITS = 12;
+
+STATIC_ASSERT( SORT_KEY_SEQUENCE_BITS + SORT_KEY_MESH_BITS + SORT_KEY_TEXTURES_BITS + SORT_KEY_RENDER_STATE_BITS + SORT_KEY_SHADER_BITS == 64 );
+
+// the keys get built for every draw call so mix whole words rather than
+// running fnv over every byte
+static u64 HashCombine( u64 hash, u64 x ) {
+	return Hash64( hash ^ x );
+}
+
+static u64 TopBits( u64 x, u32 bits ) {
+	return x >> ( 64 - bits );
+}
+
+RenderState PackRenderState( const PipelineState & pipeline, bool cw_winding ) {
+	CullFace cull_face = pipeline.cull_face;
+	if( cull_face != CullFace_Disabled && cw_winding ) {
+		cull_face = cull_face == CullFace_Front ? CullFace_Back : CullFace_Front;
+	}
+
+	RenderState state = { };
+	state.blend_func = pipeline.blend_func;
+	state.depth_func = pipeline.depth_func;
+	state.cull_face = cull_face;
+	state.write_depth = pipeline.write_depth ? 1 : 0;
+	state.clamp_depth = pipeline.clamp_depth ? 1 : 0;
+	state.view_weapon_depth_hack = pipeline.view_weapon_depth_hack ? 1 : 0;
+	state.wireframe = pipeline.wireframe ? 1 : 0;
+	state.scissor = pipeline.scissor.exists ? 1 : 0;
+	return state;
+}
+
+static u64 HashTextures( const PipelineState & pipeline ) {
+	u64 hash = 0;
+	for( size_t i = 0; i < pipeline.num_textures; i++ ) {
+		const PipelineState::TextureBinding & binding = pipeline.textures[ i ];
+		u32 texture = binding.texture == NULL ? 0 : binding.texture->texture;
+		hash = HashCombine( hash, binding.name_hash );
+		hash = HashCombine( hash, ( u64( texture ) << 32 ) | binding.sampler );
+	}
+	return hash;
+}
+
+static u64 HashMesh( const Mesh & mesh ) {
+	u64 hash = HashCombine( 0, ( u64( mesh.index_buffer.buffer ) << 32 ) | mesh.index_format );
+	for( size_t i = 0; i < ARRAY_COUNT( mesh.vertex_buffers ); i++ ) {
+		const Optional< VertexAttribute > & attr = mesh.vertex_descriptor.attributes[ i ];
+		if( mesh.vertex_buffers[ i ].buffer == 0 && !attr.exists )
+			continue;
+
+		hash = HashCombine( hash, ( u64( i ) << 32 ) | mesh.vertex_buffers[ i ].buffer );
+		hash = HashCombine( hash, mesh.vertex_descriptor.buffer_strides[ i ] );
+		if( attr.exists ) {
+			hash = HashCombine( hash, ( u64( attr.value.format ) << 32 ) | attr.value.buffer );
+			hash = HashCombine( hash, attr.value.offset );
+		}
+	}
+	return hash;
+}
+
+DrawCallKey MakeDrawCallKey( const PipelineState & pipeline, const Mesh & mesh, size_t sequence ) {
+	DrawCallKey key;
+	key.program = pipeline.shader->program;
+	key.render_state = PackRenderState( pipeline, mesh.cw_winding );
+	key.textures_hash = HashTextures( pipeline );
+	key.mesh_hash = HashMesh( mesh );
+
+	u64 sort_key = key.program & ( ( 1u << SORT_KEY_SHADER_BITS ) - 1 );
+	sort_key = ( sort_key << SORT_KEY_RENDER_STATE_BITS ) | key.render_state.bits;
+	sort_key = ( sort_key << SORT_KEY_TEXTURES_BITS ) | TopBits( key.textures_hash, SORT_KEY_TEXTURES_BITS );
+	sort_key = ( sort_key << SORT_KEY_MESH_BITS ) | TopBits( key.mesh_hash, SORT_KEY_MESH_BITS );
+	sort_key = ( sort_key << SORT_KEY_SEQUENCE_BITS ) | Min2( sequence, size_t( ( 1u << SORT_KEY_SEQUENCE_BITS ) - 1 ) );
+	key.sort_key = sort_key;
+
+	return key;
+}
+
+Span< DrawSortItem > RadixSortDraws( Span< DrawSortItem > items, Span< DrawSortItem > scratch ) {
+	TracyZoneScoped;
+
+	Assert( scratch.n >= items.n );
+
+	// build every digit's histogram in one pass, LSD radix sort 8 bits at a
+	// time, and skip digits that are the same for every key. they often
+	// are, e.g. the sequence high byte or shaders in single shader passes
+	u32 counts[ 8 ][ 256 ] = { };
+	for( DrawSortItem item : items ) {
+		for( u32 digit = 0; digit < 8; digit++ ) {
+			counts[ digit ][ ( item.key >> ( digit * 8 ) ) & 0xFF ]++;
+		}
+	}
+
+	Span< DrawSortItem > src = items;
+	Span< DrawSortItem > dst = scratch.slice( 0, items.n );
+
+	for( u32 digit = 0; digit < 8; digit++ ) {
+		if( items.n == 0 || counts[ digit ][ ( items[ 0 ].key >> ( digit * 8 ) ) & 0xFF ] == items.n )
+			continue;
+
+		u32 offsets[ 256 ];
+		u32 total = 0;
+		for( u32 i = 0; i < 256; i++ ) {
+			offsets[ i ] = total;
+			total += counts[ digit ][ i ];
+		}
+
+		for( DrawSortItem item : src ) {
+			dst[ offsets[ ( item.key >> ( digit * 8 ) ) & 0xFF ]++ ] = item;
+		}
+
+		Swap2( &src, &dst );
+	}
+
+	return src;
+}
+
+DrawStateChanges DiffDrawCallKeys( const DrawCallKey & prev, const DrawCallKey & curr ) {
+	DrawStateChanges changes;
+	changes.program = prev.program != curr.program;
+	changes.render_state = prev.render_state.bits != curr.render_state.bits;
+	// texture bindings depend on the shader's samplers too
+	changes.textures = changes.program || prev.textures_hash != curr.textures_hash;
+	changes.mesh = prev.mesh_hash != curr.mesh_hash;
+	return changes;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "qcommon/types.h"
+#include "client/renderer/backend.h"
+
+/*
+ * draw calls get a 64 bit sort key when they're added, so sorting a pass
+ * is a radix sort over integers rather than comparing PipelineStates.
+ * from the top bits down:
+ *
+ * - shader, 12 bits
+ * - fixed function state, 11 bits
+ * - textures, 12 bits
+ * - mesh, 13 bits
+ * - submission order, 16 bits, so equal draws keep their order
+ *
+ * the shader/textures/mesh fields are truncated so they only group draws
+ * together, the backend decides what to rebind from the full values
+ *
+ * none of this touches GL so it can be tested/benchmarked headless
+ */
+
+union RenderState {
+	struct {
+		u16 blend_func : 2;
+		u16 depth_func : 2;
+		u16 cull_face : 2; // with cw_winding already applied
+		u16 write_depth : 1;
+		u16 clamp_depth : 1;
+		u16 view_weapon_depth_hack : 1;
+		u16 wireframe : 1;
+		u16 scissor : 1;
+	};
+
+	u16 bits;
+};
+
+STATIC_ASSERT( sizeof( RenderState ) == sizeof( u16 ) );
+
+struct DrawCallKey {
+	u64 sort_key;
+	u64 textures_hash;
+	u64 mesh_hash;
+	u32 program;
+	RenderState render_state;
+};
+
+struct DrawSortItem {
+	u64 key;
+	u32 draw;
+};
+
+RenderState PackRenderState( const PipelineState & pipeline, bool cw_winding );
+DrawCallKey MakeDrawCallKey( const PipelineState & pipeline, const Mesh & mesh, size_t sequence );
+
+// returns whichever of items/scratch ends up holding the sorted items
+Span< DrawSortItem > RadixSortDraws( Span< DrawSortItem > items, Span< DrawSortItem > scratch );
+
+struct DrawStateChanges {
+	bool program;
+	bool render_state;
+	bool textures;
+	bool mesh;
+};
+
+DrawStateChanges DiffDrawCallKeys( const DrawCallKey & prev, const DrawCallKey & curr );
@@ -16,6 +16,8 @@ enum VertexFormat : u8 {
 	VertexFormat_U8x4,
 	VertexFormat_U8x4_Norm,
 
+	VertexFormat_S8x4_Norm,
+
 	VertexFormat_U16x2,
 	VertexFormat_U16x2_Norm,
 	VertexFormat_U16x3,
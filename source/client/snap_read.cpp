@@ -18,8 +18,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
-#include "qcommon/qcommon.h"
-#include "cgame/cg_public.h"
+#include "client/snap_read.h"
 
 const char * const svc_strings[256] = {
 	"svc_servercmd",
@@ -210,7 +209,12 @@ static snapshot_t *SNAP_ParseFrameHeader( msg_t *msg, snapshot_t *newframe, snap
 		newframe = &backup[snapNum % CMD_BACKUP];
 	}
 
-	memset( newframe, 0, sizeof( snapshot_t ) );
+	// snapshots are ~400KB, nearly all of it arrays that parsing fills up to
+	// a count, and clearing the whole thing was a big chunk of decoding time
+	memset( newframe, 0, offsetof( snapshot_t, playerState ) );
+	newframe->numEntities = 0;
+	newframe->numgamecommands = 0;
+	newframe->gamecommandsDataHead = 0;
 
 	newframe->serverTime = serverTime;
 	newframe->serverFrame = snapNum;
@@ -297,6 +301,7 @@ snapshot_t *SNAP_ParseFrame( msg_t *msg, const snapshot_t *lastFrame, snapshot_t
 
 			gcmd = &newframe->gamecommands[newframe->numgamecommands - 1];
 			gcmd->all = true;
+			memset( gcmd->targets, 0, sizeof( gcmd->targets ) );
 
 			SafeStrCpy( newframe->gamecommandsData + newframe->gamecommandsDataHead, text,
 						sizeof( newframe->gamecommandsData ) - newframe->gamecommandsDataHead );
@@ -342,7 +347,7 @@ snapshot_t *SNAP_ParseFrame( msg_t *msg, const snapshot_t *lastFrame, snapshot_t
 		numplayers++;
 	}
 	newframe->numplayers = numplayers;
-	newframe->playerState = newframe->playerStates[0];
+	newframe->playerState = numplayers > 0 ? newframe->playerStates[0] : SyncPlayerState { };
 
 	// read packet entities
 	cmd = MSG_ReadUint8( msg );
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "qcommon/qcommon.h"
+#include "cgame/cg_public.h"
+
+void SNAP_ParseBaseline( msg_t *msg, SyncEntityState *baselines );
+snapshot_t *SNAP_ParseFrame( msg_t *msg, const snapshot_t *lastFrame, snapshot_t *backup, SyncEntityState *baselines, int showNet );
@@ -130,6 +130,15 @@ static bool G_VoteMapValidate( callvotedata_t *data, bool first ) {
 
 static void G_VoteMapPassed( callvotedata_t *vote ) {
 	SafeStrCpy( level.callvote_map, vote->argv[0], sizeof( level.callvote_map ) );
+
+	if( !StrEqual( level.callvote_map, sv.mapname ) ) {
+		PreloadServerMap( level.callvote_map );
+
+		// let clients that don't have the map start downloading it now
+		TempAllocator temp = svs.frame_arena.temp();
+		PF_GameCmd( NULL, temp( "nextmap {}", level.callvote_map ) );
+	}
+
 	G_EndMatch();
 }
 
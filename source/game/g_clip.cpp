@@ -14,15 +14,131 @@ struct CollisionEntity {
 	int view_height;
 };
 
-struct CollisionFrame {
+/*
+ * lag compensation history
+ *
+ * the live grid/entities are what the game links into. when a frame ends we
+ * append a record for each entity whose collision state changed, and each
+ * record points at the previous record for the same entity, so we can walk
+ * an entity back in time without keeping copies of the whole world around.
+ * entities that don't change get a fresh record every
+ * COLLISION_KEYFRAME_INTERVAL frames so their state never falls out of the
+ * record ring while it's still inside the rewind window
+ */
+
+static constexpr u64 COLLISION_HISTORY_FRAMES = 64;
+static constexpr u64 COLLISION_KEYFRAME_INTERVAL = 32;
+static constexpr u64 MAX_COLLISION_RECORDS = 16384;
+static constexpr size_t MAX_COLLISION_REWINDS = 8;
+
+struct CollisionRecord {
+	u64 frame;
+	u64 prev; // handle of this entity's previous record
+	int entity_id;
+	CollisionEntity entity;
+	SpatialHashPrimitive primitive;
+};
+
+struct CollisionHistoryFrame {
 	s64 timestamp;
+	u64 first_record;
+};
+
+/*
+ * everything a rewound trace needs that only depends on the target time, so
+ * it gets computed once and shared by every trace that goes back to that
+ * time this frame, e.g. all the pellets from one shotgun blast
+ */
+struct CollisionRewindEntity {
+	int entity_id;
+	const SpatialHashPrimitive * older;
+	const SpatialHashPrimitive * newer;
+};
+
+struct CollisionRewind {
+	s64 gametime;
+	int time_delta;
+
+	// newer_frame is older_frame + 1, which can be the live frame. if the
+	// target time is older than the history then found is false, older_frame
+	// is the oldest frame and nothing else is filled in
+	bool found;
+	u64 older_frame;
+	float t;
+
+	// entities with records after older_frame. entities that changed since
+	// the last backup aren't recorded yet and can still move this frame, so
+	// they get checked at trace time instead
+	CollisionRewindEntity changed[ MAX_EDICTS ];
+	size_t num_changed;
+};
+
+struct CollisionHistory {
 	SpatialHashGrid grid;
 	CollisionEntity entities[ MAX_EDICTS ];
-	size_t num_entities;
+	u64 dirty[ MAX_EDICTS / 64 ];
+
+	u64 frame;
+	CollisionHistoryFrame frames[ COLLISION_HISTORY_FRAMES ];
+
+	CollisionRecord records[ MAX_COLLISION_RECORDS ];
+	u64 num_records;
+	u64 latest_record[ MAX_EDICTS ]; // handle = record index + 1, 0 = none
+
+	CollisionRewind rewinds[ MAX_COLLISION_REWINDS ];
+	size_t num_rewinds;
+
+	u64 version;
 };
 
-static CollisionFrame g_collision_frames[ 64 ];
-static size_t g_current_collision_frame = 0;
+static CollisionHistory g_collision_history;
+
+static const CollisionRecord * GetCollisionRecord( u64 handle ) {
+	const CollisionHistory * h = &g_collision_history;
+	if( handle == 0 || h->num_records - ( handle - 1 ) > MAX_COLLISION_RECORDS )
+		return NULL;
+	return &h->records[ ( handle - 1 ) % MAX_COLLISION_RECORDS ];
+}
+
+// returns the record that was current at the end of the given frame
+static const CollisionRecord * FindCollisionRecord( int entity_id, u64 frame ) {
+	const CollisionRecord * record = GetCollisionRecord( g_collision_history.latest_record[ entity_id ] );
+	while( record != NULL && record->frame > frame ) {
+		record = GetCollisionRecord( record->prev );
+	}
+	return record;
+}
+
+static bool operator==( const SpatialHashPrimitive & a, const SpatialHashPrimitive & b ) {
+	return a.solidity == b.solidity &&
+		a.sbounds.x1 == b.sbounds.x1 && a.sbounds.x2 == b.sbounds.x2 &&
+		a.sbounds.y1 == b.sbounds.y1 && a.sbounds.y2 == b.sbounds.y2 &&
+		a.sbounds.z1 == b.sbounds.z1 && a.sbounds.z2 == b.sbounds.z2;
+}
+
+static bool operator==( const CollisionModel & a, const CollisionModel & b ) {
+	if( a.type != b.type )
+		return false;
+
+	switch( a.type ) {
+		case CollisionModelType_AABB: return a.aabb.mins == b.aabb.mins && a.aabb.maxs == b.aabb.maxs;
+		case CollisionModelType_Sphere: return a.sphere.center == b.sphere.center && a.sphere.radius == b.sphere.radius;
+		case CollisionModelType_Capsule: return a.capsule.a == b.capsule.a && a.capsule.b == b.capsule.b && a.capsule.radius == b.capsule.radius;
+		case CollisionModelType_MapModel: return a.map_model == b.map_model;
+		case CollisionModelType_GLTF: return a.gltf_model == b.gltf_model;
+		default: return true;
+	}
+}
+
+static bool operator==( const CollisionEntity & a, const CollisionEntity & b ) {
+	if( a.override_collision_model.exists != b.override_collision_model.exists )
+		return false;
+	if( a.override_collision_model.exists && !( a.override_collision_model.value == b.override_collision_model.value ) )
+		return false;
+
+	return a.id.id == b.id.id && a.origin == b.origin && a.scale == b.scale && a.angles == b.angles &&
+		a.model == b.model && a.view_height == b.view_height;
+}
 
 static CollisionEntity GetCollisionEntity( const edict_t * ent ) {
 	return CollisionEntity {
@@ -46,41 +162,213 @@ static void ApplyCollisionEntity( CollisionEntity cent, edict_t * ent ) {
 	ent->viewheight = cent.view_height;
 }
 
+static void MarkCollisionEntityDirty( int entity_id ) {
+	g_collision_history.dirty[ entity_id / 64 ] |= 1_u64 << ( entity_id % 64 );
+}
+
 void GClip_BackUpCollisionFrame() {
-	CollisionFrame * frame = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ];
-	frame->timestamp = svs.gametime;
-	frame->num_entities = game.numentities;
-	g_current_collision_frame++;
+	TracyZoneScoped;
+
+	CollisionHistory * h = &g_collision_history;
+	h->frames[ h->frame % COLLISION_HISTORY_FRAMES ] = CollisionHistoryFrame {
+		.timestamp = svs.gametime,
+		.first_record = h->num_records,
+	};
+
+	for( int i = 0; i < game.numentities; i++ ) {
+		bool dirty = ( h->dirty[ i / 64 ] & ( 1_u64 << ( i % 64 ) ) ) != 0;
+		bool keyframe = u64( i ) % COLLISION_KEYFRAME_INTERVAL == h->frame % COLLISION_KEYFRAME_INTERVAL;
+
+		const CollisionRecord * latest = GetCollisionRecord( h->latest_record[ i ] );
+		if( latest == NULL && !dirty )
+			continue;
+
+		if( latest != NULL && latest->entity == h->entities[ i ] && latest->primitive == h->grid.primitives[ i ] ) {
+			bool stale = h->frame - latest->frame >= COLLISION_KEYFRAME_INTERVAL;
+			if( !keyframe || !stale )
+				continue;
+		}
+
+		CollisionRecord * record = &h->records[ h->num_records % MAX_COLLISION_RECORDS ];
+		*record = CollisionRecord {
+			.frame = h->frame,
+			.prev = h->latest_record[ i ],
+			.entity_id = i,
+			.entity = h->entities[ i ],
+			.primitive = h->grid.primitives[ i ],
+		};
+		h->num_records++;
+		h->latest_record[ i ] = h->num_records;
+	}
 
-	CollisionFrame * newframe = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ];
-	newframe->grid = frame->grid;
-	memcpy( newframe->entities, frame->entities, frame->num_entities * sizeof( CollisionEntity ) );
+	TracyPlotSample( "Collision history records", s64( h->num_records - h->frames[ h->frame % COLLISION_HISTORY_FRAMES ].first_record ) );
+
+	memset( h->dirty, 0, sizeof( h->dirty ) );
+	h->frame++;
+	h->num_rewinds = 0;
+}
+
+static s64 CollisionFrameTimestamp( u64 frame ) {
+	const CollisionHistory * h = &g_collision_history;
+	return frame == h->frame ? svs.gametime : h->frames[ frame % COLLISION_HISTORY_FRAMES ].timestamp;
+}
+
+// the entity's broadphase primitive at the end of the given frame, where the
+// current frame is whatever's in the live grid
+static const SpatialHashPrimitive * CollisionPrimitiveAtFrame( int entity_id, u64 frame ) {
+	const CollisionHistory * h = &g_collision_history;
+	if( frame == h->frame )
+		return &h->grid.primitives[ entity_id ];
+
+	const CollisionRecord * record = FindCollisionRecord( entity_id, frame );
+	return record == NULL ? NULL : &record->primitive;
 }
 
-static void GetCollisionFrames4D( const CollisionFrame ** older, const CollisionFrame ** newer, int time_delta ) {
-	if( time_delta == 0 ) {
-		*older = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ];
-		*newer = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ];
+static void BuildCollisionRewind( CollisionRewind * rewind ) {
+	TracyZoneScoped;
+
+	CollisionHistory * h = &g_collision_history;
+
+	s64 time = rewind->gametime + rewind->time_delta;
+
+	// frame timestamps only go up so binary search for the newest frame
+	// older than the target time
+	u64 max_frames_back = Min2( COLLISION_HISTORY_FRAMES - 1, h->frame );
+	u64 lo = 1;
+	u64 hi = max_frames_back + 1;
+	while( lo < hi ) {
+		u64 mid = lo + ( hi - lo ) / 2;
+		if( CollisionFrameTimestamp( h->frame - mid ) < time ) {
+			hi = mid;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+
+	rewind->found = lo <= max_frames_back;
+	rewind->older_frame = h->frame - Min2( lo, max_frames_back );
+	rewind->t = 1.0f;
+	rewind->num_changed = 0;
+
+	if( !rewind->found )
+		return;
+
+	u64 newer_frame = rewind->older_frame + 1;
+	rewind->t = Unlerp01( CollisionFrameTimestamp( rewind->older_frame ), time, CollisionFrameTimestamp( newer_frame ) );
+
+	// the live frame has no records yet
+	if( newer_frame == h->frame )
 		return;
+
+	u64 checked[ MAX_EDICTS / 64 ] = { };
+	u64 oldest_record = h->num_records > MAX_COLLISION_RECORDS ? h->num_records - MAX_COLLISION_RECORDS : 0;
+	u64 first_record = Max2( h->frames[ newer_frame % COLLISION_HISTORY_FRAMES ].first_record, oldest_record );
+
+	for( u64 i = first_record; i < h->num_records; i++ ) {
+		int entity_id = h->records[ i % MAX_COLLISION_RECORDS ].entity_id;
+		u64 bit = 1_u64 << ( entity_id % 64 );
+		if( checked[ entity_id / 64 ] & bit )
+			continue;
+		checked[ entity_id / 64 ] |= bit;
+
+		rewind->changed[ rewind->num_changed++ ] = CollisionRewindEntity {
+			.entity_id = entity_id,
+			.older = CollisionPrimitiveAtFrame( entity_id, rewind->older_frame ),
+			.newer = CollisionPrimitiveAtFrame( entity_id, newer_frame ),
+		};
 	}
+}
 
-	s64 time = svs.gametime + time_delta;
-	for( size_t i = 1; i < ARRAY_COUNT( g_collision_frames ); i++ ) {
-		s64 index = ( g_current_collision_frame - i ) % ARRAY_COUNT( g_collision_frames );
-		if( index < 0 ) {
-			break;
+static const CollisionRewind * FindCollisionRewind( int time_delta ) {
+	CollisionHistory * h = &g_collision_history;
+
+	for( size_t i = 0; i < Min2( h->num_rewinds, MAX_COLLISION_REWINDS ); i++ ) {
+		const CollisionRewind * rewind = &h->rewinds[ i ];
+		if( rewind->gametime == svs.gametime && rewind->time_delta == time_delta ) {
+			return rewind;
 		}
-		if( g_collision_frames[ index ].timestamp < time ) {
-			*older = &g_collision_frames[ index ];
-			*newer = &g_collision_frames[ ( index + 1 ) % ARRAY_COUNT( g_collision_frames ) ];
-			return;
+	}
+
+	CollisionRewind * rewind = &h->rewinds[ h->num_rewinds % MAX_COLLISION_REWINDS ];
+	h->num_rewinds++;
+
+	rewind->gametime = svs.gametime;
+	rewind->time_delta = time_delta;
+	BuildCollisionRewind( rewind );
+
+	return rewind;
+}
+
+static size_t TraverseCollisionHistory4D( Vec3 start, Vec3 end, MinMax3 extents, float max_fraction, int * touchlist, SolidBits solid_mask, int time_delta ) {
+	const CollisionHistory * h = &g_collision_history;
+
+	size_t num = TraverseSpatialHashGrid( &h->grid, start, end, extents, max_fraction, touchlist, solid_mask );
+	if( time_delta == 0 )
+		return num;
+
+	const CollisionRewind * rewind = FindCollisionRewind( time_delta );
+	if( !rewind->found )
+		return num;
+
+	u64 dirty = 0;
+	for( u64 word : h->dirty ) {
+		dirty |= word;
+	}
+	if( rewind->num_changed == 0 && dirty == 0 )
+		return num;
+
+	// entities that haven't changed since older_frame are where the live
+	// grid says they are, everything else needs to be checked against its
+	// state at older_frame/newer_frame
+	u64 touching[ MAX_EDICTS / 64 ] = { };
+	for( size_t i = 1; i < num; i++ ) {
+		touching[ touchlist[ i ] / 64 ] |= 1_u64 << ( touchlist[ i ] % 64 );
+	}
+
+	auto recheck = [&]( int entity_id, const SpatialHashPrimitive * older, const SpatialHashPrimitive * newer ) {
+		bool overlaps = older != NULL && SpatialHashPrimitiveOverlaps( older, start, end, extents, max_fraction, solid_mask );
+		overlaps = overlaps || ( newer != NULL && SpatialHashPrimitiveOverlaps( newer, start, end, extents, max_fraction, solid_mask ) );
+
+		u64 bit = 1_u64 << ( entity_id % 64 );
+		touching[ entity_id / 64 ] &= ~bit;
+		if( overlaps ) {
+			touching[ entity_id / 64 ] |= bit;
 		}
+	};
+
+	for( size_t i = 0; i < rewind->num_changed; i++ ) {
+		const CollisionRewindEntity * changed = &rewind->changed[ i ];
+		recheck( changed->entity_id, changed->older, changed->newer );
 	}
 
-	// timedelta too big, idk return current?
-	*older = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ];
-	*newer = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ];
-	return;
+	// the live grid is only right for these if newer_frame is the live frame,
+	// otherwise they have to go back to their recorded state too
+	u64 newer_frame = rewind->older_frame + 1;
+	for( size_t i = 0; i < ARRAY_COUNT( h->dirty ); i++ ) {
+		if( h->dirty[ i ] == 0 )
+			continue;
+		for( size_t j = 0; j < 64; j++ ) {
+			if( h->dirty[ i ] & ( 1_u64 << j ) ) {
+				int entity_id = int( i * 64 + j );
+				recheck( entity_id, CollisionPrimitiveAtFrame( entity_id, rewind->older_frame ), CollisionPrimitiveAtFrame( entity_id, newer_frame ) );
+			}
+		}
+	}
+
+	num = 0;
+	touchlist[ num++ ] = 0;
+	for( size_t i = 0; i < ARRAY_COUNT( touching ); i++ ) {
+		if( touching[ i ] == 0 )
+			continue;
+		for( size_t j = 0; j < 64; j++ ) {
+			if( touching[ i ] & ( 1_u64 << j ) ) {
+				touchlist[ num++ ] = i * 64 + j;
+			}
+		}
+	}
+
+	return num;
 }
 
 static CollisionEntity LerpCollisionEntity4D( const CollisionEntity * older, float t, const CollisionEntity * newer ) {
@@ -144,32 +432,75 @@ static bool CollisionEntity4D( int entity_id, int time_delta, edict_t * ent ) {
 	if( time_delta == 0 || entity_id == 0 ) // special case world...
 		return true;
 
-	CollisionEntity * newer = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ].entities[ entity_id ];
-	s64 newer_time = svs.gametime;
-	s64 target_time = svs.gametime + time_delta;
-	for( size_t i = 1; i < ARRAY_COUNT( g_collision_frames ); i++ ) {
-		s64 index = ( g_current_collision_frame - i ) % ARRAY_COUNT( g_collision_frames );
-		CollisionEntity * older = &g_collision_frames[ index ].entities[ entity_id ];
+	const CollisionHistory * h = &g_collision_history;
+
+	const CollisionRewind * rewind = FindCollisionRewind( time_delta );
+	u64 older_frame = rewind->older_frame;
+	if( older_frame == h->frame ) // no history yet
+		return true;
+
+	// walk back through the entity's records. the state is constant between
+	// records so we only need to look at the frames where it changed
+	static const CollisionEntity missing = { };
+	const CollisionEntity * newer = &h->entities[ entity_id ];
+	const CollisionRecord * record = GetCollisionRecord( h->latest_record[ entity_id ] );
+	u64 frame = h->frame - 1;
+
+	while( true ) {
+		while( record != NULL && record->frame > frame ) {
+			record = GetCollisionRecord( record->prev );
+		}
+
+		const CollisionEntity * older = record != NULL ? &record->entity : &missing;
 		if( !CheckSimilarCollisionEntities( older, newer ) ) {
 			// entity changed before this point, use most recent version
 			ApplyCollisionEntity( *newer, ent );
 			return true;
 		}
 
-		s64 older_time = g_collision_frames[ index ].timestamp;
+		u64 changed_at = record != NULL ? record->frame : 0;
+		if( changed_at > older_frame ) {
+			newer = older;
+			frame = changed_at - 1;
+			continue;
+		}
 
-		if( g_collision_frames[ index ].timestamp < target_time ) {
-			float t = Unlerp01( older_time, target_time, newer_time );
-			CollisionEntity lerped = LerpCollisionEntity4D( older, t, newer );
-			ApplyCollisionEntity( lerped, ent );
-			return true;
+		if( !rewind->found )
+			return false; // time_delta too big, can't find
+
+		// if the last change was after older_frame + 1 then it didn't change
+		// between the two frames we're interpolating
+		if( frame != older_frame ) {
+			newer = older;
 		}
 
-		newer = older;
-		newer_time = older_time;
+		CollisionEntity lerped = LerpCollisionEntity4D( older, rewind->t, newer );
+		ApplyCollisionEntity( lerped, ent );
+		return true;
 	}
+}
+
+static bool GetTraceEntity4D( int entity_id, int passent, int time_delta, edict_t * touch ) {
+	if( !CollisionEntity4D( entity_id, time_delta, touch ) )
+		return false;
+	if( touch->s.number == passent )
+		return false;
+	if( touch->r.owner != NULL && touch->r.owner->s.number == passent )
+		return false;
+	if( game.edicts[ passent ].r.owner != NULL && game.edicts[ passent ].r.owner->s.number == touch->s.number )
+		return false;
+	return true;
+}
+
+static void TraceVsEnt4D( int entity_id, const Ray & ray, const Shape & shape, int passent, SolidBits solid_mask, int time_delta, trace_t * result ) {
+	edict_t touch;
+	if( !GetTraceEntity4D( entity_id, passent, time_delta, &touch ) )
+		return;
 
-	return false; // time_delta too big, can't find
+	trace_t trace = TraceVsEnt( ServerCollisionModelStorage(), ray, shape, &touch.s, solid_mask );
+	if( trace.fraction <= result->fraction ) {
+		*result = trace;
+	}
 }
 
 trace_t G_Trace4D( Vec3 start, MinMax3 bounds, Vec3 end, const edict_t * passedict, SolidBits solid_mask, int time_delta ) {
@@ -190,32 +521,21 @@ trace_t G_Trace4D( Vec3 start, MinMax3 bounds, Vec3 end, const edict_t * passedi
 		shape.aabb = ToCenterExtents( bounds );
 	}
 
-	MinMax3 ray_bounds = Union( Union( MinMax3::Empty(), ray.origin ), ray.origin + ray.direction * ray.length );
-	MinMax3 broadphase_bounds = MinkowskiSum( ray_bounds, shape );
-
 	trace_t result = MakeMissedTrace( ray );
 
-	const CollisionFrame * a;
-	const CollisionFrame * b;
-	GetCollisionFrames4D( &a, &b, time_delta );
+	// do the world first so the broadphase can skip everything behind
+	// whatever it hits
+	TraceVsEnt4D( 0, ray, shape, passent, solid_mask, time_delta, &result );
+
+	MinMax3 extents = MinkowskiSum( MinMax3( Vec3( 0.0f ) ), shape );
 	int touchlist[ MAX_EDICTS ];
-	size_t num = TraverseSpatialHashGrid( &a->grid, &b->grid, broadphase_bounds, touchlist, solid_mask );
+	size_t num = TraverseCollisionHistory4D( start, end, extents, result.fraction, touchlist, solid_mask, time_delta );
 
-	for( size_t i = 0; i < num; i++ ) {
-		edict_t touch;
-		if( !CollisionEntity4D( touchlist[ i ], time_delta, &touch ) )
-			continue;
-		if( touch.s.number == passent )
-			continue;
-		if( touch.r.owner != NULL && touch.r.owner->s.number == passent )
-			continue;
-		if( game.edicts[ passent ].r.owner != NULL && game.edicts[ passent ].r.owner->s.number == touch.s.number )
-			continue;
+	TracyPlotSample( "Trace candidates", s64( num ) );
 
-		trace_t trace = TraceVsEnt( ServerCollisionModelStorage(), ray, shape, &touch.s, solid_mask );
-		if( trace.fraction <= result.fraction ) {
-			result = trace;
-		}
+	// touchlist[ 0 ] is the world
+	for( size_t i = 1; i < num; i++ ) {
+		TraceVsEnt4D( touchlist[ i ], ray, shape, passent, solid_mask, time_delta, &result );
 	}
 
 	return result;
@@ -225,14 +545,96 @@ trace_t G_Trace( Vec3 start, MinMax3 bounds, Vec3 end, const edict_t * passedict
 	return G_Trace4D( start, bounds, end, passedict, solid_mask, 0 );
 }
 
-int GClip_FindInRadius4D( Vec3 org, float rad, int * list, size_t maxcount, int time_delta ) {
-	MinMax3 bounds = MinMax3( org - rad, org + rad );
+static void TraceVsEntBatch4D( int entity_id, Span< const Ray > rays, u64 lanes, int passent, SolidBits solid_mask, int time_delta, trace_t * results ) {
+	edict_t touch;
+	if( !GetTraceEntity4D( entity_id, passent, time_delta, &touch ) )
+		return;
+
+	Ray lane_rays[ MAX_TRACE_BATCH ];
+	size_t lane_indices[ MAX_TRACE_BATCH ];
+	size_t num_lanes = 0;
+	for( size_t i = 0; i < rays.n; i++ ) {
+		if( lanes & ( 1_u64 << i ) ) {
+			lane_rays[ num_lanes ] = rays[ i ];
+			lane_indices[ num_lanes ] = i;
+			num_lanes++;
+		}
+	}
+
+	trace_t traces[ MAX_TRACE_BATCH ];
+	TraceVsEntBatch( ServerCollisionModelStorage(), Span< const Ray >( lane_rays, num_lanes ), &touch.s, solid_mask, traces );
+
+	for( size_t i = 0; i < num_lanes; i++ ) {
+		trace_t * result = &results[ lane_indices[ i ] ];
+		if( traces[ i ].fraction <= result->fraction ) {
+			*result = traces[ i ];
+		}
+	}
+}
+
+/*
+ * same as calling G_Trace4D with a point shape for each end, but the rewind
+ * and entity filtering happen once per entity instead of once per ray, and
+ * rays that hit the same brush model get traced together
+ */
+void G_TraceBatch( Vec3 start, Span< const Vec3 > ends, const edict_t * passedict, SolidBits solid_mask, int time_delta, trace_t * results ) {
+	TracyZoneScoped;
+
+	Assert( ends.n <= MAX_TRACE_BATCH );
+	if( ends.n == 0 )
+		return;
+
+	int passent = passedict == NULL ? -1 : ENTNUM( passedict );
+
+	Assert( passent == -1 || ( passent >= 0 && size_t( passent ) < ARRAY_COUNT( game.edicts ) ) );
+
+	Ray rays[ MAX_TRACE_BATCH ];
+	for( size_t i = 0; i < ends.n; i++ ) {
+		rays[ i ] = MakeRayStartEnd( start, ends[ i ] );
+		results[ i ] = MakeMissedTrace( rays[ i ] );
+	}
+
+	TraceVsEntBatch4D( 0, Span< const Ray >( rays, ends.n ), U64_MAX >> ( 64 - ends.n ), passent, solid_mask, time_delta, results );
+
+	// which rays each entity needs to be traced against
+	u64 candidates[ MAX_EDICTS / 64 ] = { };
+	u64 lanes[ MAX_EDICTS ];
 
-	const CollisionFrame * a;
-	const CollisionFrame * b;
-	GetCollisionFrames4D( &a, &b, time_delta );
+	for( size_t i = 0; i < ends.n; i++ ) {
+		int touchlist[ MAX_EDICTS ];
+		size_t num = TraverseCollisionHistory4D( start, ends[ i ], MinMax3( 0.0f ), results[ i ].fraction, touchlist, solid_mask, time_delta );
+
+		for( size_t j = 1; j < num; j++ ) {
+			int entity_id = touchlist[ j ];
+			u64 bit = 1_u64 << ( entity_id % 64 );
+			if( ( candidates[ entity_id / 64 ] & bit ) == 0 ) {
+				candidates[ entity_id / 64 ] |= bit;
+				lanes[ entity_id ] = 0;
+			}
+			lanes[ entity_id ] |= 1_u64 << i;
+		}
+	}
+
+	// go in entity order so ties resolve the same way as G_Trace4D
+	for( size_t i = 0; i < ARRAY_COUNT( candidates ); i++ ) {
+		if( candidates[ i ] == 0 )
+			continue;
+		for( size_t j = 0; j < 64; j++ ) {
+			if( candidates[ i ] & ( 1_u64 << j ) ) {
+				int entity_id = i * 64 + j;
+				TraceVsEntBatch4D( entity_id, Span< const Ray >( rays, ends.n ), lanes[ entity_id ], passent, solid_mask, time_delta, results );
+			}
+		}
+	}
+}
+
+u64 GClip_CollisionVersion() {
+	return g_collision_history.version;
+}
+
+int GClip_FindInRadius4D( Vec3 org, float rad, int * list, size_t maxcount, int time_delta ) {
 	int touchlist[ MAX_EDICTS ];
-	size_t touchnum = TraverseSpatialHashGrid( &a->grid, &b->grid, bounds, touchlist, SolidMask_AnySolid );
+	size_t touchnum = TraverseCollisionHistory4D( org, org, MinMax3( Vec3( -rad ), Vec3( rad ) ), 1.0f, touchlist, SolidMask_AnySolid, time_delta );
 
 	size_t num = 0;
 	for( size_t i = 0; i < touchnum; i++ ) {
@@ -254,19 +656,35 @@ void G_SplashFrac4D( const edict_t * ent, Vec3 hitpoint, float maxradius, Vec3 *
 }
 
 void GClip_ClearWorld() {
-	CollisionFrame * frame = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ];
-	ClearSpatialHashGrid( &frame->grid );
+	memset( &g_collision_history, 0, sizeof( g_collision_history ) );
 }
 
 void GClip_LinkEntity( const edict_t * ent ) {
-	CollisionFrame * frame = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ];
-	frame->entities[ ENTNUM( ent ) ] = GetCollisionEntity( ent );
-	LinkEntity( &frame->grid, ServerCollisionModelStorage(), &ent->s, ENTNUM( ent ) );
+	CollisionHistory * h = &g_collision_history;
+
+	CollisionEntity old_entity = h->entities[ ENTNUM( ent ) ];
+	SpatialHashPrimitive old_primitive = h->grid.primitives[ ENTNUM( ent ) ];
+
+	h->entities[ ENTNUM( ent ) ] = GetCollisionEntity( ent );
+	LinkEntity( &h->grid, ServerCollisionModelStorage(), &ent->s, ENTNUM( ent ) );
+	MarkCollisionEntityDirty( ENTNUM( ent ) );
+
+	// non-solid stuff like events can't change what traces hit
+	const SpatialHashPrimitive & primitive = h->grid.primitives[ ENTNUM( ent ) ];
+	bool solid = old_primitive.solidity != Solid_NotSolid || primitive.solidity != Solid_NotSolid;
+	if( solid && !( old_entity == h->entities[ ENTNUM( ent ) ] && old_primitive == primitive ) ) {
+		h->version++;
+	}
 }
 
 void GClip_UnlinkEntity( const edict_t * ent ) {
-	CollisionFrame * frame = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ];
-	UnlinkEntity( &frame->grid, ENTNUM( ent ) );
+	CollisionHistory * h = &g_collision_history;
+	if( h->grid.primitives[ ENTNUM( ent ) ].solidity != Solid_NotSolid ) {
+		h->version++;
+	}
+
+	UnlinkEntity( &h->grid, ENTNUM( ent ) );
+	MarkCollisionEntityDirty( ENTNUM( ent ) );
 }
 
 void GClip_TouchTriggers( edict_t * ent ) {
@@ -279,8 +697,7 @@ void GClip_TouchTriggers( edict_t * ent ) {
 	bounds.maxs += ent->s.origin;
 
 	int touchlist[ MAX_EDICTS ];
-	CollisionFrame * frame = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ];
-	size_t touchnum = TraverseSpatialHashGrid( &frame->grid, bounds, touchlist, Solid_Trigger );
+	size_t touchnum = TraverseSpatialHashGrid( &g_collision_history.grid, bounds, touchlist, Solid_Trigger );
 
 	for( size_t i = 0; i < touchnum; i++ ) {
 		if( !ent->r.inuse )
@@ -322,8 +739,7 @@ void G_PMoveTouchTriggers( const pmove_t * pm, Vec3 previous_origin ) {
 	bounds = Union( bounds, pm->bounds + previous_origin );
 
 	int touchlist[ MAX_EDICTS ];
-	CollisionFrame * frame = &g_collision_frames[ g_current_collision_frame % ARRAY_COUNT( g_collision_frames ) ];
-	size_t num = TraverseSpatialHashGrid( &frame->grid, bounds, touchlist, Solid_Trigger );
+	size_t num = TraverseSpatialHashGrid( &g_collision_history.grid, bounds, touchlist, Solid_Trigger );
 
 	for( size_t i = 0; i < num; i++ ) {
 		if( !ent->r.inuse )
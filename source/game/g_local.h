@@ -326,6 +326,8 @@ bool G_TriggerWait( edict_t * ent );
 
 trace_t G_Trace( Vec3 start, MinMax3 bounds, Vec3 end, const edict_t * passedict, SolidBits solid_mask );
 trace_t G_Trace4D( Vec3 start, MinMax3 bounds, Vec3 end, const edict_t * passedict, SolidBits solid_mask, int timeDelta );
+void G_TraceBatch( Vec3 start, Span< const Vec3 > ends, const edict_t * passedict, SolidBits solid_mask, int timeDelta, trace_t * results );
+u64 GClip_CollisionVersion();
 void GClip_BackUpCollisionFrame();
 int GClip_FindInRadius4D( Vec3 org, float rad, int * list, size_t maxcount, int timeDelta );
 void G_SplashFrac4D( const edict_t * ent, Vec3 hitpoint, float maxradius, Vec3 * pushdir, float *frac, int timeDelta, bool selfdamage );
@@ -2,23 +2,50 @@
 #include "qcommon/compression.h"
 #include "qcommon/fs.h"
 #include "qcommon/string.h"
+#include "qcommon/threads.h"
 #include "game/g_maps.h"
 #include "gameshared/cdmap.h"
 #include "gameshared/collision.h"
+#include "gameshared/collision_pack.h"
 #include "server/server.h"
 
 #include "cgltf/cgltf.h"
 
 static CollisionModelStorage collision_models;
 
+static Span< const u8 > collision_pack_data;
+static Span< const CollisionPackModel > collision_pack;
+static size_t num_unpacked_models;
+
 struct ServerMapData {
 	StringHash base_hash;
-	Span< u8 > data;
+	Span< const u8 > mapped; // .cdmap
+	Span< u8 > data; // decompressed .cdmap.zst
+	Span< u8 > decompressed_sections;
 };
 
+// the next map, loaded in the background while the current one is still
+// being played. it outlives ShutdownServerCollisionModels because changing
+// maps restarts the whole game
+struct PreloadedServerMap {
+	char * name;
+	ServerMapData map;
+	MapSharedCollisionData collision;
+	bool ok;
+};
+
+static Thread * preload_thread;
+static PreloadedServerMap preloaded_map;
+
 static ServerMapData maps[ CollisionModelStorage::MAX_MAPS ];
 static size_t num_maps;
 
+static void DeleteServerMapData( const ServerMapData & map ) {
+	UnmapFile( map.mapped );
+	Free( sys_allocator, map.data.ptr );
+	Free( sys_allocator, map.decompressed_sections.ptr );
+}
+
 static bool AddGLTFModel( Span< const u8 > data, Span< const char > path ) {
 	cgltf_options options = { };
 	options.type = cgltf_file_type_glb;
@@ -47,6 +74,31 @@ static bool AddGLTFModel( Span< const u8 > data, Span< const char > path ) {
 	return true;
 }
 
+// returns false if the model isn't in the pack or has changed since it was built
+static bool AddPackedGLTFModel( TempAllocator * temp, const char * path, StringHash name ) {
+	const CollisionPackModel * model = FindCollisionPackModel( collision_pack, name );
+	if( model == NULL )
+		return false;
+
+	FileMetadata metadata;
+	if( !GetFileMetadata( temp, path, &metadata ) )
+		return false;
+	if( metadata.size != model->source_size || metadata.modified_time != model->source_modified_time )
+		return false;
+
+	if( !CollisionPackModelHasCollision( model ) )
+		return true;
+
+	GLTFCollisionData data;
+	if( !DecodeCollisionPackModel( &data, collision_pack_data, model ) ) {
+		Com_GGPrint( S_COLOR_YELLOW "{} is corrupt in base/collision.pack, loading it from the .glb", path );
+		return false;
+	}
+
+	AddGLTFCollisionData( &collision_models, name, data );
+	return true;
+}
+
 static void LoadModelsRecursive( TempAllocator * temp, DynamicString * path, size_t skip ) {
 	ListDirHandle scan = BeginListDir( temp, path->c_str() );
 
@@ -63,8 +115,12 @@ static void LoadModelsRecursive( TempAllocator * temp, DynamicString * path, siz
 			LoadModelsRecursive( temp, path, skip );
 		}
 		else if( FileExtension( path->c_str() ) == ".glb" ) {
-			Span< u8 > data = ReadFileBinary( temp, path->c_str() );
-			AddGLTFModel( data, StripExtension( path->c_str() + skip ) );
+			Span< const char > name = StripExtension( path->c_str() + skip );
+			if( !AddPackedGLTFModel( temp, path->c_str(), StringHash( name ) ) ) {
+				Span< u8 > data = ReadFileBinary( temp, path->c_str() );
+				AddGLTFModel( data, name );
+				num_unpacked_models++;
+			}
 		}
 		path->truncate( old_len );
 	}
@@ -74,31 +130,55 @@ void InitServerCollisionModels() {
 	InitCollisionModelStorage( &collision_models );
 
 	TempAllocator temp = svs.frame_arena.temp();
+
+	collision_pack_data = MapFile( &temp, temp( "{}/base/collision.pack", RootDirPath() ) );
+	if( collision_pack_data.ptr != NULL && !DecodeCollisionPack( &collision_pack, collision_pack_data ) ) {
+		Com_Printf( S_COLOR_YELLOW "base/collision.pack is corrupt or out of date, rebuild it with collisionpack\n" );
+		UnmapFile( collision_pack_data );
+		collision_pack_data = Span< const u8 >();
+	}
+
+	num_unpacked_models = 0;
 	DynamicString base( &temp, "{}/base", RootDirPath() );
 	LoadModelsRecursive( &temp, &base, base.length() + 1 );
 
+	if( collision_pack_data.ptr != NULL && num_unpacked_models > 0 ) {
+		Com_GGPrint( "{} models are missing from or stale in base/collision.pack", num_unpacked_models );
+	}
+
 	num_maps = 0;
 }
 
 void ShutdownServerCollisionModels() {
 	ShutdownCollisionModelStorage( &collision_models );
 
+	UnmapFile( collision_pack_data );
+	collision_pack_data = Span< const u8 >();
+	collision_pack = Span< const CollisionPackModel >();
+
 	for( size_t i = 0; i < num_maps; i++ ) {
-		Free( sys_allocator, maps[ i ].data.ptr );
+		DeleteServerMapData( maps[ i ] );
 	}
 }
 
-bool LoadServerMap( const char * name ) {
-	TempAllocator temp = svs.frame_arena.temp();
+// this also runs on the preload thread, so it can't touch the frame arena
+// or collision_models
+static bool ReadServerMap( const char * name, ServerMapData * map, MapSharedCollisionData * collision ) {
+	TracyZoneScoped;
 
-	const char * path = temp( "{}/base/maps/{}.cdmap", RootDirPath(), name );
+	*map = { };
+	map->base_hash = StringHash( name );
 
-	ServerMapData map;
-	map.base_hash = StringHash( name );
-	map.data = ReadFileBinary( sys_allocator, path );
+	char * path = ( *sys_allocator )( "{}/base/maps/{}.cdmap", RootDirPath(), name );
+	defer { Free( sys_allocator, path ); };
+
+	map->mapped = MapFile( sys_allocator, path );
+
+	Span< const u8 > data = map->mapped;
+	if( data.ptr == NULL ) {
+		char * zst_path = ( *sys_allocator )( "{}.zst", path );
+		defer { Free( sys_allocator, zst_path ); };
 
-	if( map.data.ptr == NULL ) {
-		const char * zst_path = temp( "{}.zst", path );
 		Span< u8 > compressed = ReadFileBinary( sys_allocator, zst_path );
 		defer { Free( sys_allocator, compressed.ptr ); };
 		if( compressed.ptr == NULL ) {
@@ -106,27 +186,99 @@ bool LoadServerMap( const char * name ) {
 			return false;
 		}
 
-		bool ok = Decompress( zst_path, sys_allocator, compressed, &map.data );
+		bool ok = Decompress( zst_path, sys_allocator, compressed, &map->data );
 		if( !ok ) {
 			Com_Printf( "Couldn't decompress %s\n", zst_path );
 			return false;
 		}
+
+		data = map->data;
 	}
 
 	MapData decoded;
-	DecodeMapResult res = DecodeMap( &decoded, map.data );
+	DecodeMapResult res = DecodeMap( &decoded, data, MapSectionMask_Game, sys_allocator, &map->decompressed_sections );
 	if( res != DecodeMapResult_Ok ) {
 		Com_Printf( "Can't decode map %s\n", name );
-		Free( sys_allocator, map.data.ptr );
+		DeleteServerMapData( *map );
 		return false;
 	}
 
-	LoadMapCollisionData( &collision_models, &decoded, map.base_hash );
+	*collision = MakeMapSharedCollisionData( &decoded, map->base_hash );
+
+	return true;
+}
+
+static void PreloadServerMapThread( void * data ) {
+	PreloadedServerMap * preload = ( PreloadedServerMap * ) data;
+	preload->ok = ReadServerMap( preload->name, &preload->map, &preload->collision );
+}
+
+void PreloadServerMap( const char * name ) {
+	DiscardPreloadedServerMap();
+
+	preloaded_map.name = CopyString( sys_allocator, name );
+	preload_thread = NewThread( PreloadServerMapThread, &preloaded_map );
+}
+
+void DiscardPreloadedServerMap() {
+	if( preload_thread == NULL )
+		return;
+
+	JoinThread( preload_thread );
+	preload_thread = NULL;
+
+	if( preloaded_map.ok ) {
+		DeleteServerMapData( preloaded_map.map );
+		DeleteMapSharedCollisionData( preloaded_map.collision );
+	}
+
+	Free( sys_allocator, preloaded_map.name );
+	preloaded_map = { };
+}
+
+static bool TakePreloadedServerMap( const char * name, ServerMapData * map, MapSharedCollisionData * collision ) {
+	if( preload_thread == NULL || !StrEqual( preloaded_map.name, name ) ) {
+		DiscardPreloadedServerMap();
+		return false;
+	}
+
+	JoinThread( preload_thread );
+	preload_thread = NULL;
+
+	bool ok = preloaded_map.ok;
+	*map = preloaded_map.map;
+	*collision = preloaded_map.collision;
+
+	Free( sys_allocator, preloaded_map.name );
+	preloaded_map = { };
+
+	return ok;
+}
+
+bool LoadServerMap( const char * name ) {
+	TracyZoneScoped;
+
+	StringHash base_hash = StringHash( name );
+	for( size_t i = 0; i < num_maps; i++ ) {
+		if( maps[ i ].base_hash == base_hash ) {
+			return true;
+		}
+	}
+
+	ServerMapData map;
+	MapSharedCollisionData collision;
+	if( !TakePreloadedServerMap( name, &map, &collision ) ) {
+		if( !ReadServerMap( name, &map, &collision ) ) {
+			return false;
+		}
+	}
 
 	if( num_maps == ARRAY_COUNT( maps ) ) {
 		Fatal( "Too many maps" );
 	}
 
+	AddMapCollisionData( &collision_models, collision );
+
 	maps[ num_maps ] = map;
 	num_maps++;
 
@@ -8,6 +8,11 @@ void ShutdownServerCollisionModels();
 
 bool LoadServerMap( const char * name );
 
+// starts loading a map we're probably about to switch to on another thread,
+// so LoadServerMap can pick it up without touching the disk
+void PreloadServerMap( const char * name );
+void DiscardPreloadedServerMap();
+
 struct MapData;
 struct MapSubModelCollisionData;
 
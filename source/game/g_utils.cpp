@@ -190,6 +190,7 @@ void G_FreeEdict( edict_t * ed ) {
 		return;
 
 	GClip_UnlinkEntity( ed );
+	PF_ResetEntityVisibility( ed );
 
 	// bool ok = entity_id_hashtable.remove( ed->id.id );
 	// Assert( ok );
@@ -213,6 +214,7 @@ void G_InitEdict( edict_t * e ) {
 	e->s.number = ENTNUM( e );
 	e->s.id = NewEntity();
 	e->r.inuse = true;
+	PF_ResetEntityVisibility( e );
 
 	// bool ok = entity_id_hashtable.add( e->id.id, e->s.number );
 	// Assert( ok );
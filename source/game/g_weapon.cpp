@@ -282,14 +282,20 @@ static void HitWithSpread( edict_t * self, Vec3 start, Vec3 angles, float range,
 	Vec3 forward;
 	AngleVectors( angles, &forward, NULL, NULL );
 
+	Vec3 ends[ MAX_TRACE_BATCH ];
 	for( int i = 0; i < traces; i++ ) {
 		Vec3 new_angles = angles;
 		new_angles.y += Lerp( -spread, float( i ) / float( traces - 1 ), spread );
 		Vec3 dir;
 		AngleVectors( new_angles, &dir, NULL, NULL );
-		Vec3 end = start + dir * range;
+		ends[ i ] = start + dir * range;
+	}
+
+	trace_t results[ MAX_TRACE_BATCH ];
+	G_TraceBatch( start, Span< const Vec3 >( ends, traces ), self, SolidMask_Shot, timeDelta, results );
 
-		trace_t trace = G_Trace4D( start, MinMax3( 0.0f ), end, self, SolidMask_Shot, timeDelta );
+	for( int i = 0; i < traces; i++ ) {
+		const trace_t & trace = results[ i ];
 		if( trace.HitSomething() && game.edicts[ trace.ent ].takedamage ) {
 			G_Damage( &game.edicts[ trace.ent ], self, self, forward, forward, trace.endpos, damage, knockback, 0, weapon );
 			break;
@@ -367,6 +373,18 @@ static void W_Fire_Bullet( edict_t * self, Vec3 start, Vec3 angles, int timeDelt
 	}
 }
 
+// batched GS_TraceBullet
+static void TraceBullets( const edict_t * self, Vec3 start, Span< const Vec3 > ends, int timeDelta, trace_t * traces, trace_t * wallbangs ) {
+	G_TraceBatch( start, ends, self, SolidMask_WallbangShot, timeDelta, traces );
+
+	Vec3 wallbang_ends[ MAX_TRACE_BATCH ];
+	for( size_t i = 0; i < ends.n; i++ ) {
+		wallbang_ends[ i ] = traces[ i ].endpos;
+	}
+
+	G_TraceBatch( start, Span< const Vec3 >( wallbang_ends, ends.n ), self, Solid_Wallbangable, timeDelta, wallbangs );
+}
+
 static void W_Fire_Shotgun( edict_t * self, Vec3 start, Vec3 angles, int timeDelta, WeaponType weapon ) {
 	const WeaponDef * def = GS_GetWeaponDef( weapon );
 
@@ -376,11 +394,26 @@ static void W_Fire_Shotgun( edict_t * self, Vec3 start, Vec3 angles, int timeDel
 	float damage_dealt[ MAX_CLIENTS + 1 ] = { };
 	Vec3 hit_locations[ MAX_CLIENTS + 1 ] = { }; // arbitrary trace end pos to use as blood origin
 
+	Vec3 ends[ MAX_TRACE_BATCH ];
 	for( int i = 0; i < def->projectile_count; i++ ) {
 		Vec2 spread = FixedSpreadPattern( i, def->spread );
+		ends[ i ] = GS_BulletEnd( start, dir, right, up, spread, def->range );
+	}
+
+	trace_t traces[ MAX_TRACE_BATCH ];
+	trace_t wallbangs[ MAX_TRACE_BATCH ];
+	TraceBullets( self, start, Span< const Vec3 >( ends, def->projectile_count ), timeDelta, traces, wallbangs );
+	u64 collision_version = GClip_CollisionVersion();
+
+	for( int i = 0; i < def->projectile_count; i++ ) {
+		// if the last pellet killed someone the rest need to go through them
+		if( GClip_CollisionVersion() != collision_version ) {
+			TraceBullets( self, start, Span< const Vec3 >( ends + i, def->projectile_count - i ), timeDelta, traces + i, wallbangs + i );
+			collision_version = GClip_CollisionVersion();
+		}
 
-		trace_t trace, wallbang;
-		GS_TraceBullet( &server_gs, &trace, &wallbang, start, dir, right, up, spread, def->range, ENTNUM( self ), timeDelta );
+		const trace_t & trace = traces[ i ];
+		const trace_t & wallbang = wallbangs[ i ];
 		if( trace.HitSomething() && game.edicts[ trace.ent ].takedamage ) {
 			int dmgflags = trace.endpos == wallbang.endpos ? 0 : DAMAGE_WALLBANG;
 			float damage = def->damage;
@@ -1,50 +1,183 @@
-#include "qcommon/types.h"
+#include "qcommon/base.h"
 #include "gameshared/cdmap.h"
 #include "gameshared/q_shared.h"
 
+#include "zstd/zstd.h"
+
 #include <string.h>
 
 template< typename T >
-static bool DecodeMapSection( Span< T > * span, Span< const u8 > data, MapSectionType type ) {
-	const MapHeader * header = align_cast< const MapHeader >( data.ptr );
-	MapSection section = header->sections[ type ];
+static bool CastMapSection( Span< const T > * span, Span< const u8 > section ) {
+	if( section.n % sizeof( T ) != 0 || uintptr_t( section.ptr ) % alignof( T ) != 0 )
+		return false;
 
-	if( section.offset + section.size > data.n )
+	*span = section.cast< const T >();
+	return true;
+}
+
+static bool ReadMapHeader( Span< const u8 > data, MapSection * sections, u64 * format_version, MapVertexEncoding * vertex_encoding, DecodeMapResult * err ) {
+	*err = DecodeMapResult_NotAMap;
+	if( data.n < sizeof( MapHeaderV1 ) )
 		return false;
 
-	if( section.size % sizeof( T ) != 0 )
+	const MapHeaderV1 * header_v1 = align_cast< const MapHeaderV1 >( data.ptr );
+	if( memcmp( header_v1->magic, CDMAP_MAGIC, sizeof( header_v1->magic ) ) != 0 )
 		return false;
 
-	*span = ( data + section.offset ).slice( 0, section.size ).cast< const T >();
-	return true;
-}
+	*format_version = header_v1->format_version;
+	*vertex_encoding = MapVertexEncoding_Float;
+
+	if( header_v1->format_version == 1 ) {
+		for( int i = 0; i < MapSection_Count; i++ ) {
+			sections[ i ] = MapSection {
+				.offset = header_v1->sections[ i ].offset,
+				.size = header_v1->sections[ i ].size,
+				.decompressed_size = header_v1->sections[ i ].size,
+				.compression = MapSectionCompression_None,
+			};
+		}
+		return true;
+	}
+
+	if( header_v1->format_version == 2 ) {
+		if( data.n < sizeof( MapHeaderV2 ) )
+			return false;
+
+		const MapHeaderV2 * header_v2 = align_cast< const MapHeaderV2 >( data.ptr );
+		memcpy( sections, header_v2->sections, sizeof( header_v2->sections ) );
+		return true;
+	}
+
+	if( header_v1->format_version != CDMAP_FORMAT_VERSION ) {
+		*err = DecodeMapResult_WrongFormatVersion;
+		return false;
+	}
 
-DecodeMapResult DecodeMap( MapData * map, Span< const u8 > data ) {
 	if( data.n < sizeof( MapHeader ) )
-		return DecodeMapResult_NotAMap;
+		return false;
 
 	const MapHeader * header = align_cast< const MapHeader >( data.ptr );
-	if( memcmp( header->magic, CDMAP_MAGIC, sizeof( header->magic ) ) != 0 )
-		return DecodeMapResult_NotAMap;
+	memcpy( sections, header->sections, sizeof( header->sections ) );
+	*vertex_encoding = header->vertex_encoding;
+	return true;
+}
+
+static bool CheckVertexSection( Span< const u8 > section, size_t element_size ) {
+	return section.n % element_size == 0 && uintptr_t( section.ptr ) % Min2( element_size, size_t( 4 ) ) == 0;
+}
+
+DecodeMapResult DecodeMap( MapData * map, Span< const u8 > data, u32 section_mask, Allocator * a, Span< u8 > * decompressed ) {
+	TracyZoneScoped;
+
+	*map = { };
+	*decompressed = Span< u8 >();
+
+	MapSection sections[ MapSection_Count ];
+	u64 format_version;
+	MapVertexEncoding vertex_encoding;
+	DecodeMapResult err;
+	if( !ReadMapHeader( data, sections, &format_version, &vertex_encoding, &err ) )
+		return err;
 
-	if( header->format_version != CDMAP_FORMAT_VERSION )
-		return DecodeMapResult_WrongFormatVersion;
+	// older maps get their meshes widened to MapMesh after the decompressed sections
+	bool convert_meshes = format_version < 3 && ( section_mask & MapSectionBit( MapSection_Meshes ) ) != 0;
+	size_t num_old_meshes = sections[ MapSection_Meshes ].decompressed_size / sizeof( MapMeshV2 );
 
+	size_t decompressed_size = 0;
+	for( int i = 0; i < MapSection_Count; i++ ) {
+		if( ( section_mask & MapSectionBit( MapSectionType( i ) ) ) == 0 )
+			continue;
+
+		if( sections[ i ].compression == MapSectionCompression_Zstd ) {
+			decompressed_size += AlignPow2( size_t( sections[ i ].decompressed_size ), size_t( 16 ) );
+		}
+		else if( sections[ i ].compression != MapSectionCompression_None ) {
+			return DecodeMapResult_NotAMap;
+		}
+	}
+
+	size_t converted_meshes_offset = decompressed_size;
+	if( convert_meshes ) {
+		decompressed_size += num_old_meshes * sizeof( MapMesh );
+	}
+
+	if( decompressed_size > 0 ) {
+		*decompressed = AllocSpan< u8 >( a, decompressed_size );
+	}
+
+	Span< const u8 > decoded[ MapSection_Count ] = { };
+	size_t cursor = 0;
 	bool ok = true;
-	ok = ok && DecodeMapSection( &map->entities, data, MapSection_Entities );
-	ok = ok && DecodeMapSection( &map->entity_data, data, MapSection_EntityData );
-	ok = ok && DecodeMapSection( &map->entity_kvs, data, MapSection_EntityKeyValues );
-	ok = ok && DecodeMapSection( &map->models, data, MapSection_Models );
-	ok = ok && DecodeMapSection( &map->nodes, data, MapSection_Nodes );
-	ok = ok && DecodeMapSection( &map->brushes, data, MapSection_Brushes );
-	ok = ok && DecodeMapSection( &map->brush_indices, data, MapSection_BrushIndices );
-	ok = ok && DecodeMapSection( &map->brush_planes, data, MapSection_BrushPlanes );
-	ok = ok && DecodeMapSection( &map->meshes, data, MapSection_Meshes );
-	ok = ok && DecodeMapSection( &map->vertex_positions, data, MapSection_VertexPositions );
-	ok = ok && DecodeMapSection( &map->vertex_normals, data, MapSection_VertexNormals );
-	ok = ok && DecodeMapSection( &map->vertex_indices, data, MapSection_VertexIndices );
-
-	return ok ? DecodeMapResult_Ok : DecodeMapResult_NotAMap;
+
+	for( int i = 0; i < MapSection_Count && ok; i++ ) {
+		if( ( section_mask & MapSectionBit( MapSectionType( i ) ) ) == 0 )
+			continue;
+
+		MapSection section = sections[ i ];
+		if( u64( section.offset ) + section.size > data.n ) {
+			ok = false;
+			break;
+		}
+
+		Span< const u8 > stored = data.slice( section.offset, section.offset + section.size );
+		if( section.compression == MapSectionCompression_None ) {
+			decoded[ i ] = stored;
+			continue;
+		}
+
+		TracyZoneScopedN( "Decompress map section" );
+
+		Span< u8 > dst = decompressed->slice( cursor, cursor + section.decompressed_size );
+		cursor += AlignPow2( size_t( section.decompressed_size ), size_t( 16 ) );
+
+		size_t r = ZSTD_decompress( dst.ptr, dst.n, stored.ptr, stored.n );
+		ok = !ZSTD_isError( r ) && r == dst.n;
+		decoded[ i ] = dst;
+	}
+
+	ok = ok && CastMapSection( &map->entities, decoded[ MapSection_Entities ] );
+	ok = ok && CastMapSection( &map->entity_data, decoded[ MapSection_EntityData ] );
+	ok = ok && CastMapSection( &map->entity_kvs, decoded[ MapSection_EntityKeyValues ] );
+	ok = ok && CastMapSection( &map->models, decoded[ MapSection_Models ] );
+	ok = ok && CastMapSection( &map->nodes, decoded[ MapSection_Nodes ] );
+	ok = ok && CastMapSection( &map->brushes, decoded[ MapSection_Brushes ] );
+	ok = ok && CastMapSection( &map->brush_indices, decoded[ MapSection_BrushIndices ] );
+	ok = ok && CastMapSection( &map->brush_planes, decoded[ MapSection_BrushPlanes ] );
+	ok = ok && CastMapSection( &map->vertex_positions, decoded[ MapSection_VertexPositions ] );
+	ok = ok && CastMapSection( &map->vertex_normals, decoded[ MapSection_VertexNormals ] );
+	ok = ok && CastMapSection( &map->vertex_indices, decoded[ MapSection_VertexIndices ] );
+	ok = ok && CheckVertexSection( map->vertex_positions, MapVertexPositionSize( vertex_encoding ) );
+	ok = ok && CheckVertexSection( map->vertex_normals, MapVertexNormalSize( vertex_encoding ) );
+	ok = ok && CheckVertexSection( map->vertex_indices, MapVertexIndexSize( vertex_encoding ) );
+	map->vertex_encoding = vertex_encoding;
+
+	if( !convert_meshes ) {
+		ok = ok && CastMapSection( &map->meshes, decoded[ MapSection_Meshes ] );
+	}
+	else {
+		Span< const MapMeshV2 > old_meshes;
+		ok = ok && CastMapSection( &old_meshes, decoded[ MapSection_Meshes ] );
+		if( ok ) {
+			Span< MapMesh > meshes = decompressed->slice( converted_meshes_offset, decompressed->n ).cast< MapMesh >();
+			for( size_t i = 0; i < old_meshes.n; i++ ) {
+				meshes[ i ] = MapMesh {
+					.material = old_meshes[ i ].material,
+					.first_vertex_index = old_meshes[ i ].first_vertex_index,
+					.num_vertices = old_meshes[ i ].num_vertices,
+				};
+			}
+			map->meshes = meshes;
+		}
+	}
+
+	if( !ok ) {
+		Free( a, decompressed->ptr );
+		*decompressed = Span< u8 >();
+		*map = { };
+		return DecodeMapResult_NotAMap;
+	}
+
+	return DecodeMapResult_Ok;
 }
 
 Span< const char > GetWorldspawnKey( const MapData * map, const char * key ) {
@@ -27,18 +27,72 @@ enum MapSectionType {
 
 STATIC_ASSERT( MapSection_Source == 0 ); // tools need to be forward compatible so we can recompile maps
 
+constexpr u32 MapSectionBit( MapSectionType section ) {
+	return u32( 1 ) << section;
+}
+
+constexpr u32 MapSectionMask_Game =
+	MapSectionBit( MapSection_Entities ) | MapSectionBit( MapSection_EntityData ) | MapSectionBit( MapSection_EntityKeyValues ) |
+	MapSectionBit( MapSection_Models ) |
+	MapSectionBit( MapSection_Nodes ) | MapSectionBit( MapSection_Brushes ) | MapSectionBit( MapSection_BrushIndices ) | MapSectionBit( MapSection_BrushPlanes );
+constexpr u32 MapSectionMask_Render =
+	MapSectionBit( MapSection_Meshes ) | MapSectionBit( MapSection_VertexPositions ) | MapSectionBit( MapSection_VertexNormals ) | MapSectionBit( MapSection_VertexIndices );
+
+enum MapSectionCompression : u32 {
+	MapSectionCompression_None,
+	MapSectionCompression_Zstd,
+};
+
+// sections are page aligned so uncompressed maps can be mmapped and used
+// in place, and compressed individually so we only pay to decompress the
+// ones we use
 struct MapSection {
 	u32 offset, size;
+	u32 decompressed_size;
+	MapSectionCompression compression;
+};
+
+// how MapSection_VertexPositions/VertexNormals/VertexIndices are stored.
+// with no bits set positions and normals are Vec3 and indices are u32
+enum MapVertexEncoding : u32 {
+	MapVertexEncoding_Float = 0,
+
+	// positions are unorm16x4 with w = 1, dequantized with
+	// MapMesh::position_offset/position_scale, and normals are snorm8x4
+	MapVertexEncoding_Quantized = ( 1 << 0 ),
+	MapVertexEncoding_U16Indices = ( 1 << 1 ),
 };
 
 struct MapHeader {
 	char magic[ 8 ];
 	u64 format_version;
 	MapSection sections[ MapSection_Count ];
+	MapVertexEncoding vertex_encoding;
+};
+
+// version 2 maps are always MapVertexEncoding_Float with indices into the
+// whole vertex buffer, see MapMeshV2
+struct MapHeaderV2 {
+	char magic[ 8 ];
+	u64 format_version;
+	MapSection sections[ MapSection_Count ];
+};
+
+// version 1 maps have no per-section compression and get shipped as
+// .cdmap.zst instead
+struct MapSectionV1 {
+	u32 offset, size;
+};
+
+struct MapHeaderV1 {
+	char magic[ 8 ];
+	u64 format_version;
+	MapSectionV1 sections[ MapSection_Count ];
 };
 
 constexpr const char CDMAP_MAGIC[ sizeof( MapHeader::magic ) ] = "cdmap";
-constexpr u64 CDMAP_FORMAT_VERSION = 1;
+constexpr u64 CDMAP_FORMAT_VERSION = 3;
+constexpr size_t CDMAP_SECTION_ALIGNMENT = 4096;
 
 struct MapEntity {
 	u32 first_key_value;
@@ -94,6 +148,19 @@ struct MapMesh {
 	u64 material;
 	u32 first_vertex_index;
 	u32 num_vertices;
+	u32 base_vertex;
+
+	// quantized positions are position_offset + unorm16 * position_scale.
+	// every mesh in a model shares the same grid so edges shared between
+	// materials don't crack
+	Vec3 position_offset;
+	float position_scale;
+};
+
+struct MapMeshV2 {
+	u64 material;
+	u32 first_vertex_index;
+	u32 num_vertices;
 };
 
 struct MapData {
@@ -107,19 +174,36 @@ struct MapData {
 	Span< const MapBrush > brushes;
 	Span< const u32 > brush_indices;
 	Span< const Plane > brush_planes;
+	PlanesSoA brush_planes_soa; // not in the file, LoadMapCollisionData fills it in
 
+	MapVertexEncoding vertex_encoding;
 	Span< const MapMesh > meshes;
-	Span< const Vec3 > vertex_positions;
-	Span< const Vec3 > vertex_normals;
-	Span< const u32 > vertex_indices;
+	Span< const u8 > vertex_positions;
+	Span< const u8 > vertex_normals;
+	Span< const u8 > vertex_indices;
 };
 
+constexpr size_t MapVertexPositionSize( MapVertexEncoding encoding ) {
+	return ( encoding & MapVertexEncoding_Quantized ) != 0 ? 4 * sizeof( u16 ) : sizeof( Vec3 );
+}
+
+constexpr size_t MapVertexNormalSize( MapVertexEncoding encoding ) {
+	return ( encoding & MapVertexEncoding_Quantized ) != 0 ? 4 * sizeof( s8 ) : sizeof( Vec3 );
+}
+
+constexpr size_t MapVertexIndexSize( MapVertexEncoding encoding ) {
+	return ( encoding & MapVertexEncoding_U16Indices ) != 0 ? sizeof( u16 ) : sizeof( u32 );
+}
+
 enum DecodeMapResult {
 	DecodeMapResult_Ok,
 	DecodeMapResult_NotAMap,
 	DecodeMapResult_WrongFormatVersion,
 };
 
-DecodeMapResult DecodeMap( MapData * map, Span< const u8 > data );
+// sections not in section_mask are left empty. compressed sections get
+// decompressed into a single allocation from a, which is returned in
+// decompressed and must outlive map
+DecodeMapResult DecodeMap( MapData * map, Span< const u8 > data, u32 section_mask, Allocator * a, Span< u8 > * decompressed );
 
 Span< const char > GetWorldspawnKey( const MapData * map, const char * key );
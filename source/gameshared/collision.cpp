@@ -19,10 +19,119 @@ CollisionModel CollisionModelAABB( const MinMax3 & aabb ) {
 	};
 }
 
+static PlanesSoA MakePlanesSoA( Allocator * a, Span< const Plane > planes ) {
+	size_t n = planes.n + PLANES_SOA_PADDING;
+	float * soa = AllocMany< float >( a, n * 4 );
+	memset( soa, 0, n * 4 * sizeof( float ) );
+
+	for( size_t i = 0; i < planes.n; i++ ) {
+		soa[ i ] = planes[ i ].normal.x;
+		soa[ i + n ] = planes[ i ].normal.y;
+		soa[ i + n * 2 ] = planes[ i ].normal.z;
+		soa[ i + n * 3 ] = planes[ i ].distance;
+	}
+
+	return PlanesSoA {
+		.normal_x = soa,
+		.normal_y = soa + n,
+		.normal_z = soa + n * 2,
+		.distance = soa + n * 3,
+	};
+}
+
+static void DeletePlanesSoA( Allocator * a, PlanesSoA soa ) {
+	Free( a, const_cast< float * >( soa.normal_x ) );
+}
+
 static void DeleteGLTFCollisionData( GLTFCollisionData data ) {
-	Free( sys_allocator, data.vertices.ptr );
-	Free( sys_allocator, data.planes.ptr );
-	Free( sys_allocator, data.brushes.ptr );
+	if( data.borrowed )
+		return;
+
+	Free( sys_allocator, const_cast< Vec3 * >( data.vertices.ptr ) );
+	Free( sys_allocator, const_cast< Plane * >( data.planes.ptr ) );
+	DeletePlanesSoA( sys_allocator, data.planes_soa );
+	Free( sys_allocator, const_cast< GLTFCollisionBrush * >( data.brushes.ptr ) );
+	Free( sys_allocator, const_cast< GLTFCollisionBVHNode * >( data.bvh.ptr ) );
+	Free( sys_allocator, const_cast< u32 * >( data.bvh_brushes.ptr ) );
+}
+
+/*
+ * gltf collision BVH
+ *
+ * top down, splitting brushes at the middle of their centers along the
+ * longest axis. props only have tens to hundreds of brushes so this is
+ * plenty, and it's fast enough to build at load time
+ */
+
+static constexpr u32 GLTF_BVH_MAX_LEAF_BRUSHES = 2;
+static constexpr u32 GLTF_BVH_MAX_MIDDLE_SPLIT_DEPTH = 24; // then split in half so traces don't overflow their stack
+
+static u32 BuildGLTFCollisionBVH( NonRAIIDynamicArray< GLTFCollisionBVHNode > * nodes, Span< u32 > brushes, u32 first_brush, Span< const MinMax3 > brush_bounds, u32 depth ) {
+	u32 node_idx = checked_cast< u32 >( nodes->add( { } ) );
+
+	MinMax3 bounds = MinMax3::Empty();
+	MinMax3 centers = MinMax3::Empty();
+	for( u32 brush : brushes ) {
+		bounds = Union( bounds, brush_bounds[ brush ] );
+		centers = Union( centers, Center( brush_bounds[ brush ] ) );
+	}
+
+	( *nodes )[ node_idx ].bounds = bounds;
+
+	if( brushes.n <= GLTF_BVH_MAX_LEAF_BRUSHES ) {
+		( *nodes )[ node_idx ].first = first_brush;
+		( *nodes )[ node_idx ].num_brushes = checked_cast< u32 >( brushes.n );
+		return node_idx;
+	}
+
+	Vec3 size = centers.maxs - centers.mins;
+	int axis = size.x > size.y ? ( size.x > size.z ? 0 : 2 ) : ( size.y > size.z ? 1 : 2 );
+	float split = Center( centers )[ axis ];
+
+	size_t num_below = 0;
+	for( size_t i = 0; i < brushes.n; i++ ) {
+		if( Center( brush_bounds[ brushes[ i ] ] )[ axis ] < split ) {
+			Swap2( &brushes[ i ], &brushes[ num_below ] );
+			num_below++;
+		}
+	}
+
+	// all the centers are in the same place, or the tree is getting too deep
+	if( num_below == 0 || num_below == brushes.n || depth >= GLTF_BVH_MAX_MIDDLE_SPLIT_DEPTH ) {
+		num_below = brushes.n / 2;
+	}
+
+	BuildGLTFCollisionBVH( nodes, brushes.slice( 0, num_below ), first_brush, brush_bounds, depth + 1 );
+	u32 second_child = BuildGLTFCollisionBVH( nodes, brushes.slice( num_below, brushes.n ), checked_cast< u32 >( first_brush + num_below ), brush_bounds, depth + 1 );
+
+	( *nodes )[ node_idx ].first = second_child;
+	( *nodes )[ node_idx ].num_brushes = 0;
+
+	return node_idx;
+}
+
+static void BuildGLTFCollisionBVH( GLTFCollisionData * data ) {
+	TracyZoneScoped;
+
+	Span< MinMax3 > brush_bounds = AllocSpan< MinMax3 >( sys_allocator, data->brushes.n );
+	defer { Free( sys_allocator, brush_bounds.ptr ); };
+
+	Span< u32 > bvh_brushes = AllocSpan< u32 >( sys_allocator, data->brushes.n );
+
+	for( size_t i = 0; i < data->brushes.n; i++ ) {
+		const GLTFCollisionBrush & brush = data->brushes[ i ];
+		brush_bounds[ i ] = MinMax3::Empty();
+		for( Vec3 vertex : data->vertices.slice( brush.first_vertex, brush.first_vertex + brush.num_vertices ) ) {
+			brush_bounds[ i ] = Union( brush_bounds[ i ], vertex );
+		}
+
+		bvh_brushes[ i ] = checked_cast< u32 >( i );
+	}
+
+	NonRAIIDynamicArray< GLTFCollisionBVHNode > nodes( sys_allocator );
+	BuildGLTFCollisionBVH( &nodes, bvh_brushes, 0, brush_bounds, 0 );
+	data->bvh = nodes.span();
+	data->bvh_brushes = bvh_brushes;
 }
 
 void InitCollisionModelStorage( CollisionModelStorage * storage ) {
@@ -35,6 +144,10 @@ void ShutdownCollisionModelStorage( CollisionModelStorage * storage ) {
 	for( size_t i = 0; i < storage->gltfs_hashtable.size(); i++ ) {
 		DeleteGLTFCollisionData( storage->gltfs[ i ] );
 	}
+
+	for( size_t i = 0; i < storage->maps_hashtable.size(); i++ ) {
+		DeleteMapSharedCollisionData( storage->maps[ i ] );
+	}
 }
 
 static bool IsConvex( GLTFCollisionData data, GLTFCollisionBrush brush ) {
@@ -205,7 +318,9 @@ bool LoadGLTFCollisionData( CollisionModelStorage * storage, const cgltf_data *
 
 	data.vertices = vertices.span();
 	data.planes = planes.span();
+	data.planes_soa = MakePlanesSoA( sys_allocator, data.planes );
 	data.brushes = brushes.span();
+	BuildGLTFCollisionBVH( &data );
 
 	for( size_t i = 0; i < data.brushes.n; i++ ) {
 		const GLTFCollisionBrush & brush = data.brushes[ i ];
@@ -221,6 +336,12 @@ bool LoadGLTFCollisionData( CollisionModelStorage * storage, const cgltf_data *
 		}
 	}
 
+	AddGLTFCollisionData( storage, name, data );
+
+	return true;
+}
+
+void AddGLTFCollisionData( CollisionModelStorage * storage, StringHash name, const GLTFCollisionData & data ) {
 	u64 idx = storage->gltfs_hashtable.size();
 	if( !storage->gltfs_hashtable.get( name.hash, &idx ) ) {
 		storage->gltfs_hashtable.add( name.hash, storage->gltfs_hashtable.size() );
@@ -230,13 +351,11 @@ bool LoadGLTFCollisionData( CollisionModelStorage * storage, const cgltf_data *
 	}
 
 	storage->gltfs[ idx ] = data;
-
-	return true;
 }
 
 static MinMax3 GLTFBounds( const GLTFCollisionData * gltf, Mat4 transform ) {
 	MinMax3 bounds = MinMax3::Empty();
-	for( Vec3 & vert : gltf->vertices ) {
+	for( Vec3 vert : gltf->vertices ) {
 		bounds = Union( bounds, ( transform * Vec4( vert, 1.0f ) ).xyz() );
 	}
 	return bounds;
@@ -273,26 +392,44 @@ static void FillMapModelsHashtable( CollisionModelStorage * storage ) {
 	}
 }
 
-void LoadMapCollisionData( CollisionModelStorage * storage, const MapData * data, StringHash base_hash ) {
+MapSharedCollisionData MakeMapSharedCollisionData( const MapData * data, StringHash base_hash ) {
+	TracyZoneScoped;
+
+	MapSharedCollisionData map;
+	map.base_hash = base_hash;
+	map.data = *data;
+	map.data.brush_planes_soa = MakePlanesSoA( sys_allocator, map.data.brush_planes );
+	return map;
+}
+
+void DeleteMapSharedCollisionData( const MapSharedCollisionData & map ) {
+	DeletePlanesSoA( sys_allocator, map.data.brush_planes_soa );
+}
+
+void AddMapCollisionData( CollisionModelStorage * storage, const MapSharedCollisionData & map ) {
 	TracyZoneScoped;
 
 	u64 idx = storage->maps_hashtable.size();
-	if( !storage->maps_hashtable.get( base_hash.hash, &idx ) ) {
-		storage->maps_hashtable.add( base_hash.hash, storage->maps_hashtable.size() );
+	if( !storage->maps_hashtable.get( map.base_hash.hash, &idx ) ) {
+		storage->maps_hashtable.add( map.base_hash.hash, storage->maps_hashtable.size() );
+	}
+	else {
+		DeleteMapSharedCollisionData( storage->maps[ idx ] );
 	}
 
 	if( idx == ARRAY_COUNT( storage->maps ) ) {
 		Fatal( "Too many maps" );
 	}
 
-	MapSharedCollisionData map;
-	map.base_hash = base_hash;
-	map.data = *data;
 	storage->maps[ idx ] = map;
 
 	FillMapModelsHashtable( storage );
 }
 
+void LoadMapCollisionData( CollisionModelStorage * storage, const MapData * data, StringHash base_hash ) {
+	AddMapCollisionData( storage, MakeMapSharedCollisionData( data, base_hash ) );
+}
+
 const MapSharedCollisionData * FindMapSharedCollisionData( const CollisionModelStorage * storage, StringHash name ) {
 	u64 idx;
 	if( !storage->maps_hashtable.get( name.hash, &idx ) )
@@ -502,6 +639,47 @@ trace_t TraceVsEnt( const CollisionModelStorage * storage, const Ray & ray, cons
 	return trace;
 }
 
+void TraceVsEntBatch( const CollisionModelStorage * storage, Span< const Ray > rays, const SyncEntityState * ent, SolidBits solid_mask, trace_t * traces ) {
+	CollisionModel collision_model = EntityCollisionModel( storage, ent );
+
+	// only map models are worth batching, everything else is a single
+	// shape and a scalar test is already cheap
+	const MapSubModelCollisionData * map_model = NULL;
+	if( collision_model.type == CollisionModelType_MapModel ) {
+		map_model = FindMapSubModelCollisionData( storage, collision_model.map_model );
+	}
+
+	if( map_model == NULL ) {
+		Shape shape = { };
+		shape.type = ShapeType_Ray;
+		for( size_t i = 0; i < rays.n; i++ ) {
+			traces[ i ] = TraceVsEnt( storage, rays[ i ], shape, ent, solid_mask );
+		}
+		return;
+	}
+
+	Assert( rays.n <= MAX_TRACE_BATCH );
+
+	Ray object_space_rays[ MAX_TRACE_BATCH ];
+	for( size_t i = 0; i < rays.n; i++ ) {
+		Vec3 object_space_origin = ( rays[ i ].origin - ent->origin ) / ent->scale;
+		Vec3 object_space_translation = ( rays[ i ].direction * rays[ i ].length ) / ent->scale;
+		object_space_rays[ i ] = MakeRayOriginDirection( object_space_origin, SafeNormalize( object_space_translation ), Length( object_space_translation ) );
+	}
+
+	const MapSharedCollisionData * map = FindMapSharedCollisionData( storage, map_model->base_hash );
+
+	bool hits[ MAX_TRACE_BATCH ];
+	Intersection intersections[ MAX_TRACE_BATCH ];
+	RaysVsMapModel( &map->data, &map->data.models[ map_model->sub_model ], Span< const Ray >( object_space_rays, rays.n ), solid_mask, hits, intersections );
+
+	Shape shape = { };
+	shape.type = ShapeType_Ray;
+	for( size_t i = 0; i < rays.n; i++ ) {
+		traces[ i ] = hits[ i ] ? MakeTrace( rays[ i ], shape, intersections[ i ], ent ) : MakeMissedTrace( rays[ i ] );
+	}
+}
+
 bool EntityOverlap( const CollisionModelStorage * storage, const SyncEntityState * ent_a, const SyncEntityState * ent_b, SolidBits solid_mask ) {
 	CollisionModel collision_model_a = EntityCollisionModel( storage, ent_a );
 	CollisionModel collision_model_b = EntityCollisionModel( storage, ent_b );
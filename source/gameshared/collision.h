@@ -16,12 +16,26 @@ struct GLTFCollisionBrush {
 	SolidBits solidity;
 };
 
+// nodes are depth first, so a node's first child is the next node
+struct GLTFCollisionBVHNode {
+	MinMax3 bounds; // object space
+	u32 first; // leaf: index into GLTFCollisionData::bvh_brushes, node: index of the second child
+	u32 num_brushes; // 0 for non-leaves
+};
+
 struct GLTFCollisionData {
 	MinMax3 bounds;
 	SolidBits broadphase_solidity;
-	Span< Vec3 > vertices;
-	Span< Plane > planes;
-	Span< GLTFCollisionBrush > brushes;
+	Span< const Vec3 > vertices;
+	Span< const Plane > planes;
+	PlanesSoA planes_soa;
+	Span< const GLTFCollisionBrush > brushes;
+
+	// empty means test every brush
+	Span< const GLTFCollisionBVHNode > bvh;
+	Span< const u32 > bvh_brushes;
+
+	bool borrowed; // points into memory owned by someone else, e.g. a collision pack
 };
 
 struct MapSubModelCollisionData {
@@ -58,11 +72,17 @@ void ShutdownCollisionModelStorage( CollisionModelStorage * storage );
 struct cgltf_data;
 bool LoadGLBBuffers( cgltf_data * data );
 bool LoadGLTFCollisionData( CollisionModelStorage * storage, const cgltf_data * gltf, Span< const char > path, StringHash name );
+void AddGLTFCollisionData( CollisionModelStorage * storage, StringHash name, const GLTFCollisionData & data );
 
 const GLTFCollisionData * FindGLTFSharedCollisionData( const CollisionModelStorage * storage, StringHash name );
 
 void LoadMapCollisionData( CollisionModelStorage * storage, const MapData * map, StringHash base_hash );
 
+// LoadMapCollisionData split in two so the expensive half can run off the main thread
+MapSharedCollisionData MakeMapSharedCollisionData( const MapData * map, StringHash base_hash );
+void DeleteMapSharedCollisionData( const MapSharedCollisionData & map );
+void AddMapCollisionData( CollisionModelStorage * storage, const MapSharedCollisionData & map );
+
 const MapSharedCollisionData * FindMapSharedCollisionData( const CollisionModelStorage * storage, StringHash name );
 const MapSubModelCollisionData * FindMapSubModelCollisionData( const CollisionModelStorage * storage, StringHash name );
 
@@ -70,8 +90,11 @@ CollisionModel EntityCollisionModel( const CollisionModelStorage * storage, cons
 MinMax3 EntityBounds( const CollisionModelStorage * storage, const SyncEntityState * ent );
 SolidBits EntitySolidity( const CollisionModelStorage * storage, const SyncEntityState * ent );
 
+constexpr size_t MAX_TRACE_BATCH = 64;
+
 trace_t MakeMissedTrace( const Ray & ray );
 trace_t TraceVsEnt( const CollisionModelStorage * storage, const Ray & ray, const Shape & shape, const SyncEntityState * ent, SolidBits solid_mask );
+void TraceVsEntBatch( const CollisionModelStorage * storage, Span< const Ray > rays, const SyncEntityState * ent, SolidBits solid_mask, trace_t * traces );
 bool EntityOverlap( const CollisionModelStorage * storage, const SyncEntityState * ent_a, const SyncEntityState * ent_b, SolidBits solid_mask );
 
 struct SpatialHashBounds {
@@ -99,3 +122,7 @@ void UnlinkEntity( SpatialHashGrid * grid, u64 entity_id );
 size_t TraverseSpatialHashGrid( const SpatialHashGrid * grid, MinMax3 bounds, int * arr, SolidBits solid_mask );
 size_t TraverseSpatialHashGrid( const SpatialHashGrid * a, const SpatialHashGrid * b, MinMax3 bounds, int * touchlist, SolidBits solid_mask );
 void ClearSpatialHashGrid( SpatialHashGrid * grid );
+
+// swept versions, for the box extents + start + ( end - start ) * t for t in [0, max_fraction]
+size_t TraverseSpatialHashGrid( const SpatialHashGrid * grid, Vec3 start, Vec3 end, MinMax3 extents, float max_fraction, int * touchlist, SolidBits solid_mask );
+bool SpatialHashPrimitiveOverlaps( const SpatialHashPrimitive * primitive, Vec3 start, Vec3 end, MinMax3 extents, float max_fraction, SolidBits solid_mask );
@@ -0,0 +1,130 @@
+#include "qcommon/base.h"
+#include "gameshared/collision_pack.h"
+
+#include <string.h>
+
+bool DecodeCollisionPack( Span< const CollisionPackModel > * models, Span< const u8 > data ) {
+	if( data.n < sizeof( CollisionPackHeader ) )
+		return false;
+
+	const CollisionPackHeader * header = align_cast< const CollisionPackHeader >( data.ptr );
+	if( memcmp( header->magic, COLLISION_PACK_MAGIC, sizeof( header->magic ) ) != 0 )
+		return false;
+
+	if( header->format_version != COLLISION_PACK_FORMAT_VERSION )
+		return false;
+
+	if( header->num_models > ( data.n - sizeof( CollisionPackHeader ) ) / sizeof( CollisionPackModel ) )
+		return false;
+
+	size_t models_size = header->num_models * sizeof( CollisionPackModel );
+	*models = ( data + sizeof( CollisionPackHeader ) ).slice( 0, models_size ).cast< const CollisionPackModel >();
+	return true;
+}
+
+const CollisionPackModel * FindCollisionPackModel( Span< const CollisionPackModel > models, StringHash name ) {
+	size_t lo = 0;
+	size_t hi = models.n;
+	while( lo < hi ) {
+		size_t mid = lo + ( hi - lo ) / 2;
+		if( models[ mid ].name == name.hash )
+			return &models[ mid ];
+
+		if( models[ mid ].name < name.hash ) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	return NULL;
+}
+
+bool CollisionPackModelHasCollision( const CollisionPackModel * model ) {
+	return model->sections[ CollisionPackSection_Brushes ].size > 0;
+}
+
+template< typename T >
+static bool DecodeCollisionPackSection( Span< const T > * span, Span< const u8 > data, const CollisionPackModel * model, CollisionPackSectionType type ) {
+	CollisionPackSection section = model->sections[ type ];
+
+	if( u64( section.offset ) + section.size > data.n )
+		return false;
+
+	if( section.offset % COLLISION_PACK_ALIGNMENT != 0 || section.size % sizeof( T ) != 0 )
+		return false;
+
+	*span = ( data + section.offset ).slice( 0, section.size ).cast< const T >();
+	return true;
+}
+
+static bool InRange( u32 first, u32 num, size_t n ) {
+	return u64( first ) + num <= n;
+}
+
+// the traces index straight into the sections, so a bad index in the pack
+// would read out of bounds
+static bool ValidateCollisionPackIndices( const GLTFCollisionData * gltf ) {
+	for( const GLTFCollisionBrush & brush : gltf->brushes ) {
+		if( !InRange( brush.first_plane, brush.num_planes, gltf->planes.n ) || !InRange( brush.first_vertex, brush.num_vertices, gltf->vertices.n ) ) {
+			return false;
+		}
+	}
+
+	for( size_t i = 0; i < gltf->bvh.n; i++ ) {
+		const GLTFCollisionBVHNode & node = gltf->bvh[ i ];
+		if( node.num_brushes > 0 ) {
+			if( !InRange( node.first, node.num_brushes, gltf->bvh_brushes.n ) )
+				return false;
+		}
+		else {
+			// nodes are depth first so the first child is the next node and
+			// the second child comes after the first child's subtree, which
+			// also means traversal can't loop
+			if( node.first <= i + 1 || node.first >= gltf->bvh.n )
+				return false;
+		}
+	}
+
+	for( u32 brush : gltf->bvh_brushes ) {
+		if( brush >= gltf->brushes.n ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool DecodeCollisionPackModel( GLTFCollisionData * gltf, Span< const u8 > data, const CollisionPackModel * model ) {
+	*gltf = { };
+	gltf->bounds = model->bounds;
+	gltf->broadphase_solidity = model->broadphase_solidity;
+	gltf->borrowed = true;
+
+	Span< const float > planes_soa;
+
+	bool ok = true;
+	ok = ok && DecodeCollisionPackSection( &gltf->vertices, data, model, CollisionPackSection_Vertices );
+	ok = ok && DecodeCollisionPackSection( &gltf->planes, data, model, CollisionPackSection_Planes );
+	ok = ok && DecodeCollisionPackSection( &planes_soa, data, model, CollisionPackSection_PlanesSoA );
+	ok = ok && DecodeCollisionPackSection( &gltf->brushes, data, model, CollisionPackSection_Brushes );
+	ok = ok && DecodeCollisionPackSection( &gltf->bvh, data, model, CollisionPackSection_BVH );
+	ok = ok && DecodeCollisionPackSection( &gltf->bvh_brushes, data, model, CollisionPackSection_BVHBrushes );
+	if( !ok )
+		return false;
+
+	// same layout as MakePlanesSoA
+	size_t n = gltf->planes.n + PLANES_SOA_PADDING;
+	if( planes_soa.n != n * 4 )
+		return false;
+
+	gltf->planes_soa = PlanesSoA {
+		.normal_x = planes_soa.ptr,
+		.normal_y = planes_soa.ptr + n,
+		.normal_z = planes_soa.ptr + n * 2,
+		.distance = planes_soa.ptr + n * 3,
+	};
+
+	return ValidateCollisionPackIndices( gltf );
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "qcommon/types.h"
+#include "gameshared/collision.h"
+
+/*
+ * precompiled collision for every .glb in base, so servers don't have to
+ * parse them all at startup. everything is laid out so GLTFCollisionData can
+ * point straight into the file. see source/tools/collisionpack
+ */
+
+enum CollisionPackSectionType {
+	CollisionPackSection_Vertices,
+	CollisionPackSection_Planes,
+	CollisionPackSection_PlanesSoA,
+	CollisionPackSection_Brushes,
+	CollisionPackSection_BVH,
+	CollisionPackSection_BVHBrushes,
+
+	CollisionPackSection_Count
+};
+
+struct CollisionPackSection {
+	u32 offset, size;
+};
+
+// models without any collision are in the pack too, with empty sections, so
+// we know not to bother parsing them
+struct CollisionPackModel {
+	u64 name; // StringHash of the path relative to base, without the extension
+	u64 source_size;
+	s64 source_modified_time;
+
+	MinMax3 bounds;
+	SolidBits broadphase_solidity;
+	CollisionPackSection sections[ CollisionPackSection_Count ];
+};
+
+// followed by num_models CollisionPackModels, sorted by name
+struct CollisionPackHeader {
+	char magic[ 8 ];
+	u64 format_version;
+	u64 num_models;
+};
+
+constexpr const char COLLISION_PACK_MAGIC[ sizeof( CollisionPackHeader::magic ) ] = "cdcoll";
+constexpr u64 COLLISION_PACK_FORMAT_VERSION = 1;
+constexpr size_t COLLISION_PACK_ALIGNMENT = 16;
+
+bool DecodeCollisionPack( Span< const CollisionPackModel > * models, Span< const u8 > data );
+const CollisionPackModel * FindCollisionPackModel( Span< const CollisionPackModel > models, StringHash name );
+bool CollisionPackModelHasCollision( const CollisionPackModel * model );
+bool DecodeCollisionPackModel( GLTFCollisionData * gltf, Span< const u8 > data, const CollisionPackModel * model );
@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "qcommon/compression.h"
 #include "qcommon/fs.h"
 #include "qcommon/serialization.h"
+#include "qcommon/threadpool.h"
 #include "gameshared/demo.h"
 
 #include "zstd/zstd.h"
@@ -43,6 +44,10 @@ static void Serialize( SerializationBuffer * buf, DemoMetadata & meta ) {
 	if( meta.metadata_version >= DemoMetadataVersion_AddDurationAndDecompressedSize ) {
 		*buf & meta.duration_seconds & meta.decompressed_size;
 	}
+
+	if( meta.metadata_version >= DemoMetadataVersion_AddSeekIndex ) {
+		*buf & meta.compressed_size & meta.num_keyframes;
+	}
 }
 
 static void FlushDemo( RecordDemoContext * ctx, bool last ) {
@@ -54,6 +59,7 @@ static void FlushDemo( RecordDemoContext * ctx, bool last ) {
 
 		if( !WritePartialFile( ctx->temp_file, out.dst, out.pos ) )
 			break;
+		ctx->compressed_size += out.pos;
 
 		bool done = last ? remaining == 0 : in.pos == in.size;
 		if( done )
@@ -89,6 +95,22 @@ void WriteDemoMessage( RecordDemoContext * ctx, msg_t msg, size_t skip ) {
 	WriteToDemo( ctx, msg.data + skip, len );
 }
 
+void AddDemoKeyframe( RecordDemoContext * ctx, s64 server_time ) {
+	// skip ending the frame when nothing was written since the last
+	// keyframe, or we write an empty frame
+	u64 frame_start = ctx->keyframes.size() == 0 ? 0 : ctx->keyframes.top().offset;
+	if( ctx->decompressed_size != frame_start ) {
+		FlushDemo( ctx, true );
+		ctx->in_buf_cursor = 0;
+	}
+
+	DemoKeyframe keyframe;
+	keyframe.server_time = server_time;
+	keyframe.offset = ctx->decompressed_size;
+	keyframe.compressed_offset = ctx->compressed_size;
+	ctx->keyframes.add( keyframe );
+}
+
 static void MaybeWriteDemoMessage( RecordDemoContext * ctx, msg_t * msg, bool force ) {
 	if( !force && msg->cursize <= msg->maxsize / 2 )
 		return;
@@ -104,10 +126,7 @@ static void CheckedZstdSetParameter( ZSTD_CCtx * zstd, ZSTD_cParameter parameter
 	}
 }
 
-bool StartRecordingDemo(
-	TempAllocator * temp, RecordDemoContext * ctx, const char * filename, unsigned int spawncount, unsigned int snapFrameTime,
-	int max_clients, const SyncEntityState * baselines
-) {
+bool StartWritingDemo( TempAllocator * temp, RecordDemoContext * ctx, const char * filename ) {
 	*ctx = { };
 
 	if( !CreatePathForFile( temp, filename ) ) {
@@ -126,7 +145,7 @@ bool StartRecordingDemo(
 	if( ctx->temp_file == NULL ) {
 		Com_Printf( S_COLOR_YELLOW "Can't open %s for writing\n", ctx->temp_filename );
 		CloseFile( ctx->file );
-		Free( sys_allocator, ctx->temp_file );
+		Free( sys_allocator, ctx->temp_filename );
 		return false;
 	}
 	ctx->filename = CopyString( sys_allocator, filename );
@@ -143,6 +162,18 @@ bool StartRecordingDemo(
 	ctx->out_buf_capacity = ZSTD_CStreamOutSize();
 	ctx->out_buf = sys_allocator->allocate( ctx->out_buf_capacity, 16 );
 
+	ctx->keyframes.init( sys_allocator );
+
+	return true;
+}
+
+bool StartRecordingDemo(
+	TempAllocator * temp, RecordDemoContext * ctx, const char * filename, unsigned int spawncount, unsigned int snapFrameTime,
+	int max_clients, const SyncEntityState * baselines
+) {
+	if( !StartWritingDemo( temp, ctx, filename ) )
+		return false;
+
 	uint8_t msg_buffer[MAX_MSGLEN];
 	msg_t msg = NewMSGWriter( msg_buffer, sizeof( msg_buffer ) );
 
@@ -204,6 +235,7 @@ void StopRecordingDemo( TempAllocator * temp, RecordDemoContext * ctx, const Dem
 		ZSTD_freeCCtx( ctx->zstd );
 		Free( sys_allocator, ctx->in_buf );
 		Free( sys_allocator, ctx->out_buf );
+		ctx->keyframes.shutdown();
 	};
 
 	if( ferror( ctx->temp_file ) ) {
@@ -211,9 +243,13 @@ void StopRecordingDemo( TempAllocator * temp, RecordDemoContext * ctx, const Dem
 		return;
 	}
 
+	DemoMetadata full_metadata = metadata;
+	full_metadata.compressed_size = ctx->compressed_size;
+	full_metadata.num_keyframes = ctx->keyframes.size();
+
 	// serialise metadata to demo file
 	DynamicArray< u8 > serialised_metadata( temp );
-	Serialize( metadata, &serialised_metadata );
+	Serialize( full_metadata, &serialised_metadata );
 
 	DemoHeader header;
 	memcpy( &header.magic, DEMO_METADATA_MAGIC, sizeof( DEMO_METADATA_MAGIC ) );
@@ -232,6 +268,9 @@ void StopRecordingDemo( TempAllocator * temp, RecordDemoContext * ctx, const Dem
 
 		ok = ok && WritePartialFile( ctx->file, buf, r );
 	}
+
+	// and the seek index goes at the end
+	ok = ok && WritePartialFile( ctx->file, ctx->keyframes.ptr(), ctx->keyframes.num_bytes() );
 }
 
 static Optional< DemoHeader > ReadDemoHeader( Span< const u8 > demo ) {
@@ -266,8 +305,16 @@ bool DecompressDemo( Allocator * a, const DemoMetadata & metadata, Span< u8 > *
 	Optional< DemoHeader > header = ReadDemoHeader( demo );
 	Assert( header.exists );
 
-	*decompressed = AllocSpan< u8 >( a, metadata.decompressed_size );
 	Span< const u8 > compressed = demo.slice( sizeof( DemoHeader ) + header.value.metadata_size, demo.n );
+	if( metadata.metadata_version >= DemoMetadataVersion_AddSeekIndex ) {
+		if( compressed.n < metadata.compressed_size ) {
+			Com_Printf( S_COLOR_RED "Demo is truncated\n" );
+			return false;
+		}
+		compressed = compressed.slice( 0, metadata.compressed_size );
+	}
+
+	*decompressed = AllocSpan< u8 >( a, metadata.decompressed_size );
 
 	size_t r = ZSTD_decompress( decompressed->ptr, decompressed->n, compressed.ptr, compressed.n );
 	if( r != decompressed->n ) {
@@ -278,3 +325,310 @@ bool DecompressDemo( Allocator * a, const DemoMetadata & metadata, Span< u8 > *
 
 	return true;
 }
+
+Optional< DemoKeyframe > FindDemoKeyframe( Span< const DemoKeyframe > keyframes, s64 server_time ) {
+	// find the last keyframe at or before server_time
+	size_t lo = 0;
+	size_t hi = keyframes.n;
+	while( lo < hi ) {
+		size_t mid = lo + ( hi - lo ) / 2;
+		if( keyframes[ mid ].server_time <= server_time ) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	if( lo == 0 )
+		return NONE;
+	return keyframes[ lo - 1 ];
+}
+
+static constexpr size_t DEMO_STREAM_CHUNK_SIZE = 256 * 1024;
+
+struct DemoStreamChunk {
+	u8 * data;
+	size_t n;
+	bool last;
+	const char * error;
+};
+
+struct DemoStream {
+	FILE * file;
+	u64 compressed_start;
+	u64 compressed_size;
+	u64 compressed_cursor;
+
+	ZSTD_DCtx * zstd;
+	void * in_buf;
+	size_t in_buf_capacity;
+	ZSTD_inBuffer in;
+	bool finished;
+
+	// the read ahead job fills chunks[ current ^ 1 ]
+	DemoStreamChunk chunks[ 2 ];
+	size_t current;
+	size_t cursor;
+	u64 chunk_offset; // of chunks[ current ] in the decompressed demo
+	JobCounter read_ahead;
+
+	u8 msg_buf[ U16_MAX ];
+};
+
+static void DecompressChunk( DemoStream * stream, DemoStreamChunk * chunk ) {
+	TracyZoneScoped;
+
+	chunk->n = 0;
+	chunk->error = NULL;
+
+	ZSTD_outBuffer out = { chunk->data, DEMO_STREAM_CHUNK_SIZE };
+	while( !stream->finished && out.pos < out.size ) {
+		if( stream->in.pos == stream->in.size && stream->compressed_cursor < stream->compressed_size ) {
+			size_t to_read = Min2( stream->in_buf_capacity, size_t( stream->compressed_size - stream->compressed_cursor ) );
+			size_t r;
+			if( !ReadPartialFile( stream->file, stream->in_buf, to_read, &r ) || r != to_read ) {
+				chunk->error = "Demo is truncated";
+				break;
+			}
+			stream->compressed_cursor += r;
+			stream->in = { stream->in_buf, r };
+		}
+
+		size_t old_out_pos = out.pos;
+		size_t r = ZSTD_decompressStream( stream->zstd, &out, &stream->in );
+		if( ZSTD_isError( r ) ) {
+			chunk->error = ZSTD_getErrorName( r );
+			break;
+		}
+
+		bool out_of_input = stream->in.pos == stream->in.size && stream->compressed_cursor == stream->compressed_size;
+		if( out_of_input ) {
+			if( r == 0 ) {
+				stream->finished = true;
+			}
+			else if( out.pos == old_out_pos ) {
+				chunk->error = "Demo is truncated";
+				break;
+			}
+		}
+	}
+
+	chunk->n = out.pos;
+	chunk->last = stream->finished || chunk->error != NULL;
+}
+
+static void ReadAheadJob( TempAllocator * temp, void * data ) {
+	DemoStream * stream = ( DemoStream * ) data;
+	DecompressChunk( stream, &stream->chunks[ stream->current ^ 1 ] );
+}
+
+static void StartReadAhead( DemoStream * stream ) {
+	if( !stream->chunks[ stream->current ].last ) {
+		ThreadPoolDo( ReadAheadJob, stream, &stream->read_ahead );
+	}
+}
+
+// compressed_offset has to be the start of a zstd frame, and offset where
+// that frame starts in the decompressed demo
+static void RestartDemoStream( DemoStream * stream, u64 compressed_offset, u64 offset ) {
+	ThreadPoolWait( &stream->read_ahead );
+
+	ZSTD_DCtx_reset( stream->zstd, ZSTD_reset_session_only );
+	Seek( stream->file, stream->compressed_start + compressed_offset );
+	stream->compressed_cursor = compressed_offset;
+	stream->in = { stream->in_buf, 0 };
+	stream->finished = false;
+
+	stream->current = 0;
+	stream->cursor = 0;
+	stream->chunk_offset = offset;
+	DecompressChunk( stream, &stream->chunks[ 0 ] );
+	StartReadAhead( stream );
+}
+
+static bool NextChunk( DemoStream * stream ) {
+	const DemoStreamChunk * chunk = &stream->chunks[ stream->current ];
+	if( chunk->error != NULL ) {
+		Com_Printf( S_COLOR_RED "Can't decompress demo: %s\n", chunk->error );
+		return false;
+	}
+	if( chunk->last )
+		return false;
+
+	ThreadPoolWait( &stream->read_ahead );
+
+	stream->chunk_offset += chunk->n;
+	stream->current ^= 1;
+	stream->cursor = 0;
+	StartReadAhead( stream );
+
+	return true;
+}
+
+static bool ReadDemoStream( DemoStream * stream, void * data, size_t n ) {
+	u8 * cursor = ( u8 * ) data;
+	while( n > 0 ) {
+		const DemoStreamChunk * chunk = &stream->chunks[ stream->current ];
+		if( stream->cursor == chunk->n ) {
+			if( !NextChunk( stream ) )
+				return false;
+			continue;
+		}
+
+		size_t to_copy = Min2( n, chunk->n - stream->cursor );
+		memcpy( cursor, chunk->data + stream->cursor, to_copy );
+		stream->cursor += to_copy;
+		cursor += to_copy;
+		n -= to_copy;
+	}
+
+	return true;
+}
+
+static bool ReadDemoStreamMetadata( Allocator * a, FILE * file, size_t file_size, DemoMetadata * metadata, u64 * metadata_size ) {
+	DemoHeader header;
+	size_t r;
+	if( !ReadPartialFile( file, &header, sizeof( header ), &r ) || r != sizeof( header ) )
+		return false;
+	if( header.metadata_size > file_size - sizeof( header ) )
+		return false;
+
+	Span< u8 > header_and_metadata = AllocSpan< u8 >( a, sizeof( header ) + header.metadata_size );
+	defer { Free( a, header_and_metadata.ptr ); };
+
+	memcpy( header_and_metadata.ptr, &header, sizeof( header ) );
+	if( !ReadPartialFile( file, header_and_metadata.ptr + sizeof( header ), header.metadata_size, &r ) || r != header.metadata_size )
+		return false;
+
+	*metadata_size = header.metadata_size;
+	return ReadDemoMetadata( a, metadata, header_and_metadata );
+}
+
+static bool ReadDemoSeekIndex( Allocator * a, FILE * file, size_t file_size, u64 index_offset, const DemoMetadata & metadata, Span< DemoKeyframe > * keyframes ) {
+	*keyframes = Span< DemoKeyframe >();
+	if( metadata.metadata_version < DemoMetadataVersion_AddSeekIndex || metadata.num_keyframes == 0 )
+		return true;
+
+	if( index_offset > file_size || metadata.num_keyframes > ( file_size - index_offset ) / sizeof( DemoKeyframe ) )
+		return false;
+
+	Span< DemoKeyframe > index = AllocSpan< DemoKeyframe >( a, metadata.num_keyframes );
+	size_t r;
+	Seek( file, index_offset );
+	bool ok = ReadPartialFile( file, index.ptr, index.num_bytes(), &r ) && r == index.num_bytes();
+
+	for( size_t i = 0; ok && i < index.n; i++ ) {
+		ok = index[ i ].offset < metadata.decompressed_size;
+		ok = ok && index[ i ].compressed_offset < metadata.compressed_size;
+		ok = ok && ( i == 0 || index[ i ].server_time >= index[ i - 1 ].server_time );
+	}
+
+	if( !ok ) {
+		Free( a, index.ptr );
+		return false;
+	}
+
+	*keyframes = index;
+	return true;
+}
+
+DemoStream * OpenDemoStream( Allocator * a, const char * filename, DemoMetadata * metadata, Span< DemoKeyframe > * keyframes ) {
+	TracyZoneScoped;
+
+	*metadata = { };
+	*keyframes = Span< DemoKeyframe >();
+
+	FILE * file = OpenFile( a, filename, OpenFile_Read );
+	if( file == NULL ) {
+		Com_Printf( S_COLOR_YELLOW "%s doesn't exist\n", filename );
+		return NULL;
+	}
+
+	size_t file_size = FileSize( file );
+	u64 metadata_size;
+	if( !ReadDemoStreamMetadata( a, file, file_size, metadata, &metadata_size ) ) {
+		Com_Printf( S_COLOR_YELLOW "Demo is corrupt\n" );
+		Free( a, metadata->game_version.ptr );
+		Free( a, metadata->server.ptr );
+		Free( a, metadata->map.ptr );
+		*metadata = { };
+		CloseFile( file );
+		return NULL;
+	}
+
+	DemoStream * stream = Alloc< DemoStream >( a );
+	stream->file = file;
+	stream->read_ahead.pending = 0;
+	stream->read_ahead.dependents = NULL;
+	stream->compressed_start = sizeof( DemoHeader ) + metadata_size;
+	if( metadata->metadata_version >= DemoMetadataVersion_AddSeekIndex ) {
+		stream->compressed_size = Min2( metadata->compressed_size, u64( file_size - stream->compressed_start ) );
+
+		if( !ReadDemoSeekIndex( a, file, file_size, stream->compressed_start + metadata->compressed_size, *metadata, keyframes ) ) {
+			Com_Printf( S_COLOR_YELLOW "Demo has a corrupt seek index, seeking will be slow\n" );
+		}
+	}
+	else {
+		stream->compressed_size = file_size - stream->compressed_start;
+	}
+
+	stream->zstd = ZSTD_createDCtx();
+	if( stream->zstd == NULL ) {
+		Fatal( "ZSTD_createDCtx" );
+	}
+
+	stream->in_buf_capacity = ZSTD_DStreamInSize();
+	stream->in_buf = a->allocate( stream->in_buf_capacity, 16 );
+	for( DemoStreamChunk & chunk : stream->chunks ) {
+		chunk.data = AllocMany< u8 >( a, DEMO_STREAM_CHUNK_SIZE );
+	}
+
+	RestartDemoStream( stream, 0, 0 );
+
+	return stream;
+}
+
+void CloseDemoStream( Allocator * a, DemoStream * stream ) {
+	if( stream == NULL )
+		return;
+
+	ThreadPoolWait( &stream->read_ahead );
+
+	CloseFile( stream->file );
+	ZSTD_freeDCtx( stream->zstd );
+	Free( a, stream->in_buf );
+	for( DemoStreamChunk & chunk : stream->chunks ) {
+		Free( a, chunk.data );
+	}
+	Free( a, stream );
+}
+
+msg_t ReadDemoMessage( DemoStream * stream ) {
+	u16 len;
+	if( !ReadDemoStream( stream, &len, sizeof( len ) ) )
+		return { };
+	if( !ReadDemoStream( stream, stream->msg_buf, len ) )
+		return { };
+	return NewMSGReader( stream->msg_buf, len, len );
+}
+
+void SeekDemoStream( DemoStream * stream, const DemoKeyframe & keyframe ) {
+	TracyZoneScoped;
+
+	u64 offset = keyframe.offset;
+	bool in_current_chunk = offset >= stream->chunk_offset && offset < stream->chunk_offset + stream->chunks[ stream->current ].n;
+	if( !in_current_chunk ) {
+		RestartDemoStream( stream, keyframe.compressed_offset, offset );
+	}
+
+	while( offset >= stream->chunk_offset + stream->chunks[ stream->current ].n ) {
+		if( !NextChunk( stream ) ) {
+			// the next read fails
+			stream->cursor = stream->chunks[ stream->current ].n;
+			return;
+		}
+	}
+
+	stream->cursor = offset - stream->chunk_offset;
+}
@@ -1,10 +1,25 @@
 #pragma once
 
 #include "qcommon/types.h"
+#include "qcommon/array.h"
 
 struct ZSTD_CCtx_s;
 struct SyncEntityState;
 
+/*
+ * recorders write a nodelta snapshot every DEMO_KEYFRAME_INTERVAL ms, and
+ * demos end with an index of where those are so playback can jump to the
+ * nearest one instead of replaying everything from the start. each keyframe
+ * also starts a new zstd frame, so we can start decompressing there too
+ */
+constexpr s64 DEMO_KEYFRAME_INTERVAL = 10000;
+
+struct DemoKeyframe {
+	s64 server_time;
+	u64 offset; // into the decompressed demo, at the start of a message
+	u64 compressed_offset; // into the zstd stream, at the start of a frame
+};
+
 struct RecordDemoContext {
 	char * filename;
 	FILE * file;
@@ -12,6 +27,9 @@ struct RecordDemoContext {
 	FILE * temp_file;
 
 	size_t decompressed_size;
+	size_t compressed_size;
+
+	NonRAIIDynamicArray< DemoKeyframe > keyframes;
 
 	ZSTD_CCtx_s * zstd;
 
@@ -30,21 +48,49 @@ struct DemoMetadata {
 	s64 utc_time;
 	u64 duration_seconds;
 	u64 decompressed_size;
+	u64 compressed_size;
+	u64 num_keyframes;
 };
 
 enum DemoMetadataVersions : u32 {
 	DemoMetadataVersion_Initial = 1,
 	DemoMetadataVersion_AddDurationAndDecompressedSize,
+	DemoMetadataVersion_AddSeekIndex,
 
 	DemoMetadataVersion_Count
 };
 
 constexpr u32 DEMO_METADATA_VERSION = DemoMetadataVersion_Count - 1;
 
+// opens the demo without writing anything, for tools that copy messages from another demo
+bool StartWritingDemo( TempAllocator * temp, RecordDemoContext * ctx, const char * filename );
 bool StartRecordingDemo( TempAllocator * temp, RecordDemoContext * ctx, const char * filename, unsigned int spawncount, unsigned int snapFrameTime,
 	int max_clients, const SyncEntityState * baselines );
 void WriteDemoMessage( RecordDemoContext * ctx, msg_t msg, size_t skip = 0 );
+// call before writing the message that contains the nodelta snapshot. ends
+// the current zstd frame, so it's not free
+void AddDemoKeyframe( RecordDemoContext * ctx, s64 server_time );
 void StopRecordingDemo( TempAllocator * temp, RecordDemoContext * ctx, const DemoMetadata & metadata );
 
 bool ReadDemoMetadata( Allocator * a, DemoMetadata * metadata, Span< const u8 > contents );
 bool DecompressDemo( Allocator * a, const DemoMetadata & metadata, Span< u8 > * decompressed, Span< const u8 > demo );
+
+Optional< DemoKeyframe > FindDemoKeyframe( Span< const DemoKeyframe > keyframes, s64 server_time );
+
+/*
+ * plays demos straight off disk. the stream decompresses a chunk at a time
+ * on the thread pool, one chunk ahead of whoever is reading, so opening a
+ * demo doesn't wait for the whole thing and memory use doesn't grow with
+ * its length
+ */
+struct DemoStream;
+
+// keyframes is empty for demos from before keyframes, or with a corrupt index
+DemoStream * OpenDemoStream( Allocator * a, const char * filename, DemoMetadata * metadata, Span< DemoKeyframe > * keyframes );
+void CloseDemoStream( Allocator * a, DemoStream * stream );
+
+// returns a msg with NULL data at the end of the demo, or if it's corrupt.
+// the msg is only valid until the next read
+msg_t ReadDemoMessage( DemoStream * stream );
+// DemoKeyframe { } is the start of the demo
+void SeekDemoStream( DemoStream * stream, const DemoKeyframe & keyframe );
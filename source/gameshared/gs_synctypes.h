@@ -346,6 +346,10 @@ struct EntityID {
 	u64 id;
 };
 
+// the precision of quantized fields is noted next to them, everything else is
+// sent exactly. keep these powers of two so quantizing is idempotent
+constexpr float SYNC_POSITION_PRECISION = 1.0f / 16.0f;
+
 struct SyncEntityState {
 	int number;
 	EntityID id;
@@ -354,9 +358,9 @@ struct SyncEntityState {
 
 	EntityType type;
 
-	Vec3 origin;
-	Vec3 angles;
-	Vec3 origin2; // velocity for players/corpses. often used for endpoints, e.g. ET_BEAM and some events
+	Vec3 origin; // SYNC_POSITION_PRECISION
+	Vec3 angles; // 16 bits per component
+	Vec3 origin2; // velocity for players/corpses. often used for endpoints, e.g. ET_BEAM and some events. exact because it's also used for directions
 
 	StringHash model;
 	StringHash model2;
@@ -388,8 +392,8 @@ struct SyncEntityState {
 
 	bool linearMovement;
 	Vec3 linearMovementVelocity;
-	Vec3 linearMovementEnd;
-	Vec3 linearMovementBegin;
+	Vec3 linearMovementEnd; // SYNC_POSITION_PRECISION
+	Vec3 linearMovementBegin; // SYNC_POSITION_PRECISION
 	unsigned int linearMovementDuration;
 	int64_t linearMovementTimeStamp;
 	int linearMovementTimeDelta;
@@ -408,8 +412,8 @@ struct SyncEntityState {
 struct pmove_state_t {
 	int pm_type;
 
-	Vec3 origin;
-	Vec3 velocity;
+	Vec3 origin; // exact so prediction matches the server
+	Vec3 velocity; // exact
 	short delta_angles[3];      // add to command angles to get view direction
 	                            // changed by spawns, rotating objects, and teleporters
 
@@ -443,7 +447,7 @@ struct TouchInfo {
 struct SyncPlayerState {
 	pmove_state_t pmove;
 
-	Vec3 viewangles;
+	Vec3 viewangles; // 16 bits per component
 
 	SyncEvent events[ 2 ];
 	unsigned int POVnum;        // entity number of the player in POV
@@ -24,8 +24,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "gameshared/gs_public.h"
 #include "gameshared/gs_weapons.h"
 
+Vec3 GS_BulletEnd( Vec3 start, Vec3 dir, Vec3 right, Vec3 up, Vec2 spread, int range ) {
+	return start + dir * range + right * spread.x + up * spread.y;
+}
+
 void GS_TraceBullet( const gs_state_t * gs, trace_t * trace, trace_t * wallbang_trace, Vec3 start, Vec3 dir, Vec3 right, Vec3 up, Vec2 spread, int range, int ignore, int timeDelta ) {
-	Vec3 end = start + dir * range + right * spread.x + up * spread.y;
+	Vec3 end = GS_BulletEnd( start, dir, right, up, spread, range );
 
 	*trace = gs->api.Trace( start, MinMax3( 0.0f ), end, ignore, SolidMask_WallbangShot, timeDelta );
 
@@ -91,6 +91,7 @@ const PerkDef * GetPerkDef( PerkType perk );
 WeaponSlot * GS_FindWeapon( SyncPlayerState * player, WeaponType weapon );
 const WeaponSlot * GS_FindWeapon( const SyncPlayerState * player, WeaponType weapon );
 
+Vec3 GS_BulletEnd( Vec3 start, Vec3 dir, Vec3 right, Vec3 up, Vec2 spread, int range );
 void GS_TraceBullet( const gs_state_t * gs, trace_t * trace, trace_t * wallbang_trace, Vec3 start, Vec3 dir, Vec3 right, Vec3 up, Vec2 spread, int range, int ignore, int timeDelta );
 Vec2 RandomSpreadPattern( u16 entropy, float spread );
 float ZoomSpreadness( s16 zoom_time, const WeaponDef * def );
@@ -5,6 +5,10 @@
 #include "gameshared/q_shared.h"
 #include "gameshared/collision.h"
 
+#if !__arm64__
+#include <immintrin.h>
+#endif
+
 Ray MakeRayOriginDirection( Vec3 origin, Vec3 direction, float length ) {
 	Ray ray;
 	ray.origin = origin;
@@ -227,6 +231,186 @@ static float AxialSupport( const Shape & shape, int axis, bool positive ) {
 	return 0;
 }
 
+/*
+ * SoA plane clipping
+ *
+ * clips the ray against 4 brush planes at a time. the planes are all
+ * independent so we can take the max of the entering ts and the min of the
+ * leaving ts at the end and get the same answer as doing them in order, as
+ * long as ties go to the earliest plane. everything else is the same float
+ * ops in the same order as the scalar code so clients and servers with and
+ * without SSE agree on pmove results
+ */
+
+#if !__arm64__
+
+static __m128 Blend( __m128 a, __m128 b, __m128 mask ) {
+	return _mm_blendv_ps( a, b, mask );
+}
+
+static __m128i Blend( __m128i a, __m128i b, __m128 mask ) {
+	return _mm_blendv_epi8( a, b, _mm_castps_si128( mask ) );
+}
+
+static bool Any( __m128 mask ) {
+	return _mm_movemask_ps( mask ) != 0;
+}
+
+static __m128 Not( __m128 mask ) {
+	return _mm_xor_ps( mask, _mm_castsi128_ps( _mm_set1_epi32( -1 ) ) );
+}
+
+static __m128 Abs( __m128 x ) {
+	return _mm_andnot_ps( _mm_set1_ps( -0.0f ), x );
+}
+
+static __m128 Dot( __m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz ) {
+	return _mm_add_ps( _mm_add_ps( _mm_mul_ps( ax, bx ), _mm_mul_ps( ay, by ) ), _mm_mul_ps( az, bz ) );
+}
+
+static __m128 Dot( __m128 ax, __m128 ay, __m128 az, Vec3 b ) {
+	return Dot( ax, ay, az, _mm_set1_ps( b.x ), _mm_set1_ps( b.y ), _mm_set1_ps( b.z ) );
+}
+
+// Support( shape, dir ) for 4 directions
+static __m128 SupportSoA( const Shape & shape, __m128 dx, __m128 dy, __m128 dz ) {
+	switch( shape.type ) {
+		case ShapeType_Ray:
+			return _mm_setzero_ps();
+
+		case ShapeType_AABB: {
+			const CenterExtents3 & aabb = shape.aabb;
+			__m128 rx = Abs( _mm_mul_ps( _mm_set1_ps( aabb.extents.x ), dx ) );
+			__m128 ry = Abs( _mm_mul_ps( _mm_set1_ps( aabb.extents.y ), dy ) );
+			__m128 rz = Abs( _mm_mul_ps( _mm_set1_ps( aabb.extents.z ), dz ) );
+			__m128 radius = _mm_add_ps( _mm_add_ps( rx, ry ), rz );
+			return _mm_add_ps( radius, Dot( dx, dy, dz, aabb.center ) );
+		}
+
+		case ShapeType_Sphere:
+			return _mm_sub_ps( _mm_set1_ps( shape.sphere.radius ), Dot( dx, dy, dz, shape.sphere.center ) );
+
+		// brush sweeps never use capsules, same as Support
+		default:
+			Assert( false );
+			break;
+	}
+
+	return _mm_setzero_ps();
+}
+
+struct PlaneClipper {
+	__m128 enter_t;
+	__m128i enter_plane;
+	__m128 leave_t;
+	float initial_enter_t;
+};
+
+static PlaneClipper MakePlaneClipper( float enter_t, float leave_t ) {
+	return PlaneClipper {
+		.enter_t = _mm_set1_ps( enter_t ),
+		.enter_plane = _mm_set1_epi32( -1 ),
+		.leave_t = _mm_set1_ps( leave_t ),
+		.initial_enter_t = enter_t,
+	};
+}
+
+// returns false if the ray starts outside a plane it's moving parallel to
+static bool ClipPlanesSoA( PlaneClipper * clipper, const Ray & ray, const Shape & shape, __m128 nx, __m128 ny, __m128 nz, __m128 distance, __m128 valid, __m128i plane_indices ) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 negate = _mm_set1_ps( -0.0f );
+
+	distance = _mm_add_ps( distance, SupportSoA( shape, _mm_xor_ps( nx, negate ), _mm_xor_ps( ny, negate ), _mm_xor_ps( nz, negate ) ) );
+
+	__m128 dist = _mm_sub_ps( distance, Dot( nx, ny, nz, ray.origin ) );
+	__m128 denom = Dot( nx, ny, nz, ray.direction );
+
+	__m128 parallel = _mm_cmpeq_ps( denom, zero );
+	if( Any( _mm_and_ps( _mm_and_ps( valid, parallel ), _mm_cmplt_ps( dist, zero ) ) ) )
+		return false;
+
+	__m128 t = _mm_div_ps( dist, Blend( denom, _mm_set1_ps( 1.0f ), parallel ) );
+	__m128 moving = _mm_andnot_ps( parallel, valid );
+	__m128 entering = _mm_cmplt_ps( denom, zero );
+
+	__m128 update_enter = _mm_and_ps( _mm_and_ps( moving, entering ), _mm_cmpgt_ps( t, clipper->enter_t ) );
+	clipper->enter_t = Blend( clipper->enter_t, t, update_enter );
+	clipper->enter_plane = Blend( clipper->enter_plane, plane_indices, update_enter );
+
+	__m128 update_leave = _mm_and_ps( _mm_andnot_ps( entering, moving ), _mm_cmplt_ps( t, clipper->leave_t ) );
+	clipper->leave_t = Blend( clipper->leave_t, t, update_leave );
+
+	return true;
+}
+
+// returns false if the ray misses, otherwise the entering t and the index of
+// the plane it entered through, or -1 if it didn't get past the initial enter_t
+static bool FinishClipPlanes( const PlaneClipper & clipper, float * enter_t, s32 * enter_plane, float * leave_t ) {
+	alignas( 16 ) float enters[ 4 ];
+	alignas( 16 ) s32 planes[ 4 ];
+	alignas( 16 ) float leaves[ 4 ];
+	_mm_store_ps( enters, clipper.enter_t );
+	_mm_store_si128( ( __m128i * ) planes, clipper.enter_plane );
+	_mm_store_ps( leaves, clipper.leave_t );
+
+	float enter = enters[ 0 ];
+	float leave = leaves[ 0 ];
+	for( int i = 1; i < 4; i++ ) {
+		enter = Max2( enter, enters[ i ] );
+		leave = Min2( leave, leaves[ i ] );
+	}
+
+	if( enter > leave )
+		return false;
+
+	s32 plane = -1;
+	if( enter != clipper.initial_enter_t ) {
+		for( int i = 0; i < 4; i++ ) {
+			if( enters[ i ] == enter && ( plane == -1 || planes[ i ] < plane ) ) {
+				plane = planes[ i ];
+			}
+		}
+	}
+
+	*enter_t = enter;
+	*enter_plane = plane;
+	*leave_t = leave;
+	return true;
+}
+
+static bool SweptShapeVsMapBrushSoA( const MapData * map, const MapBrush * brush, const Ray & ray, const Shape & shape, Intersection enter, Intersection leave, Intersection * intersection ) {
+	const PlanesSoA & planes = map->brush_planes_soa;
+	PlaneClipper clipper = MakePlaneClipper( enter.t, leave.t );
+
+	for( u32 i = 0; i < brush->num_planes; i += 4 ) {
+		u32 first = brush->first_plane + i;
+		__m128i indices = _mm_add_epi32( _mm_set1_epi32( i ), _mm_set_epi32( 3, 2, 1, 0 ) );
+		__m128 valid = _mm_castsi128_ps( _mm_cmplt_epi32( indices, _mm_set1_epi32( brush->num_planes ) ) );
+
+		__m128 nx = _mm_loadu_ps( planes.normal_x + first );
+		__m128 ny = _mm_loadu_ps( planes.normal_y + first );
+		__m128 nz = _mm_loadu_ps( planes.normal_z + first );
+		__m128 distance = _mm_loadu_ps( planes.distance + first );
+
+		if( !ClipPlanesSoA( &clipper, ray, shape, nx, ny, nz, distance, valid, indices ) )
+			return false;
+	}
+
+	s32 enter_plane;
+	if( !FinishClipPlanes( clipper, &enter.t, &enter_plane, &leave.t ) )
+		return false;
+
+	if( enter_plane != -1 ) {
+		enter.normal = map->brush_planes[ brush->first_plane + enter_plane ].normal;
+	}
+
+	enter.solidity = brush->solidity;
+	*intersection = enter;
+	return true;
+}
+
+#endif
+
 static bool SweptShapeVsMapBrush( const MapData * map, const MapBrush * brush, Ray ray, const Shape & shape, SolidBits solid_mask, Intersection * intersection ) {
 	if( ( brush->solidity & solid_mask ) == 0 )
 		return false;
@@ -235,6 +419,9 @@ static bool SweptShapeVsMapBrush( const MapData * map, const MapBrush * brush, R
 	if( !RayVsAABB( ray, MinkowskiSum( brush->bounds, shape ), &enter, &leave ) )
 		return false;
 
+#if !__arm64__
+	return SweptShapeVsMapBrushSoA( map, brush, ray, shape, enter, leave, intersection );
+#else
 	for( u32 i = 0; i < brush->num_planes; i++ ) {
 		Plane plane = map->brush_planes[ brush->first_plane + i ];
 		plane.distance += Support( shape, -plane.normal );
@@ -266,6 +453,7 @@ static bool SweptShapeVsMapBrush( const MapData * map, const MapBrush * brush, R
 	enter.solidity = brush->solidity;
 	*intersection = enter;
 	return true;
+#endif
 }
 
 static bool SweptShapeVsMapLeaf( const MapData * map, const MapKDTreeNode * leaf, const Ray & ray, const Shape & shape, SolidBits solid_mask, Intersection * intersection ) {
@@ -388,6 +576,350 @@ bool SweptShapeVsMapModel( const MapData * map, const MapModel * model, Ray ray,
 	return best.exists;
 }
 
+/*
+ * ray packets
+ *
+ * SweptShapeVsMapModel for up to 4 rays at once. each lane does exactly the
+ * same float ops as the scalar code in the same order so the results are
+ * identical. rays in a packet have to point the same way on every axis so
+ * each lane visits the kd-tree nodes in the same order the scalar traversal
+ * would, which matters when brushes tie
+ */
+
+#if !__arm64__
+
+static constexpr size_t RAY_PACKET_SIZE = 4;
+
+struct RayPacket {
+	__m128 origin[ 3 ];
+	__m128 direction[ 3 ];
+	__m128 inv_dir[ 3 ];
+	__m128 length;
+	bool negative[ 3 ];
+};
+
+struct RayPacketTraversalWork {
+	const MapKDTreeNode * node;
+	__m128 t_min;
+	__m128 t_max;
+	__m128 active;
+};
+
+// normal ids for the packet intersections, anything >= 0 is an index into
+// the brush's planes
+static constexpr int PacketNormal_None = -4;
+static constexpr int PacketNormal_AABBAxis = -3; // + axis
+
+static __m128 RayPacketVsAABB( const RayPacket & packet, __m128 active, const MinMax3 & aabb, __m128 * enter_t, __m128i * enter_normal, __m128 * leave_t ) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 far_scale = _mm_set1_ps( 1.0f + 2.0f * Gamma( 3 ) );
+
+	__m128 alive = active;
+	__m128 enter = zero;
+	__m128i normal = _mm_set1_epi32( PacketNormal_None );
+	__m128 leave = packet.length;
+
+	for( int i = 0; i < 3; i++ ) {
+		__m128 mins = _mm_set1_ps( aabb.mins[ i ] );
+		__m128 maxs = _mm_set1_ps( aabb.maxs[ i ] );
+
+		__m128 parallel = _mm_cmpeq_ps( packet.direction[ i ], zero );
+		__m128 inside = _mm_and_ps( _mm_cmplt_ps( mins, packet.origin[ i ] ), _mm_cmplt_ps( packet.origin[ i ], maxs ) );
+		alive = _mm_and_ps( alive, _mm_or_ps( Not( parallel ), inside ) );
+
+		__m128 near = _mm_mul_ps( _mm_sub_ps( mins, packet.origin[ i ] ), packet.inv_dir[ i ] );
+		__m128 far = _mm_mul_ps( _mm_sub_ps( maxs, packet.origin[ i ] ), packet.inv_dir[ i ] );
+		if( packet.negative[ i ] ) {
+			Swap2( &near, &far );
+		}
+
+		far = _mm_mul_ps( far, far_scale );
+
+		__m128 moving = _mm_andnot_ps( parallel, alive );
+
+		__m128 update_enter = _mm_and_ps( moving, _mm_cmpgt_ps( near, enter ) );
+		enter = Blend( enter, near, update_enter );
+		normal = Blend( normal, _mm_set1_epi32( PacketNormal_AABBAxis + i ), update_enter );
+
+		__m128 update_leave = _mm_and_ps( moving, _mm_cmplt_ps( far, leave ) );
+		leave = Blend( leave, far, update_leave );
+
+		alive = _mm_andnot_ps( _mm_and_ps( moving, _mm_cmpgt_ps( enter, leave ) ), alive );
+	}
+
+	*enter_t = enter;
+	*enter_normal = normal;
+	*leave_t = leave;
+	return alive;
+}
+
+static __m128 RayPacketVsMapBrush( const MapData * map, const MapBrush * brush, const RayPacket & packet, __m128 active, __m128 * enter_t, __m128i * enter_normal ) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.0f );
+
+	__m128 enter, leave;
+	__m128i normal;
+	__m128 alive = RayPacketVsAABB( packet, active, brush->bounds, &enter, &normal, &leave );
+
+	for( u32 i = 0; i < brush->num_planes; i++ ) {
+		if( !Any( alive ) )
+			return alive;
+
+		Plane plane = map->brush_planes[ brush->first_plane + i ];
+		__m128 nx = _mm_set1_ps( plane.normal.x );
+		__m128 ny = _mm_set1_ps( plane.normal.y );
+		__m128 nz = _mm_set1_ps( plane.normal.z );
+		__m128 distance = _mm_add_ps( _mm_set1_ps( plane.distance ), zero ); // + Support( ray ), which is 0
+
+		__m128 origin_dot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, packet.origin[ 0 ] ), _mm_mul_ps( ny, packet.origin[ 1 ] ) ), _mm_mul_ps( nz, packet.origin[ 2 ] ) );
+		__m128 dist = _mm_sub_ps( distance, origin_dot );
+		__m128 denom = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, packet.direction[ 0 ] ), _mm_mul_ps( ny, packet.direction[ 1 ] ) ), _mm_mul_ps( nz, packet.direction[ 2 ] ) );
+
+		__m128 parallel = _mm_cmpeq_ps( denom, zero );
+		alive = _mm_andnot_ps( _mm_and_ps( parallel, _mm_cmplt_ps( dist, zero ) ), alive );
+
+		__m128 t = _mm_div_ps( dist, Blend( denom, one, parallel ) );
+		__m128 moving = _mm_andnot_ps( parallel, alive );
+		__m128 entering = _mm_cmplt_ps( denom, zero );
+
+		__m128 update_enter = _mm_and_ps( _mm_and_ps( moving, entering ), _mm_cmpgt_ps( t, enter ) );
+		enter = Blend( enter, t, update_enter );
+		normal = Blend( normal, _mm_set1_epi32( i ), update_enter );
+
+		__m128 update_leave = _mm_and_ps( _mm_andnot_ps( entering, moving ), _mm_cmplt_ps( t, leave ) );
+		leave = Blend( leave, t, update_leave );
+
+		alive = _mm_andnot_ps( _mm_and_ps( moving, _mm_cmpgt_ps( enter, leave ) ), alive );
+	}
+
+	*enter_t = enter;
+	*enter_normal = normal;
+	return alive;
+}
+
+static void RayPacketVsMapModel( const MapData * map, const MapModel * model, const Ray * rays, size_t num_rays, SolidBits solid_mask, bool * hits, Intersection * intersections ) {
+	Assert( num_rays > 0 && num_rays <= RAY_PACKET_SIZE );
+
+	// pad out the packet with copies of the first ray so the unused lanes
+	// don't do anything weird
+	alignas( 16 ) float lanes[ 10 ][ RAY_PACKET_SIZE ];
+	for( size_t i = 0; i < RAY_PACKET_SIZE; i++ ) {
+		const Ray & ray = rays[ i < num_rays ? i : 0 ];
+		for( int j = 0; j < 3; j++ ) {
+			lanes[ j ][ i ] = ray.origin[ j ];
+			lanes[ 3 + j ][ i ] = ray.direction[ j ];
+			lanes[ 6 + j ][ i ] = ray.inv_dir[ j ];
+		}
+		lanes[ 9 ][ i ] = ray.length;
+	}
+
+	RayPacket packet;
+	for( int j = 0; j < 3; j++ ) {
+		packet.origin[ j ] = _mm_load_ps( lanes[ j ] );
+		packet.direction[ j ] = _mm_load_ps( lanes[ 3 + j ] );
+		packet.inv_dir[ j ] = _mm_load_ps( lanes[ 6 + j ] );
+		packet.negative[ j ] = rays[ 0 ].direction[ j ] < 0.0f;
+	}
+	packet.length = _mm_load_ps( lanes[ 9 ] );
+
+	__m128 active = _mm_castsi128_ps( _mm_cmplt_epi32( _mm_set_epi32( 3, 2, 1, 0 ), _mm_set1_epi32( num_rays ) ) );
+
+	__m128 bounds_enter, bounds_leave;
+	__m128i bounds_normal;
+	active = RayPacketVsAABB( packet, active, model->bounds, &bounds_enter, &bounds_normal, &bounds_leave );
+
+	__m128 best_t = _mm_set1_ps( FLT_MAX );
+	u32 best_brush[ RAY_PACKET_SIZE ];
+	s32 best_normal[ RAY_PACKET_SIZE ];
+	__m128 done = _mm_setzero_ps();
+
+	RayPacketTraversalWork todo[ 64 ];
+	u32 num_todo = 0;
+
+	RayPacketTraversalWork current = { &map->nodes[ model->root_node ], bounds_enter, bounds_leave, active };
+	while( true ) {
+		// the scalar traversal gives up as soon as it reaches a node past the end of the ray
+		__m128 past_end = _mm_and_ps( _mm_andnot_ps( done, current.active ), _mm_cmpgt_ps( current.t_min, packet.length ) );
+		done = _mm_or_ps( done, past_end );
+		current.active = _mm_andnot_ps( done, current.active );
+
+		bool pop = !Any( current.active );
+
+		if( !pop && !MapKDTreeNode::is_leaf( *current.node ) ) {
+			u32 axis = current.node->node.is_leaf_and_splitting_plane_axis;
+
+			const MapKDTreeNode * near_child = current.node + 1;
+			const MapKDTreeNode * far_child = &map->nodes[ current.node->node.front_child ];
+
+			// + AxialSupport( ray ), which is 0
+			float splitting_plane_near = current.node->node.splitting_plane_distance + 0.0f;
+			float splitting_plane_far = current.node->node.splitting_plane_distance - 0.0f;
+
+			if( packet.negative[ axis ] ) {
+				Swap2( &near_child, &far_child );
+				Swap2( &splitting_plane_near, &splitting_plane_far );
+			}
+
+			__m128 near_plane = _mm_set1_ps( splitting_plane_near );
+			__m128 far_plane = _mm_set1_ps( splitting_plane_far );
+			__m128 origin = packet.origin[ axis ];
+			__m128 parallel = _mm_cmpeq_ps( packet.direction[ axis ], _mm_setzero_ps() );
+
+			__m128 t_at_near = _mm_mul_ps( _mm_sub_ps( near_plane, origin ), packet.inv_dir[ axis ] );
+			__m128 t_at_far = _mm_mul_ps( _mm_sub_ps( far_plane, origin ), packet.inv_dir[ axis ] );
+
+			__m128 starts_near = Blend( _mm_cmple_ps( current.t_min, t_at_near ), _mm_cmple_ps( origin, near_plane ), parallel );
+			__m128 reaches_far = Blend( _mm_cmpge_ps( current.t_max, t_at_far ), _mm_cmpge_ps( origin, far_plane ), parallel );
+
+			RayPacketTraversalWork near = {
+				near_child,
+				current.t_min,
+				Blend( _mm_min_ps( current.t_max, t_at_near ), current.t_max, parallel ),
+				_mm_and_ps( current.active, starts_near ),
+			};
+			RayPacketTraversalWork far = {
+				far_child,
+				Blend( _mm_max_ps( current.t_min, t_at_far ), current.t_min, parallel ),
+				current.t_max,
+				_mm_and_ps( current.active, _mm_or_ps( Not( starts_near ), reaches_far ) ),
+			};
+
+			if( Any( near.active ) ) {
+				if( Any( far.active ) ) {
+					todo[ num_todo++ ] = far;
+				}
+				current = near;
+			}
+			else {
+				current = far;
+			}
+
+			if( num_todo == ARRAY_COUNT( todo ) ) {
+				Fatal( "Trace hit max tree depth" );
+			}
+			continue;
+		}
+
+		if( !pop ) {
+			for( u32 i = 0; i < current.node->leaf.num_brushes; i++ ) {
+				u32 brush_index = map->brush_indices[ current.node->leaf.first_brush + i ];
+				const MapBrush * brush = &map->brushes[ brush_index ];
+				if( ( brush->solidity & solid_mask ) == 0 )
+					continue;
+
+				__m128 enter_t;
+				__m128i enter_normal;
+				__m128 hit = RayPacketVsMapBrush( map, brush, packet, current.active, &enter_t, &enter_normal );
+
+				__m128 closer = _mm_and_ps( hit, _mm_cmplt_ps( enter_t, best_t ) );
+				int closer_lanes = _mm_movemask_ps( closer );
+				if( closer_lanes == 0 )
+					continue;
+
+				best_t = Blend( best_t, enter_t, closer );
+
+				alignas( 16 ) s32 normals[ RAY_PACKET_SIZE ];
+				_mm_store_si128( ( __m128i * ) normals, enter_normal );
+				for( size_t j = 0; j < RAY_PACKET_SIZE; j++ ) {
+					if( closer_lanes & ( 1 << j ) ) {
+						best_brush[ j ] = brush_index;
+						best_normal[ j ] = normals[ j ];
+					}
+				}
+			}
+		}
+
+		if( num_todo == 0 )
+			break;
+
+		num_todo--;
+		current = todo[ num_todo ];
+	}
+
+	alignas( 16 ) float ts[ RAY_PACKET_SIZE ];
+	_mm_store_ps( ts, best_t );
+
+	for( size_t i = 0; i < num_rays; i++ ) {
+		hits[ i ] = ts[ i ] != FLT_MAX;
+		if( !hits[ i ] )
+			continue;
+
+		const MapBrush * brush = &map->brushes[ best_brush[ i ] ];
+
+		Vec3 normal = Vec3( 0.0f );
+		if( best_normal[ i ] >= 0 ) {
+			normal = map->brush_planes[ brush->first_plane + best_normal[ i ] ].normal;
+		}
+		else if( best_normal[ i ] != PacketNormal_None ) {
+			int axis = best_normal[ i ] - PacketNormal_AABBAxis;
+			normal = Vec3( 0.0f );
+			normal[ axis ] = 1.0f;
+			normal = normal * -SignedOne( rays[ i ].direction[ axis ] );
+		}
+
+		intersections[ i ] = { ts[ i ], normal, brush->solidity };
+	}
+}
+
+#endif
+
+void RaysVsMapModel( const MapData * map, const MapModel * model, Span< const Ray > rays, SolidBits solid_mask, bool * hits, Intersection * intersections ) {
+	Shape ray_shape = { };
+	ray_shape.type = ShapeType_Ray;
+
+#if !__arm64__
+	// bucket the rays by which way they point on each axis
+	size_t buckets[ 8 ][ RAY_PACKET_SIZE ];
+	size_t bucket_sizes[ 8 ] = { };
+
+	auto Flush = [&]( size_t bucket ) {
+		Ray packet_rays[ RAY_PACKET_SIZE ];
+		bool packet_hits[ RAY_PACKET_SIZE ];
+		Intersection packet_intersections[ RAY_PACKET_SIZE ];
+		for( size_t i = 0; i < bucket_sizes[ bucket ]; i++ ) {
+			packet_rays[ i ] = rays[ buckets[ bucket ][ i ] ];
+		}
+
+		RayPacketVsMapModel( map, model, packet_rays, bucket_sizes[ bucket ], solid_mask, packet_hits, packet_intersections );
+
+		for( size_t i = 0; i < bucket_sizes[ bucket ]; i++ ) {
+			hits[ buckets[ bucket ][ i ] ] = packet_hits[ i ];
+			intersections[ buckets[ bucket ][ i ] ] = packet_intersections[ i ];
+		}
+		bucket_sizes[ bucket ] = 0;
+	};
+
+	for( size_t i = 0; i < rays.n; i++ ) {
+		if( rays[ i ].length == 0.0f ) {
+			hits[ i ] = SweptShapeVsMapModel( map, model, rays[ i ], ray_shape, solid_mask, &intersections[ i ] );
+			continue;
+		}
+
+		size_t bucket = 0;
+		for( int j = 0; j < 3; j++ ) {
+			if( rays[ i ].direction[ j ] < 0.0f ) {
+				bucket |= 1 << j;
+			}
+		}
+
+		buckets[ bucket ][ bucket_sizes[ bucket ]++ ] = i;
+		if( bucket_sizes[ bucket ] == RAY_PACKET_SIZE ) {
+			Flush( bucket );
+		}
+	}
+
+	for( size_t i = 0; i < ARRAY_COUNT( bucket_sizes ); i++ ) {
+		if( bucket_sizes[ i ] > 0 ) {
+			Flush( i );
+		}
+	}
+#else
+	for( size_t i = 0; i < rays.n; i++ ) {
+		hits[ i ] = SweptShapeVsMapModel( map, model, rays[ i ], ray_shape, solid_mask, &intersections[ i ] );
+	}
+#endif
+}
+
 static Vec3 MakeNormal( int axis, bool positive ) {
 	Vec3 n = Vec3( 0.0f );
 	n[ axis ] = positive ? 1.0f : -1.0f;
@@ -456,7 +988,93 @@ bool SweptAABBVsAABB( const MinMax3 & a, Vec3 va, const MinMax3 & b, Vec3 vb, In
 	return true;
 }
 
-static bool SweptShapeVsGLTFBrush( const GLTFCollisionData * gltf, GLTFCollisionBrush & brush, Mat4 transform, Ray ray, const Shape & shape, SolidBits solid_mask, Intersection * intersection ) {
+static constexpr float GLTF_BEVEL_AXIS_DOT = 0.99999f;
+
+static Plane TransformGLTFPlane( const Mat4 & transform, Plane plane ) {
+	Vec3 p = ( transform * Vec4( plane.normal * plane.distance, 1.0f ) ).xyz();
+	plane.normal = SafeNormalize( ( transform * Vec4( plane.normal, 0.0f ) ).xyz() );
+	plane.distance = Dot( p, plane.normal );
+	return plane;
+}
+
+#if !__arm64__
+
+// TransformGLTFPlane for 4 planes
+static void TransformGLTFPlanesSoA( const Mat4 & transform, __m128 * nx, __m128 * ny, __m128 * nz, __m128 * distance ) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.0f );
+
+	Vec4 rows[] = { transform.row0(), transform.row1(), transform.row2() };
+
+	__m128 point[ 3 ];
+	__m128 normal[ 3 ];
+	__m128 px = _mm_mul_ps( *nx, *distance );
+	__m128 py = _mm_mul_ps( *ny, *distance );
+	__m128 pz = _mm_mul_ps( *nz, *distance );
+	for( int i = 0; i < 3; i++ ) {
+		__m128 r0 = _mm_set1_ps( rows[ i ].x );
+		__m128 r1 = _mm_set1_ps( rows[ i ].y );
+		__m128 r2 = _mm_set1_ps( rows[ i ].z );
+		__m128 r3 = _mm_set1_ps( rows[ i ].w );
+		point[ i ] = _mm_add_ps( Dot( r0, r1, r2, px, py, pz ), _mm_mul_ps( r3, one ) );
+		normal[ i ] = _mm_add_ps( Dot( r0, r1, r2, *nx, *ny, *nz ), _mm_mul_ps( r3, zero ) );
+	}
+
+	// SafeNormalize
+	__m128 is_zero = _mm_and_ps( _mm_and_ps( _mm_cmpeq_ps( normal[ 0 ], zero ), _mm_cmpeq_ps( normal[ 1 ], zero ) ), _mm_cmpeq_ps( normal[ 2 ], zero ) );
+	__m128 length = _mm_sqrt_ps( Dot( normal[ 0 ], normal[ 1 ], normal[ 2 ], normal[ 0 ], normal[ 1 ], normal[ 2 ] ) );
+	__m128 inv_length = _mm_div_ps( one, Blend( length, one, is_zero ) );
+	for( int i = 0; i < 3; i++ ) {
+		normal[ i ] = Blend( _mm_mul_ps( normal[ i ], inv_length ), normal[ i ], is_zero );
+	}
+
+	*nx = normal[ 0 ];
+	*ny = normal[ 1 ];
+	*nz = normal[ 2 ];
+	*distance = Dot( point[ 0 ], point[ 1 ], point[ 2 ], normal[ 0 ], normal[ 1 ], normal[ 2 ] );
+}
+
+static bool ClipGLTFBrushPlanesSoA( const GLTFCollisionData * gltf, const GLTFCollisionBrush & brush, const Mat4 & transform, const Ray & ray, const Shape & shape, Intersection * enter, Intersection * leave ) {
+	const PlanesSoA & planes = gltf->planes_soa;
+	const __m128 bevel_axis_dot = _mm_set1_ps( GLTF_BEVEL_AXIS_DOT );
+
+	PlaneClipper clipper = MakePlaneClipper( enter->t, leave->t );
+
+	for( u32 i = 0; i < brush.num_planes; i += 4 ) {
+		u32 first = brush.first_plane + i;
+		__m128i indices = _mm_add_epi32( _mm_set1_epi32( i ), _mm_set_epi32( 3, 2, 1, 0 ) );
+		__m128 valid = _mm_castsi128_ps( _mm_cmplt_epi32( indices, _mm_set1_epi32( brush.num_planes ) ) );
+
+		__m128 nx = _mm_loadu_ps( planes.normal_x + first );
+		__m128 ny = _mm_loadu_ps( planes.normal_y + first );
+		__m128 nz = _mm_loadu_ps( planes.normal_z + first );
+		__m128 distance = _mm_loadu_ps( planes.distance + first );
+		TransformGLTFPlanesSoA( transform, &nx, &ny, &nz, &distance );
+
+		// the dot products with the bevel axes are just the normal's components
+		__m128 is_bevel_axis = _mm_cmpge_ps( Abs( nx ), bevel_axis_dot );
+		is_bevel_axis = _mm_or_ps( is_bevel_axis, _mm_cmpge_ps( Abs( ny ), bevel_axis_dot ) );
+		is_bevel_axis = _mm_or_ps( is_bevel_axis, _mm_cmpge_ps( Abs( nz ), bevel_axis_dot ) );
+		valid = _mm_andnot_ps( is_bevel_axis, valid );
+
+		if( !ClipPlanesSoA( &clipper, ray, shape, nx, ny, nz, distance, valid, indices ) )
+			return false;
+	}
+
+	s32 enter_plane;
+	if( !FinishClipPlanes( clipper, &enter->t, &enter_plane, &leave->t ) )
+		return false;
+
+	if( enter_plane != -1 ) {
+		enter->normal = TransformGLTFPlane( transform, gltf->planes[ brush.first_plane + enter_plane ] ).normal;
+	}
+
+	return true;
+}
+
+#endif
+
+static bool SweptShapeVsGLTFBrush( const GLTFCollisionData * gltf, const GLTFCollisionBrush & brush, Mat4 transform, Ray ray, const Shape & shape, SolidBits solid_mask, Intersection * intersection ) {
 	constexpr Vec3 bevel_axes[] = {
 		Vec3( 1, 0, 0 ),
 		Vec3( 0, 1, 0 ),
@@ -505,15 +1123,17 @@ static bool SweptShapeVsGLTFBrush( const GLTFCollisionData * gltf, GLTFCollision
 	}
 
 	// check non-bevel planes
-	Span< Plane > brush_planes = gltf->planes.slice( brush.first_plane, brush.first_plane + brush.num_planes );
+#if !__arm64__
+	if( !ClipGLTFBrushPlanesSoA( gltf, brush, transform, ray, shape, &enter, &leave ) )
+		return false;
+#else
+	Span< const Plane > brush_planes = gltf->planes.slice( brush.first_plane, brush.first_plane + brush.num_planes );
 	for( Plane plane : brush_planes ) {
-		Vec3 p = ( transform * Vec4( plane.normal * plane.distance, 1.0f ) ).xyz();
-		plane.normal = SafeNormalize( ( transform * Vec4( plane.normal, 0.0f ) ).xyz() );
-		plane.distance = Dot( p, plane.normal );
+		plane = TransformGLTFPlane( transform, plane );
 
 		bool is_bevel_axis = false;
 		for( const Vec3 & bevel_axis : bevel_axes ) {
-			if( Abs( Dot( plane.normal, bevel_axis ) ) >= 0.99999f ) {
+			if( Abs( Dot( plane.normal, bevel_axis ) ) >= GLTF_BEVEL_AXIS_DOT ) {
 				is_bevel_axis = true;
 				break;
 			}
@@ -525,9 +1145,10 @@ static bool SweptShapeVsGLTFBrush( const GLTFCollisionData * gltf, GLTFCollision
 		if( !CheckPlane( plane ) )
 			return false;
 	}
+#endif
 
 	// check bevel planes
-	Span< Vec3 > brush_vertices = gltf->vertices.slice( brush.first_vertex, brush.first_vertex + brush.num_vertices );
+	Span< const Vec3 > brush_vertices = gltf->vertices.slice( brush.first_vertex, brush.first_vertex + brush.num_vertices );
 	for( Vec3 vert : brush_vertices ) {
 		vert = ( transform * Vec4( vert, 1.0f ) ).xyz();
 		for( size_t j = 0; j < ARRAY_COUNT( bevel_axes ); j++ ) {
@@ -551,15 +1172,103 @@ static bool SweptShapeVsGLTFBrush( const GLTFCollisionData * gltf, GLTFCollision
 	return true;
 }
 
+static void UpdateGLTFIntersection( const GLTFCollisionData * gltf, u32 brush_idx, Mat4 transform, Ray ray, const Shape & shape, SolidBits solid_mask, Optional< Intersection > * best, u32 * best_brush ) {
+	const GLTFCollisionBrush & brush = gltf->brushes[ brush_idx ];
+	Intersection brush_intersection;
+	if( !SweptShapeVsGLTFBrush( gltf, brush, transform, ray, shape, solid_mask, &brush_intersection ) )
+		return;
+
+	// break ties by brush index so we get the same result as going through
+	// the brushes in order
+	bool closer = !best->exists || brush_intersection.t < best->value.t;
+	bool tied = best->exists && brush_intersection.t == best->value.t && brush_idx < *best_brush;
+	if( closer || tied ) {
+		brush_intersection.solidity = brush.solidity;
+		*best = brush_intersection;
+		*best_brush = brush_idx;
+	}
+}
+
+// the world space AABB of a transformed object space AABB, plus a bit of
+// slop so rounding can't make us skip brushes
+static MinMax3 TransformBVHBounds( const Mat4 & transform, const MinMax3 & bounds ) {
+	Vec3 center = ( transform * Vec4( Center( bounds ), 1.0f ) ).xyz();
+	Vec3 half_size = ( bounds.maxs - bounds.mins ) * 0.5f;
+
+	Vec3 extents;
+	Vec4 rows[] = { transform.row0(), transform.row1(), transform.row2() };
+	for( int i = 0; i < 3; i++ ) {
+		extents[ i ] = Abs( rows[ i ].x ) * half_size.x + Abs( rows[ i ].y ) * half_size.y + Abs( rows[ i ].z ) * half_size.z + 1.0f;
+	}
+
+	return MinMax3( center - extents, center + extents );
+}
+
+struct GLTFBVHTraversalWork {
+	u32 node;
+	float t;
+};
+
 bool SweptShapeVsGLTF( const GLTFCollisionData * gltf, Mat4 transform, Ray ray, const Shape & shape, SolidBits solid_mask, Intersection * intersection ) {
 	Optional< Intersection > best = NONE;
+	u32 best_brush = 0;
 
-	for( GLTFCollisionBrush & brush : gltf->brushes ) {
-		Intersection brush_intersection;
-		if( SweptShapeVsGLTFBrush( gltf, brush, transform, ray, shape, solid_mask, &brush_intersection ) ) {
-			if( !best.exists || brush_intersection.t < best.value.t ) {
-				brush_intersection.solidity = brush.solidity;
-				best = brush_intersection;
+	if( gltf->bvh.n == 0 ) {
+		for( u32 i = 0; i < gltf->brushes.n; i++ ) {
+			UpdateGLTFIntersection( gltf, i, transform, ray, shape, solid_mask, &best, &best_brush );
+		}
+	}
+	else {
+		// front to back, skipping anything that starts behind the closest hit
+		// so far. nodes that start at exactly the same t still need checking
+		// for ties
+		auto NodeEnterT = [&]( u32 node, float * t ) -> bool {
+			Intersection enter, leave;
+			if( !RayVsAABB( ray, MinkowskiSum( TransformBVHBounds( transform, gltf->bvh[ node ].bounds ), shape ), &enter, &leave ) )
+				return false;
+			*t = enter.t;
+			return !best.exists || enter.t <= best.value.t;
+		};
+
+		GLTFBVHTraversalWork todo[ 64 ];
+		u32 num_todo = 0;
+
+		float root_t;
+		if( NodeEnterT( 0, &root_t ) ) {
+			todo[ num_todo++ ] = { 0, root_t };
+		}
+
+		while( num_todo > 0 ) {
+			num_todo--;
+			GLTFBVHTraversalWork work = todo[ num_todo ];
+			if( best.exists && work.t > best.value.t )
+				continue;
+
+			const GLTFCollisionBVHNode & node = gltf->bvh[ work.node ];
+			if( node.num_brushes > 0 ) {
+				for( u32 i = 0; i < node.num_brushes; i++ ) {
+					UpdateGLTFIntersection( gltf, gltf->bvh_brushes[ node.first + i ], transform, ray, shape, solid_mask, &best, &best_brush );
+				}
+				continue;
+			}
+
+			u32 children[ 2 ] = { work.node + 1, node.first };
+			float children_t[ 2 ];
+			bool hit_children[ 2 ];
+			for( int i = 0; i < 2; i++ ) {
+				hit_children[ i ] = NodeEnterT( children[ i ], &children_t[ i ] );
+			}
+
+			// push the further child first so the nearer one gets popped first
+			int first = hit_children[ 0 ] && hit_children[ 1 ] && children_t[ 1 ] > children_t[ 0 ] ? 1 : 0;
+			for( int i = 0; i < 2; i++ ) {
+				int child = first ^ i;
+				if( !hit_children[ child ] )
+					continue;
+				if( num_todo == ARRAY_COUNT( todo ) ) {
+					Fatal( "Trace hit max BVH depth" );
+				}
+				todo[ num_todo++ ] = { children[ child ], children_t[ child ] };
 			}
 		}
 	}
@@ -45,6 +45,9 @@ bool RayVsCapsule( const Ray & ray, const Capsule & capsule, float * t );
 
 // TODO: special case stationary traces
 bool SweptShapeVsMapModel( const MapData * map, const MapModel * model, Ray ray, const Shape & shape, SolidBits solid_mask, Intersection * intersection );
+// same as SweptShapeVsMapModel with a ray shape for each ray, but traces
+// rays that point the same way through the tree together
+void RaysVsMapModel( const MapData * map, const MapModel * model, Span< const Ray > rays, SolidBits solid_mask, bool * hits, Intersection * intersections );
 bool SweptAABBVsAABB( const MinMax3 & a, Vec3 va, const MinMax3 & b, Vec3 vb, Intersection * intersection );
 
 struct GLTFCollisionData;
@@ -43,3 +43,17 @@ struct trace_t {
 	bool GotSomewhere() const { return fraction > 0.0f; }
 	bool GotNowhere() const { return fraction == 0.0f; }
 };
+
+/*
+ * brush planes split into one array per component so they can be clipped
+ * against several at a time. the arrays have PLANES_SOA_PADDING zeroes on
+ * the end so the last brush's planes can be read with full width loads
+ */
+struct PlanesSoA {
+	const float * normal_x;
+	const float * normal_y;
+	const float * normal_z;
+	const float * distance;
+};
+
+constexpr size_t PLANES_SOA_PADDING = 3;
@@ -13,22 +13,61 @@ static inline u64 GetCellHash( s32 x, s32 y, s32 z ) {
 	return hash;
 }
 
-static SpatialHashBounds GetSpatialHashBounds( MinMax3 bounds ) {
-	constexpr s32 dimensions[] = { 64, 64, 1024 };
+static constexpr float cell_dimensions[] = { 64.0f, 64.0f, 1024.0f };
+
+// cell i covers [ i * size, ( i + 1 ) * size ) so anything that overlaps is
+// guaranteed to share a cell
+static s32 GetCellCoordinate( float x, int axis ) {
+	return s32( floorf( x / cell_dimensions[ axis ] ) );
+}
 
+static SpatialHashBounds GetSpatialHashBounds( MinMax3 bounds ) {
 	SpatialHashBounds sbounds;
 
-	sbounds.x1 = s32( bounds.mins.x ) / dimensions[ 0 ];
-	sbounds.y1 = s32( bounds.mins.y ) / dimensions[ 1 ];
-	sbounds.z1 = s32( bounds.mins.z ) / dimensions[ 2 ];
+	sbounds.x1 = GetCellCoordinate( bounds.mins.x, 0 );
+	sbounds.y1 = GetCellCoordinate( bounds.mins.y, 1 );
+	sbounds.z1 = GetCellCoordinate( bounds.mins.z, 2 );
 
-	sbounds.x2 = ( s32( bounds.maxs.x ) - 1 ) / dimensions[ 0 ] + 1;
-	sbounds.y2 = ( s32( bounds.maxs.y ) - 1 ) / dimensions[ 1 ] + 1;
-	sbounds.z2 = ( s32( bounds.maxs.z ) - 1 ) / dimensions[ 2 ] + 1;
+	sbounds.x2 = GetCellCoordinate( bounds.maxs.x, 0 );
+	sbounds.y2 = GetCellCoordinate( bounds.maxs.y, 1 );
+	sbounds.z2 = GetCellCoordinate( bounds.maxs.z, 2 );
 
 	return sbounds;
 }
 
+static size_t CountCells( const SpatialHashBounds & sbounds ) {
+	return size_t( sbounds.x2 - sbounds.x1 + 1 ) * size_t( sbounds.y2 - sbounds.y1 + 1 ) * size_t( sbounds.z2 - sbounds.z1 + 1 );
+}
+
+static void AddCell( SpatialHashCell * result, const SpatialHashGrid * grid, s32 x, s32 y, s32 z ) {
+	u64 hash = GetCellHash( x, y, z );
+	u64 cell_idx = hash % ARRAY_COUNT( grid->cells );
+	for( size_t i = 0; i < ARRAY_COUNT( &SpatialHashCell::active ); i++ ) {
+		result->active[ i ] |= grid->cells[ cell_idx ].active[ i ];
+	}
+}
+
+static size_t GetTouchlist( const SpatialHashGrid * grid, const SpatialHashCell & result, int * touchlist, SolidBits solid_mask ) {
+	size_t num = 0;
+	touchlist[ num++ ] = 0;
+
+	for( size_t i = 0; i < ARRAY_COUNT( &SpatialHashCell::active ); i++ ) {
+		if( result.active[ i ] == 0 ) {
+			continue;
+		}
+		for( size_t j = 0; j < 64; j++ ) {
+			if( ( result.active[ i ] & ( 1ULL << j ) ) != 0 ) {
+				size_t entity_id = i * 64 + j;
+				if( HasAnyBit( grid->primitives[ entity_id ].solidity, solid_mask ) ) {
+					touchlist[ num++ ] = entity_id;
+				}
+			}
+		}
+	}
+
+	return num;
+}
+
 template< bool Union >
 static size_t TraverseSpatialHashGridGeneric( const SpatialHashGrid * a, const SpatialHashGrid * b, MinMax3 bounds, int * touchlist, SolidBits solid_mask ) {
 	TracyZoneScoped;
@@ -82,6 +121,148 @@ size_t TraverseSpatialHashGrid( const SpatialHashGrid * grid, const MinMax3 boun
 	return TraverseSpatialHashGridGeneric< false >( grid, NULL, bounds, touchlist, solid_mask );
 }
 
+/*
+ * swept box queries
+ *
+ * the box is extents + start + ( end - start ) * t for t in [0, max_fraction].
+ * rather than taking the bounds of the whole sweep, which is mostly empty
+ * space for long diagonal traces, we march cell by cell along the axis the
+ * sweep crosses the most cells on, and only look at the cells the box
+ * touches while it's inside each slab
+ */
+
+// narrows [t0, t1] to where the box overlaps [lo, hi] on one axis
+static bool SweptSlabOverlap( float start, float dir, float mins, float maxs, float lo, float hi, float * t0, float * t1 ) {
+	if( dir == 0.0f ) {
+		return start + maxs >= lo && start + mins <= hi;
+	}
+
+	float enter = ( lo - maxs - start ) / dir;
+	float leave = ( hi - mins - start ) / dir;
+	if( dir < 0.0f ) {
+		Swap2( &enter, &leave );
+	}
+
+	*t0 = Max2( *t0, enter );
+	*t1 = Min2( *t1, leave );
+	return *t0 <= *t1;
+}
+
+static void SweptCellRange( float start, float dir, float mins, float maxs, float t0, float t1, int axis, s32 * c1, s32 * c2 ) {
+	float p0 = start + dir * t0;
+	float p1 = start + dir * t1;
+	*c1 = GetCellCoordinate( Min2( p0, p1 ) + mins, axis );
+	*c2 = GetCellCoordinate( Max2( p0, p1 ) + maxs, axis );
+}
+
+static MinMax3 PadSweptExtents( MinMax3 extents ) {
+	// so float error can't make us miss a cell
+	constexpr float epsilon = 1.0f;
+	return MinMax3( extents.mins - epsilon, extents.maxs + epsilon );
+}
+
+static MinMax3 SweptBounds( Vec3 start, Vec3 end, MinMax3 extents, float max_fraction ) {
+	MinMax3 ray = Union( Union( MinMax3::Empty(), start ), start + ( end - start ) * max_fraction );
+	return MinMax3( ray.mins + extents.mins, ray.maxs + extents.maxs );
+}
+
+size_t TraverseSpatialHashGrid( const SpatialHashGrid * grid, Vec3 start, Vec3 end, MinMax3 extents, float max_fraction, int * touchlist, SolidBits solid_mask ) {
+	TracyZoneScoped;
+
+	extents = PadSweptExtents( extents );
+
+	// short traces and stationary boxes are cheaper to do in one go
+	SpatialHashBounds sbounds = GetSpatialHashBounds( SweptBounds( start, end, extents, max_fraction ) );
+	if( CountCells( sbounds ) <= 8 ) {
+		SpatialHashCell result = { };
+		for( s32 x = sbounds.x1; x <= sbounds.x2; x++ ) {
+			for( s32 y = sbounds.y1; y <= sbounds.y2; y++ ) {
+				for( s32 z = sbounds.z1; z <= sbounds.z2; z++ ) {
+					AddCell( &result, grid, x, y, z );
+				}
+			}
+		}
+		return GetTouchlist( grid, result, touchlist, solid_mask );
+	}
+
+	Vec3 dir = end - start;
+
+	int a = 0;
+	for( int i = 1; i < 3; i++ ) {
+		if( Abs( dir[ i ] ) / cell_dimensions[ i ] > Abs( dir[ a ] ) / cell_dimensions[ a ] ) {
+			a = i;
+		}
+	}
+	int b = ( a + 1 ) % 3;
+	int c = ( a + 2 ) % 3;
+
+	s32 first, last;
+	SweptCellRange( start[ a ], dir[ a ], extents.mins[ a ], extents.maxs[ a ], 0.0f, max_fraction, a, &first, &last );
+	s32 step = 1;
+	if( dir[ a ] < 0.0f ) {
+		Swap2( &first, &last );
+		step = -1;
+	}
+
+	SpatialHashCell result = { };
+	s32 cell[ 3 ];
+	for( cell[ a ] = first; ; cell[ a ] += step ) {
+		float t0 = 0.0f;
+		float t1 = max_fraction;
+		float lo = cell[ a ] * cell_dimensions[ a ];
+		if( SweptSlabOverlap( start[ a ], dir[ a ], extents.mins[ a ], extents.maxs[ a ], lo, lo + cell_dimensions[ a ], &t0, &t1 ) ) {
+			s32 b1, b2;
+			SweptCellRange( start[ b ], dir[ b ], extents.mins[ b ], extents.maxs[ b ], t0, t1, b, &b1, &b2 );
+
+			for( cell[ b ] = b1; cell[ b ] <= b2; cell[ b ]++ ) {
+				float u0 = t0;
+				float u1 = t1;
+				float lo = cell[ b ] * cell_dimensions[ b ];
+				if( !SweptSlabOverlap( start[ b ], dir[ b ], extents.mins[ b ], extents.maxs[ b ], lo, lo + cell_dimensions[ b ], &u0, &u1 ) )
+					continue;
+
+				s32 c1, c2;
+				SweptCellRange( start[ c ], dir[ c ], extents.mins[ c ], extents.maxs[ c ], u0, u1, c, &c1, &c2 );
+				for( cell[ c ] = c1; cell[ c ] <= c2; cell[ c ]++ ) {
+					AddCell( &result, grid, cell[ 0 ], cell[ 1 ], cell[ 2 ] );
+				}
+			}
+		}
+
+		if( cell[ a ] == last )
+			break;
+	}
+
+	return GetTouchlist( grid, result, touchlist, solid_mask );
+}
+
+bool SpatialHashPrimitiveOverlaps( const SpatialHashPrimitive * primitive, Vec3 start, Vec3 end, MinMax3 extents, float max_fraction, SolidBits solid_mask ) {
+	if( !HasAnyBit( primitive->solidity, solid_mask ) )
+		return false;
+
+	extents = PadSweptExtents( extents );
+
+	const SpatialHashBounds & p = primitive->sbounds;
+	s32 cells[ 3 ][ 2 ] = {
+		{ p.x1, p.x2 },
+		{ p.y1, p.y2 },
+		{ p.z1, p.z2 },
+	};
+
+	Vec3 dir = end - start;
+	float t0 = 0.0f;
+	float t1 = max_fraction;
+	for( int i = 0; i < 3; i++ ) {
+		float lo = cells[ i ][ 0 ] * cell_dimensions[ i ];
+		float hi = ( cells[ i ][ 1 ] + 1 ) * cell_dimensions[ i ];
+		if( !SweptSlabOverlap( start[ i ], dir[ i ], extents.mins[ i ], extents.maxs[ i ], lo, hi, &t0, &t1 ) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
 void UnlinkEntity( SpatialHashGrid * grid, u64 entity_id ) {
 	TracyZoneScoped;
 
@@ -123,7 +304,7 @@ void LinkEntity( SpatialHashGrid * grid, const CollisionModelStorage * storage,
 	for( s32 x = sbounds.x1; x <= sbounds.x2; x++ ) {
 		for( s32 y = sbounds.y1; y <= sbounds.y2; y++ ) {
 			for( s32 z = sbounds.z1; z <= sbounds.z2; z++ ) {
-				u64 hash = GetCellHash( x, y, 0 );
+				u64 hash = GetCellHash( x, y, z );
 				u64 cell_idx = hash % ARRAY_COUNT( grid->cells );
 				SpatialHashCell & cell = grid->cells[ cell_idx ];
 				cell.active[ entity_id / 64 ] |= 1ULL << ( entity_id % 64 );
@@ -36,6 +36,17 @@ void Seek( FILE * file, size_t cursor );
 size_t FileSize( FILE * file );
 
 bool FileExists( Allocator * a, const char * path );
+
+struct FileMetadata {
+	u64 size;
+	s64 modified_time;
+};
+
+bool GetFileMetadata( Allocator * a, const char * path, FileMetadata * metadata );
+
+// read only, returns an empty span on failure
+Span< const u8 > MapFile( Allocator * a, const char * path );
+void UnmapFile( Span< const u8 > file );
 bool WriteFile( Allocator * a, const char * path, const void * data, size_t len );
 bool MoveFile( Allocator * a, const char * old_path, const char * new_path, MoveFileReplace replace );
 bool RemoveFile( Allocator * a, const char * path );
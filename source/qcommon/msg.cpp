@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "qcommon/qcommon.h"
 #include "qcommon/serialization.h"
 
+#include <bit>
 #include <type_traits>
 
 #define MAX_MSG_STRING_CHARS    2048
@@ -58,12 +59,17 @@ void *MSG_GetSpace( msg_t * msg, size_t length ) {
 	return ptr;
 }
 
+/*
+ * deltas are a bitmask saying which fields changed followed by a bitstream of
+ * the new values. integers are sent as the zigzagged difference from the
+ * baseline with a length prefix, so small changes only take a few bits
+ */
 struct DeltaBuffer {
 	static constexpr u32 MAX_FIELDS = 1024;
 
 	u8 * buf;
-	u8 * cursor;
-	u8 * end;
+	size_t bit_cursor;
+	size_t bits_capacity;
 
 	u8 field_mask[ MAX_FIELDS / 8 ];
 	u32 num_fields;
@@ -73,36 +79,42 @@ struct DeltaBuffer {
 	bool error;
 };
 
+static size_t DeltaPayloadBytes( const DeltaBuffer & delta ) {
+	return ( delta.bit_cursor + 7 ) / 8;
+}
+
 static void MSG_WriteDeltaBuffer( msg_t * msg, const DeltaBuffer & delta ) {
 	MSG_WriteUintBase128( msg, delta.num_fields );
 	u8 bytes = ( delta.num_fields + 7 ) / 8;
 	MSG_Write( msg, delta.field_mask, bytes );
-	MSG_Write( msg, delta.buf, delta.cursor - delta.buf );
+	MSG_Write( msg, delta.buf, DeltaPayloadBytes( delta ) );
 }
 
 static DeltaBuffer MSG_StartReadingDeltaBuffer( msg_t * msg ) {
 	DeltaBuffer delta = { };
 
 	delta.num_fields = MSG_ReadUintBase128( msg );
+	if( delta.num_fields > DeltaBuffer::MAX_FIELDS ) {
+		delta.num_fields = 0;
+		delta.error = true;
+	}
 	u8 bytes = ( delta.num_fields + 7 ) / 8;
 	MSG_ReadData( msg, delta.field_mask, bytes );
 
 	delta.buf = msg->data + msg->readcount;
-	delta.cursor = msg->data + msg->readcount;
-	delta.end = msg->data + msg->cursize;
+	delta.bits_capacity = msg->readcount < msg->cursize ? ( msg->cursize - msg->readcount ) * 8 : 0;
 
 	return delta;
 }
 
 static void MSG_FinishReadingDeltaBuffer( msg_t * msg, const DeltaBuffer & delta ) {
-	msg->readcount += delta.cursor - delta.buf;
+	msg->readcount += DeltaPayloadBytes( delta );
 }
 
 static DeltaBuffer DeltaWriter( u8 * buf, size_t n ) {
 	DeltaBuffer delta = { };
 	delta.buf = buf;
-	delta.cursor = buf;
-	delta.end = delta.buf + n;
+	delta.bits_capacity = n * 8;
 	delta.serializing = true;
 
 	return delta;
@@ -137,38 +149,119 @@ static bool GetBit( DeltaBuffer * buf ) {
 	return b;
 }
 
-static void AddBytes( DeltaBuffer * buf, const void * data, size_t n ) {
-	if( buf->error || size_t( buf->end - buf->cursor ) < n ) {
+static void AddBits( DeltaBuffer * buf, u64 x, u32 n ) {
+	Assert( n <= 64 );
+	if( buf->error || buf->bits_capacity - buf->bit_cursor < n ) {
 		buf->error = true;
 		return;
 	}
 
-	memcpy( buf->cursor, data, n );
-	buf->cursor += n;
+	while( n > 0 ) {
+		size_t byte = buf->bit_cursor / 8;
+		u32 bit = buf->bit_cursor % 8;
+		u32 chunk = Min2( n, 8 - bit );
+
+		// the write buffer is uninitialised so clear bytes as we reach them
+		if( bit == 0 ) {
+			buf->buf[ byte ] = 0;
+		}
+		buf->buf[ byte ] |= u8( ( x & ( ( 1_u64 << chunk ) - 1 ) ) << bit );
+
+		x >>= chunk;
+		n -= chunk;
+		buf->bit_cursor += chunk;
+	}
 }
 
-static void GetBytes( DeltaBuffer * buf, void * data, size_t n ) {
-	if( buf->error || size_t( buf->end - buf->cursor ) < n ) {
+static u64 GetBits( DeltaBuffer * buf, u32 n ) {
+	Assert( n <= 64 );
+	if( buf->error || buf->bits_capacity - buf->bit_cursor < n ) {
 		buf->error = true;
-		memset( data, 0, n );
-		return;
+		return 0;
 	}
 
-	memcpy( data, buf->cursor, n );
-	buf->cursor += n;
+	u64 x = 0;
+	u32 shift = 0;
+	while( n > 0 ) {
+		size_t byte = buf->bit_cursor / 8;
+		u32 bit = buf->bit_cursor % 8;
+		u32 chunk = Min2( n, 8 - bit );
+
+		x |= u64( ( buf->buf[ byte ] >> bit ) & ( ( 1_u64 << chunk ) - 1 ) ) << shift;
+
+		shift += chunk;
+		n -= chunk;
+		buf->bit_cursor += chunk;
+	}
+
+	return x;
+}
+
+// length prefix followed by the value without its top bit, which is implied
+static void AddVarBits( DeltaBuffer * buf, u64 x, u32 max_bits ) {
+	u32 n = std::bit_width( x );
+	AddBits( buf, n, std::bit_width( max_bits ) );
+	if( n > 1 ) {
+		AddBits( buf, x, n - 1 );
+	}
+}
+
+static u64 GetVarBits( DeltaBuffer * buf, u32 max_bits ) {
+	u32 n = GetBits( buf, std::bit_width( max_bits ) );
+	if( n > max_bits ) {
+		buf->error = true;
+		return 0;
+	}
+
+	if( n == 0 )
+		return 0;
+	return ( 1_u64 << ( n - 1 ) ) | GetBits( buf, n - 1 );
+}
+
+static u64 ZigZag( s64 x ) {
+	return ( u64( x ) << 1 ) ^ u64( x >> 63 );
+}
+
+static s64 UnZigZag( u64 x ) {
+	return s64( x >> 1 ) ^ -s64( x & 1 );
+}
+
+template< typename T >
+static void DeltaFixedBits( DeltaBuffer * buf, T & x, const T & baseline, u32 bits ) {
+	using U = std::make_unsigned_t< T >;
+	if( buf->serializing ) {
+		AddBit( buf, x != baseline );
+		if( x != baseline ) {
+			AddBits( buf, U( x ), bits );
+		}
+	}
+	else {
+		if( GetBit( buf ) ) {
+			x = T( GetBits( buf, bits ) );
+		}
+		else {
+			x = baseline;
+		}
+	}
 }
 
 template< typename T >
-static void DeltaFundamental( DeltaBuffer * buf, T & x, const T & baseline ) {
+static void DeltaInteger( DeltaBuffer * buf, T & x, const T & baseline ) {
+	using U = std::make_unsigned_t< T >;
+	using S = std::make_signed_t< T >;
+	constexpr u32 bits = sizeof( T ) * 8;
+
 	if( buf->serializing ) {
 		AddBit( buf, x != baseline );
 		if( x != baseline ) {
-			AddBytes( buf, &x, sizeof( x ) );
+			S diff = S( U( U( x ) - U( baseline ) ) );
+			AddVarBits( buf, ZigZag( diff ), bits );
 		}
 	}
 	else {
 		if( GetBit( buf ) ) {
-			GetBytes( buf, &x, sizeof( x ) );
+			s64 diff = UnZigZag( GetVarBits( buf, bits ) );
+			x = T( U( U( baseline ) + U( diff ) ) );
 		}
 		else {
 			x = baseline;
@@ -176,16 +269,60 @@ static void DeltaFundamental( DeltaBuffer * buf, T & x, const T & baseline ) {
 	}
 }
 
-static void Delta( DeltaBuffer * buf, char & x, char baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, s8 & x, s8 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, s16 & x, s16 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, s32 & x, s32 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, s64 & x, s64 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, u8 & x, u8 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, u16 & x, u16 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, u32 & x, u32 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, u64 & x, u64 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, float & x, float baseline ) { DeltaFundamental( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, char & x, char baseline ) { DeltaFixedBits( buf, x, baseline, 8 ); }
+static void Delta( DeltaBuffer * buf, s8 & x, s8 baseline ) { DeltaFixedBits( buf, x, baseline, 8 ); }
+static void Delta( DeltaBuffer * buf, s16 & x, s16 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, s32 & x, s32 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, s64 & x, s64 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, u8 & x, u8 baseline ) { DeltaFixedBits( buf, x, baseline, 8 ); }
+static void Delta( DeltaBuffer * buf, u16 & x, u16 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, u32 & x, u32 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, u64 & x, u64 baseline ) { DeltaInteger( buf, x, baseline ); }
+
+// floats are sent exactly, xored with the baseline so values that are close
+// to it share their sign/exponent/high mantissa bits and those get dropped
+static void Delta( DeltaBuffer * buf, float & x, float baseline ) {
+	u32 bits = std::bit_cast< u32 >( x );
+	u32 baseline_bits = std::bit_cast< u32 >( baseline );
+
+	if( buf->serializing ) {
+		AddBit( buf, bits != baseline_bits );
+		if( bits != baseline_bits ) {
+			AddVarBits( buf, bits ^ baseline_bits, 32 );
+		}
+	}
+	else {
+		if( GetBit( buf ) ) {
+			bits = baseline_bits ^ u32( GetVarBits( buf, 32 ) );
+		}
+		else {
+			bits = baseline_bits;
+		}
+		x = std::bit_cast< float >( bits );
+	}
+}
+
+static s32 Quantize( float x, float precision ) {
+	float q = roundf( x / precision );
+	if( !( q >= float( S32_MIN ) && q <= float( S32_MAX ) ) ) // also catches NaN
+		return 0;
+	return s32( q );
+}
+
+static void DeltaQuantized( DeltaBuffer * buf, float & x, float baseline, float precision ) {
+	s32 q = Quantize( x, precision );
+	s32 baseline_q = Quantize( baseline, precision );
+	DeltaInteger( buf, q, baseline_q );
+	if( !buf->serializing ) {
+		x = q * precision;
+	}
+}
+
+static void DeltaQuantized( DeltaBuffer * buf, Vec3 & v, const Vec3 & baseline, float precision ) {
+	for( int i = 0; i < 3; i++ ) {
+		DeltaQuantized( buf, v[ i ], baseline[ i ], precision );
+	}
+}
 
 static void Delta( DeltaBuffer * buf, bool & b, bool baseline ) {
 	if( buf->serializing ) {
@@ -208,8 +345,9 @@ void Delta( DeltaBuffer * buf, Optional< T > & x, const Optional< T > & baseline
 	}
 }
 
+// hashes are random so there's nothing to gain from sending the difference
 static void Delta( DeltaBuffer * buf, StringHash & hash, StringHash baseline ) {
-	DeltaFundamental( buf, hash.hash, baseline.hash );
+	DeltaFixedBits( buf, hash.hash, baseline.hash, 64 );
 }
 
 template< typename T, size_t N >
@@ -232,8 +370,8 @@ static void Delta( DeltaBuffer * buf, MinMax3 & b, const MinMax3 & baseline ) {
 
 static void Delta( DeltaBuffer * buf, RGBA8 & rgba, const RGBA8 & baseline ) {
 	Delta( buf, rgba.r, baseline.r );
-	Delta( buf, rgba.g, baseline.b );
-	Delta( buf, rgba.b, baseline.g );
+	Delta( buf, rgba.g, baseline.g );
+	Delta( buf, rgba.b, baseline.b );
 	Delta( buf, rgba.a, baseline.a );
 }
 
@@ -248,10 +386,16 @@ static void Delta( DeltaBuffer * buf, Capsule & c, const Capsule & baseline ) {
 	Delta( buf, c.radius, baseline.radius );
 }
 
+template< typename E >
+constexpr u32 EnumBits( E count ) {
+	using T = typename std::underlying_type< E >::type;
+	return std::bit_width( u64( T( count ) - 1 ) );
+}
+
 template< typename E >
 void DeltaEnum( DeltaBuffer * buf, E & x, E baseline, E count ) {
 	using T = typename std::underlying_type< E >::type;
-	Delta( buf, ( T & ) x, ( const T & ) baseline );
+	DeltaFixedBits( buf, ( T & ) x, ( const T & ) baseline, EnumBits( count ) );
 	if( x < 0 || x >= count ) {
 		buf->error = true;
 	}
@@ -266,7 +410,7 @@ void DeltaEnum( DeltaBuffer * buf, Optional< E > & x, Optional< E > baseline, E
 	using T = typename std::underlying_type< E >::type;
 	const T & baseline_to_delta_against = baseline.exists ? baseline.value : null_baseline;
 	if( x.exists ) {
-		Delta( buf, ( T & ) x.value, baseline_to_delta_against );
+		DeltaFixedBits( buf, ( T & ) x.value, baseline_to_delta_against, EnumBits( count ) );
 		if( x.value < 0 || x.value >= count ) {
 			buf->error = true;
 		}
@@ -276,7 +420,7 @@ void DeltaEnum( DeltaBuffer * buf, Optional< E > & x, Optional< E > baseline, E
 template< typename E >
 void DeltaBitfieldEnum( DeltaBuffer * buf, E & x, E baseline, E mask ) {
 	using T = typename std::underlying_type< E >::type;
-	Delta( buf, ( T & ) x, ( const T & ) baseline );
+	DeltaFixedBits( buf, ( T & ) x, ( const T & ) baseline, std::bit_width( u64( mask ) ) );
 	if( ( x & ~mask ) != 0 ) {
 		buf->error = true;
 	}
@@ -291,7 +435,7 @@ void DeltaBitfieldEnum( DeltaBuffer * buf, Optional< E > & x, Optional< E > base
 	using T = typename std::underlying_type< E >::type;
 	const T & baseline_to_delta_against = baseline.exists ? baseline.value : null_baseline;
 	if( x.exists ) {
-		Delta( buf, ( T & ) x.value, baseline_to_delta_against );
+		DeltaFixedBits( buf, ( T & ) x.value, baseline_to_delta_against, std::bit_width( u64( mask ) ) );
 		if( ( x.value & ~mask ) != 0 ) {
 			buf->error = true;
 		}
@@ -331,30 +475,31 @@ static void Delta( DeltaBuffer * buf, CollisionModel & cm, const CollisionModel
 	}
 }
 
-template< size_t N >
-constexpr auto SmallestSufficientIntType() {
-	if constexpr ( N < ( 1_u64 << 8 ) ) { return u8(); }
-	else if constexpr ( N < ( 1_u64 << 16 ) ) { return u16(); }
-	else if constexpr ( N < ( 1_u64 << 32 ) ) { return u32(); }
-	else { return u64(); }
-}
-
 template< size_t N >
 static void DeltaString( DeltaBuffer * buf, char ( &str )[ N ], const char ( &baseline )[ N ] ) {
+	constexpr u32 length_bits = std::bit_width( N - 1 );
+
 	if( buf->serializing ) {
 		bool diff = !StrEqual( str, baseline );
 		AddBit( buf, diff );
 		if( diff ) {
-			decltype( SmallestSufficientIntType< N >() ) n = strlen( str );
-			AddBytes( buf, &n, sizeof( n ) );
-			AddBytes( buf, str, n );
+			size_t n = strlen( str );
+			AddBits( buf, n, length_bits );
+			for( size_t i = 0; i < n; i++ ) {
+				AddBits( buf, u8( str[ i ] ), 8 );
+			}
 		}
 	}
 	else {
 		if( GetBit( buf ) ) {
-			decltype( SmallestSufficientIntType< N >() ) n;
-			GetBytes( buf, &n, sizeof( n ) );
-			GetBytes( buf, str, n );
+			size_t n = GetBits( buf, length_bits );
+			if( n >= N ) {
+				buf->error = true;
+				n = 0;
+			}
+			for( size_t i = 0; i < n; i++ ) {
+				str[ i ] = char( GetBits( buf, 8 ) );
+			}
 			str[ n ] = '\0';
 		}
 		else {
@@ -363,11 +508,19 @@ static void DeltaString( DeltaBuffer * buf, char ( &str )[ N ], const char ( &ba
 	}
 }
 
+// round rather than truncate so a received angle quantizes back to the same
+// value, otherwise deltas against it drift
+static u16 QuantizeAngle( float x ) {
+	return u16( u32( roundf( AngleNormalize360( x ) * ( 65536.0f / 360.0f ) ) ) );
+}
+
 static void DeltaAngle( DeltaBuffer * buf, float & x, const float & baseline ) {
-	u16 angle16 = AngleNormalize360( x ) / 360.0f * U16_MAX;
-	u16 baseline16 = AngleNormalize360( baseline ) / 360.0f * U16_MAX;
+	u16 angle16 = QuantizeAngle( x );
+	u16 baseline16 = QuantizeAngle( baseline );
 	Delta( buf, angle16, baseline16 );
-	x = angle16 / float( U16_MAX ) * 360.0f;
+	if( !buf->serializing ) {
+		x = angle16 * ( 360.0f / 65536.0f );
+	}
 }
 
 static void DeltaAngle( DeltaBuffer * buf, Vec3 & v, const Vec3 & baseline ) {
@@ -559,7 +712,7 @@ static void Delta( DeltaBuffer * buf, SyncEvent & event, const SyncEvent & basel
 static void Delta( DeltaBuffer * buf, SyncEntityState & ent, const SyncEntityState & baseline ) {
 	Delta( buf, ent.events, baseline.events );
 
-	Delta( buf, ent.origin, baseline.origin );
+	DeltaQuantized( buf, ent.origin, baseline.origin, SYNC_POSITION_PRECISION );
 	DeltaAngle( buf, ent.angles, baseline.angles );
 
 	Delta( buf, ent.override_collision_model, baseline.override_collision_model );
@@ -594,8 +747,8 @@ static void Delta( DeltaBuffer * buf, SyncEntityState & ent, const SyncEntitySta
 	Delta( buf, ent.linearMovement, baseline.linearMovement );
 	Delta( buf, ent.linearMovementDuration, baseline.linearMovementDuration );
 	Delta( buf, ent.linearMovementVelocity, baseline.linearMovementVelocity );
-	Delta( buf, ent.linearMovementBegin, baseline.linearMovementBegin );
-	Delta( buf, ent.linearMovementEnd, baseline.linearMovementEnd );
+	DeltaQuantized( buf, ent.linearMovementBegin, baseline.linearMovementBegin, SYNC_POSITION_PRECISION );
+	DeltaQuantized( buf, ent.linearMovementEnd, baseline.linearMovementEnd, SYNC_POSITION_PRECISION );
 	Delta( buf, ent.linearMovementTimeDelta, baseline.linearMovementTimeDelta );
 
 	Delta( buf, ent.silhouetteColor, baseline.silhouetteColor );
@@ -263,6 +263,46 @@ size_t UDPReceive( Socket socket, NetAddress * source, void * data, size_t n ) {
 	return 0;
 }
 
+static size_t UDPReceiveBatch( u64 handle, UDPDatagram * datagrams, size_t n ) {
+	if( handle == 0 ) {
+		return 0;
+	}
+
+	constexpr size_t max_batch = 64;
+
+	size_t total = 0;
+	while( total < n ) {
+		OSDatagram os_datagrams[ max_batch ];
+		sockaddr_storage sources[ max_batch ];
+
+		size_t batch = Min2( n - total, max_batch );
+		for( size_t i = 0; i < batch; i++ ) {
+			os_datagrams[ i ] = { datagrams[ total + i ].data, datagrams[ total + i ].capacity, &sources[ i ], 0 };
+		}
+
+		size_t received = OSSocketReceiveBatch( handle, os_datagrams, batch );
+		for( size_t i = 0; i < received; i++ ) {
+			datagrams[ total + i ].size = os_datagrams[ i ].received;
+			datagrams[ total + i ].source = SockaddrToNetAddress( &sources[ i ] );
+		}
+
+		total += received;
+		if( received < batch ) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+size_t UDPReceiveBatch( Socket socket, UDPDatagram * datagrams, size_t n ) {
+	Assert( socket.type == SocketType_UDPClient || socket.type == SocketType_UDPServer );
+
+	size_t received = UDPReceiveBatch( socket.ipv4, datagrams, n );
+	received += UDPReceiveBatch( socket.ipv6, datagrams + received, n - received );
+	return received;
+}
+
 bool TCPAccept( Socket server, NonBlockingBool nonblocking, Socket * client, NetAddress * address ) {
 	Assert( server.type == SocketType_TCPServer );
 
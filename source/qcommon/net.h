@@ -68,6 +68,16 @@ void CloseSocket( Socket socket );
 size_t UDPSend( Socket socket, NetAddress destination, const void * data, size_t n );
 size_t UDPReceive( Socket socket, NetAddress * source, void * data, size_t n );
 
+struct UDPDatagram {
+	void * data;
+	size_t capacity;
+	size_t size;
+	NetAddress source;
+};
+
+// drains up to n pending datagrams, returns how many were received
+size_t UDPReceiveBatch( Socket socket, UDPDatagram * datagrams, size_t n );
+
 bool TCPAccept( Socket server, NonBlockingBool nonblocking, Socket * client, NetAddress * address );
 bool TCPSend( Socket socket, const void * data, size_t n, size_t * sent );
 bool TCPSendFile( Socket socket, FILE * file, size_t offset, size_t n, size_t * sent );
@@ -20,6 +20,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "qcommon/qcommon.h"
 #include "qcommon/csprng.h"
+#include "qcommon/fs.h"
+#include "qcommon/string.h"
+#include "qcommon/time.h"
 
 #include "zstd/zstd.h"
 
@@ -84,6 +87,17 @@ static Cvar * showpackets;
 static Cvar * showdrop;
 static Cvar * net_showfragments;
 
+static NetchanCompressor * main_thread_compressor;
+static ZSTD_DCtx * main_thread_decompressor;
+
+struct NetchanDictionary {
+	u32 id;
+	ZSTD_CDict * cdicts[ ARRAY_COUNT( NETCHAN_COMPRESSION_LEVELS ) ];
+	ZSTD_DDict * ddict;
+};
+
+static NetchanDictionary dictionary;
+
 /*
 * Netchan_OutOfBand
 *
@@ -129,14 +143,61 @@ void Netchan_Setup( netchan_t * chan, const NetAddress & address, u64 session_id
 	chan->outgoingSequence = 1;
 }
 
-void Netchan_CompressMessage( msg_t * msg ) {
-	static u8 compressed[ MAX_MSGLEN ];
-	size_t compressed_size = ZSTD_compress( compressed, sizeof( compressed ), msg->data, msg->cursize, ZSTD_CLEVEL_DEFAULT );
+struct NetchanCompressor {
+	ZSTD_CCtx * zstd;
+	u8 compressed[ MAX_MSGLEN ];
+};
+
+NetchanCompressor * NewNetchanCompressor() {
+	NetchanCompressor * compressor = Alloc< NetchanCompressor >( sys_allocator );
+	compressor->zstd = ZSTD_createCCtx();
+	if( compressor->zstd == NULL ) {
+		Fatal( "ZSTD_createCCtx" );
+	}
+	return compressor;
+}
+
+void DeleteNetchanCompressor( NetchanCompressor * compressor ) {
+	if( compressor == NULL )
+		return;
+	ZSTD_freeCCtx( compressor->zstd );
+	Free( sys_allocator, compressor );
+}
+
+u32 Netchan_DictionaryID() {
+	return dictionary.id;
+}
+
+void Netchan_NegotiateDictionary( netchan_t * chan, u64 remote_dictionary_id ) {
+	chan->dictionary_id = remote_dictionary_id == dictionary.id ? dictionary.id : 0;
+}
+
+void Netchan_CompressMessage( const netchan_t * chan, msg_t * msg, NetchanCompressor * compressor ) {
+	if( compressor == NULL ) {
+		compressor = main_thread_compressor;
+	}
+
+	size_t level = Netchan_CompressionLevel( msg->cursize );
+	Time start = Now();
+
+	size_t compressed_size;
+	if( chan->dictionary_id != 0 ) {
+		Assert( chan->dictionary_id == dictionary.id );
+		compressed_size = ZSTD_compress_usingCDict( compressor->zstd, compressor->compressed, sizeof( compressor->compressed ), msg->data, msg->cursize, dictionary.cdicts[ level ] );
+	}
+	else {
+		compressed_size = ZSTD_compressCCtx( compressor->zstd, compressor->compressed, sizeof( compressor->compressed ), msg->data, msg->cursize, NETCHAN_COMPRESSION_LEVELS[ level ].level );
+	}
+
+	TracyPlotSample( "Netchan compression us", ToSeconds( Now() - start ) * 1000000.0f );
+
 	if( ZSTD_isError( compressed_size ) || compressed_size >= msg->cursize )
 		return;
 
+	TracyPlotSample( "Netchan compression ratio", float( msg->cursize ) / float( compressed_size ) );
+
 	MSG_Clear( msg );
-	MSG_Write( msg, compressed, compressed_size );
+	MSG_Write( msg, compressor->compressed, compressed_size );
 	msg->compressed = true;
 }
 
@@ -144,8 +205,23 @@ bool Netchan_DecompressMessage( msg_t * msg ) {
 	if( !msg->compressed )
 		return true;
 
+	const u8 * compressed = msg->data + msg->readcount;
+	size_t compressed_size = msg->cursize - msg->readcount;
+
+	// frames that were compressed without a dictionary must be decompressed
+	// without one too, or the repeat offsets come out wrong
+	unsigned frame_dictionary_id = ZSTD_getDictID_fromFrame( compressed, compressed_size );
+	if( frame_dictionary_id != 0 && frame_dictionary_id != dictionary.id )
+		return false;
+
 	static u8 decompressed[ MAX_MSGLEN ];
-	size_t decompressed_size = ZSTD_decompress( decompressed, sizeof( decompressed ) - msg->readcount, msg->data + msg->readcount, msg->cursize - msg->readcount );
+	size_t decompressed_size;
+	if( frame_dictionary_id != 0 ) {
+		decompressed_size = ZSTD_decompress_usingDDict( main_thread_decompressor, decompressed, sizeof( decompressed ) - msg->readcount, compressed, compressed_size, dictionary.ddict );
+	}
+	else {
+		decompressed_size = ZSTD_decompressDCtx( main_thread_decompressor, decompressed, sizeof( decompressed ) - msg->readcount, compressed, compressed_size );
+	}
 	if( ZSTD_isError( decompressed_size ) )
 		return false;
 
@@ -468,11 +544,53 @@ bool Netchan_Process( netchan_t * chan, msg_t * msg ) {
 	return true;
 }
 
+static void LoadDictionary() {
+	DynamicString path( sys_allocator, "{}/base/netchan.zdict", RootDirPath() );
+	Span< u8 > data = ReadFileBinary( sys_allocator, path.c_str() );
+	if( data.ptr == NULL )
+		return;
+	defer { Free( sys_allocator, data.ptr ); };
+
+	u32 id = ZSTD_getDictID_fromDict( data.ptr, data.n );
+	if( id == 0 ) {
+		Com_GGPrint( S_COLOR_YELLOW "{} isn't a zstd dictionary", path );
+		return;
+	}
+
+	for( size_t i = 0; i < ARRAY_COUNT( dictionary.cdicts ); i++ ) {
+		dictionary.cdicts[ i ] = ZSTD_createCDict( data.ptr, data.n, NETCHAN_COMPRESSION_LEVELS[ i ].level );
+		if( dictionary.cdicts[ i ] == NULL ) {
+			Fatal( "ZSTD_createCDict" );
+		}
+	}
+	dictionary.ddict = ZSTD_createDDict( data.ptr, data.n );
+	if( dictionary.ddict == NULL ) {
+		Fatal( "ZSTD_createDDict" );
+	}
+	dictionary.id = id;
+}
+
 void Netchan_Init() {
 	showpackets = NewCvar( "showpackets", "0" );
 	showdrop = NewCvar( "showdrop", "0" );
 	net_showfragments = NewCvar( "net_showfragments", "0" );
+
+	main_thread_compressor = NewNetchanCompressor();
+	main_thread_decompressor = ZSTD_createDCtx();
+	if( main_thread_decompressor == NULL ) {
+		Fatal( "ZSTD_createDCtx" );
+	}
+
+	LoadDictionary();
 }
 
 void Netchan_Shutdown() {
+	for( ZSTD_CDict * cdict : dictionary.cdicts ) {
+		ZSTD_freeCDict( cdict );
+	}
+	ZSTD_freeDDict( dictionary.ddict );
+	dictionary = { };
+
+	ZSTD_freeDCtx( main_thread_decompressor );
+	DeleteNetchanCompressor( main_thread_compressor );
 }
@@ -26,8 +26,31 @@ struct netchan_t {
 	size_t unsentLength;
 	uint8_t unsentBuffer[MAX_MSGLEN];
 	bool unsentIsCompressed;
+
+	u32 dictionary_id; // compress with the shared dictionary if both ends have it, 0 otherwise
+};
+
+// small packets are cheap to compress hard, big ones would take too long
+struct NetchanCompressionLevel {
+	size_t max_size;
+	int level;
+};
+
+constexpr NetchanCompressionLevel NETCHAN_COMPRESSION_LEVELS[] = {
+	{ 256, 9 },
+	{ 1024, 7 },
+	{ 4096, 5 },
+	{ MAX_MSGLEN, 3 },
 };
 
+inline size_t Netchan_CompressionLevel( size_t size ) {
+	size_t i = 0;
+	while( size > NETCHAN_COMPRESSION_LEVELS[ i ].max_size && i < ARRAY_COUNT( NETCHAN_COMPRESSION_LEVELS ) - 1 ) {
+		i++;
+	}
+	return i;
+}
+
 void Netchan_Init();
 void Netchan_Shutdown();
 void Netchan_Setup( netchan_t * chan, const NetAddress & address, u64 session_id );
@@ -35,7 +58,17 @@ bool Netchan_Process( netchan_t * chan, msg_t * msg );
 bool Netchan_Transmit( Socket socket, netchan_t * chan, msg_t * msg );
 bool Netchan_PushAllFragments( Socket socket, netchan_t * chan );
 bool Netchan_TransmitNextFragment( Socket socket, netchan_t * chan );
-void Netchan_CompressMessage( msg_t * msg );
+// reusable compression state so messages can be compressed from several threads at once
+struct NetchanCompressor;
+NetchanCompressor * NewNetchanCompressor();
+void DeleteNetchanCompressor( NetchanCompressor * compressor );
+
+// both ends send the ID of their base/netchan.zdict while connecting and
+// only use it if they match. see source/tools/netdict
+u32 Netchan_DictionaryID();
+void Netchan_NegotiateDictionary( netchan_t * chan, u64 remote_dictionary_id );
+
+void Netchan_CompressMessage( const netchan_t * chan, msg_t * msg, NetchanCompressor * compressor = NULL );
 bool Netchan_DecompressMessage( msg_t * msg );
 
 [[gnu::format( printf, 3, 4 )]] void Netchan_OutOfBandPrint( Socket socket, const NetAddress & address, const char * format, ... );
@@ -25,5 +25,15 @@ void OSSocketSetSockOptOne( u64 handle, int level, int opt );
 bool OSSocketSend( u64 handle, const void * data, size_t n, const sockaddr_storage * destination, size_t destination_size, size_t * sent );
 bool OSSocketReceive( u64 handle, void * data, size_t n, sockaddr_storage * source, size_t * received );
 
+struct OSDatagram {
+	void * data;
+	size_t capacity;
+	sockaddr_storage * source;
+	size_t received;
+};
+
+// UDP only, returns the number of datagrams received
+size_t OSSocketReceiveBatch( u64 handle, OSDatagram * datagrams, size_t n );
+
 void OSSocketListen( u64 handle );
 u64 OSSocketAccept( u64 handle, sockaddr_storage * address );
@@ -11,7 +11,9 @@
 // these must come after qcommon because both tracy and one of these defines BLOCK_SIZE
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 char * FindHomeDirectory( Allocator * a ) {
@@ -40,6 +42,42 @@ bool CreateDirectory( Allocator * a, const char * path ) {
 	return mkdir( path, 0755 ) == 0 || errno == EEXIST;
 }
 
+bool GetFileMetadata( Allocator * a, const char * path, FileMetadata * metadata ) {
+	struct stat st;
+	if( stat( path, &st ) != 0 )
+		return false;
+
+	metadata->size = st.st_size;
+	metadata->modified_time = st.st_mtime;
+	return true;
+}
+
+Span< const u8 > MapFile( Allocator * a, const char * path ) {
+	int fd = open( path, O_RDONLY );
+	if( fd == -1 )
+		return Span< const u8 >();
+	defer { close( fd ); };
+
+	struct stat st;
+	if( fstat( fd, &st ) != 0 || st.st_size == 0 )
+		return Span< const u8 >();
+
+	void * mapped = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if( mapped == MAP_FAILED )
+		return Span< const u8 >();
+
+	return Span< const u8 >( ( const u8 * ) mapped, st.st_size );
+}
+
+void UnmapFile( Span< const u8 > file ) {
+	if( file.ptr == NULL )
+		return;
+
+	if( munmap( const_cast< u8 * >( file.ptr ), file.n ) != 0 ) {
+		FatalErrno( "munmap" );
+	}
+}
+
 struct ListDirHandleImpl {
 	DIR * dir;
 };
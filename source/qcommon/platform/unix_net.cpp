@@ -128,6 +128,59 @@ bool OSSocketReceive( u64 handle, void * data, size_t n, sockaddr_storage * sour
 	}
 }
 
+#if PLATFORM_LINUX
+
+size_t OSSocketReceiveBatch( u64 handle, OSDatagram * datagrams, size_t n ) {
+	constexpr size_t max_batch = 64;
+	n = Min2( n, max_batch );
+
+	iovec iovs[ max_batch ];
+	mmsghdr headers[ max_batch ];
+	for( size_t i = 0; i < n; i++ ) {
+		iovs[ i ] = { datagrams[ i ].data, datagrams[ i ].capacity };
+		headers[ i ] = { };
+		headers[ i ].msg_hdr.msg_name = datagrams[ i ].source;
+		headers[ i ].msg_hdr.msg_namelen = sizeof( sockaddr_in6 );
+		headers[ i ].msg_hdr.msg_iov = &iovs[ i ];
+		headers[ i ].msg_hdr.msg_iovlen = 1;
+	}
+
+	int socket = HandleToOSSocket( handle );
+
+	while( true ) {
+		int ret = recvmmsg( socket, headers, checked_cast< unsigned int >( n ), MSG_DONTWAIT, NULL );
+		if( ret == -1 ) {
+			if( errno == EINTR ) {
+				continue;
+			}
+			if( errno == EAGAIN || errno == ECONNRESET || errno == ECONNREFUSED ) {
+				return 0;
+			}
+			FatalErrno( "recvmmsg" );
+		}
+
+		for( int i = 0; i < ret; i++ ) {
+			datagrams[ i ].received = headers[ i ].msg_len;
+		}
+
+		return checked_cast< size_t >( ret );
+	}
+}
+
+#else
+
+size_t OSSocketReceiveBatch( u64 handle, OSDatagram * datagrams, size_t n ) {
+	for( size_t i = 0; i < n; i++ ) {
+		if( !OSSocketReceive( handle, datagrams[ i ].data, datagrams[ i ].capacity, datagrams[ i ].source, &datagrams[ i ].received ) || datagrams[ i ].received == 0 ) {
+			return i;
+		}
+	}
+
+	return n;
+}
+
+#endif
+
 void OSSocketListen( u64 handle ) {
 	if( handle == 0 ) {
 		return;
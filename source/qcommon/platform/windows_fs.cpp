@@ -106,6 +106,54 @@ bool RemoveFile( Allocator * a, const char * path ) {
 	return DeleteFileW( wide_path ) != 0;
 }
 
+bool GetFileMetadata( Allocator * a, const char * path, FileMetadata * metadata ) {
+	wchar_t * wide_path = UTF8ToWide( a, path );
+	defer { Free( a, wide_path ); };
+
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if( GetFileAttributesExW( wide_path, GetFileExInfoStandard, &attributes ) == 0 )
+		return false;
+
+	metadata->size = ( u64( attributes.nFileSizeHigh ) << 32 ) | attributes.nFileSizeLow;
+	metadata->modified_time = s64( ( u64( attributes.ftLastWriteTime.dwHighDateTime ) << 32 ) | attributes.ftLastWriteTime.dwLowDateTime );
+	return true;
+}
+
+Span< const u8 > MapFile( Allocator * a, const char * path ) {
+	wchar_t * wide_path = UTF8ToWide( a, path );
+	defer { Free( a, wide_path ); };
+
+	HANDLE file = CreateFileW( wide_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if( file == INVALID_HANDLE_VALUE )
+		return Span< const u8 >();
+	defer { CloseHandle( file ); };
+
+	LARGE_INTEGER size;
+	if( GetFileSizeEx( file, &size ) == 0 || size.QuadPart == 0 )
+		return Span< const u8 >();
+
+	// the view keeps the mapping alive after we close it
+	HANDLE mapping = CreateFileMappingW( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if( mapping == NULL )
+		return Span< const u8 >();
+	defer { CloseHandle( mapping ); };
+
+	const void * mapped = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if( mapped == NULL )
+		return Span< const u8 >();
+
+	return Span< const u8 >( ( const u8 * ) mapped, size.QuadPart );
+}
+
+void UnmapFile( Span< const u8 > file ) {
+	if( file.ptr == NULL )
+		return;
+
+	if( UnmapViewOfFile( file.ptr ) == 0 ) {
+		FatalGLE( "UnmapViewOfFile" );
+	}
+}
+
 #undef CreateDirectory
 bool CreateDirectory( Allocator * a, const char * path ) {
 	wchar_t * wide_path = UTF8ToWide( a, path );
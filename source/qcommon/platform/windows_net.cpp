@@ -137,6 +137,16 @@ bool OSSocketReceive( u64 handle, void * data, size_t n, sockaddr_storage * sour
 	return true;
 }
 
+size_t OSSocketReceiveBatch( u64 handle, OSDatagram * datagrams, size_t n ) {
+	for( size_t i = 0; i < n; i++ ) {
+		if( !OSSocketReceive( handle, datagrams[ i ].data, datagrams[ i ].capacity, datagrams[ i ].source, &datagrams[ i ].received ) || datagrams[ i ].received == 0 ) {
+			return i;
+		}
+	}
+
+	return n;
+}
+
 void OSSocketListen( u64 handle ) {
 	if( handle == 0 ) {
 		return;
@@ -20,13 +20,98 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "qcommon/qcommon.h"
 #include "server/server.h"
+#include "game/g_maps.h"
+#include "gameshared/intersection_tests.h"
+
+void SNAP_ClearEntityDeltaCache( EntityDeltaCache * delta_cache, int64_t frameNum ) {
+	delta_cache->frameNum = frameNum;
+
+	for( EntityDeltaCacheSlot & slot : delta_cache->slots ) {
+		slot.key.store( 0, std::memory_order_relaxed );
+		slot.size_plus_one.store( 0, std::memory_order_relaxed );
+	}
+
+	delta_cache->data_used.store( 0, std::memory_order_relaxed );
+	delta_cache->hits.store( 0, std::memory_order_relaxed );
+	delta_cache->misses.store( 0, std::memory_order_relaxed );
+	delta_cache->bytes_saved.store( 0, std::memory_order_relaxed );
+}
+
+/*
+* SNAP_WriteDeltaEntity
+*
+* MSG_WriteDeltaEntity, but if another client already wrote the delta from the
+* same baseline we copy their bytes instead of encoding it again. baseline_frame
+* is the frame the baseline was captured in, or -1 for the map baselines.
+*
+* If the slot for this delta is still being filled by another thread we encode
+* it ourselves rather than wait.
+*/
+static void SNAP_WriteDeltaEntity( msg_t * msg, const SyncEntityState * baseline, int64_t baseline_frame,
+	const SyncEntityState * ent, bool force, EntityDeltaCache * delta_cache
+) {
+	if( delta_cache == NULL ) {
+		MSG_WriteDeltaEntity( msg, baseline, ent, force );
+		return;
+	}
+
+	constexpr size_t max_probes = 16;
+	constexpr u64 mask = ENTITY_DELTA_CACHE_SLOTS - 1;
+	STATIC_ASSERT( IsPowerOf2( ENTITY_DELTA_CACHE_SLOTS ) );
+
+	// force is implied by baseline_frame so it doesn't need to go in the key
+	u64 key = ( u64( baseline_frame + 1 ) << 16 ) | ( u64( ent->number ) << 1 ) | 1;
+	u64 base = Hash64( key );
+
+	EntityDeltaCacheSlot * claimed = NULL;
+	for( size_t i = 0; i < max_probes; i++ ) {
+		EntityDeltaCacheSlot * slot = &delta_cache->slots[ ( base + i ) & mask ];
+
+		u64 slot_key = slot->key.load( std::memory_order_relaxed );
+		if( slot_key == 0 && slot->key.compare_exchange_strong( slot_key, key ) ) {
+			claimed = slot;
+			break;
+		}
+
+		if( slot_key == key ) {
+			u32 size_plus_one = slot->size_plus_one.load( std::memory_order_acquire );
+			if( size_plus_one == 0 )
+				break;
+
+			u32 size = size_plus_one - 1;
+			MSG_Write( msg, delta_cache->data + slot->offset, size );
+			delta_cache->hits.fetch_add( 1, std::memory_order_relaxed );
+			delta_cache->bytes_saved.fetch_add( size, std::memory_order_relaxed );
+			return;
+		}
+	}
+
+	delta_cache->misses.fetch_add( 1, std::memory_order_relaxed );
+
+	size_t start = msg->cursize;
+	MSG_WriteDeltaEntity( msg, baseline, ent, force );
+
+	if( claimed == NULL )
+		return;
+
+	// if the data buffer is full the slot never gets published, so everyone
+	// else encodes this delta themselves
+	size_t size = msg->cursize - start;
+	size_t offset = delta_cache->data_used.fetch_add( size, std::memory_order_relaxed );
+	if( offset + size > sizeof( delta_cache->data ) )
+		return;
+
+	memcpy( delta_cache->data + offset, msg->data + start, size );
+	claimed->offset = checked_cast< u32 >( offset );
+	claimed->size_plus_one.store( checked_cast< u32 >( size + 1 ), std::memory_order_release );
+}
 
 /*
 * SNAP_EmitPacketEntities
 *
 * Writes a delta update of an SyncEntityState list to the message.
 */
-static void SNAP_EmitPacketEntities( const ginfo_t * gi, const client_snapshot_t * from, const client_snapshot_t * to, msg_t * msg, const SyncEntityState * baselines, const SyncEntityState * client_entities, int num_client_entities ) {
+static void SNAP_EmitPacketEntities( const ginfo_t * gi, const client_snapshot_t * from, const client_snapshot_t * to, msg_t * msg, const SyncEntityState * baselines, const SyncEntityState * client_entities, int num_client_entities, EntityDeltaCache * delta_cache ) {
 	MSG_WriteUint8( msg, svc_packetentities );
 
 	int from_num_entities = from == NULL ? 0 : from->num_entities;
@@ -58,7 +143,7 @@ static void SNAP_EmitPacketEntities( const ginfo_t * gi, const client_snapshot_t
 			// in any bytes being emited if the entity has not changed at all
 			// note that players are always 'newentities', this updates their oldorigin always
 			// and prevents warping ( wsw : jal : I removed it from the players )
-			MSG_WriteDeltaEntity( msg, oldent, newent, false );
+			SNAP_WriteDeltaEntity( msg, oldent, from->frameNum, newent, false, delta_cache );
 			oldindex++;
 			newindex++;
 			continue;
@@ -66,7 +151,7 @@ static void SNAP_EmitPacketEntities( const ginfo_t * gi, const client_snapshot_t
 
 		if( newnum < oldnum ) {
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity( msg, &baselines[newnum], newent, true );
+			SNAP_WriteDeltaEntity( msg, &baselines[newnum], -1, newent, true, delta_cache );
 			newindex++;
 			continue;
 		}
@@ -193,7 +278,7 @@ static void SNAP_WriteMultiPOVCommands( const ginfo_t * gi, const client_t * cli
 }
 
 void SNAP_WriteFrameSnapToClient( const ginfo_t * gi, client_t * client, msg_t * msg, int64_t frameNum, int64_t gameTime,
-								  const SyncEntityState * baselines, const client_entities_t * client_entities ) {
+								  const SyncEntityState * baselines, const client_entities_t * client_entities, EntityDeltaCache * delta_cache ) {
 	// this is the frame we are creating
 	client_snapshot_t * frame = &client->snapShots[ frameNum % ARRAY_COUNT( client->snapShots ) ];
 
@@ -220,6 +305,9 @@ void SNAP_WriteFrameSnapToClient( const ginfo_t * gi, client_t * client, msg_t *
 		if( oldframe->multipov != frame->multipov ) {
 			oldframe = NULL;        // don't delta compress a frame of different POV type
 		}
+		else if( s64( oldframe->first_entity ) < s64( client_entities->next_entities ) - s64( client_entities->num_entities ) ) {
+			oldframe = NULL;        // the entities have been overwritten in the circular buffer
+		}
 	}
 
 	MSG_WriteUint8( msg, svc_frame );
@@ -282,7 +370,10 @@ void SNAP_WriteFrameSnapToClient( const ginfo_t * gi, client_t * client, msg_t *
 	MSG_WriteUint8( msg, 0 );
 
 	// delta encode the entities
-	SNAP_EmitPacketEntities( gi, oldframe, frame, msg, baselines, client_entities->entities, client_entities->num_entities );
+	if( delta_cache != NULL && delta_cache->frameNum != frameNum ) {
+		delta_cache = NULL;
+	}
+	SNAP_EmitPacketEntities( gi, oldframe, frame, msg, baselines, client_entities->entities, client_entities->num_entities, delta_cache );
 
 	client->lastSentFrameNum = frameNum;
 }
@@ -295,13 +386,6 @@ Build a client frame structure
 =============================================================================
 */
 
-#define MAX_SNAPSHOT_ENTITIES   1024
-typedef struct {
-	int numSnapshotEntities;
-	int snapshotEntities[MAX_SNAPSHOT_ENTITIES];
-	uint8_t entityAddedToSnapList[MAX_EDICTS / 8];
-} snapshotEntityNumbers_t;
-
 static bool SNAP_AddEntNumToSnapList( int entNum, snapshotEntityNumbers_t *entList ) {
 	if( entNum >= MAX_EDICTS ) {
 		return false;
@@ -342,7 +426,148 @@ static bool SNAP_SnapCullSoundEntity( const edict_t * ent, Vec3 listener_origin
 	return gain <= 0.05f;
 }
 
-static bool SNAP_SnapCullEntity( const edict_t * ent, const edict_t * clent, const client_snapshot_t * frame, Vec3 vieworg ) {
+// entities that go out of sight keep getting sent for this long so they don't pop
+constexpr int64_t SNAP_OCCLUSION_LINGER = 1000;
+// roughly how far ahead of the server the client has predicted its own view, in seconds
+constexpr float SNAP_OCCLUSION_LOOKAHEAD = 0.1f;
+// grow the entity bounds by this much so the test stays conservative
+constexpr float SNAP_OCCLUSION_MARGIN = 32.0f;
+// reuse an occluded result until the viewer or the entity moves this far
+constexpr float SNAP_OCCLUSION_RETEST_DISTANCE = 8.0f;
+
+struct SnapOcclusionView {
+	const MapData * map;
+	client_t * client;
+	Vec3 eye;
+	Vec3 predicted_eye;
+	int64_t time;
+};
+
+static bool SNAP_IsOcclusionCullable( const edict_t * ent, const edict_t * clent ) {
+	// anything that makes noise or gets drawn through walls has to be sent
+	if( ent->s.sound != EMPTY_HASH || ent->s.positioned_sound ) {
+		return false;
+	}
+	for( const SyncEvent & event : ent->s.events ) {
+		if( event.type != EV_NONE ) {
+			return false;
+		}
+	}
+	if( ent->s.silhouetteColor.a != 0 ) {
+		return false;
+	}
+	if( ent->s.ownerNum == clent->s.number ) {
+		return false;
+	}
+
+	// static entities delta to nothing, so culling them would only cost
+	// bandwidth when they get sent from the baseline again
+	switch( ent->s.type ) {
+		case ET_PLAYER:
+		case ET_CORPSE:
+		case ET_ROCKET:
+		case ET_GRENADE:
+		case ET_STUNGRENADE:
+		case ET_ARBULLET:
+		case ET_BUBBLE:
+		case ET_RAILALT:
+		case ET_RIFLEBULLET:
+		case ET_PISTOLBULLET:
+		case ET_STAKE:
+		case ET_BLAST:
+		case ET_SAWBLADE:
+		case ET_SHURIKEN:
+		case ET_THROWING_AXE:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+static bool SNAP_LineOfSight( const MapData * map, Vec3 start, Vec3 end ) {
+	Ray ray = MakeRayStartEnd( start, end );
+
+	Shape shape = { };
+	shape.type = ShapeType_Ray;
+
+	Intersection intersection;
+	if( !SweptShapeVsMapModel( map, &map->models[ 0 ], ray, shape, SolidMask_Opaque, &intersection ) ) {
+		return true;
+	}
+
+	return intersection.t >= ray.length;
+}
+
+static bool SNAP_BoundsInLineOfSight( const MapData * map, Vec3 eye, Vec3 predicted_eye, const MinMax3 & bounds ) {
+	bool inside = true;
+	for( int i = 0; i < 3; i++ ) {
+		inside = inside && eye[ i ] >= bounds.mins[ i ] && eye[ i ] <= bounds.maxs[ i ];
+	}
+	if( inside ) {
+		return true;
+	}
+
+	Vec3 points[ 9 ];
+	points[ 0 ] = ( bounds.mins + bounds.maxs ) * 0.5f;
+	for( int i = 0; i < 8; i++ ) {
+		points[ i + 1 ] = Vec3(
+			( i & 1 ) ? bounds.maxs.x : bounds.mins.x,
+			( i & 2 ) ? bounds.maxs.y : bounds.mins.y,
+			( i & 4 ) ? bounds.maxs.z : bounds.mins.z
+		);
+	}
+
+	for( Vec3 point : points ) {
+		if( SNAP_LineOfSight( map, eye, point ) || SNAP_LineOfSight( map, predicted_eye, point ) ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+* SNAP_OcclusionCullEntity
+*
+* Conservative line of sight test against the world brushes. Entities that
+* pass are remembered for SNAP_OCCLUSION_LINGER ms, which saves retesting
+* them every snap and stops them flickering in and out around corners.
+*/
+static bool SNAP_OcclusionCullEntity( const SnapOcclusionView * view, const edict_t * ent ) {
+	client_entity_visibility_t * vis = &view->client->entity_visibility[ ent->s.number ];
+
+	int64_t since_visible = view->time - vis->last_visible;
+	if( since_visible < SNAP_OCCLUSION_LINGER / 2 ) {
+		return false;
+	}
+
+	bool moved = !vis->occluded ||
+		Length( view->eye - vis->tested_eye ) > SNAP_OCCLUSION_RETEST_DISTANCE ||
+		Length( ent->s.origin - vis->tested_origin ) > SNAP_OCCLUSION_RETEST_DISTANCE;
+
+	if( moved ) {
+		MinMax3 bounds = ServerEntityBounds( &ent->s );
+		if( bounds.mins.x > bounds.maxs.x ) {
+			bounds = MinMax3( 0.0f );
+		}
+		bounds = MinMax3( bounds.mins + ent->s.origin - SNAP_OCCLUSION_MARGIN, bounds.maxs + ent->s.origin + SNAP_OCCLUSION_MARGIN );
+
+		if( SNAP_BoundsInLineOfSight( view->map, view->eye, view->predicted_eye, bounds ) ) {
+			vis->last_visible = view->time;
+			vis->occluded = false;
+			return false;
+		}
+
+		vis->occluded = true;
+		vis->tested_eye = view->eye;
+		vis->tested_origin = ent->s.origin;
+	}
+
+	return since_visible >= SNAP_OCCLUSION_LINGER;
+}
+
+static bool SNAP_SnapCullEntity( const edict_t * ent, const edict_t * clent, const client_snapshot_t * frame, Vec3 vieworg, const SnapOcclusionView * occlusion ) {
 	// filters: this entity has been disabled for comunication
 	if( ent->s.svflags & SVF_NOCLIENT ) {
 		return true;
@@ -388,17 +613,21 @@ static bool SNAP_SnapCullEntity( const edict_t * ent, const edict_t * clent, con
 		return SNAP_SnapCullSoundEntity( ent, vieworg );
 	}
 
+	if( occlusion != NULL && SNAP_IsOcclusionCullable( ent, clent ) ) {
+		return SNAP_OcclusionCullEntity( occlusion, ent );
+	}
+
 	return false;
 }
 
-static void SNAP_AddEntitiesVisibleAtOrigin( const ginfo_t * gi, const edict_t * clent, Vec3 vieworg, const client_snapshot_t * frame, snapshotEntityNumbers_t * entList ) {
+static void SNAP_AddEntitiesVisibleAtOrigin( const ginfo_t * gi, const edict_t * clent, Vec3 vieworg, const client_snapshot_t * frame, const SnapOcclusionView * occlusion, snapshotEntityNumbers_t * entList ) {
 	// add the entities to the list
 	for( int entNum = 0; entNum < gi->num_edicts; entNum++ ) {
 		const edict_t * ent = EDICT_NUM( entNum );
 		Assert( ent->s.number == entNum );
 
 		// always add the client entity, even if SVF_NOCLIENT
-		if( ent != clent && SNAP_SnapCullEntity( ent, clent, frame, vieworg ) ) {
+		if( ent != clent && SNAP_SnapCullEntity( ent, clent, frame, vieworg, occlusion ) ) {
 			continue;
 		}
 
@@ -414,7 +643,7 @@ static void SNAP_AddEntitiesVisibleAtOrigin( const ginfo_t * gi, const edict_t *
 	}
 }
 
-static void SNAP_BuildSnapEntitiesList( const ginfo_t * gi, const edict_t * clent, Vec3 vieworg, const client_snapshot_t * frame, snapshotEntityNumbers_t * entList ) {
+static void SNAP_BuildSnapEntitiesList( const ginfo_t * gi, const edict_t * clent, Vec3 vieworg, const client_snapshot_t * frame, const SnapOcclusionView * occlusion, snapshotEntityNumbers_t * entList ) {
 	entList->numSnapshotEntities = 0;
 	memset( entList->entityAddedToSnapList, 0, sizeof( entList->entityAddedToSnapList ) );
 
@@ -427,27 +656,30 @@ static void SNAP_BuildSnapEntitiesList( const ginfo_t * gi, const edict_t * clen
 		SNAP_AddEntNumToSnapList( entNum, entList );
 	}
 
-	SNAP_AddEntitiesVisibleAtOrigin( gi, clent, vieworg, frame, entList );
+	SNAP_AddEntitiesVisibleAtOrigin( gi, clent, vieworg, frame, occlusion, entList );
 
 	SNAP_SortSnapList( entList );
 }
 
 /*
-* SNAP_BuildClientFrameSnap
+* SNAP_BuildClientFrame
 *
 * Decides which entities are going to be visible to the client, and
-* copies off the playerstat and areabits.
+* copies off the playerstate and game state. Only touches the client's
+* own frame so it's safe to run for several clients in parallel.
+*
+* With occlusion_culling, entities that are out of the player's line of
+* sight get left out too. Spectators and dead players see everything.
 */
-void SNAP_BuildClientFrameSnap( const ginfo_t * gi, int64_t frameNum, int64_t timeStamp,
-	client_t * client,
-	const SyncGameState * gameState, client_entities_t * client_entities
+bool SNAP_BuildClientFrame( const ginfo_t * gi, int64_t frameNum, int64_t timeStamp,
+	client_t * client, const SyncGameState * gameState, snapshotEntityNumbers_t * entsList, bool occlusion_culling
 ) {
 	Assert( gameState );
 
 	const edict_t * clent = client->edict;
 	Vec3 org;
 	if( clent && !clent->r.client ) {   // allow NULL ent for server record
-		return;     // not in game yet
+		return false;     // not in game yet
 	}
 	if( clent ) {
 		org = clent->s.origin;
@@ -459,6 +691,7 @@ void SNAP_BuildClientFrameSnap( const ginfo_t * gi, int64_t frameNum, int64_t ti
 
 	// this is the frame we are creating
 	client_snapshot_t * frame = &client->snapShots[ frameNum % ARRAY_COUNT( client->snapShots ) ];
+	frame->frameNum = frameNum;
 	frame->sentTimeStamp = timeStamp;
 	frame->UcmdExecuted = client->UcmdExecuted;
 
@@ -498,30 +731,65 @@ void SNAP_BuildClientFrameSnap( const ginfo_t * gi, int64_t frameNum, int64_t ti
 		frame->ps[0].playerNum = NUM_FOR_EDICT( clent ) - 1;
 	}
 
+	SnapOcclusionView occlusion;
+	const SnapOcclusionView * occlusion_view = NULL;
+	if( occlusion_culling && !frame->allentities && clent && clent->r.client->ps.pmove.pm_type == PM_NORMAL ) {
+		occlusion.map = FindServerMap( gameState->map );
+		occlusion.client = client;
+		occlusion.eye = org;
+		occlusion.predicted_eye = org + clent->r.client->ps.pmove.velocity * SNAP_OCCLUSION_LOOKAHEAD;
+		occlusion.time = timeStamp;
+		if( occlusion.map != NULL ) {
+			occlusion_view = &occlusion;
+		}
+	}
+
 	// build up the list of visible entities
-	snapshotEntityNumbers_t entsList;
-	SNAP_BuildSnapEntitiesList( gi, clent, org, frame, &entsList );
+	SNAP_BuildSnapEntitiesList( gi, clent, org, frame, occlusion_view, entsList );
 
 	// store current match state information
 	frame->gameState = *gameState;
 
-	//=============================
+	return true;
+}
 
-	// dump the entities list
-	int ne = client_entities->next_entities;
-	frame->num_entities = 0;
-	frame->first_entity = ne;
+/*
+* SNAP_ReserveClientFrameEntities
+*
+* Allocates the frame's range in the circular client_entities array. This
+* must be called for clients in a deterministic order.
+*/
+void SNAP_ReserveClientFrameEntities( client_t * client, int64_t frameNum, const snapshotEntityNumbers_t * entsList, client_entities_t * client_entities ) {
+	client_snapshot_t * frame = &client->snapShots[ frameNum % ARRAY_COUNT( client->snapShots ) ];
+	frame->num_entities = entsList->numSnapshotEntities;
+	frame->first_entity = client_entities->next_entities;
+	client_entities->next_entities += entsList->numSnapshotEntities;
+}
 
-	for( int e = 0; e < entsList.numSnapshotEntities; e++ ) {
-		// add it to the circular client_entities array
-		const edict_t * ent = EDICT_NUM( entsList.snapshotEntities[e] );
-		SyncEntityState * state = &client_entities->entities[ne % client_entities->num_entities];
+/*
+* SNAP_WriteClientFrameEntities
+*
+* Dumps the entities list into the frame's reserved range.
+*/
+void SNAP_WriteClientFrameEntities( const ginfo_t * gi, const client_t * client, int64_t frameNum, const snapshotEntityNumbers_t * entsList, client_entities_t * client_entities ) {
+	const client_snapshot_t * frame = &client->snapShots[ frameNum % ARRAY_COUNT( client->snapShots ) ];
 
-		*state = ent->s;
+	for( int e = 0; e < frame->num_entities; e++ ) {
+		// add it to the circular client_entities array
+		const edict_t * ent = EDICT_NUM( entsList->snapshotEntities[e] );
+		client_entities->entities[( frame->first_entity + e ) % client_entities->num_entities] = ent->s;
+	}
+}
 
-		frame->num_entities++;
-		ne++;
+void SNAP_BuildClientFrameSnap( const ginfo_t * gi, int64_t frameNum, int64_t timeStamp,
+	client_t * client,
+	const SyncGameState * gameState, client_entities_t * client_entities
+) {
+	snapshotEntityNumbers_t entsList;
+	if( !SNAP_BuildClientFrame( gi, frameNum, timeStamp, client, gameState, &entsList ) ) {
+		return;
 	}
 
-	client_entities->next_entities = ne;
+	SNAP_ReserveClientFrameEntities( client, frameNum, &entsList, client_entities );
+	SNAP_WriteClientFrameEntities( gi, client, frameNum, &entsList, client_entities );
 }
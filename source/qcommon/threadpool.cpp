@@ -0,0 +1,594 @@
+#include "qcommon/base.h"
+#include "qcommon/threads.h"
+#include "qcommon/threadpool.h"
+
+/*
+ * every thread that runs jobs (the workers, plus whoever called
+ * InitThreadPool) has its own deque. they push and pop jobs at the back,
+ * and when they run out they steal from the front of everyone else's. each
+ * deque has its own lock, which is almost never contended because thieves
+ * only show up when they have nothing else to do
+ *
+ * threads outside the pool add jobs to a shared queue instead, and if they
+ * fill it up the rest go on an overflow list behind it
+ */
+
+struct ParallelForData {
+	void * datum;
+	size_t stride;
+	JobCallback callback;
+	size_t grain;
+};
+
+struct Job {
+	JobCallback callback;
+	void * data;
+	JobCounter * counter;
+
+	// for ParallelFor chunks, in which case callback is NULL
+	const ParallelForData * parallel_for;
+	size_t begin, end;
+};
+
+struct DependentJob {
+	Job job;
+	DependentJob * next;
+};
+
+struct JobQueue {
+	Job jobs[ 1024 ];
+	Mutex * mutex;
+	size_t head;
+	std::atomic< size_t > size;
+};
+
+// threads that run out of work sleep on their own semaphore, and whoever
+// wakes them takes them off the list first, so a wakeup can never be eaten
+// by the wrong thread
+struct Sleeper {
+	Semaphore * sem;
+	const JobCounter * waiting_for;
+	bool can_help;
+	Sleeper * next;
+};
+
+struct Worker {
+	Thread * thread;
+	u32 index;
+	ArenaAllocator arena;
+	JobQueue queue;
+	Semaphore * sem;
+};
+
+// workers[ 0 ] is the thread that called InitThreadPool
+static Worker workers[ 32 ];
+static u32 num_workers;
+
+static JobQueue shared_queue;
+
+// only used when something floods the pool from outside, so it's a plain
+// locked list. once anything is on it everything else goes on it too, so
+// jobs still come out in the order they went in
+static Mutex * overflow_mutex;
+static DependentJob * overflow_head;
+static DependentJob * overflow_tail;
+static std::atomic< size_t > num_overflow;
+
+static thread_local Worker * current_worker;
+
+static JobCounter all_jobs;
+
+// only taken when a counter hits zero or gets a dependent
+static Mutex * dependents_mutex;
+
+static Mutex * sleepers_mutex;
+static Sleeper * sleepers;
+static std::atomic< u32 > num_sleepers;
+
+static std::atomic< bool > shutting_down;
+
+static void InitJobQueue( JobQueue * queue ) {
+	queue->mutex = NewMutex();
+	queue->head = 0;
+	queue->size = 0;
+}
+
+static void ShutdownJobQueue( JobQueue * queue ) {
+	DeleteMutex( queue->mutex );
+}
+
+static bool PushBack( JobQueue * queue, const Job & job ) {
+	Lock( queue->mutex );
+	defer { Unlock( queue->mutex ); };
+
+	size_t size = queue->size.load( std::memory_order_relaxed );
+	if( size == ARRAY_COUNT( queue->jobs ) )
+		return false;
+
+	queue->jobs[ ( queue->head + size ) % ARRAY_COUNT( queue->jobs ) ] = job;
+	queue->size = size + 1;
+
+	return true;
+}
+
+static bool PopBack( JobQueue * queue, Job * job ) {
+	if( queue->size.load( std::memory_order_relaxed ) == 0 )
+		return false;
+
+	Lock( queue->mutex );
+	defer { Unlock( queue->mutex ); };
+
+	size_t size = queue->size.load( std::memory_order_relaxed );
+	if( size == 0 )
+		return false;
+
+	*job = queue->jobs[ ( queue->head + size - 1 ) % ARRAY_COUNT( queue->jobs ) ];
+	queue->size = size - 1;
+
+	return true;
+}
+
+static bool PopFront( JobQueue * queue, Job * job ) {
+	if( queue->size.load( std::memory_order_relaxed ) == 0 )
+		return false;
+
+	Lock( queue->mutex );
+	defer { Unlock( queue->mutex ); };
+
+	size_t size = queue->size.load( std::memory_order_relaxed );
+	if( size == 0 )
+		return false;
+
+	*job = queue->jobs[ queue->head % ARRAY_COUNT( queue->jobs ) ];
+	queue->head++;
+	queue->size = size - 1;
+
+	return true;
+}
+
+static void PushOverflow( const Job & job ) {
+	DependentJob * overflow = Alloc< DependentJob >( sys_allocator );
+	overflow->job = job;
+	overflow->next = NULL;
+
+	Lock( overflow_mutex );
+	defer { Unlock( overflow_mutex ); };
+
+	if( overflow_tail != NULL ) {
+		overflow_tail->next = overflow;
+	}
+	else {
+		overflow_head = overflow;
+	}
+	overflow_tail = overflow;
+	num_overflow++;
+}
+
+static bool PopOverflow( Job * job ) {
+	if( num_overflow == 0 )
+		return false;
+
+	DependentJob * overflow;
+	{
+		Lock( overflow_mutex );
+		defer { Unlock( overflow_mutex ); };
+
+		overflow = overflow_head;
+		if( overflow == NULL )
+			return false;
+
+		overflow_head = overflow->next;
+		if( overflow_head == NULL ) {
+			overflow_tail = NULL;
+		}
+		num_overflow--;
+	}
+
+	*job = overflow->job;
+	Free( sys_allocator, overflow );
+	return true;
+}
+
+static bool AnyJobsQueued() {
+	if( shared_queue.size > 0 || num_overflow > 0 )
+		return true;
+
+	for( u32 i = 0; i < num_workers; i++ ) {
+		if( workers[ i ].queue.size > 0 ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool TryGetJob( Worker * worker, Job * job ) {
+	if( PopBack( &worker->queue, job ) )
+		return true;
+
+	if( PopFront( &shared_queue, job ) )
+		return true;
+
+	if( PopOverflow( job ) )
+		return true;
+
+	for( u32 i = 1; i < num_workers; i++ ) {
+		Worker * victim = &workers[ ( worker->index + i ) % num_workers ];
+		if( PopFront( &victim->queue, job ) ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool ShouldSleep( const Sleeper * sleeper ) {
+	if( sleeper->can_help && ( shutting_down || AnyJobsQueued() ) )
+		return false;
+	if( sleeper->waiting_for != NULL && sleeper->waiting_for->pending == 0 )
+		return false;
+	return true;
+}
+
+static void GoToSleep( Sleeper * sleeper ) {
+	Lock( sleepers_mutex );
+
+	// count ourselves before checking for work, so anyone adding work after
+	// the check sees us
+	num_sleepers++;
+	if( !ShouldSleep( sleeper ) ) {
+		num_sleepers--;
+		Unlock( sleepers_mutex );
+		return;
+	}
+
+	sleeper->next = sleepers;
+	sleepers = sleeper;
+
+	Unlock( sleepers_mutex );
+
+	Wait( sleeper->sem );
+}
+
+template< typename F >
+static void WakeSleepers( F && should_wake, bool just_one ) {
+	if( num_sleepers == 0 )
+		return;
+
+	Lock( sleepers_mutex );
+	defer { Unlock( sleepers_mutex ); };
+
+	Sleeper ** prev = &sleepers;
+	while( *prev != NULL ) {
+		Sleeper * sleeper = *prev;
+		if( !should_wake( sleeper ) ) {
+			prev = &sleeper->next;
+			continue;
+		}
+
+		*prev = sleeper->next;
+		num_sleepers--;
+		Signal( sleeper->sem );
+
+		if( just_one ) {
+			break;
+		}
+	}
+}
+
+static void WakeWorker() {
+	// this includes threads in ThreadPoolWait who can help
+	WakeSleepers( []( const Sleeper * sleeper ) { return sleeper->can_help; }, true );
+}
+
+static void RunJob( Worker * worker, const Job & job );
+
+static void AddJob( const Job & job ) {
+	if( current_worker != NULL ) {
+		if( !PushBack( &current_worker->queue, job ) ) {
+			RunJob( current_worker, job );
+			return;
+		}
+	}
+	else {
+		if( num_overflow > 0 || !PushBack( &shared_queue, job ) ) {
+			PushOverflow( job );
+		}
+	}
+
+	WakeWorker();
+}
+
+// ParallelFor waits for its own chunks, so they stay out of all_jobs and
+// don't all fight over it
+static void AddToCounter( const Job & job ) {
+	if( job.counter != NULL ) {
+		job.counter->pending++;
+	}
+	if( job.parallel_for == NULL ) {
+		all_jobs.pending++;
+	}
+}
+
+static void DecrementCounter( JobCounter * counter ) {
+	DependentJob * dependents = NULL;
+
+	while( true ) {
+		u32 pending = counter->pending;
+		Assert( pending > 0 );
+
+		if( pending > 1 ) {
+			if( counter->pending.compare_exchange_weak( pending, pending - 1 ) ) {
+				return;
+			}
+			continue;
+		}
+
+		// take the dependents before the counter hits zero, because it can
+		// go out of scope as soon as it does
+		Lock( dependents_mutex );
+		dependents = counter->dependents;
+		counter->dependents = NULL;
+		bool zero = counter->pending.compare_exchange_strong( pending, 0 );
+		if( !zero ) {
+			counter->dependents = dependents;
+			dependents = NULL;
+		}
+		Unlock( dependents_mutex );
+
+		if( zero ) {
+			break;
+		}
+	}
+
+	// counter is only used as a key here, it may have already gone out of scope
+	WakeSleepers( [&]( const Sleeper * sleeper ) { return sleeper->waiting_for == counter; }, false );
+
+	while( dependents != NULL ) {
+		DependentJob * next = dependents->next;
+		AddJob( dependents->job );
+		Free( sys_allocator, dependents );
+		dependents = next;
+	}
+}
+
+static void FinishJob( const Job & job ) {
+	if( job.counter != NULL ) {
+		DecrementCounter( job.counter );
+	}
+	if( job.parallel_for == NULL ) {
+		DecrementCounter( &all_jobs );
+	}
+}
+
+static void RunParallelForChunk( Worker * worker, Job job ) {
+	const ParallelForData * pf = job.parallel_for;
+
+	size_t i = job.begin;
+	size_t end = job.end;
+	while( i < end ) {
+		// keep handing off the back half until what's left is one grain, so
+		// there's always something for other threads to steal no matter how
+		// much they're already juggling. the halves they steal get split
+		// again the same way
+		if( end - i > pf->grain ) {
+			Job half = job;
+			half.begin = i + ( end - i ) / 2;
+			half.end = end;
+			end = half.begin;
+
+			AddToCounter( half );
+			AddJob( half );
+		}
+
+		TempAllocator temp = worker->arena.temp();
+		pf->callback( &temp, ( ( char * ) pf->datum ) + pf->stride * i );
+		i++;
+	}
+}
+
+static void RunJob( Worker * worker, const Job & job ) {
+	if( job.parallel_for != NULL ) {
+		RunParallelForChunk( worker, job );
+	}
+	else {
+		TempAllocator temp = worker->arena.temp();
+		job.callback( &temp, job.data );
+	}
+
+	FinishJob( job );
+}
+
+static void ThreadPoolWorker( void * data ) {
+	TracyCSetThreadName( "Thread pool worker" );
+
+	Worker * worker = ( Worker * ) data;
+	current_worker = worker;
+
+	while( true ) {
+		Job job;
+		if( TryGetJob( worker, &job ) ) {
+			RunJob( worker, job );
+			continue;
+		}
+
+		if( shutting_down )
+			break;
+
+		Sleeper sleeper = { };
+		sleeper.sem = worker->sem;
+		sleeper.can_help = true;
+		GoToSleep( &sleeper );
+	}
+}
+
+void InitThreadPool() {
+	TracyZoneScoped;
+
+	shutting_down = false;
+	sleepers = NULL;
+	num_sleepers = 0;
+	all_jobs.pending = 0;
+	dependents_mutex = NewMutex();
+	sleepers_mutex = NewMutex();
+
+	InitJobQueue( &shared_queue );
+	overflow_mutex = NewMutex();
+	overflow_head = NULL;
+	overflow_tail = NULL;
+	num_overflow = 0;
+
+	num_workers = Min2( GetCoreCount(), u32( ARRAY_COUNT( workers ) ) );
+
+	constexpr size_t arena_size = 1024 * 1024; // 1MB
+
+	for( u32 i = 0; i < num_workers; i++ ) {
+		void * arena_memory = sys_allocator->allocate( arena_size, 16 );
+		workers[ i ].index = i;
+		workers[ i ].arena = ArenaAllocator( arena_memory, arena_size );
+		InitJobQueue( &workers[ i ].queue );
+		workers[ i ].sem = NewSemaphore();
+	}
+
+	current_worker = &workers[ 0 ];
+
+	for( u32 i = 1; i < num_workers; i++ ) {
+		workers[ i ].thread = NewThread( ThreadPoolWorker, &workers[ i ] );
+	}
+}
+
+void ShutdownThreadPool() {
+	TracyZoneScoped;
+
+	shutting_down = true;
+	WakeSleepers( []( const Sleeper * sleeper ) { return true; }, false );
+
+	// join everyone before freeing anything, because they might still be
+	// trying to steal from each other
+	for( u32 i = 1; i < num_workers; i++ ) {
+		JoinThread( workers[ i ].thread );
+	}
+
+	for( u32 i = 0; i < num_workers; i++ ) {
+		Free( sys_allocator, workers[ i ].arena.get_memory() );
+		ShutdownJobQueue( &workers[ i ].queue );
+		DeleteSemaphore( workers[ i ].sem );
+	}
+
+	current_worker = NULL;
+
+	ShutdownJobQueue( &shared_queue );
+
+	while( overflow_head != NULL ) {
+		DependentJob * next = overflow_head->next;
+		Free( sys_allocator, overflow_head );
+		overflow_head = next;
+	}
+	overflow_tail = NULL;
+	num_overflow = 0;
+	DeleteMutex( overflow_mutex );
+
+	DeleteMutex( sleepers_mutex );
+	DeleteMutex( dependents_mutex );
+}
+
+void ThreadPoolDo( JobCallback callback, void * data, JobCounter * counter ) {
+	TracyZoneScoped;
+
+	Job job = { };
+	job.callback = callback;
+	job.data = data;
+	job.counter = counter;
+
+	AddToCounter( job );
+	AddJob( job );
+}
+
+void ThreadPoolDoAfter( JobCounter * dependency, JobCallback callback, void * data, JobCounter * counter ) {
+	TracyZoneScoped;
+
+	Job job = { };
+	job.callback = callback;
+	job.data = data;
+	job.counter = counter;
+
+	AddToCounter( job );
+
+	Lock( dependents_mutex );
+	bool ready = dependency->pending == 0;
+	if( !ready ) {
+		DependentJob * dependent = Alloc< DependentJob >( sys_allocator );
+		dependent->job = job;
+		dependent->next = dependency->dependents;
+		dependency->dependents = dependent;
+	}
+	Unlock( dependents_mutex );
+
+	if( ready ) {
+		AddJob( job );
+	}
+}
+
+void ParallelFor( void * datum, size_t n, size_t stride, JobCallback callback ) {
+	TracyZoneScoped;
+
+	if( n == 0 )
+		return;
+
+	ParallelForData pf;
+	pf.datum = datum;
+	pf.stride = stride;
+	pf.callback = callback;
+	pf.grain = Max2( n / ( num_workers * 16 ), size_t( 1 ) );
+
+	JobCounter counter;
+
+	Job job = { };
+	job.counter = &counter;
+	job.parallel_for = &pf;
+	job.begin = 0;
+	job.end = n;
+
+	AddToCounter( job );
+	if( current_worker != NULL ) {
+		RunJob( current_worker, job );
+	}
+	else {
+		AddJob( job );
+	}
+
+	ThreadPoolWait( &counter );
+}
+
+void ThreadPoolWait( JobCounter * counter ) {
+	TracyZoneScoped;
+
+	Worker * worker = current_worker;
+	Semaphore * sem = NULL;
+
+	while( counter->pending > 0 ) {
+		Job job;
+		if( worker != NULL && TryGetJob( worker, &job ) ) {
+			RunJob( worker, job );
+			continue;
+		}
+
+		if( sem == NULL ) {
+			sem = worker != NULL ? worker->sem : NewSemaphore();
+		}
+
+		Sleeper sleeper = { };
+		sleeper.sem = sem;
+		sleeper.waiting_for = counter;
+		sleeper.can_help = worker != NULL;
+		GoToSleep( &sleeper );
+	}
+
+	if( worker == NULL && sem != NULL ) {
+		DeleteSemaphore( sem );
+	}
+}
+
+void ThreadPoolFinish() {
+	ThreadPoolWait( &all_jobs );
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+
+#include "qcommon/types.h"
+
+using JobCallback = void ( * )( TempAllocator * temp, void * data );
+
+struct DependentJob;
+
+// counts unfinished jobs so you can wait on or schedule work after a subset
+// of them, rather than everything with ThreadPoolFinish
+struct JobCounter {
+	std::atomic< u32 > pending = 0;
+	DependentJob * dependents = NULL;
+};
+
+void InitThreadPool();
+void ShutdownThreadPool();
+
+void ThreadPoolDo( JobCallback callback, void * data = NULL, JobCounter * counter = NULL );
+// doesn't start until every job added to dependency has finished
+void ThreadPoolDoAfter( JobCounter * dependency, JobCallback callback, void * data = NULL, JobCounter * counter = NULL );
+// only waits on its own jobs, so other work can be in flight while it runs
+void ParallelFor( void * datum, size_t n, size_t stride, JobCallback callback );
+
+// runs other jobs while it waits, so it's fine to call from inside a job
+void ThreadPoolWait( JobCounter * counter );
+void ThreadPoolFinish();
+
+template< typename T >
+void ParallelFor( Span< T > datum, JobCallback callback ) {
+	ParallelFor( datum.ptr, datum.n, sizeof( T ), callback );
+}
@@ -20,8 +20,11 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "qcommon/qcommon.h"
 #include "qcommon/rng.h"
+#include "qcommon/hashtable.h"
 #include "game/g_local.h"
 
 // some commands are only valid before the server has finished
@@ -57,6 +60,7 @@ struct server_t {
 #define NUM_FOR_EDICT( e ) ( ( e ) - sv.gi.edicts )
 
 struct client_snapshot_t {
+	int64_t frameNum;
 	bool allentities;
 	bool multipov;
 	int numplayers;
@@ -75,6 +79,14 @@ struct game_command_t {
 
 #define LATENCY_COUNTS  16
 
+// per entity state for the snapshot occlusion test
+struct client_entity_visibility_t {
+	int64_t last_visible;
+	bool occluded;      // result of the last line of sight test, reused until the viewer or the entity moves
+	Vec3 tested_eye;
+	Vec3 tested_origin;
+};
+
 struct client_t {
 	sv_client_state_t state;
 
@@ -109,6 +121,7 @@ struct client_t {
 	edict_t * edict;                 // EDICT_NUM(clientnum+1)
 
 	client_snapshot_t snapShots[UPDATE_BACKUP]; // updates can be delta'd from here
+	client_entity_visibility_t entity_visibility[MAX_EDICTS];
 
 	int challenge;                  // challenge of this user, randomly generated
 
@@ -138,12 +151,41 @@ struct challenge_t {
 	int64_t time;
 };
 
+#define MAX_SNAPSHOT_ENTITIES   1024
+struct snapshotEntityNumbers_t {
+	int numSnapshotEntities;
+	int snapshotEntities[MAX_SNAPSHOT_ENTITIES];
+	uint8_t entityAddedToSnapList[MAX_EDICTS / 8];
+};
+
 struct client_entities_t {
 	unsigned num_entities;      // maxclients->integer*UPDATE_BACKUP*MAX_PACKET_ENTITIES
 	unsigned next_entities;     // next client_entity to use
 	SyncEntityState * entities; // [num_entities]
 };
 
+// every client that deltas an entity from the same frame to the current frame
+// gets the same bytes, so encode each of those once per frame and share them
+#define ENTITY_DELTA_CACHE_SLOTS ( MAX_SNAPSHOT_ENTITIES * 4 )
+
+struct EntityDeltaCacheSlot {
+	std::atomic< u64 > key;           // 0 = empty
+	std::atomic< u32 > size_plus_one; // 0 = still being encoded by whoever claimed the slot
+	u32 offset;
+};
+
+struct EntityDeltaCache {
+	int64_t frameNum;
+
+	EntityDeltaCacheSlot slots[ ENTITY_DELTA_CACHE_SLOTS ];
+	u8 data[ 1024 * 1024 ];
+	std::atomic< size_t > data_used;
+
+	std::atomic< s64 > hits;
+	std::atomic< s64 > misses;
+	std::atomic< s64 > bytes_saved;
+};
+
 struct server_static_t {
 	bool initialized;               // sv_init has completed
 	int64_t realtime;               // real world time - always increasing, no clamping, etc
@@ -160,8 +202,11 @@ struct server_static_t {
 
 	client_t * clients;
 	client_entities_t client_entities;
+	Hashtable< MAX_CLIENTS * 2 > session_id_to_client;
 
 	challenge_t challenges[MAX_CHALLENGES]; // to prevent invalid IPs from connecting
+	Hashtable< MAX_CHALLENGES * 2 > address_to_challenge;
+	size_t next_challenge;              // challenges are handed out round robin, so this is also the oldest
 };
 
 struct server_constant_t {
@@ -198,6 +243,9 @@ extern Cvar * sv_debug_serverCmd;
 
 extern Cvar * sv_demodir;
 
+extern Cvar * sv_parallelsnaps;
+extern Cvar * sv_occlusionculling;
+
 //===========================================================
 
 //
@@ -227,16 +275,18 @@ void SV_Map( const char * level, bool devmap );
 //
 // sv_send.c
 //
-bool SV_Netchan_Transmit( netchan_t * netchan, msg_t * msg );
+bool SV_Netchan_Transmit( netchan_t * netchan, msg_t * msg, NetchanCompressor * compressor = NULL );
 void SV_AddServerCommand( client_t * client, const char *cmd );
 void SV_SendServerCommand( client_t * cl, const char * format, ... );
 void SV_AddGameCommand( client_t * client, const char * cmd );
 void SV_AddReliableCommandsToMessage( client_t * client, msg_t * msg );
 bool SV_SendClientsFragments();
 void SV_InitClientMessage( client_t * client, msg_t * msg, uint8_t *data, size_t size );
-bool SV_SendMessageToClient( client_t * client, msg_t * msg );
+bool SV_SendMessageToClient( client_t * client, msg_t * msg, NetchanCompressor * compressor = NULL );
 void SV_ResetClientFrameCounters();
 
+void SV_InitClientDatagramJobs();
+void SV_ShutdownClientDatagramJobs();
 void SV_SendClientMessages();
 
 [[gnu::format( printf, 1, 2 )]] void SV_BroadcastCommand( const char *format, ... );
@@ -249,6 +299,7 @@ bool SV_ClientConnect( const NetAddress & address, client_t * client, char * use
 	u64 session_id, int challenge, bool fakeClient );
 
 [[gnu::format( printf, 2, 3 )]] void SV_DropClient( client_t * drop, const char * format, ... );
+client_t * SV_FindClientBySessionID( u64 session_id );
 
 void SV_ExecuteClientThinks( int clientNum );
 void SV_ClientResetCommandBuffers( client_t * client );
@@ -262,7 +313,7 @@ void SV_Status_f();
 //
 // sv_ents.c
 //
-void SV_WriteFrameSnapToClient( client_t * client, msg_t * msg );
+void SV_WriteFrameSnapToClient( client_t * client, msg_t * msg, EntityDeltaCache * delta_cache = NULL );
 void SV_BuildClientFrameSnap( client_t * client );
 
 //
@@ -271,6 +322,7 @@ void SV_BuildClientFrameSnap( client_t * client );
 void PF_DropClient( edict_t * ent, const char * message );
 int PF_GetClientState( int numClient );
 void PF_GameCmd( edict_t * ent, const char * cmd );
+void PF_ResetEntityVisibility( const edict_t * ent );
 void SV_LocateEntities( edict_t * edicts, int num_edicts, int max_edicts );
 
 //
@@ -279,6 +331,7 @@ void SV_LocateEntities( edict_t * edicts, int num_edicts, int max_edicts );
 void SV_Demo_WriteSnap();
 void SV_Demo_AddServerCommand( const char * command );
 void SV_Demo_Stop( bool silent );
+void SV_Demo_Shutdown();
 void SV_Demo_Start_f();
 void SV_Demo_Stop_f();
 void SV_Demo_Purge_f();
@@ -296,8 +349,16 @@ void ShutdownWebServer();
 // snap_write
 //
 void SNAP_WriteFrameSnapToClient( const ginfo_t * gi, client_t * client, msg_t * msg, int64_t frameNum, int64_t gameTime,
-	const SyncEntityState * baselines, const client_entities_t * client_entities );
+	const SyncEntityState * baselines, const client_entities_t * client_entities, EntityDeltaCache * delta_cache = NULL );
+
+void SNAP_ClearEntityDeltaCache( EntityDeltaCache * delta_cache, int64_t frameNum );
 
 void SNAP_BuildClientFrameSnap( const ginfo_t * gi, int64_t frameNum, int64_t timeStamp,
 	client_t * client,
 	const SyncGameState * gameState, client_entities_t * client_entities );
+
+// SNAP_BuildClientFrameSnap split into steps so clients can be built in parallel
+bool SNAP_BuildClientFrame( const ginfo_t * gi, int64_t frameNum, int64_t timeStamp,
+	client_t * client, const SyncGameState * gameState, snapshotEntityNumbers_t * entsList, bool occlusion_culling = false );
+void SNAP_ReserveClientFrameEntities( client_t * client, int64_t frameNum, const snapshotEntityNumbers_t * entsList, client_entities_t * client_entities );
+void SNAP_WriteClientFrameEntities( const ginfo_t * gi, const client_t * client, int64_t frameNum, const snapshotEntityNumbers_t * entsList, client_entities_t * client_entities );
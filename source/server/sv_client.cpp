@@ -45,6 +45,9 @@ void SV_ClientResetCommandBuffers( client_t *client ) {
 	// reset snapshots delta-compression
 	client->lastframe = -1;
 	client->lastSentFrameNum = 0;
+
+	// occlusion results are for whatever was in the slots on the last map
+	memset( client->entity_visibility, 0, sizeof( client->entity_visibility ) );
 }
 
 bool SV_ClientConnect( const NetAddress & address, client_t * client, char * userinfo, u64 session_id, int challenge, bool fakeClient ) {
@@ -74,6 +77,11 @@ bool SV_ClientConnect( const NetAddress & address, client_t * client, char * use
 		client->netchan.remoteAddress = NULL_ADDRESS;
 	} else {
 		Netchan_Setup( &client->netchan, address, session_id );
+
+		u64 slot = client - svs.clients;
+		if( !svs.session_id_to_client.add( Hash64( session_id ), slot ) ) {
+			svs.session_id_to_client.update( Hash64( session_id ), slot );
+		}
 	}
 
 	ClientUserinfoChanged( client->edict, userinfo );
@@ -120,11 +128,28 @@ void SV_DropClient( client_t *drop, const char *format, ... ) {
 			// this will remove the body, among other things
 			ClientDisconnect( drop->edict, reason );
 		}
+
+		u64 slot;
+		if( svs.session_id_to_client.get( Hash64( drop->netchan.session_id ), &slot ) && slot == u64( drop - svs.clients ) ) {
+			svs.session_id_to_client.remove( Hash64( drop->netchan.session_id ) );
+		}
 	}
 
 	drop->state = CS_ZOMBIE;    // become free in a few seconds
 }
 
+client_t * SV_FindClientBySessionID( u64 session_id ) {
+	u64 slot;
+	if( !svs.session_id_to_client.get( Hash64( session_id ), &slot ) )
+		return NULL;
+
+	client_t * client = &svs.clients[ slot ];
+	if( client->state == CS_FREE || client->state == CS_ZOMBIE || client->netchan.session_id != session_id )
+		return NULL;
+
+	return client;
+}
+
 /*
 ============================================================
 
@@ -19,21 +19,158 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include <time.h>
+#include <atomic>
 
 #include "server/server.h"
 #include "qcommon/array.h"
 #include "qcommon/fs.h"
 #include "qcommon/string.h"
+#include "qcommon/threads.h"
 #include "qcommon/version.h"
 #include "gameshared/demo.h"
 
 #include "nanosort/nanosort.hpp"
 
-static RecordDemoContext record_demo_context = { };
+/*
+ * compressing and writing the demo happens on a recorder thread so it
+ * doesn't spike the frame time. the game thread encodes snapshots and
+ * hands them over through a single producer single consumer ring, and if
+ * the disk is slow enough for the ring to fill up we drop snapshots rather
+ * than stall the server, and make the next one a keyframe
+ */
+
+static constexpr size_t DEMO_QUEUE_SIZE = 4 * 1024 * 1024;
+// waking the recorder isn't free, and on machines with few cores it takes
+// time from the frame we wake it from, so batch up snapshots first
+static constexpr size_t DEMO_QUEUE_WAKE_SIZE = 64 * 1024;
+
+struct DemoQueueEntry {
+	u32 size;
+	bool keyframe;
+	s64 server_time;
+};
+
+struct DemoRecorder {
+	RecordDemoContext ctx;
+	Thread * thread;
+	Semaphore * sem;
+
+	u8 * queue;
+	std::atomic< size_t > head; // written by the recorder
+	std::atomic< size_t > tail; // written by the game thread
+
+	std::atomic< bool > stopping;
+	DemoMetadata metadata; // owned by the recorder once stopping is set
+};
+
+static DemoRecorder demo_recorder;
+static bool demo_recording;
 static client_t demo_client;
 static s64 demo_gametime;
+static s64 demo_last_keyframe;
+static u64 demo_dropped_snaps;
+static size_t demo_unsignalled_bytes;
 static time_t demo_utc_time;
 
+static void CopyToDemoQueue( size_t cursor, const void * data, size_t n ) {
+	size_t offset = cursor % DEMO_QUEUE_SIZE;
+	size_t first = Min2( n, DEMO_QUEUE_SIZE - offset );
+	memcpy( demo_recorder.queue + offset, data, first );
+	memcpy( demo_recorder.queue, ( const u8 * ) data + first, n - first );
+}
+
+static void CopyFromDemoQueue( size_t cursor, void * data, size_t n ) {
+	size_t offset = cursor % DEMO_QUEUE_SIZE;
+	size_t first = Min2( n, DEMO_QUEUE_SIZE - offset );
+	memcpy( data, demo_recorder.queue + offset, first );
+	memcpy( ( u8 * ) data + first, demo_recorder.queue, n - first );
+}
+
+static bool PushDemoMessage( msg_t msg, bool keyframe, s64 server_time ) {
+	size_t head = demo_recorder.head.load( std::memory_order_acquire );
+	size_t tail = demo_recorder.tail.load( std::memory_order_relaxed );
+
+	DemoQueueEntry entry;
+	entry.size = checked_cast< u32 >( msg.cursize );
+	entry.keyframe = keyframe;
+	entry.server_time = server_time;
+
+	size_t n = sizeof( entry ) + msg.cursize;
+	if( DEMO_QUEUE_SIZE - ( tail - head ) < n )
+		return false;
+
+	CopyToDemoQueue( tail, &entry, sizeof( entry ) );
+	CopyToDemoQueue( tail + sizeof( entry ), msg.data, msg.cursize );
+	demo_recorder.tail.store( tail + n, std::memory_order_release );
+
+	demo_unsignalled_bytes += n;
+	if( demo_unsignalled_bytes >= DEMO_QUEUE_WAKE_SIZE ) {
+		Signal( demo_recorder.sem );
+		demo_unsignalled_bytes = 0;
+	}
+
+	return true;
+}
+
+static void DrainDemoQueue() {
+	TracyZoneScoped;
+
+	size_t head = demo_recorder.head.load( std::memory_order_relaxed );
+	size_t tail = demo_recorder.tail.load( std::memory_order_acquire );
+
+	while( head != tail ) {
+		DemoQueueEntry entry;
+		CopyFromDemoQueue( head, &entry, sizeof( entry ) );
+
+		u8 msg_buffer[ MAX_MSGLEN ];
+		Assert( entry.size <= sizeof( msg_buffer ) );
+		CopyFromDemoQueue( head + sizeof( entry ), msg_buffer, entry.size );
+		head += sizeof( entry ) + entry.size;
+
+		// let the game thread reuse the space while we compress
+		demo_recorder.head.store( head, std::memory_order_release );
+
+		if( entry.keyframe ) {
+			AddDemoKeyframe( &demo_recorder.ctx, entry.server_time );
+		}
+		WriteDemoMessage( &demo_recorder.ctx, NewMSGReader( msg_buffer, entry.size, entry.size ) );
+	}
+}
+
+static void DemoRecorderThread( void * data ) {
+	while( true ) {
+		Wait( demo_recorder.sem );
+
+		bool stopping = demo_recorder.stopping.load( std::memory_order_acquire );
+		DrainDemoQueue();
+		if( stopping )
+			break;
+	}
+
+	constexpr size_t arena_size = 64 * 1024;
+	ArenaAllocator arena( sys_allocator->allocate( arena_size, 16 ), arena_size );
+	defer { Free( sys_allocator, arena.get_memory() ); };
+	TempAllocator temp = arena.temp();
+
+	DemoMetadata * metadata = &demo_recorder.metadata;
+	metadata->decompressed_size = demo_recorder.ctx.decompressed_size;
+	StopRecordingDemo( &temp, &demo_recorder.ctx, *metadata );
+
+	Free( sys_allocator, metadata->game_version.ptr );
+	Free( sys_allocator, metadata->server.ptr );
+	Free( sys_allocator, metadata->map.ptr );
+}
+
+static void WaitForDemoRecorder() {
+	if( demo_recorder.thread == NULL )
+		return;
+
+	JoinThread( demo_recorder.thread );
+	DeleteSemaphore( demo_recorder.sem );
+	Free( sys_allocator, demo_recorder.queue );
+	demo_recorder.thread = NULL;
+}
+
 static const char * GetDemoDir( TempAllocator * temp ) {
 	return StrEqual( sv_demodir->value, "" ) ? "demos" : ( *temp )( "demos/{}", sv_demodir->value );
 }
@@ -41,7 +178,7 @@ static const char * GetDemoDir( TempAllocator * temp ) {
 void SV_Demo_WriteSnap() {
 	TracyZoneScoped;
 
-	if( record_demo_context.file == NULL ) {
+	if( !demo_recording ) {
 		return;
 	}
 
@@ -61,19 +198,38 @@ void SV_Demo_WriteSnap() {
 	uint8_t msg_buffer[MAX_MSGLEN];
 	msg_t msg = NewMSGWriter( msg_buffer, sizeof( msg_buffer ) );
 
+	bool keyframe = demo_client.nodelta || svs.gametime - demo_last_keyframe >= DEMO_KEYFRAME_INTERVAL;
+	if( keyframe ) {
+		demo_client.nodelta = true;
+		demo_client.nodelta_frame = 0;
+	}
+
 	SV_BuildClientFrameSnap( &demo_client );
 
 	SV_WriteFrameSnapToClient( &demo_client, &msg );
 
 	SV_AddReliableCommandsToMessage( &demo_client, &msg );
 
-	WriteDemoMessage( &record_demo_context, msg );
+	demo_client.nodelta = false;
+
+	if( !PushDemoMessage( msg, keyframe, svs.gametime ) ) {
+		if( demo_dropped_snaps == 0 ) {
+			Com_Printf( S_COLOR_YELLOW "The disk can't keep up with demo recording, dropping snapshots\n" );
+		}
+		demo_dropped_snaps++;
+
+		// the next snap can't delta from one that never got written
+		demo_client.nodelta = true;
+	}
+	else if( keyframe ) {
+		demo_last_keyframe = svs.gametime;
+	}
 
 	demo_client.lastframe = sv.framenum; // FIXME: is this needed?
 }
 
 void SV_Demo_AddServerCommand( const char * command ) {
-	if( record_demo_context.file == NULL ) {
+	if( !demo_recording ) {
 		return;
 	}
 
@@ -100,7 +256,7 @@ void SV_Demo_Start_f() {
 		return;
 	}
 
-	if( record_demo_context.temp_file != NULL ) {
+	if( demo_recording ) {
 		Com_Printf( "Already recording\n" );
 		return;
 	}
@@ -133,44 +289,65 @@ void SV_Demo_Start_f() {
 
 	Com_Printf( "Recording server demo: %s\n", filename );
 
-	bool recording = StartRecordingDemo( &temp, &record_demo_context, filename, svs.spawncount, svc.snapFrameTime, server_gs.maxclients, sv.baselines );
+	// let the last demo finish saving
+	WaitForDemoRecorder();
+
+	bool recording = StartRecordingDemo( &temp, &demo_recorder.ctx, filename, svs.spawncount, svc.snapFrameTime, server_gs.maxclients, sv.baselines );
 	if( !recording )
 		return;
 
+	demo_recorder.queue = AllocMany< u8 >( sys_allocator, DEMO_QUEUE_SIZE );
+	demo_recorder.head = 0;
+	demo_recorder.tail = 0;
+	demo_recorder.stopping = false;
+	demo_recorder.sem = NewSemaphore();
+	demo_recorder.thread = NewThread( DemoRecorderThread );
+
 	SV_Demo_InitClient();
 
+	demo_recording = true;
 	demo_gametime = svs.gametime;
+	demo_dropped_snaps = 0;
+	demo_unsignalled_bytes = 0;
 	demo_utc_time = checked_cast< s64 >( time( NULL ) );
 
-	// write one nodelta frame
+	// the first frame is a keyframe
 	demo_client.nodelta = true;
 	SV_Demo_WriteSnap();
-	demo_client.nodelta = false;
 }
 
 void SV_Demo_Stop( bool silent ) {
-	if( record_demo_context.file == NULL ) {
+	if( !demo_recording ) {
 		if( !silent ) {
 			Com_Printf( "Not recording a demo.\n" );
 		}
 		return;
 	}
 
-	Com_Printf( "Saving demo: %s\n", record_demo_context.filename );
+	Com_Printf( "Saving demo: %s\n", demo_recorder.ctx.filename );
+	if( demo_dropped_snaps > 0 ) {
+		Com_GGPrint( S_COLOR_YELLOW "Dropped {} snapshots because the disk couldn't keep up", demo_dropped_snaps );
+	}
 
-	TempAllocator temp = svs.frame_arena.temp();
+	// the recorder fills in decompressed_size and frees the strings
+	DemoMetadata * metadata = &demo_recorder.metadata;
+	*metadata = { };
+	metadata->metadata_version = DEMO_METADATA_VERSION;
+	metadata->game_version = MakeSpan( CopyString( sys_allocator, APP_VERSION ) );
+	metadata->server = MakeSpan( CopyString( sys_allocator, sv_hostname->value ) );
+	metadata->map = MakeSpan( CopyString( sys_allocator, sv.mapname ) );
+	metadata->utc_time = demo_utc_time;
+	metadata->duration_seconds = ( svs.gametime - demo_gametime ) / 1000;
+
+	demo_recorder.stopping.store( true, std::memory_order_release );
+	Signal( demo_recorder.sem );
+
+	demo_recording = false;
+}
 
-	DemoMetadata metadata = { };
-	metadata.metadata_version = DEMO_METADATA_VERSION;
-	metadata.game_version = MakeSpan( CopyString( &temp, APP_VERSION ) );
-	metadata.server = MakeSpan( sv_hostname->value );
-	metadata.map = MakeSpan( sv.mapname );
-	metadata.utc_time = demo_utc_time;
-	metadata.duration_seconds = ( svs.gametime - demo_gametime ) / 1000;
-	metadata.decompressed_size = record_demo_context.decompressed_size;
-
-	StopRecordingDemo( &temp, &record_demo_context, metadata );
-	record_demo_context = { };
+void SV_Demo_Shutdown() {
+	SV_Demo_Stop( true );
+	WaitForDemoRecorder();
 }
 
 void SV_Demo_Stop_f() {
@@ -67,6 +67,18 @@ void PF_GameCmd( edict_t * ent, const char * cmd ) {
 	}
 }
 
+/*
+* PF_ResetEntityVisibility
+*
+* Forgets every client's occlusion results for the entity's slot, so
+* whatever gets spawned in it next isn't culled using the old one's
+*/
+void PF_ResetEntityVisibility( const edict_t * ent ) {
+	for( int i = 0; i < sv_maxclients->integer; i++ ) {
+		svs.clients[ i ].entity_visibility[ ent->s.number ] = { };
+	}
+}
+
 void SV_LocateEntities( edict_t *edicts, int num_edicts, int max_edicts ) {
 	sv.gi.edicts = edicts;
 	sv.gi.clients = svs.clients;
@@ -127,6 +127,7 @@ static void SV_InitGame() {
 
 	svs.clients = AllocMany< client_t >( sys_allocator, sv_maxclients->integer );
 	memset( svs.clients, 0, sizeof( svs.clients[ 0 ] ) * sv_maxclients->integer );
+	svs.session_id_to_client.clear();
 
 	svs.client_entities.num_entities = sv_maxclients->integer * UPDATE_BACKUP * MAX_SNAP_ENTITIES;
 	svs.client_entities.entities = AllocMany< SyncEntityState >( sys_allocator, svs.client_entities.num_entities );
@@ -134,6 +135,8 @@ static void SV_InitGame() {
 
 	svs.socket = NewUDPServer( sv_port->integer, NonBlocking_Yes );
 
+	SV_InitClientDatagramJobs();
+
 	// init game
 	G_Init( svc.snapFrameTime );
 	for( int i = 0; i < sv_maxclients->integer; i++ ) {
@@ -185,7 +188,7 @@ void SV_ShutdownGame( const char *finalmsg, bool reconnect ) {
 		return;
 	}
 
-	SV_Demo_Stop( true );
+	SV_Demo_Shutdown();
 
 	SV_FinalMessage( finalmsg, reconnect );
 
@@ -193,6 +196,8 @@ void SV_ShutdownGame( const char *finalmsg, bool reconnect ) {
 
 	CloseSocket( svs.socket );
 
+	SV_ShutdownClientDatagramJobs();
+
 	Free( sys_allocator, svs.clients );
 	Free( sys_allocator, svs.client_entities.entities );
 
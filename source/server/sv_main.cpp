@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "qcommon/version.h"
 #include "qcommon/csprng.h"
 #include "qcommon/time.h"
+#include "game/g_maps.h"
 
 static bool sv_initialized = false;
 
@@ -48,6 +49,9 @@ Cvar *sv_debug_serverCmd;
 
 Cvar *sv_demodir;
 
+Cvar *sv_parallelsnaps;
+Cvar *sv_occlusionculling;
+
 //============================================================================
 
 static void SV_CalcPings() {
@@ -106,22 +110,14 @@ static bool SV_ProcessPacket( netchan_t *netchan, msg_t *msg ) {
 	return true;
 }
 
-static void SV_ReadPackets() {
-	TracyZoneScoped;
-
-	uint8_t data[ MAX_MSGLEN ];
-	NetAddress source;
-	size_t bytes_received = UDPReceive( svs.socket, &source, data, sizeof( data ) );
-	if( bytes_received == 0 ) {
-		return;
-	}
-
-	msg_t msg = NewMSGReader( data, bytes_received, sizeof( data ) );
+// returns the number of packets we know were lost or discarded
+static s64 SV_DispatchPacket( const NetAddress & source, u8 * data, size_t size, size_t maxsize ) {
+	msg_t msg = NewMSGReader( data, size, maxsize );
 
 	// check for connectionless packet (0xffffffff) first
 	if( MSG_ReadInt32( &msg ) == -1 ) {
 		SV_ConnectionlessPacket( source, &msg );
-		return;
+		return 0;
 	}
 
 	MSG_BeginReading( &msg );
@@ -129,29 +125,60 @@ static void SV_ReadPackets() {
 	MSG_ReadInt32( &msg ); // sequence number
 	u64 session_id = MSG_ReadUint64( &msg );
 
-	for( int i = 0; i < sv_maxclients->integer; i++ ) {
-		client_t * cl = &svs.clients[ i ];
+	client_t * cl = SV_FindClientBySessionID( session_id );
+	if( cl == NULL ) {
+		return 1;
+	}
 
-		if( cl->state == CS_FREE || cl->state == CS_ZOMBIE ) {
-			continue;
-		}
-		if( cl->edict && ( cl->edict->s.svflags & SVF_FAKECLIENT ) ) {
-			continue;
-		}
+	cl->netchan.remoteAddress = source;
 
-		if( cl->netchan.session_id != session_id ) {
-			continue;
-		}
+	if( !SV_ProcessPacket( &cl->netchan, &msg ) ) {
+		return 0;
+	}
 
-		cl->netchan.remoteAddress = source;
+	// this is a valid, sequenced packet, so process it
+	cl->lastPacketReceivedTime = svs.realtime;
+	SV_ParseClientMessage( cl, &msg );
 
-		if( SV_ProcessPacket( &cl->netchan, &msg ) ) { // this is a valid, sequenced packet, so process it
-			cl->lastPacketReceivedTime = svs.realtime;
-			SV_ParseClientMessage( cl, &msg );
+	return Max2( cl->netchan.dropped, 0 );
+}
+
+static void SV_ReadPackets() {
+	TracyZoneScoped;
+
+	// packets are received in batches into a ring of buffers that gets
+	// reused until the socket is drained. we stop after max_batches so a
+	// flood can't stall the frame, whatever's left waits in the socket
+	// buffer until next frame
+	constexpr size_t packets_per_batch = 32;
+	constexpr size_t max_batches = 32;
+	static u8 packet_buffers[ packets_per_batch ][ MAX_MSGLEN ];
+
+	UDPDatagram datagrams[ packets_per_batch ];
+	for( size_t i = 0; i < packets_per_batch; i++ ) {
+		datagrams[ i ] = { };
+		datagrams[ i ].data = packet_buffers[ i ];
+		datagrams[ i ].capacity = sizeof( packet_buffers[ i ] );
+	}
+
+	s64 received = 0;
+	s64 dropped = 0;
+
+	for( size_t batch = 0; batch < max_batches; batch++ ) {
+		size_t n = UDPReceiveBatch( svs.socket, datagrams, packets_per_batch );
+
+		for( size_t i = 0; i < n; i++ ) {
+			dropped += SV_DispatchPacket( datagrams[ i ].source, packet_buffers[ i ], datagrams[ i ].size, sizeof( packet_buffers[ i ] ) );
 		}
 
-		break;
+		received += n;
+		if( n < packets_per_batch ) {
+			break;
+		}
 	}
+
+	TracyPlotSample( "Server packets received", received );
+	TracyPlotSample( "Server packets dropped", dropped );
 }
 
 /*
@@ -372,6 +399,9 @@ void SV_Init() {
 
 	sv_debug_serverCmd = NewCvar( "sv_debug_serverCmd", "0" );
 
+	sv_parallelsnaps = NewCvar( "sv_parallelsnaps", "1", CvarFlag_Archive );
+	sv_occlusionculling = NewCvar( "sv_occlusionculling", "1", CvarFlag_Archive );
+
 	// this is a message holder for shared use
 	tmpMessage = NewMSGWriter( tmpMessageData, sizeof( tmpMessageData ) );
 
@@ -401,6 +431,7 @@ void SV_Shutdown( const char *finalmsg ) {
 	sv_initialized = false;
 
 	SV_ShutdownGame( finalmsg, false );
+	DiscardPreloadedServerMap();
 
 	SV_ShutdownOperatorCommands();
 
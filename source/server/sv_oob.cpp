@@ -235,6 +235,35 @@ static void SVC_MasterServerResponse( const NetAddress & address ) {
 	MasterOrLivesowResponse( address, "infoResponse", false );
 }
 
+static u64 HashIgnoringPort( const NetAddress & address ) {
+	if( address.family == AddressFamily_IPv4 ) {
+		return Hash64( &address.ipv4, sizeof( address.ipv4 ) );
+	}
+	return Hash64( &address.ipv6, sizeof( address.ipv6 ) );
+}
+
+static challenge_t * FindChallenge( const NetAddress & address ) {
+	u64 idx;
+	if( !svs.address_to_challenge.get( HashIgnoringPort( address ), &idx ) ) {
+		return NULL;
+	}
+
+	challenge_t * challenge = &svs.challenges[ idx ];
+	return EqualIgnoringPort( address, challenge->adr ) ? challenge : NULL;
+}
+
+static void RemoveChallenge( challenge_t * challenge ) {
+	u64 key = HashIgnoringPort( challenge->adr );
+	u64 idx;
+	if( svs.address_to_challenge.get( key, &idx ) && idx == u64( challenge - svs.challenges ) ) {
+		svs.address_to_challenge.remove( key );
+	}
+
+	challenge->challenge = 0; // wsw : r1q2 : reset challenge
+	challenge->time = 0;
+	challenge->adr = NULL_ADDRESS;
+}
+
 /*
 * SVC_GetChallenge
 *
@@ -245,34 +274,34 @@ static void SVC_MasterServerResponse( const NetAddress & address ) {
 * challenge, they must give a valid IP address.
 */
 static void SVC_GetChallenge( const NetAddress & address ) {
-	int oldest = 0;
-	int oldestTime = 0x7fffffff;
-
 	if( sv_showChallenge->integer ) {
 		Com_GGPrint( "Challenge Packet {}", address );
 	}
 
 	// see if we already have a challenge for this ip
-	int i;
-	for( i = 0; i < MAX_CHALLENGES; i++ ) {
-		if( EqualIgnoringPort( address, svs.challenges[i].adr ) ) {
-			break;
-		}
-		if( svs.challenges[i].time < oldestTime ) {
-			oldestTime = svs.challenges[i].time;
-			oldest = i;
-		}
-	}
+	challenge_t * challenge = FindChallenge( address );
 
-	if( i == MAX_CHALLENGES ) {
+	if( challenge == NULL ) {
 		// overwrite the oldest
-		svs.challenges[oldest].challenge = RandomUniform( &svs.rng, 0, S16_MAX );
-		svs.challenges[oldest].adr = address;
-		svs.challenges[oldest].time = Sys_Milliseconds();
-		i = oldest;
+		size_t idx = svs.next_challenge;
+		svs.next_challenge = ( svs.next_challenge + 1 ) % MAX_CHALLENGES;
+
+		challenge = &svs.challenges[ idx ];
+		if( challenge->adr != NULL_ADDRESS ) {
+			RemoveChallenge( challenge );
+		}
+
+		challenge->challenge = RandomUniform( &svs.rng, 0, S16_MAX );
+		challenge->adr = address;
+		challenge->time = Sys_Milliseconds();
+
+		u64 key = HashIgnoringPort( address );
+		if( !svs.address_to_challenge.add( key, idx ) ) {
+			svs.address_to_challenge.update( key, idx );
+		}
 	}
 
-	Netchan_OutOfBandPrint( svs.socket, address, "challenge %i", svs.challenges[i].challenge );
+	Netchan_OutOfBandPrint( svs.socket, address, "challenge %i", challenge->challenge );
 }
 
 /*
@@ -288,6 +317,7 @@ static void SVC_DirectConnect( const NetAddress & address ) {
 
 	u64 session_id = SpanToU64( MakeSpan( Cmd_Argv( 2 ) ), 0 );
 	int challenge = atoi( Cmd_Argv( 3 ) );
+	u64 dictionary_id = SpanToU64( MakeSpan( Cmd_Argv( 5 ) ), 0 );
 
 	if( !Info_Validate( Cmd_Argv( 4 ) ) ) {
 		Netchan_OutOfBandPrint( svs.socket, address, "reject\n%i\nInvalid userinfo string\n", 0 );
@@ -297,25 +327,25 @@ static void SVC_DirectConnect( const NetAddress & address ) {
 	char userinfo[ MAX_INFO_STRING ];
 	SafeStrCpy( userinfo, Cmd_Argv( 4 ), sizeof( userinfo ) );
 
+	if( session_id == 0 ) {
+		Netchan_OutOfBandPrint( svs.socket, address, "reject\n%i\nInvalid session id\n", 0 );
+		return;
+	}
+
 	// see if the challenge is valid
 	{
-		int i;
-		for( i = 0; i < MAX_CHALLENGES; i++ ) {
-			if( EqualIgnoringPort( address, svs.challenges[i].adr ) ) {
-				if( challenge == svs.challenges[i].challenge ) {
-					svs.challenges[i].challenge = 0; // wsw : r1q2 : reset challenge
-					svs.challenges[i].time = 0;
-					svs.challenges[i].adr = NULL_ADDRESS;
-					break; // good
-				}
-				Netchan_OutOfBandPrint( svs.socket, address, "reject\n%i\nBad challenge\n", DROP_FLAG_AUTORECONNECT );
-				return;
-			}
-		}
-		if( i == MAX_CHALLENGES ) {
+		challenge_t * found = FindChallenge( address );
+		if( found == NULL ) {
 			Netchan_OutOfBandPrint( svs.socket, address, "reject\n%i\nNo challenge for address\n", DROP_FLAG_AUTORECONNECT );
 			return;
 		}
+
+		if( challenge != found->challenge ) {
+			Netchan_OutOfBandPrint( svs.socket, address, "reject\n%i\nBad challenge\n", DROP_FLAG_AUTORECONNECT );
+			return;
+		}
+
+		RemoveChallenge( found );
 	}
 
 	//r1: limit connections from a single IP
@@ -373,8 +403,10 @@ static void SVC_DirectConnect( const NetAddress & address ) {
 		return;
 	}
 
+	Netchan_NegotiateDictionary( &newcl->netchan, dictionary_id );
+
 	// send the connect packet to the client
-	Netchan_OutOfBandPrint( svs.socket, address, "client_connect" );
+	Netchan_OutOfBandPrint( svs.socket, address, "client_connect %u", newcl->netchan.dictionary_id );
 }
 
 /*
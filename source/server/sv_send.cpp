@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "server/server.h"
+#include "qcommon/threadpool.h"
 
 // shared message buffer to be used for occasional messages
 msg_t tmpMessage;
@@ -210,13 +211,13 @@ bool SV_SendClientsFragments() {
 	return sent;
 }
 
-bool SV_Netchan_Transmit( netchan_t *netchan, msg_t *msg ) {
+bool SV_Netchan_Transmit( netchan_t *netchan, msg_t *msg, NetchanCompressor * compressor ) {
 	// if we got here with unsent fragments, fire them all now
 	if( !Netchan_PushAllFragments( svs.socket, netchan ) ) {
 		return false;
 	}
 
-	Netchan_CompressMessage( msg );
+	Netchan_CompressMessage( netchan, msg, compressor );
 	return Netchan_Transmit( svs.socket, netchan, msg );
 }
 
@@ -236,7 +237,7 @@ void SV_InitClientMessage( client_t *client, msg_t *msg, uint8_t *data, size_t s
 	MSG_WriteUintBase128( msg, client->UcmdReceived ); // acknowledge the last ucmd
 }
 
-bool SV_SendMessageToClient( client_t *client, msg_t *msg ) {
+bool SV_SendMessageToClient( client_t *client, msg_t *msg, NetchanCompressor * compressor ) {
 	Assert( client );
 
 	if( client->edict && ( client->edict->s.svflags & SVF_FAKECLIENT ) ) {
@@ -245,7 +246,7 @@ bool SV_SendMessageToClient( client_t *client, msg_t *msg ) {
 
 	// transmit the message data
 	client->lastPacketSentTime = svs.realtime;
-	return SV_Netchan_Transmit( &client->netchan, msg );
+	return SV_Netchan_Transmit( &client->netchan, msg, compressor );
 }
 
 /*
@@ -267,8 +268,8 @@ void SV_ResetClientFrameCounters() {
 	}
 }
 
-void SV_WriteFrameSnapToClient( client_t *client, msg_t *msg ) {
-	SNAP_WriteFrameSnapToClient( &sv.gi, client, msg, sv.framenum, svs.gametime, sv.baselines, &svs.client_entities );
+void SV_WriteFrameSnapToClient( client_t *client, msg_t *msg, EntityDeltaCache * delta_cache ) {
+	SNAP_WriteFrameSnapToClient( &sv.gi, client, msg, sv.framenum, svs.gametime, sv.baselines, &svs.client_entities, delta_cache );
 }
 
 void SV_BuildClientFrameSnap( client_t *client ) {
@@ -276,22 +277,102 @@ void SV_BuildClientFrameSnap( client_t *client ) {
 		client, &server_gs.gameState, &svs.client_entities );
 }
 
-static void SV_SendClientDatagram( client_t *client ) {
-	if( client->edict && ( client->edict->s.svflags & SVF_FAKECLIENT ) ) {
+struct ClientDatagramJob {
+	client_t * client;
+	bool built;
+	snapshotEntityNumbers_t entities;
+	NetchanCompressor * compressor;
+	u8 message[ MAX_MSGLEN ];
+};
+
+static ClientDatagramJob datagram_jobs[ MAX_CLIENTS ];
+static EntityDeltaCache entity_delta_cache;
+
+void SV_InitClientDatagramJobs() {
+	for( ClientDatagramJob & job : datagram_jobs ) {
+		job.compressor = NewNetchanCompressor();
+	}
+}
+
+void SV_ShutdownClientDatagramJobs() {
+	for( ClientDatagramJob & job : datagram_jobs ) {
+		DeleteNetchanCompressor( job.compressor );
+		job.compressor = NULL;
+	}
+}
+
+static void SV_BuildClientDatagram( TempAllocator * temp, void * data ) {
+	TracyZoneScoped;
+
+	ClientDatagramJob * job = ( ClientDatagramJob * ) data;
+
+	// decide which SyncEntityStates and SyncPlayerState get sent
+	job->built = SNAP_BuildClientFrame( &sv.gi, sv.framenum, svs.gametime, job->client, &server_gs.gameState, &job->entities, sv_occlusionculling->integer != 0 );
+}
+
+static void SV_SendClientDatagram( TempAllocator * temp, void * data ) {
+	TracyZoneScoped;
+
+	ClientDatagramJob * job = ( ClientDatagramJob * ) data;
+	client_t * client = job->client;
+
+	if( job->built ) {
+		SNAP_WriteClientFrameEntities( &sv.gi, client, sv.framenum, &job->entities, &svs.client_entities );
+	}
+
+	msg_t msg;
+	SV_InitClientMessage( client, &msg, job->message, sizeof( job->message ) );
+
+	SV_AddReliableCommandsToMessage( client, &msg );
+
+	SV_WriteFrameSnapToClient( client, &msg, &entity_delta_cache );
+
+	SV_SendMessageToClient( client, &msg, job->compressor );
+}
+
+static void SV_SendClientDatagrams( Span< ClientDatagramJob > jobs ) {
+	TracyZoneScoped;
+
+	if( jobs.n == 0 ) {
 		return;
 	}
 
-	SV_InitClientMessage( client, &tmpMessage, NULL, 0 );
+	bool parallel = sv_parallelsnaps->integer != 0;
+
+	SNAP_ClearEntityDeltaCache( &entity_delta_cache, sv.framenum );
 
-	SV_AddReliableCommandsToMessage( client, &tmpMessage );
+	if( parallel ) {
+		ParallelFor( jobs, SV_BuildClientDatagram );
+	}
+	else {
+		TempAllocator temp = svs.frame_arena.temp();
+		for( ClientDatagramJob & job : jobs ) {
+			SV_BuildClientDatagram( &temp, &job );
+		}
+	}
 
-	// send over all the relevant SyncEntityState
-	// and the SyncPlayerState
-	SV_BuildClientFrameSnap( client );
+	// the circular entity buffer is carved up in client order, so every
+	// client's delta base is the same no matter how the jobs get scheduled
+	for( const ClientDatagramJob & job : jobs ) {
+		if( job.built ) {
+			SNAP_ReserveClientFrameEntities( job.client, sv.framenum, &job.entities, &svs.client_entities );
+		}
+	}
 
-	SV_WriteFrameSnapToClient( client, &tmpMessage );
+	if( parallel ) {
+		ParallelFor( jobs, SV_SendClientDatagram );
+	}
+	else {
+		TempAllocator temp = svs.frame_arena.temp();
+		for( ClientDatagramJob & job : jobs ) {
+			SV_SendClientDatagram( &temp, &job );
+		}
+	}
 
-	SV_SendMessageToClient( client, &tmpMessage );
+	s64 hits = entity_delta_cache.hits.load( std::memory_order_relaxed );
+	s64 misses = entity_delta_cache.misses.load( std::memory_order_relaxed );
+	TracyPlotSample( "Entity delta cache hit rate", hits + misses == 0 ? 0.0f : float( hits ) / float( hits + misses ) );
+	TracyPlotSample( "Entity delta cache bytes saved", entity_delta_cache.bytes_saved.load( std::memory_order_relaxed ) );
 }
 
 void SV_SendClientMessages() {
@@ -299,6 +380,7 @@ void SV_SendClientMessages() {
 
 	int i;
 	client_t *client;
+	size_t num_jobs = 0;
 
 	// send a message to each connected client
 	for( i = 0, client = svs.clients; i < sv_maxclients->integer; i++, client++ ) {
@@ -312,7 +394,8 @@ void SV_SendClientMessages() {
 		}
 
 		if( client->state == CS_SPAWNED ) {
-			SV_SendClientDatagram( client );
+			datagram_jobs[ num_jobs ].client = client;
+			num_jobs++;
 		} else {
 			// send pending reliable commands, or send heartbeats for not timing out
 			if( client->reliableSequence > client->reliableAcknowledge ||
@@ -323,4 +406,6 @@ void SV_SendClientMessages() {
 			}
 		}
 	}
+
+	SV_SendClientDatagrams( Span< ClientDatagramJob >( datagram_jobs, num_jobs ) );
 }
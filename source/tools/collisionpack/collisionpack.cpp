@@ -0,0 +1,195 @@
+#include <stdarg.h>
+
+#include "qcommon/base.h"
+#include "qcommon/array.h"
+#include "qcommon/fs.h"
+#include "qcommon/hash.h"
+#include "qcommon/string.h"
+#include "gameshared/collision.h"
+#include "gameshared/collision_pack.h"
+#include "gameshared/q_shared.h"
+
+#include "cgltf/cgltf.h"
+
+#include "nanosort/nanosort.hpp"
+
+/*
+ * parses every .glb in base and writes their collision to a collision pack,
+ * so servers can skip doing it at startup
+ */
+
+struct PackedModel {
+	StringHash name;
+	Span< const char > path;
+	FileMetadata metadata;
+};
+
+void ShowErrorMessage( const char * msg, const char * file, int line ) {
+	printf( "%s (%s:%d)\n", msg, file, line );
+}
+
+void Com_Printf( const char * format, ... ) {
+	va_list argptr;
+	va_start( argptr, format );
+	vprintf( format, argptr );
+	va_end( argptr );
+}
+
+// same as AddGLTFModel in g_maps.cpp
+static void LoadGLTFModel( CollisionModelStorage * storage, Span< const u8 > data, Span< const char > path, StringHash name ) {
+	cgltf_options options = { };
+	options.type = cgltf_file_type_glb;
+
+	cgltf_data * gltf;
+	if( cgltf_parse( &options, data.ptr, data.num_bytes(), &gltf ) != cgltf_result_success ) {
+		Com_GGPrint( "{} isn't a GLTF file", path );
+		return;
+	}
+
+	defer { cgltf_free( gltf ); };
+
+	if( !LoadGLBBuffers( gltf ) ) {
+		Com_GGPrint( "Couldn't load buffers in {}", path );
+		return;
+	}
+
+	if( cgltf_validate( gltf ) != cgltf_result_success ) {
+		Com_GGPrint( "{} is invalid GLTF", path );
+		return;
+	}
+
+	LoadGLTFCollisionData( storage, gltf, path, name );
+}
+
+static bool LoadModelsRecursive( CollisionModelStorage * storage, NonRAIIDynamicArray< PackedModel > * models, DynamicString * path, size_t skip ) {
+	ListDirHandle scan = BeginListDir( sys_allocator, path->c_str() );
+
+	const char * name;
+	bool dir;
+	while( ListDirNext( &scan, &name, &dir ) ) {
+		// skip ., .., .git, etc
+		if( name[ 0 ] == '.' )
+			continue;
+
+		size_t old_len = path->length();
+		path->append( "/{}", name );
+		defer { path->truncate( old_len ); };
+
+		if( dir ) {
+			if( !LoadModelsRecursive( storage, models, path, skip ) )
+				return false;
+			continue;
+		}
+
+		if( FileExtension( path->c_str() ) != ".glb" )
+			continue;
+
+		PackedModel model;
+		model.path = StripExtension( CopyString( sys_allocator, path->c_str() + skip ) );
+		model.name = StringHash( model.path );
+
+		Span< u8 > data = ReadFileBinary( sys_allocator, path->c_str() );
+		defer { Free( sys_allocator, data.ptr ); };
+		if( data.ptr == NULL || !GetFileMetadata( sys_allocator, path->c_str(), &model.metadata ) ) {
+			printf( "Can't read %s\n", path->c_str() );
+			return false;
+		}
+
+		LoadGLTFModel( storage, data, model.path, model.name );
+		models->add( model );
+	}
+
+	return true;
+}
+
+template< typename T >
+static void Pack( DynamicArray< u8 > * packed, CollisionPackModel * model, CollisionPackSectionType section, Span< const T > data ) {
+	size_t offset = packed->extend( AlignPow2( data.num_bytes(), COLLISION_PACK_ALIGNMENT ) );
+	memset( packed->ptr() + offset, 0, packed->size() - offset );
+	memcpy( packed->ptr() + offset, data.ptr, data.num_bytes() );
+
+	model->sections[ section ].offset = checked_cast< u32 >( offset );
+	model->sections[ section ].size = checked_cast< u32 >( data.num_bytes() );
+}
+
+int main( int argc, char ** argv ) {
+	if( argc != 3 ) {
+		printf( "Usage: %s <base dir> <collision.pack>\n", argv[ 0 ] );
+		return 1;
+	}
+
+	CollisionModelStorage * storage = Alloc< CollisionModelStorage >( sys_allocator );
+	InitCollisionModelStorage( storage );
+	defer {
+		ShutdownCollisionModelStorage( storage );
+		Free( sys_allocator, storage );
+	};
+
+	NonRAIIDynamicArray< PackedModel > models( sys_allocator );
+	defer {
+		for( PackedModel model : models ) {
+			Free( sys_allocator, const_cast< char * >( model.path.ptr ) );
+		}
+		models.shutdown();
+	};
+
+	DynamicString base( sys_allocator, "{}", argv[ 1 ] );
+	if( !LoadModelsRecursive( storage, &models, &base, base.length() + 1 ) )
+		return 1;
+
+	nanosort( models.begin(), models.end(), []( const PackedModel & a, const PackedModel & b ) {
+		return a.name.hash < b.name.hash;
+	} );
+
+	for( size_t i = 1; i < models.size(); i++ ) {
+		if( models[ i ].name.hash == models[ i - 1 ].name.hash ) {
+			Com_GGPrint( "{} and {} have the same hash", models[ i ].path, models[ i - 1 ].path );
+			return 1;
+		}
+	}
+
+	DynamicArray< u8 > packed( sys_allocator );
+	size_t models_offset = sizeof( CollisionPackHeader );
+	packed.resize( AlignPow2( models_offset + models.size() * sizeof( CollisionPackModel ), COLLISION_PACK_ALIGNMENT ) );
+	memset( packed.ptr(), 0, packed.size() );
+
+	size_t num_with_collision = 0;
+	for( size_t i = 0; i < models.size(); i++ ) {
+		CollisionPackModel model = { };
+		model.name = models[ i ].name.hash;
+		model.source_size = models[ i ].metadata.size;
+		model.source_modified_time = models[ i ].metadata.modified_time;
+
+		const GLTFCollisionData * gltf = FindGLTFSharedCollisionData( storage, models[ i ].name );
+		if( gltf != NULL ) {
+			size_t num_soa_floats = ( gltf->planes.n + PLANES_SOA_PADDING ) * 4;
+
+			model.bounds = gltf->bounds;
+			model.broadphase_solidity = gltf->broadphase_solidity;
+			Pack( &packed, &model, CollisionPackSection_Vertices, gltf->vertices );
+			Pack( &packed, &model, CollisionPackSection_Planes, gltf->planes );
+			Pack( &packed, &model, CollisionPackSection_PlanesSoA, Span< const float >( gltf->planes_soa.normal_x, num_soa_floats ) );
+			Pack( &packed, &model, CollisionPackSection_Brushes, gltf->brushes );
+			Pack( &packed, &model, CollisionPackSection_BVH, gltf->bvh );
+			Pack( &packed, &model, CollisionPackSection_BVHBrushes, gltf->bvh_brushes );
+			num_with_collision++;
+		}
+
+		memcpy( packed.ptr() + models_offset + i * sizeof( CollisionPackModel ), &model, sizeof( model ) );
+	}
+
+	CollisionPackHeader header = { };
+	memcpy( header.magic, COLLISION_PACK_MAGIC, sizeof( header.magic ) );
+	header.format_version = COLLISION_PACK_FORMAT_VERSION;
+	header.num_models = models.size();
+	memcpy( packed.ptr(), &header, sizeof( header ) );
+
+	if( !WriteFile( sys_allocator, argv[ 2 ], packed.ptr(), packed.num_bytes() ) ) {
+		printf( "Can't write %s\n", argv[ 2 ] );
+		return 1;
+	}
+
+	printf( "Wrote %zu models, %zu with collision, to %s\n", models.size(), num_with_collision, argv[ 2 ] );
+
+	return 0;
+}
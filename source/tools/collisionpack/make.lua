@@ -0,0 +1,36 @@
+bin( "collisionpack", {
+	srcs = {
+		"source/tools/collisionpack/collisionpack.cpp",
+		"source/gameshared/cdmap.cpp",
+		"source/gameshared/collision.cpp",
+		"source/gameshared/collision_pack.cpp",
+		"source/gameshared/editor_materials.cpp",
+		"source/gameshared/intersection_tests.cpp",
+		"source/gameshared/q_math.cpp",
+		"source/gameshared/q_shared.cpp",
+		"source/qcommon/allocators.cpp",
+		"source/qcommon/base.cpp",
+		"source/qcommon/fs.cpp",
+		"source/qcommon/hash.cpp",
+		"source/qcommon/rng.cpp",
+		"source/qcommon/platform/*_fs.cpp",
+		"source/qcommon/platform/*_sys.cpp",
+		"source/qcommon/platform/*_threads.cpp",
+	},
+
+	libs = {
+		"cgltf",
+		"ggformat",
+		"tracy",
+		"zstd",
+	},
+
+	windows_ldflags = "ole32.lib shell32.lib user32.lib advapi32.lib",
+	linux_ldflags = "-lm -lpthread",
+} )
+
+generated_file( "base/collision.pack", {
+	tool = "collisionpack",
+	args = "base base/collision.pack",
+	deps = { "base/**.glb" },
+} )
@@ -0,0 +1,245 @@
+#include <float.h>
+#include <stdarg.h>
+
+#include "qcommon/base.h"
+#include "qcommon/qcommon.h"
+#include "qcommon/rng.h"
+#include "gameshared/q_math.h"
+
+/*
+ * sends a few thousand snapshots of moving entities and a player through the
+ * delta encoding and checks what comes out. quantized fields have to stay
+ * within their precision of what the server has, every frame, so they can't
+ * drift, and everything else has to come back exact. exits with 1 if
+ * anything is out
+ */
+
+void ShowErrorMessage( const char * msg, const char * file, int line ) {
+	printf( "%s (%s:%d)\n", msg, file, line );
+}
+
+void Com_Printf( const char * format, ... ) {
+	va_list argptr;
+	va_start( argptr, format );
+	vprintf( format, argptr );
+	va_end( argptr );
+}
+
+constexpr size_t NUM_ENTITIES = 64;
+constexpr size_t NUM_FRAMES = 4000;
+constexpr float FRAME_TIME = 1.0f / 62.5f;
+
+constexpr float ANGLE_PRECISION = 360.0f / 65536.0f;
+
+struct MovingEntity {
+	Vec3 velocity;
+	Vec3 angular_velocity;
+	bool mover;
+};
+
+struct MaxError {
+	const char * name;
+	float bound;
+	float error;
+};
+
+static MaxError origin_error = { "origin", SYNC_POSITION_PRECISION * 0.5f };
+static MaxError mover_error = { "linear movement", SYNC_POSITION_PRECISION * 0.5f };
+// plus a little for the rounding in AngleNormalize360
+static MaxError angles_error = { "angles", ANGLE_PRECISION * 0.5f + 360.0f * FLT_EPSILON };
+static MaxError viewangles_error = { "viewangles", ANGLE_PRECISION * 0.5f + 360.0f * FLT_EPSILON };
+static MaxError velocity_error = { "origin2/velocity", 0.0f };
+static MaxError pmove_error = { "pmove origin/velocity", 0.0f };
+static size_t num_inexact_entities;
+static size_t num_inexact_players;
+
+static void UpdateError( MaxError * e, Vec3 received, Vec3 sent ) {
+	for( int i = 0; i < 3; i++ ) {
+		e->error = Max2( e->error, Abs( received[ i ] - sent[ i ] ) );
+	}
+}
+
+static void UpdateAngleError( MaxError * e, Vec3 received, Vec3 sent ) {
+	for( int i = 0; i < 3; i++ ) {
+		e->error = Max2( e->error, Abs( AngleDelta( received[ i ], sent[ i ] ) ) );
+	}
+}
+
+static Vec3 RandomVec3( RNG * rng, float range ) {
+	return Vec3( RandomFloat11( rng ), RandomFloat11( rng ), RandomFloat11( rng ) ) * range;
+}
+
+// spread over a big map, with some right out at the edges where floats are
+// coarsest
+static Vec3 RandomOrigin( RNG * rng ) {
+	return RandomVec3( rng, Probability( rng, 0.1f ) ? 32000.0f : 4096.0f );
+}
+
+static void SpawnEntity( RNG * rng, SyncEntityState * ent, MovingEntity * moving, int number ) {
+	*ent = { };
+	ent->number = number;
+	ent->type = ET_GENERIC;
+	ent->origin = RandomOrigin( rng );
+	ent->angles = RandomVec3( rng, 180.0f );
+
+	moving->velocity = RandomVec3( rng, Probability( rng, 0.5f ) ? 320.0f : 2000.0f );
+	moving->angular_velocity = RandomVec3( rng, 720.0f );
+	moving->mover = Probability( rng, 0.2f );
+
+	ent->origin2 = moving->velocity;
+	if( moving->mover ) {
+		ent->linearMovementBegin = ent->origin;
+		ent->linearMovementEnd = RandomOrigin( rng );
+	}
+}
+
+// the fields we've already checked are copied over so the rest can be
+// compared in one go
+static bool EverythingElseMatches( SyncEntityState received, const SyncEntityState & sent ) {
+	received.origin = sent.origin;
+	received.angles = sent.angles;
+	received.linearMovementBegin = sent.linearMovementBegin;
+	received.linearMovementEnd = sent.linearMovementEnd;
+	return memcmp( &received, &sent, sizeof( sent ) ) == 0;
+}
+
+static bool EverythingElseMatches( SyncPlayerState received, const SyncPlayerState & sent ) {
+	received.viewangles = sent.viewangles;
+	return memcmp( &received, &sent, sizeof( sent ) ) == 0;
+}
+
+static bool CheckError( const MaxError & e ) {
+	bool ok = e.error <= e.bound;
+	printf( "%-24s max error %.6f, allowed %.6f%s\n", e.name, e.error, e.bound, ok ? "" : " FAIL" );
+	return ok;
+}
+
+int main( int argc, char ** argv ) {
+	RNG rng = NewRNG( 1, 0 );
+
+	// the server deltas against what it sent last, the client against what
+	// it received last
+	static SyncEntityState sent[ NUM_ENTITIES ];
+	static SyncEntityState server_baselines[ NUM_ENTITIES ];
+	static SyncEntityState client_baselines[ NUM_ENTITIES ];
+	static MovingEntity moving[ NUM_ENTITIES ];
+
+	for( size_t i = 0; i < NUM_ENTITIES; i++ ) {
+		SpawnEntity( &rng, &sent[ i ], &moving[ i ], int( i + 1 ) );
+	}
+
+	SyncPlayerState player = { };
+	SyncPlayerState server_player_baseline = { };
+	SyncPlayerState client_player_baseline = { };
+	player.pmove.origin = RandomOrigin( &rng );
+
+	static u8 buf[ MAX_MSGLEN ];
+	size_t entity_bytes = 0;
+	size_t player_bytes = 0;
+
+	for( size_t frame = 0; frame < NUM_FRAMES; frame++ ) {
+		for( size_t i = 0; i < NUM_ENTITIES; i++ ) {
+			// teleports and respawns make big deltas
+			if( Probability( &rng, 0.005f ) ) {
+				SpawnEntity( &rng, &sent[ i ], &moving[ i ], int( i + 1 ) );
+				continue;
+			}
+
+			sent[ i ].origin += moving[ i ].velocity * FRAME_TIME;
+			sent[ i ].angles += moving[ i ].angular_velocity * FRAME_TIME;
+			for( int j = 0; j < 3; j++ ) {
+				// bounce off the edges of the map
+				if( Abs( sent[ i ].origin[ j ] ) > 32000.0f ) {
+					moving[ i ].velocity[ j ] = -moving[ i ].velocity[ j ];
+				}
+				sent[ i ].angles[ j ] = AngleNormalize180( sent[ i ].angles[ j ] );
+			}
+			if( Probability( &rng, 0.05f ) ) {
+				moving[ i ].velocity += RandomVec3( &rng, 200.0f );
+				sent[ i ].origin2 = moving[ i ].velocity;
+			}
+		}
+
+		player.pmove.velocity += RandomVec3( &rng, 50.0f );
+		player.pmove.origin += player.pmove.velocity * FRAME_TIME;
+		player.viewangles = RandomVec3( &rng, 360.0f );
+
+		msg_t msg = NewMSGWriter( buf, sizeof( buf ) );
+		for( size_t i = 0; i < NUM_ENTITIES; i++ ) {
+			MSG_WriteDeltaEntity( &msg, &server_baselines[ i ], &sent[ i ], true );
+			server_baselines[ i ] = sent[ i ];
+		}
+		entity_bytes += msg.cursize;
+
+		size_t before_player = msg.cursize;
+		MSG_WriteDeltaPlayerState( &msg, &server_player_baseline, &player );
+		server_player_baseline = player;
+		player_bytes += msg.cursize - before_player;
+
+		msg_t reader = NewMSGReader( buf, msg.cursize, sizeof( buf ) );
+		for( size_t i = 0; i < NUM_ENTITIES; i++ ) {
+			bool remove;
+			int number = MSG_ReadEntityNumber( &reader, &remove );
+			if( number != sent[ i ].number || remove ) {
+				printf( "Read entity %d, expected %d\n", number, sent[ i ].number );
+				return 1;
+			}
+
+			// cleared so the padding compares equal
+			SyncEntityState received;
+			memset( &received, 0, sizeof( received ) );
+			received.number = number;
+			MSG_ReadDeltaEntity( &reader, &client_baselines[ i ], &received );
+
+			UpdateError( &origin_error, received.origin, sent[ i ].origin );
+			UpdateAngleError( &angles_error, received.angles, sent[ i ].angles );
+			UpdateError( &velocity_error, received.origin2, sent[ i ].origin2 );
+			if( moving[ i ].mover ) {
+				UpdateError( &mover_error, received.linearMovementBegin, sent[ i ].linearMovementBegin );
+				UpdateError( &mover_error, received.linearMovementEnd, sent[ i ].linearMovementEnd );
+			}
+			if( !EverythingElseMatches( received, sent[ i ] ) ) {
+				num_inexact_entities++;
+			}
+
+			client_baselines[ i ] = received;
+		}
+
+		SyncPlayerState received_player;
+		memset( &received_player, 0, sizeof( received_player ) );
+		MSG_ReadDeltaPlayerState( &reader, &client_player_baseline, &received_player );
+
+		UpdateAngleError( &viewangles_error, received_player.viewangles, player.viewangles );
+		UpdateError( &pmove_error, received_player.pmove.origin, player.pmove.origin );
+		UpdateError( &pmove_error, received_player.pmove.velocity, player.pmove.velocity );
+		if( !EverythingElseMatches( received_player, player ) ) {
+			num_inexact_players++;
+		}
+
+		client_player_baseline = received_player;
+
+		if( reader.readcount != msg.cursize ) {
+			printf( "Frame %zu read %zu bytes, wrote %zu\n", frame, reader.readcount, msg.cursize );
+			return 1;
+		}
+	}
+
+	printf( "%zu frames of %zu entities and a player\n", NUM_FRAMES, NUM_ENTITIES );
+	printf( "%.1f bytes per entity delta, %.1f per player delta\n",
+		double( entity_bytes ) / ( NUM_FRAMES * NUM_ENTITIES ), double( player_bytes ) / NUM_FRAMES );
+
+	bool ok = true;
+	ok = CheckError( origin_error ) && ok;
+	ok = CheckError( mover_error ) && ok;
+	ok = CheckError( angles_error ) && ok;
+	ok = CheckError( viewangles_error ) && ok;
+	ok = CheckError( velocity_error ) && ok;
+	ok = CheckError( pmove_error ) && ok;
+
+	if( num_inexact_entities > 0 || num_inexact_players > 0 ) {
+		printf( "%zu entity and %zu player deltas changed fields that should be exact FAIL\n", num_inexact_entities, num_inexact_players );
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
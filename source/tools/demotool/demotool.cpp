@@ -0,0 +1,702 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <setjmp.h>
+
+#include "qcommon/base.h"
+#include "qcommon/fs.h"
+#include "qcommon/qcommon.h"
+#include "qcommon/string.h"
+#include "qcommon/threadpool.h"
+#include "qcommon/threads.h"
+#include "qcommon/time.h"
+#include "qcommon/version.h"
+#include "gameshared/demo.h"
+#include "client/snap_read.h"
+
+#include "nanosort/nanosort.hpp"
+
+/*
+ * demotool index <demo> [output]
+ *
+ * rewrites demos recorded before keyframes so they have one every
+ * DEMO_KEYFRAME_INTERVAL ms, plus the seek index. we decode every snapshot,
+ * and at each keyframe replace the delta frame with a nodelta frame of the
+ * same snapshot, so the demo plays back exactly the same
+ *
+ * demotool stats <output dir> <demos or dirs>...
+ *
+ * decodes demos without the client, one per core, and writes out what
+ * happened in them as columns, to <output dir>/<demo path>.stats, where the
+ * path is relative to the dir it was found in, or just the name for demos
+ * given directly. players
+ * are identified by entity number, i.e. client number + 1, and 0 is the
+ * world, or nobody for assists. the file is:
+ *
+ * "cdstats\0", u32 num_tables, then for each table
+ *     string name, u64 num_rows, u32 num_columns, then for each column
+ *         string name, string numpy dtype, num_rows values
+ *
+ * where strings are a u32 length and then the chars. the tables are
+ *
+ * - positions: time, player, x, y, z, health, weapon. every player every frame
+ * - shots: time, player, weapon, alt
+ * - kills: time, victim, attacker, assist, damage_type, wallbang. damage_type
+ *   is DamageType::encoded
+ */
+
+void ShowErrorMessage( const char * msg, const char * file, int line ) {
+	printf( "%s (%s:%d)\n", msg, file, line );
+}
+
+void Com_Printf( const char * format, ... ) {
+	va_list argptr;
+	va_start( argptr, format );
+	vprintf( format, argptr );
+	va_end( argptr );
+}
+
+// set while a stats job is decoding, so a broken demo only fails that demo.
+// nothing between the setjmp in DecodeDemoStats and any Com_Error can have a
+// destructor, i.e. no TracyZoneScoped/defer/DynamicString in ParseMessage or
+// the snap_read/msg code it calls, because longjmp skips them
+static thread_local jmp_buf * abort_job;
+
+void Com_Error( const char * format, ... ) {
+	va_list argptr;
+	va_start( argptr, format );
+	vprintf( format, argptr );
+	va_end( argptr );
+	printf( "\n" );
+
+	if( abort_job != NULL ) {
+		longjmp( *abort_job, 1 );
+	}
+	exit( 1 );
+}
+
+struct DemoDecoder {
+	SyncEntityState baselines[ MAX_EDICTS ];
+	snapshot_t snapshots[ CMD_BACKUP ];
+	const snapshot_t * last_snapshot;
+};
+
+struct ParsedMessage {
+	const snapshot_t * snapshot;
+	size_t frame_start, frame_end;
+	size_t gamecommands_start, gamecommands_end;
+};
+
+static void SkipFrameHeader( msg_t * msg ) {
+	MSG_ReadIntBase128( msg ); // serverTime
+	MSG_ReadUintBase128( msg ); // snapNum
+	MSG_ReadUintBase128( msg ); // deltaFrameNum
+	MSG_ReadUintBase128( msg ); // ucmdExecuted
+}
+
+// finds the game commands in a frame so keyframes can copy them verbatim
+static void FindGameCommands( msg_t msg, ParsedMessage * parsed ) {
+	SkipFrameHeader( &msg );
+	u8 flags = MSG_ReadUint8( &msg );
+
+	parsed->gamecommands_start = msg.readcount;
+	MSG_ReadUint8( &msg ); // svc_gamecommands
+	while( MSG_ReadInt16( &msg ) != -1 ) {
+		MSG_ReadString( &msg );
+		if( flags & FRAMESNAP_FLAG_MULTIPOV ) {
+			MSG_SkipData( &msg, MSG_ReadUint8( &msg ) );
+		}
+	}
+	parsed->gamecommands_end = msg.readcount;
+}
+
+// CL_ParseServerMessage minus everything that isn't snapshots
+static ParsedMessage ParseMessage( DemoDecoder * decoder, msg_t msg ) {
+	ParsedMessage parsed = { };
+
+	while( msg.readcount < msg.cursize ) {
+		u8 cmd = MSG_ReadUint8( &msg );
+		switch( cmd ) {
+			case svc_servercmd:
+				MSG_ReadInt32( &msg );
+				MSG_ReadString( &msg );
+				break;
+
+			case svc_unreliable:
+				MSG_ReadString( &msg );
+				break;
+
+			case svc_serverdata:
+				return parsed; // always sent alone
+
+			case svc_spawnbaseline:
+				SNAP_ParseBaseline( &msg, decoder->baselines );
+				break;
+
+			case svc_clcack:
+				MSG_ReadUintBase128( &msg );
+				MSG_ReadUintBase128( &msg );
+				break;
+
+			case svc_frame: {
+				parsed.frame_start = msg.readcount - 1;
+				FindGameCommands( msg, &parsed );
+
+				const snapshot_t * snap = SNAP_ParseFrame( &msg, decoder->last_snapshot, decoder->snapshots, decoder->baselines, 0 );
+				parsed.frame_end = msg.readcount;
+				if( snap->valid ) {
+					decoder->last_snapshot = snap;
+					parsed.snapshot = snap;
+				}
+			} break;
+
+			default:
+				Com_Error( "Illegible server message" );
+		}
+	}
+
+	return parsed;
+}
+
+// SNAP_WriteFrameSnapToClient with no delta frame
+static void WriteKeyframe( msg_t * msg, const DemoDecoder * decoder, const snapshot_t * snap, Span< const u8 > gamecommands ) {
+	MSG_WriteUint8( msg, svc_frame );
+	MSG_WriteIntBase128( msg, snap->serverTime );
+	MSG_WriteUintBase128( msg, snap->serverFrame );
+	MSG_WriteUintBase128( msg, snap->deltaFrameNum );
+	MSG_WriteUintBase128( msg, snap->ucmdExecuted );
+
+	u8 flags = 0;
+	if( snap->allentities ) {
+		flags |= FRAMESNAP_FLAG_ALLENTITIES;
+	}
+	if( snap->multipov ) {
+		flags |= FRAMESNAP_FLAG_MULTIPOV;
+	}
+	MSG_WriteUint8( msg, flags );
+
+	MSG_Write( msg, gamecommands.ptr, gamecommands.n );
+
+	MSG_WriteUint8( msg, svc_match );
+	MSG_WriteDeltaGameState( msg, NULL, &snap->gameState );
+
+	for( int i = 0; i < snap->numplayers; i++ ) {
+		MSG_WriteUint8( msg, svc_playerinfo );
+		MSG_WriteDeltaPlayerState( msg, NULL, &snap->playerStates[ i ] );
+	}
+	MSG_WriteUint8( msg, 0 );
+
+	MSG_WriteUint8( msg, svc_packetentities );
+	for( int i = 0; i < snap->numEntities; i++ ) {
+		const SyncEntityState * ent = &snap->parsedEntities[ i % ARRAY_COUNT( snap->parsedEntities ) ];
+		MSG_WriteDeltaEntity( msg, &decoder->baselines[ ent->number ], ent, true );
+	}
+	MSG_WriteEntityNumber( msg, MAX_EDICTS, false );
+}
+
+static bool IndexDemo( ArenaAllocator * arena, const char * path, const char * output_path ) {
+	Span< u8 > demo = ReadFileBinary( sys_allocator, path );
+	if( demo.ptr == NULL ) {
+		printf( "Can't read %s\n", path );
+		return false;
+	}
+	defer { Free( sys_allocator, demo.ptr ); };
+
+	DemoMetadata metadata;
+	if( !ReadDemoMetadata( sys_allocator, &metadata, demo ) ) {
+		printf( "%s isn't a demo\n", path );
+		return false;
+	}
+	defer {
+		Free( sys_allocator, metadata.game_version.ptr );
+		Free( sys_allocator, metadata.server.ptr );
+		Free( sys_allocator, metadata.map.ptr );
+	};
+
+	// snapshots are only readable by the version that wrote them, and parsing
+	// one from another version gives garbage rather than failing cleanly
+	if( !StrEqual( metadata.game_version, APP_VERSION ) ) {
+		printf( "%s was recorded with version %.*s but this is %s, index it with demotool from %.*s\n", path,
+			int( metadata.game_version.n ), metadata.game_version.ptr, APP_VERSION,
+			int( metadata.game_version.n ), metadata.game_version.ptr );
+		return false;
+	}
+
+	if( metadata.metadata_version >= DemoMetadataVersion_AddSeekIndex ) {
+		printf( "%s already has a seek index\n", path );
+		return true;
+	}
+
+	Span< u8 > decompressed;
+	if( !DecompressDemo( sys_allocator, metadata, &decompressed, demo ) ) {
+		printf( "Can't decompress %s\n", path );
+		return false;
+	}
+	defer { Free( sys_allocator, decompressed.ptr ); };
+
+	TempAllocator temp = arena->temp();
+
+	// write next to the output and move it over at the end, so indexing a
+	// demo in place doesn't lose it if something goes wrong
+	const char * temp_output_path = temp( "{}.index", output_path );
+
+	RecordDemoContext ctx;
+	if( !StartWritingDemo( &temp, &ctx, temp_output_path ) )
+		return false;
+
+	DemoDecoder * decoder = Alloc< DemoDecoder >( sys_allocator );
+	memset( decoder, 0, sizeof( *decoder ) );
+	defer { Free( sys_allocator, decoder ); };
+
+	static u8 keyframe_buf[ U16_MAX ];
+	s64 last_keyframe = S64_MIN;
+	size_t num_rewritten = 0;
+
+	msg_t contents = NewMSGReader( decompressed.ptr, decompressed.n, decompressed.n );
+	while( true ) {
+		msg_t msg = MSG_ReadMsg( &contents );
+		if( msg.data == NULL )
+			break;
+
+		ParsedMessage parsed = ParseMessage( decoder, msg );
+		const snapshot_t * snap = parsed.snapshot;
+
+		if( snap == NULL || ( snap->delta && snap->serverTime < last_keyframe + DEMO_KEYFRAME_INTERVAL ) ) {
+			WriteDemoMessage( &ctx, msg );
+			continue;
+		}
+
+		AddDemoKeyframe( &ctx, snap->serverTime );
+		last_keyframe = snap->serverTime;
+
+		if( !snap->delta ) {
+			WriteDemoMessage( &ctx, msg );
+			continue;
+		}
+
+		msg_t keyframe = NewMSGWriter( keyframe_buf, sizeof( keyframe_buf ) );
+		MSG_Write( &keyframe, msg.data, parsed.frame_start );
+		WriteKeyframe( &keyframe, decoder, snap, Span< const u8 >( msg.data, msg.cursize ).slice( parsed.gamecommands_start, parsed.gamecommands_end ) );
+		MSG_Write( &keyframe, msg.data + parsed.frame_end, msg.cursize - parsed.frame_end );
+
+		WriteDemoMessage( &ctx, keyframe );
+		num_rewritten++;
+	}
+
+	size_t num_keyframes = ctx.keyframes.size();
+
+	DemoMetadata new_metadata = metadata;
+	new_metadata.metadata_version = DEMO_METADATA_VERSION;
+	new_metadata.decompressed_size = ctx.decompressed_size;
+	StopRecordingDemo( &temp, &ctx, new_metadata );
+
+	if( !MoveFile( &temp, temp_output_path, output_path, MoveFile_DoReplace ) ) {
+		printf( "Can't write %s\n", output_path );
+		return false;
+	}
+
+	printf( "%s: %zu keyframes, %zu snapshots rewritten, %.1f -> %.1f KB decompressed\n", output_path,
+		num_keyframes, num_rewritten, decompressed.n / 1024.0f, new_metadata.decompressed_size / 1024.0f );
+
+	return true;
+}
+
+template< typename T > const char * NumpyDType();
+template<> const char * NumpyDType< s64 >() { return "<i8"; }
+template<> const char * NumpyDType< s16 >() { return "<i2"; }
+template<> const char * NumpyDType< u16 >() { return "<u2"; }
+template<> const char * NumpyDType< u8 >() { return "|u1"; }
+template<> const char * NumpyDType< float >() { return "<f4"; }
+
+struct StatsWriter {
+	FILE * file;
+	bool ok;
+	u64 num_rows;
+};
+
+static void WriteStatsBytes( StatsWriter * writer, const void * data, size_t n ) {
+	writer->ok = writer->ok && WritePartialFile( writer->file, data, n );
+}
+
+static void WriteStatsString( StatsWriter * writer, const char * str ) {
+	u32 len = checked_cast< u32 >( strlen( str ) );
+	WriteStatsBytes( writer, &len, sizeof( len ) );
+	WriteStatsBytes( writer, str, len );
+}
+
+static void WriteStatsTable( StatsWriter * writer, const char * name, size_t num_rows, u32 num_columns ) {
+	writer->num_rows = num_rows;
+	WriteStatsString( writer, name );
+	WriteStatsBytes( writer, &writer->num_rows, sizeof( writer->num_rows ) );
+	WriteStatsBytes( writer, &num_columns, sizeof( num_columns ) );
+}
+
+template< typename T >
+static void WriteStatsColumn( StatsWriter * writer, const char * name, const NonRAIIDynamicArray< T > & column ) {
+	Assert( column.size() == writer->num_rows );
+	WriteStatsString( writer, name );
+	WriteStatsString( writer, NumpyDType< T >() );
+	WriteStatsBytes( writer, column.ptr(), column.num_bytes() );
+}
+
+struct DemoStats {
+	struct {
+		NonRAIIDynamicArray< s64 > time;
+		NonRAIIDynamicArray< u16 > player;
+		NonRAIIDynamicArray< float > x, y, z;
+		NonRAIIDynamicArray< s16 > health;
+		NonRAIIDynamicArray< u8 > weapon;
+	} positions;
+
+	struct {
+		NonRAIIDynamicArray< s64 > time;
+		NonRAIIDynamicArray< u16 > player;
+		NonRAIIDynamicArray< u8 > weapon;
+		NonRAIIDynamicArray< u8 > alt;
+	} shots;
+
+	struct {
+		NonRAIIDynamicArray< s64 > time;
+		NonRAIIDynamicArray< u16 > victim;
+		NonRAIIDynamicArray< u16 > attacker;
+		NonRAIIDynamicArray< u16 > assist;
+		NonRAIIDynamicArray< u8 > damage_type;
+		NonRAIIDynamicArray< u8 > wallbang;
+	} kills;
+
+	// event entities can stay in more than one snapshot
+	EntityID last_event[ MAX_EDICTS ];
+};
+
+template< typename F >
+static void ForEachStatsColumn( DemoStats * stats, F f ) {
+	f( &stats->positions.time ); f( &stats->positions.player );
+	f( &stats->positions.x ); f( &stats->positions.y ); f( &stats->positions.z );
+	f( &stats->positions.health ); f( &stats->positions.weapon );
+
+	f( &stats->shots.time ); f( &stats->shots.player ); f( &stats->shots.weapon ); f( &stats->shots.alt );
+
+	f( &stats->kills.time ); f( &stats->kills.victim ); f( &stats->kills.attacker ); f( &stats->kills.assist );
+	f( &stats->kills.damage_type ); f( &stats->kills.wallbang );
+}
+
+static bool ParseStatsInt( Span< const char > * cursor, int * x ) {
+	return TrySpanToInt( ParseToken( cursor, Parse_StopOnNewLine ), x );
+}
+
+static void AddKill( DemoStats * stats, s64 time, const char * command ) {
+	Span< const char > cursor = MakeSpan( command );
+	if( ParseToken( &cursor, Parse_StopOnNewLine ) != "obry" )
+		return;
+
+	int victim, attacker, assist, damage_type, wallbang;
+	bool ok = ParseStatsInt( &cursor, &victim );
+	ok = ok && ParseStatsInt( &cursor, &attacker );
+	ok = ok && ParseStatsInt( &cursor, &assist );
+	ok = ok && ParseStatsInt( &cursor, &damage_type );
+	ok = ok && ParseStatsInt( &cursor, &wallbang );
+	if( !ok )
+		return;
+
+	stats->kills.time.add( time );
+	stats->kills.victim.add( u16( victim ) );
+	stats->kills.attacker.add( u16( attacker ) );
+	stats->kills.assist.add( u16( Max2( assist, 0 ) ) );
+	stats->kills.damage_type.add( u8( damage_type ) );
+	stats->kills.wallbang.add( u8( wallbang ) );
+}
+
+static void AddSnapshotStats( DemoStats * stats, const snapshot_t * snap ) {
+	s64 time = snap->serverTime;
+
+	for( int i = 0; i < snap->numplayers; i++ ) {
+		const SyncPlayerState * ps = &snap->playerStates[ i ];
+		stats->positions.time.add( time );
+		stats->positions.player.add( u16( ps->playerNum + 1 ) );
+		stats->positions.x.add( ps->pmove.origin.x );
+		stats->positions.y.add( ps->pmove.origin.y );
+		stats->positions.z.add( ps->pmove.origin.z );
+		stats->positions.health.add( ps->health );
+		stats->positions.weapon.add( u8( ps->weapon ) );
+	}
+
+	for( int i = 0; i < snap->numEntities; i++ ) {
+		const SyncEntityState * ent = &snap->parsedEntities[ i % ARRAY_COUNT( snap->parsedEntities ) ];
+		if( ent->type != ET_EVENT || ent->id.id == stats->last_event[ ent->number ].id )
+			continue;
+		stats->last_event[ ent->number ] = ent->id;
+
+		for( const SyncEvent & event : ent->events ) {
+			if( event.type != EV_FIREWEAPON && event.type != EV_ALTFIREWEAPON )
+				continue;
+
+			stats->shots.time.add( time );
+			stats->shots.player.add( u16( ent->ownerNum ) );
+			stats->shots.weapon.add( u8( event.parm & 0xFF ) );
+			stats->shots.alt.add( event.type == EV_ALTFIREWEAPON ? 1 : 0 );
+		}
+	}
+
+	for( int i = 0; i < snap->numgamecommands; i++ ) {
+		AddKill( stats, time, snap->gamecommandsData + snap->gamecommands[ i ].commandOffset );
+	}
+}
+
+static bool WriteDemoStats( TempAllocator * temp, const char * path, DemoStats * stats ) {
+	if( !CreatePathForFile( temp, path ) )
+		return false;
+
+	FILE * file = OpenFile( temp, path, OpenFile_WriteOverwrite );
+	if( file == NULL )
+		return false;
+
+	StatsWriter writer = { file, true };
+
+	const char magic[ 8 ] = "cdstats";
+	u32 num_tables = 3;
+	WriteStatsBytes( &writer, magic, sizeof( magic ) );
+	WriteStatsBytes( &writer, &num_tables, sizeof( num_tables ) );
+
+	WriteStatsTable( &writer, "positions", stats->positions.time.size(), 7 );
+	WriteStatsColumn( &writer, "time", stats->positions.time );
+	WriteStatsColumn( &writer, "player", stats->positions.player );
+	WriteStatsColumn( &writer, "x", stats->positions.x );
+	WriteStatsColumn( &writer, "y", stats->positions.y );
+	WriteStatsColumn( &writer, "z", stats->positions.z );
+	WriteStatsColumn( &writer, "health", stats->positions.health );
+	WriteStatsColumn( &writer, "weapon", stats->positions.weapon );
+
+	WriteStatsTable( &writer, "shots", stats->shots.time.size(), 4 );
+	WriteStatsColumn( &writer, "time", stats->shots.time );
+	WriteStatsColumn( &writer, "player", stats->shots.player );
+	WriteStatsColumn( &writer, "weapon", stats->shots.weapon );
+	WriteStatsColumn( &writer, "alt", stats->shots.alt );
+
+	WriteStatsTable( &writer, "kills", stats->kills.time.size(), 6 );
+	WriteStatsColumn( &writer, "time", stats->kills.time );
+	WriteStatsColumn( &writer, "victim", stats->kills.victim );
+	WriteStatsColumn( &writer, "attacker", stats->kills.attacker );
+	WriteStatsColumn( &writer, "assist", stats->kills.assist );
+	WriteStatsColumn( &writer, "damage_type", stats->kills.damage_type );
+	WriteStatsColumn( &writer, "wallbang", stats->kills.wallbang );
+
+	return CloseFile( file ) && writer.ok;
+}
+
+struct StatsJob {
+	const char * path;
+	const char * output_path;
+	bool ok;
+	u64 num_frames;
+	u64 decompressed_size;
+};
+
+// see abort_job for what can't go in here
+static bool DecodeDemoStats( StatsJob * job, Span< u8 > decompressed, DemoDecoder * decoder, DemoStats * stats ) {
+	jmp_buf abort;
+	abort_job = &abort;
+	if( setjmp( abort ) != 0 ) {
+		abort_job = NULL;
+		return false;
+	}
+
+	msg_t contents = NewMSGReader( decompressed.ptr, decompressed.n, decompressed.n );
+	while( true ) {
+		msg_t msg = MSG_ReadMsg( &contents );
+		if( msg.data == NULL )
+			break;
+
+		const snapshot_t * snap = ParseMessage( decoder, msg ).snapshot;
+		if( snap == NULL )
+			continue;
+
+		AddSnapshotStats( stats, snap );
+		job->num_frames++;
+	}
+
+	abort_job = NULL;
+	return true;
+}
+
+static bool ComputeDemoStats( TempAllocator * temp, StatsJob * job ) {
+	TracyZoneScoped;
+
+	Span< u8 > demo = ReadFileBinary( sys_allocator, job->path );
+	if( demo.ptr == NULL ) {
+		printf( "Can't read %s\n", job->path );
+		return false;
+	}
+	defer { Free( sys_allocator, demo.ptr ); };
+
+	DemoMetadata metadata;
+	if( !ReadDemoMetadata( temp, &metadata, demo ) ) {
+		printf( "%s isn't a demo\n", job->path );
+		return false;
+	}
+
+	// the whole demo at once rather than a DemoStream because it's faster and
+	// we're already using every core
+	Span< u8 > decompressed;
+	if( !DecompressDemo( sys_allocator, metadata, &decompressed, demo ) ) {
+		printf( "Can't decompress %s\n", job->path );
+		return false;
+	}
+	defer { Free( sys_allocator, decompressed.ptr ); };
+
+	DemoDecoder * decoder = Alloc< DemoDecoder >( sys_allocator );
+	memset( decoder, 0, sizeof( *decoder ) );
+	defer { Free( sys_allocator, decoder ); };
+
+	DemoStats * stats = Alloc< DemoStats >( sys_allocator );
+	ForEachStatsColumn( stats, []( auto * column ) { column->init( sys_allocator ); } );
+	memset( stats->last_event, 0, sizeof( stats->last_event ) );
+	defer {
+		ForEachStatsColumn( stats, []( auto * column ) { column->shutdown(); } );
+		Free( sys_allocator, stats );
+	};
+
+	if( !DecodeDemoStats( job, decompressed, decoder, stats ) ) {
+		printf( "Can't decode %s\n", job->path );
+		return false;
+	}
+
+	job->decompressed_size = decompressed.n;
+
+	if( !WriteDemoStats( temp, job->output_path, stats ) ) {
+		printf( "Can't write %s\n", job->output_path );
+		return false;
+	}
+
+	return true;
+}
+
+static void DemoStatsJob( TempAllocator * temp, void * data ) {
+	StatsJob * job = ( StatsJob * ) data;
+	job->ok = ComputeDemoStats( temp, job );
+}
+
+struct FoundDemo {
+	const char * path;
+	const char * relative_path; // points into path
+};
+
+// skip is how much of path to drop to get the path we mirror in the output dir
+static void FindDemos( NonRAIIDynamicArray< FoundDemo > * demos, DynamicString * path, size_t skip ) {
+	if( FileExtension( path->c_str() ) == APP_DEMO_EXTENSION_STR ) {
+		char * copy = CopyString( sys_allocator, path->c_str() );
+		demos->add( { copy, copy + skip } );
+		return;
+	}
+
+	ListDirHandle scan = BeginListDir( sys_allocator, path->c_str() );
+
+	const char * name;
+	bool dir;
+	while( ListDirNext( &scan, &name, &dir ) ) {
+		// skip ., .., .git, etc
+		if( name[ 0 ] == '.' )
+			continue;
+
+		size_t old_len = path->length();
+		path->append( "/{}", name );
+		if( dir || FileExtension( name ) == APP_DEMO_EXTENSION_STR ) {
+			FindDemos( demos, path, skip );
+		}
+		path->truncate( old_len );
+	}
+}
+
+// everything here scales with the number of demos, so it all comes from
+// sys_allocator rather than the arena
+static bool DemoStatsMain( const char * output_dir, Span< const char * > inputs ) {
+	NonRAIIDynamicArray< FoundDemo > demos( sys_allocator );
+	defer {
+		for( FoundDemo demo : demos ) {
+			Free( sys_allocator, const_cast< char * >( demo.path ) );
+		}
+		demos.shutdown();
+	};
+
+	for( const char * input : inputs ) {
+		DynamicString path( sys_allocator, "{}", input );
+		size_t skip = FileExtension( input ) == APP_DEMO_EXTENSION_STR ? path.length() - FileName( input ).n : path.length() + 1;
+		FindDemos( &demos, &path, skip );
+	}
+
+	Span< StatsJob > jobs = AllocSpan< StatsJob >( sys_allocator, demos.size() );
+	defer {
+		for( const StatsJob & job : jobs ) {
+			Free( sys_allocator, const_cast< char * >( job.output_path ) );
+		}
+		Free( sys_allocator, jobs.ptr );
+	};
+
+	for( size_t i = 0; i < jobs.n; i++ ) {
+		jobs[ i ] = { };
+		jobs[ i ].path = demos[ i ].path;
+		jobs[ i ].output_path = ( *sys_allocator )( "{}/{}.stats", output_dir, StripExtension( demos[ i ].relative_path ) );
+	}
+
+	// demos from different inputs can still end up in the same place, and
+	// then two jobs would write the same file at once
+	{
+		Span< StatsJob > sorted = AllocSpan< StatsJob >( sys_allocator, jobs.n );
+		defer { Free( sys_allocator, sorted.ptr ); };
+		memcpy( sorted.ptr, jobs.ptr, jobs.num_bytes() );
+		nanosort( sorted.begin(), sorted.end(), []( const StatsJob & a, const StatsJob & b ) {
+			return strcmp( a.output_path, b.output_path ) < 0;
+		} );
+
+		bool duplicates = false;
+		for( size_t i = 1; i < sorted.n; i++ ) {
+			if( StrEqual( sorted[ i - 1 ].output_path, sorted[ i ].output_path ) ) {
+				printf( "%s and %s would both write %s\n", sorted[ i - 1 ].path, sorted[ i ].path, sorted[ i ].output_path );
+				duplicates = true;
+			}
+		}
+
+		if( duplicates )
+			return false;
+	}
+
+	Time start = Now();
+	ParallelFor( jobs, DemoStatsJob );
+	float seconds = ToSeconds( Now() - start );
+
+	size_t num_ok = 0;
+	u64 num_frames = 0;
+	u64 decompressed_size = 0;
+	for( const StatsJob & job : jobs ) {
+		num_ok += job.ok ? 1 : 0;
+		num_frames += job.num_frames;
+		decompressed_size += job.decompressed_size;
+	}
+
+	printf( "%zu/%zu demos, %llu frames in %.2fs on %u cores: %.0f frames/s, %.1f MB/s decompressed\n",
+		num_ok, jobs.n, ( unsigned long long ) num_frames, seconds, GetCoreCount(),
+		num_frames / seconds, decompressed_size / seconds / 1024.0f / 1024.0f );
+
+	return num_ok == jobs.n;
+}
+
+int main( int argc, char ** argv ) {
+	bool index = ( argc == 3 || argc == 4 ) && StrEqual( argv[ 1 ], "index" );
+	bool stats = argc >= 4 && StrEqual( argv[ 1 ], "stats" );
+	if( !index && !stats ) {
+		printf( "Usage: %s index <demo> [output]\n", argv[ 0 ] );
+		printf( "       %s stats <output dir> <demos or dirs>...\n", argv[ 0 ] );
+		return 1;
+	}
+
+	if( stats ) {
+		InitThreadPool();
+		defer { ShutdownThreadPool(); };
+		return DemoStatsMain( argv[ 2 ], Span< const char * >( ( const char ** ) argv + 3, argc - 3 ) ) ? 0 : 1;
+	}
+
+	constexpr size_t arena_size = 1024 * 1024;
+	ArenaAllocator arena( sys_allocator->allocate( arena_size, 16 ), arena_size );
+	defer { Free( sys_allocator, arena.get_memory() ); };
+
+	const char * output_path = argc == 4 ? argv[ 3 ] : argv[ 2 ];
+	return IndexDemo( &arena, argv[ 2 ], output_path ) ? 0 : 1;
+}
@@ -6,6 +6,8 @@
 #include "qcommon/fs.h"
 #include "qcommon/string.h"
 #include "qcommon/hash.h"
+#include "qcommon/threadpool.h"
+#include "qcommon/time.h"
 #include "gameshared/cdmap.h"
 #include "gameshared/editor_materials.h"
 #include "gameshared/q_math.h"
@@ -217,6 +219,22 @@ static std::vector< CompiledMesh > BrushToCompiledMeshes( const ParsedBrush & br
 	return face_meshes;
 }
 
+/*
+ * this is copied from Physically Based Rendering
+ * https://pbr-book.org/3ed-2018/Primitives_and_Intersection_Acceleration/Kd-Tree_Accelerator
+ *
+ * big nodes pick their split from a histogram of brush bounds instead of
+ * trying every brush edge, and big subtrees get built on the thread pool.
+ * forked subtrees get stitched back together in the same order a single
+ * thread would have built them in, so the output doesn't depend on timing
+ */
+
+static constexpr float KDTREE_TRAVERSAL_COST = 1.0f;
+static constexpr float KDTREE_INTERSECT_COST = 80.0f;
+
+static constexpr u32 KDTREE_SAH_BINS = 32;
+static constexpr size_t KDTREE_FORK_THRESHOLD = 256;
+
 struct CandidatePlane {
 	float distance;
 	u32 brush_id;
@@ -224,7 +242,39 @@ struct CandidatePlane {
 };
 
 struct CandidatePlanes {
-	std::vector< CandidatePlane > axes[ 3 ];
+	Span< CandidatePlane > axes[ 3 ];
+};
+
+struct KDTreeBuildJob;
+
+struct KDTreeBuildNode {
+	u32 axis; // MapKDTreeNode::LEAF for leaves
+	float distance;
+	u32 front_child;
+	u32 first_brush;
+	u32 num_brushes;
+	KDTreeBuildJob * fork;
+};
+
+struct KDTreeBuilder {
+	Span< const MinMax3 > brush_bounds;
+	size_t binned_sah_above;
+	JobCounter jobs;
+};
+
+struct KDTreeBuildJob {
+	KDTreeBuilder * builder;
+
+	size_t scratch_size;
+	ArenaAllocator * scratch; // only while the job is running
+
+	Span< u32 > brush_ids;
+	CandidatePlanes candidate_planes;
+	MinMax3 bounds;
+	u32 max_depth;
+
+	NonRAIIDynamicArray< KDTreeBuildNode > nodes;
+	NonRAIIDynamicArray< u32 > brush_indices;
 };
 
 static int MaxAxis( MinMax3 bounds ) {
@@ -239,7 +289,29 @@ static float SurfaceArea( MinMax3 bounds ) {
 	return 2.0f * ( dims.x * dims.y + dims.x * dims.z + dims.y * dims.z );
 }
 
-static CandidatePlanes BuildCandidatePlanes( Span< const u32 > brush_ids, Span< const MinMax3 > brush_bounds ) {
+static float SplitCost( MinMax3 node_bounds, int axis, float distance, size_t num_below, size_t num_above ) {
+	MinMax3 below_bounds = node_bounds;
+	MinMax3 above_bounds = node_bounds;
+	below_bounds.maxs[ axis ] = distance;
+	above_bounds.mins[ axis ] = distance;
+
+	float node_surface_area = SurfaceArea( node_bounds );
+	float frac_below = SurfaceArea( below_bounds ) / node_surface_area;
+	float frac_above = SurfaceArea( above_bounds ) / node_surface_area;
+
+	float empty_bonus = num_below == 0 || num_above == 0 ? 0.5f : 1.0f;
+
+	return KDTREE_TRAVERSAL_COST + KDTREE_INTERSECT_COST * empty_bonus * ( frac_below * num_below + frac_above * num_above );
+}
+
+// children only ever get a subset of their parent's brushes, so this is
+// enough for the deepest possible chain of nodes below a subtree root
+static size_t KDTreeScratchSize( size_t num_brushes, u32 max_depth ) {
+	size_t per_node = num_brushes * ( 2 * sizeof( u32 ) + 18 * sizeof( CandidatePlane ) ) + 256;
+	return ( max_depth + 1 ) * per_node;
+}
+
+static CandidatePlanes BuildCandidatePlanes( Allocator * a, Span< const u32 > brush_ids, Span< const MinMax3 > brush_bounds ) {
 	TracyZoneScoped;
 
 	CandidatePlanes planes;
@@ -251,12 +323,12 @@ static CandidatePlanes BuildCandidatePlanes( Span< const u32 > brush_ids, Span<
 	for( int i = 0; i < 3; i++ ) {
 		TracyZoneScopedN( zone_labels[ i ] );
 
-		std::vector< CandidatePlane > & axis = planes.axes[ i ];
-		axis.reserve( brush_ids.n * 2 );
+		Span< CandidatePlane > axis = AllocSpan< CandidatePlane >( a, brush_ids.n * 2 );
 
-		for( u32 brush_id : brush_ids ) {
-			axis.push_back( { brush_bounds[ brush_id ].mins[ i ], brush_id, true } );
-			axis.push_back( { brush_bounds[ brush_id ].maxs[ i ], brush_id, false } );
+		for( size_t j = 0; j < brush_ids.n; j++ ) {
+			u32 brush_id = brush_ids[ j ];
+			axis[ j * 2 + 0 ] = { brush_bounds[ brush_id ].mins[ i ], brush_id, true };
+			axis[ j * 2 + 1 ] = { brush_bounds[ brush_id ].maxs[ i ], brush_id, false };
 		}
 
 		{
@@ -267,172 +339,353 @@ static CandidatePlanes BuildCandidatePlanes( Span< const u32 > brush_ids, Span<
 				return a.distance < b.distance;
 			} );
 		}
+
+		planes.axes[ i ] = axis;
 	}
 
 	return planes;
 }
 
-static void SplitBounds( MinMax3 bounds, int axis, float distance, MinMax3 * below, MinMax3 * above ) {
-	*below = bounds;
-	*above = bounds;
+static bool FindBestSplitExact( CandidatePlanes candidate_planes, size_t num_brushes, MinMax3 node_bounds, int * best_axis, size_t * best_plane ) {
+	TracyZoneScoped;
+
+	float best_cost = INFINITY;
+
+	for( int i = 0; i < 3; i++ ) {
+		int axis = ( MaxAxis( node_bounds ) + i ) % 3;
+
+		size_t num_below = 0;
+		size_t num_above = num_brushes;
+
+		for( size_t j = 0; j < candidate_planes.axes[ axis ].n; j++ ) {
+			const CandidatePlane & plane = candidate_planes.axes[ axis ][ j ];
+
+			if( !plane.start_edge ) {
+				num_above--;
+			}
+
+			if( plane.distance > node_bounds.mins[ axis ] && plane.distance < node_bounds.maxs[ axis ] ) {
+				float cost = SplitCost( node_bounds, axis, plane.distance, num_below, num_above );
+				if( cost < best_cost ) {
+					best_cost = cost;
+					*best_axis = axis;
+					*best_plane = j;
+				}
+			}
+
+			if( plane.start_edge ) {
+				num_below++;
+			}
+		}
+
+		if( best_cost != INFINITY ) {
+			return true;
+		}
+	}
 
-	below->maxs[ axis ] = distance;
-	above->mins[ axis ] = distance;
+	return false;
 }
 
-static u32 MakeLeaf( CompiledKDTree * tree, Span< const u32 > brush_ids ) {
+static bool FindBestSplitBinned( Span< const u32 > brush_ids, Span< const MinMax3 > brush_bounds, MinMax3 node_bounds, int * best_axis, float * best_distance ) {
 	TracyZoneScoped;
 
-	MapKDTreeNode leaf;
-	leaf.leaf.is_leaf = 3;
-	leaf.leaf.first_brush = tree->brush_indices.size();
-	leaf.leaf.num_brushes = checked_cast< u16 >( brush_ids.n );
+	float best_cost = INFINITY;
+
+	for( int axis = 0; axis < 3; axis++ ) {
+		float lo = node_bounds.mins[ axis ];
+		float hi = node_bounds.maxs[ axis ];
+		if( hi <= lo )
+			continue;
 
-	for( u32 brush_id : brush_ids ) {
-		tree->brush_indices.push_back( brush_id );
+		// brushes can stick out of the node so clamp them into the end bins
+		u32 starts[ KDTREE_SAH_BINS ] = { };
+		u32 ends[ KDTREE_SAH_BINS ] = { };
+		float scale = KDTREE_SAH_BINS / ( hi - lo );
+		for( u32 brush_id : brush_ids ) {
+			float start = Clamp( 0.0f, ( brush_bounds[ brush_id ].mins[ axis ] - lo ) * scale, float( KDTREE_SAH_BINS - 1 ) );
+			float end = Clamp( 0.0f, ( brush_bounds[ brush_id ].maxs[ axis ] - lo ) * scale, float( KDTREE_SAH_BINS - 1 ) );
+			starts[ u32( start ) ]++;
+			ends[ u32( end ) ]++;
+		}
+
+		size_t num_below = 0;
+		size_t num_above = brush_ids.n;
+
+		for( u32 i = 1; i < KDTREE_SAH_BINS; i++ ) {
+			num_below += starts[ i - 1 ];
+			num_above -= ends[ i - 1 ];
+
+			float distance = lo + ( hi - lo ) * i / KDTREE_SAH_BINS;
+			if( distance <= lo || distance >= hi )
+				continue;
+
+			float cost = SplitCost( node_bounds, axis, distance, num_below, num_above );
+			if( cost < best_cost ) {
+				best_cost = cost;
+				*best_axis = axis;
+				*best_distance = distance;
+			}
+		}
 	}
 
-	tree->nodes.push_back( leaf );
-	return tree->nodes.size() - 1;
+	return best_cost != INFINITY;
+}
+
+static u32 AddKDTreeNode( KDTreeBuildJob * job, KDTreeBuildNode node ) {
+	job->nodes.add( node );
+	return checked_cast< u32 >( job->nodes.size() - 1 );
+}
+
+static u32 MakeLeaf( KDTreeBuildJob * job, Span< const u32 > brush_ids ) {
+	TracyZoneScoped;
+
+	KDTreeBuildNode leaf = { };
+	leaf.axis = MapKDTreeNode::LEAF;
+	leaf.first_brush = checked_cast< u32 >( job->brush_indices.size() );
+	leaf.num_brushes = checked_cast< u32 >( brush_ids.n );
+
+	job->brush_indices.add_many( brush_ids );
+
+	return AddKDTreeNode( job, leaf );
 }
 
-static u32 BuildKDTreeRecursive( CompiledKDTree * tree, Span< const u32 > brush_ids, Span< const MinMax3 > brush_bounds, CandidatePlanes candidate_planes, MinMax3 node_bounds, u32 max_depth ) {
-	/*
-	 * this is copied from Physically Based Rendering
-	 * https://pbr-book.org/3ed-2018/Primitives_and_Intersection_Acceleration/Kd-Tree_Accelerator
-	 */
+static void BuildKDTreeJob( TempAllocator * temp, void * data );
+
+static KDTreeBuildJob * ForkKDTreeBuild( KDTreeBuilder * builder, Span< const u32 > brush_ids, CandidatePlanes candidate_planes, MinMax3 bounds, u32 max_depth ) {
+	TracyZoneScoped;
+
+	KDTreeBuildJob * job = Alloc< KDTreeBuildJob >( sys_allocator );
+	job->builder = builder;
+	job->scratch_size = KDTreeScratchSize( brush_ids.n, max_depth );
+	job->brush_ids = CloneSpan( sys_allocator, brush_ids );
+	for( int i = 0; i < 3; i++ ) {
+		job->candidate_planes.axes[ i ] = CloneSpan( sys_allocator, candidate_planes.axes[ i ] );
+	}
+	job->bounds = bounds;
+	job->max_depth = max_depth;
+	job->nodes.init( sys_allocator );
+	job->brush_indices.init( sys_allocator );
+
+	ThreadPoolDo( BuildKDTreeJob, job, &builder->jobs );
 
+	return job;
+}
+
+static u32 BuildKDTreeRecursive( KDTreeBuildJob * job, Span< const u32 > brush_ids, CandidatePlanes candidate_planes, MinMax3 node_bounds, u32 max_depth ) {
 	TracyZoneScoped;
 
+	const KDTreeBuilder * builder = job->builder;
+	Span< const MinMax3 > brush_bounds = builder->brush_bounds;
+
 	if( brush_ids.n <= 1 || max_depth == 0 ) {
-		return MakeLeaf( tree, brush_ids );
+		return MakeLeaf( job, brush_ids );
+	}
+
+	TempAllocator temp = job->scratch->temp();
+
+	// candidate planes are sorted once when we switch to exact splits and
+	// split along with the brushes after that
+	bool exact = brush_ids.n <= builder->binned_sah_above;
+	if( exact && candidate_planes.axes[ 0 ].n == 0 ) {
+		candidate_planes = BuildCandidatePlanes( &temp, brush_ids, brush_bounds );
 	}
 
 	int best_axis = 0;
 	size_t best_plane = 0;
+	float distance;
 
-	float node_surface_area = SurfaceArea( node_bounds );
-
-	{
-		TracyZoneScopedN( "Find best split" );
+	if( exact ) {
+		if( !FindBestSplitExact( candidate_planes, brush_ids.n, node_bounds, &best_axis, &best_plane ) ) {
+			return MakeLeaf( job, brush_ids );
+		}
+		distance = candidate_planes.axes[ best_axis ][ best_plane ].distance;
+	}
+	else {
+		if( !FindBestSplitBinned( brush_ids, brush_bounds, node_bounds, &best_axis, &distance ) ) {
+			return MakeLeaf( job, brush_ids );
+		}
+	}
 
-		float best_cost = INFINITY;
+	// make node
+	KDTreeBuildNode node = { };
+	node.axis = best_axis;
+	node.distance = distance;
 
-		for( int i = 0; i < 3; i++ ) {
-			int axis = ( MaxAxis( node_bounds ) + i ) % 3;
+	DynamicArray< u32 > below_brush_ids( &temp, brush_ids.n );
+	DynamicArray< u32 > above_brush_ids( &temp, brush_ids.n );
+	CandidatePlanes below_planes = { };
+	CandidatePlanes above_planes = { };
 
-			size_t num_below = 0;
-			size_t num_above = brush_ids.n;
+	if( exact ) {
+		{
+			TracyZoneScopedN( "Classify above/below" );
 
-			for( size_t j = 0; j < candidate_planes.axes[ axis ].size(); j++ ) {
-				const CandidatePlane & plane = candidate_planes.axes[ axis ][ j ];
+			Span< const CandidatePlane > axis = candidate_planes.axes[ best_axis ];
 
-				if( !plane.start_edge ) {
-					num_above--;
+			for( size_t i = 0; i < best_plane; i++ ) {
+				if( axis[ i ].start_edge ) {
+					below_brush_ids.add( axis[ i ].brush_id );
 				}
+			}
 
-				if( plane.distance > node_bounds.mins[ axis ] && plane.distance < node_bounds.maxs[ axis ] ) {
-					MinMax3 below_bounds, above_bounds;
-					SplitBounds( node_bounds, axis, plane.distance, &below_bounds, &above_bounds );
+			for( size_t i = best_plane + 1; i < axis.n; i++ ) {
+				if( !axis[ i ].start_edge ) {
+					above_brush_ids.add( axis[ i ].brush_id );
+				}
+			}
+		}
 
-					float frac_below = SurfaceArea( below_bounds ) / node_surface_area;
-					float frac_above = SurfaceArea( above_bounds ) / node_surface_area;
+		{
+			TracyZoneScopedN( "Split candidate planes" );
 
-					float empty_bonus = num_below == 0 || num_above == 0 ? 0.5f : 1.0f;
+			for( int i = 0; i < 3; i++ ) {
+				below_planes.axes[ i ] = AllocSpan< CandidatePlane >( &temp, candidate_planes.axes[ i ].n );
+				above_planes.axes[ i ] = AllocSpan< CandidatePlane >( &temp, candidate_planes.axes[ i ].n );
 
-					constexpr float traversal_cost = 1.0f;
-					constexpr float intersect_cost = 80.0f;
-					float cost = traversal_cost + intersect_cost * empty_bonus * ( frac_below * num_below + frac_above * num_above );
+				size_t num_below = 0;
+				size_t num_above = 0;
 
-					if( cost < best_cost ) {
-						best_cost = cost;
-						best_axis = axis;
-						best_plane = j;
-					}
-				}
+				for( const CandidatePlane & plane : candidate_planes.axes[ i ] ) {
+					const MinMax3 & curr_brush_bounds = brush_bounds[ plane.brush_id ];
 
-				if( plane.start_edge ) {
-					num_below++;
+					if( curr_brush_bounds.mins[ best_axis ] < distance )
+						below_planes.axes[ i ][ num_below++ ] = plane;
+					if( curr_brush_bounds.maxs[ best_axis ] > distance )
+						above_planes.axes[ i ][ num_above++ ] = plane;
 				}
-			}
 
-			if( best_cost != INFINITY ) {
-				break;
+				below_planes.axes[ i ].n = num_below;
+				above_planes.axes[ i ].n = num_above;
 			}
 		}
+	}
+	else {
+		TracyZoneScopedN( "Classify above/below" );
 
-		if( best_cost == INFINITY ) {
-			return MakeLeaf( tree, brush_ids );
+		for( u32 brush_id : brush_ids ) {
+			const MinMax3 & bounds = brush_bounds[ brush_id ];
+			bool above = bounds.maxs[ best_axis ] > distance;
+			bool below = bounds.mins[ best_axis ] < distance || !above;
+
+			if( below )
+				below_brush_ids.add( brush_id );
+			if( above )
+				above_brush_ids.add( brush_id );
 		}
 	}
 
-	// make node
-	float distance = candidate_planes.axes[ best_axis ][ best_plane ].distance;
+	MinMax3 below_bounds = node_bounds;
+	MinMax3 above_bounds = node_bounds;
+	below_bounds.maxs[ best_axis ] = distance;
+	above_bounds.mins[ best_axis ] = distance;
 
-	MapKDTreeNode node;
-	node.node.is_leaf_and_splitting_plane_axis = best_axis;
-	node.node.splitting_plane_distance = distance;
+	u32 node_id = AddKDTreeNode( job, node );
 
-	std::vector< u32 > below_brush_ids;
-	std::vector< u32 > above_brush_ids;
+	// start building the front child on another thread before we build the
+	// back child, but leave its node after the back child so the layout
+	// matches a single threaded build
+	KDTreeBuildJob * fork = NULL;
+	if( above_brush_ids.size() >= KDTREE_FORK_THRESHOLD ) {
+		fork = ForkKDTreeBuild( job->builder, above_brush_ids.span(), above_planes, above_bounds, max_depth - 1 );
+	}
 
-	{
-		TracyZoneScopedN( "Classify above/below" );
+	BuildKDTreeRecursive( job, below_brush_ids.span(), below_planes, below_bounds, max_depth - 1 );
 
-		for( size_t i = 0; i < best_plane; i++ ) {
-			if( candidate_planes.axes[ best_axis ][ i ].start_edge ) {
-				below_brush_ids.push_back( candidate_planes.axes[ best_axis ][ i ].brush_id );
-			}
-		}
+	if( fork != NULL ) {
+		KDTreeBuildNode forked = { };
+		forked.fork = fork;
+		node.front_child = AddKDTreeNode( job, forked );
+	}
+	else {
+		node.front_child = BuildKDTreeRecursive( job, above_brush_ids.span(), above_planes, above_bounds, max_depth - 1 );
+	}
 
-		for( size_t i = best_plane + 1; i < candidate_planes.axes[ best_axis ].size(); i++ ) {
-			if( !candidate_planes.axes[ best_axis ][ i ].start_edge ) {
-				above_brush_ids.push_back( candidate_planes.axes[ best_axis ][ i ].brush_id );
-			}
-		}
+	job->nodes[ node_id ] = node;
+
+	return node_id;
+}
+
+static void BuildKDTreeJob( TempAllocator * temp, void * data ) {
+	KDTreeBuildJob * job = ( KDTreeBuildJob * ) data;
+
+	ArenaAllocator scratch( sys_allocator->allocate( job->scratch_size, 16 ), job->scratch_size );
+	job->scratch = &scratch;
+
+	BuildKDTreeRecursive( job, job->brush_ids, job->candidate_planes, job->bounds, job->max_depth );
+
+	job->scratch = NULL;
+	Free( sys_allocator, scratch.get_memory() );
+	Free( sys_allocator, job->brush_ids.ptr );
+	for( Span< CandidatePlane > axis : job->candidate_planes.axes ) {
+		Free( sys_allocator, axis.ptr );
 	}
+}
 
-	CandidatePlanes below_planes;
-	CandidatePlanes above_planes;
-	{
-		TracyZoneScopedN( "Split candidate planes" );
+static u32 FlattenKDTree( CompiledKDTree * tree, KDTreeBuildJob * job, u32 local_id ) {
+	KDTreeBuildNode node = job->nodes[ local_id ];
 
-		for( int i = 0; i < 3; i++ ) {
-			std::vector< CandidatePlane > & axis_below = below_planes.axes[ i ];
-			std::vector< CandidatePlane > & axis_above = above_planes.axes[ i ];
+	if( node.fork != NULL ) {
+		u32 node_id = FlattenKDTree( tree, node.fork, 0 );
+		node.fork->nodes.shutdown();
+		node.fork->brush_indices.shutdown();
+		Free( sys_allocator, node.fork );
+		return node_id;
+	}
 
-			for( size_t j = 0; j < candidate_planes.axes[ i ].size(); j++ ) {
-				CandidatePlane & plane = candidate_planes.axes[ i ][ j ];
-				const MinMax3 & curr_brush_bounds = brush_bounds[ plane.brush_id ];
+	u32 node_id = checked_cast< u32 >( tree->nodes.size() );
 
-				if( curr_brush_bounds.mins[ best_axis ] < distance )
-					axis_below.push_back( plane );
-				if( curr_brush_bounds.maxs[ best_axis ] > distance )
-					axis_above.push_back( plane );
-			}
+	if( node.axis == MapKDTreeNode::LEAF ) {
+		MapKDTreeNode leaf;
+		leaf.leaf.is_leaf = MapKDTreeNode::LEAF;
+		leaf.leaf.first_brush = tree->brush_indices.size();
+		leaf.leaf.num_brushes = node.num_brushes;
 
-			below_planes.axes[ i ] = axis_below;
-			above_planes.axes[ i ] = axis_above;
+		for( u32 i = 0; i < node.num_brushes; i++ ) {
+			tree->brush_indices.push_back( job->brush_indices[ node.first_brush + i ] );
 		}
-	}
 
-	MinMax3 below_bounds, above_bounds;
-	SplitBounds( node_bounds, best_axis, distance, &below_bounds, &above_bounds );
+		tree->nodes.push_back( leaf );
+		return node_id;
+	}
 
-	u16 node_id = checked_cast< u16 >( tree->nodes.size() );
 	tree->nodes.push_back( MapKDTreeNode() );
 
-	BuildKDTreeRecursive( tree, VectorToSpan( below_brush_ids ), brush_bounds, below_planes, below_bounds, max_depth - 1 );
-	node.node.front_child = BuildKDTreeRecursive( tree, VectorToSpan( above_brush_ids ), brush_bounds, above_planes, above_bounds, max_depth - 1 );
+	MapKDTreeNode flat;
+	flat.node.is_leaf_and_splitting_plane_axis = node.axis;
+	flat.node.splitting_plane_distance = node.distance;
 
-	tree->nodes[ node_id ] = node;
+	FlattenKDTree( tree, job, local_id + 1 );
+	flat.node.front_child = FlattenKDTree( tree, job, node.front_child );
+
+	tree->nodes[ node_id ] = flat;
 
 	return node_id;
 }
 
-static void BuildKDTree( CompiledKDTree * tree, Span< const MinMax3 > brush_bounds ) {
+static float KDTreeSAHCost( const CompiledKDTree * tree, u32 node_id, MinMax3 bounds, float root_surface_area ) {
+	MapKDTreeNode node = tree->nodes[ node_id ];
+	float frac = SurfaceArea( bounds ) / root_surface_area;
+
+	if( MapKDTreeNode::is_leaf( node ) ) {
+		return KDTREE_INTERSECT_COST * node.leaf.num_brushes * frac;
+	}
+
+	int axis = node.node.is_leaf_and_splitting_plane_axis;
+	MinMax3 below_bounds = bounds;
+	MinMax3 above_bounds = bounds;
+	below_bounds.maxs[ axis ] = node.node.splitting_plane_distance;
+	above_bounds.mins[ axis ] = node.node.splitting_plane_distance;
+
+	return KDTREE_TRAVERSAL_COST * frac
+		+ KDTreeSAHCost( tree, node_id + 1, below_bounds, root_surface_area )
+		+ KDTreeSAHCost( tree, node.node.front_child, above_bounds, root_surface_area );
+}
+
+static void BuildKDTree( CompiledKDTree * tree, Span< const MinMax3 > brush_bounds, size_t binned_sah_above ) {
 	TracyZoneScoped;
 
+	Time start = Now();
+
 	MinMax3 tree_bounds = MinMax3::Empty();
 	for( const MinMax3 & bounds : brush_bounds ) {
 		tree_bounds = Union( bounds, tree_bounds );
@@ -440,14 +693,36 @@ static void BuildKDTree( CompiledKDTree * tree, Span< const MinMax3 > brush_boun
 
 	u32 max_depth = roundf( 8.0f + 1.3f * Log2( brush_bounds.n ) );
 
-	std::vector< u32 > brush_ids;
+	KDTreeBuilder builder;
+	builder.brush_bounds = brush_bounds;
+	builder.binned_sah_above = binned_sah_above;
+
+	KDTreeBuildJob root = { };
+	root.builder = &builder;
+	root.scratch_size = KDTreeScratchSize( brush_bounds.n, max_depth );
+	root.bounds = tree_bounds;
+	root.max_depth = max_depth;
+	root.nodes.init( sys_allocator );
+	root.brush_indices.init( sys_allocator );
+	defer {
+		root.nodes.shutdown();
+		root.brush_indices.shutdown();
+	};
+
+	root.brush_ids = AllocSpan< u32 >( sys_allocator, brush_bounds.n );
 	for( u32 i = 0; i < checked_cast< u32 >( brush_bounds.n ); i++ ) {
-		brush_ids.push_back( i );
+		root.brush_ids[ i ] = i;
 	}
 
-	CandidatePlanes candidate_planes = BuildCandidatePlanes( VectorToSpan( brush_ids ), brush_bounds );
+	BuildKDTreeJob( NULL, &root );
+	ThreadPoolWait( &builder.jobs );
+
+	FlattenKDTree( tree, &root, 0 );
 
-	BuildKDTreeRecursive( tree, VectorToSpan( brush_ids ), brush_bounds, candidate_planes, tree_bounds, max_depth );
+	if( tree->nodes.size() > 1 ) {
+		float sah_cost = KDTreeSAHCost( tree, 0, tree_bounds, SurfaceArea( tree_bounds ) );
+		ggprint( "Built kd-tree with {} brushes, {} nodes in {.2}ms, SAH cost {.2}\n", brush_bounds.n, tree->nodes.size(), ToSeconds( Now() - start ) * 1000.0f, sah_cost );
+	}
 }
 
 static CompiledMesh MergeMeshes( Span< const CompiledMesh > meshes ) {
@@ -521,8 +796,7 @@ static std::vector< CompiledMesh > GenerateRenderGeometry( const ParsedEntity &
 
 		{ TracyZoneScopedN( "meshopt_remapVertexBuffer" ); meshopt_remapVertexBuffer( vertices, merged.vertices.data(), merged.vertices.size(), sizeof( InterleavedMapVertex ), remap.data() ); }
 		{ TracyZoneScopedN( "meshopt_remapIndexBuffer" ); meshopt_remapIndexBuffer( indices, merged.indices.data(), merged.indices.size(), remap.data() ); }
-		// optimizeVertexCache is extremely slow so don't bother
-		// { TracyZoneScopedN( "meshopt_optimizeVertexCache" ); meshopt_optimizeVertexCache( indices, indices, num_indices, num_vertices ); }
+		{ TracyZoneScopedN( "meshopt_optimizeVertexCache" ); meshopt_optimizeVertexCache( indices, indices, num_indices, num_vertices ); }
 		{ TracyZoneScopedN( "meshopt_optimizeOverdraw" ); meshopt_optimizeOverdraw( indices, indices, num_indices, &vertices[ 0 ].position.x, num_vertices, sizeof( InterleavedMapVertex ), 1.05f ); }
 		{ TracyZoneScopedN( "meshopt_optimizeVertexFetch" ); meshopt_optimizeVertexFetch( vertices, indices, num_indices, vertices, num_vertices, sizeof( InterleavedMapVertex ) ); }
 
@@ -532,6 +806,51 @@ static std::vector< CompiledMesh > GenerateRenderGeometry( const ParsedEntity &
 	return optimized_meshes;
 }
 
+struct PositionQuantization {
+	Vec3 offset;
+	float step;
+};
+
+// snap to the smallest power of two grid that covers the whole model, so
+// anything the editor already put on that grid comes out exact, and every
+// mesh in the model lands on the same grid
+static PositionQuantization ChoosePositionQuantization( Span< const CompiledMesh > meshes ) {
+	MinMax3 bounds = MinMax3::Empty();
+	for( const CompiledMesh & mesh : meshes ) {
+		for( const InterleavedMapVertex & v : mesh.vertices ) {
+			bounds = Union( bounds, v.position );
+		}
+	}
+
+	PositionQuantization quantization = { };
+	if( meshes.n == 0 )
+		return quantization;
+
+	Vec3 extents = bounds.maxs - bounds.mins;
+	float extent = Max2( extents.x, Max2( extents.y, extents.z ) );
+
+	// 65534 leaves room for rounding the offset down
+	quantization.step = 1.0f / 1024.0f;
+	while( quantization.step * 65534.0f < extent ) {
+		quantization.step *= 2.0f;
+	}
+
+	for( int i = 0; i < 3; i++ ) {
+		quantization.offset[ i ] = floorf( bounds.mins[ i ] / quantization.step ) * quantization.step;
+	}
+
+	return quantization;
+}
+
+static u16 QuantizeCoordinate( float x, float offset, float step ) {
+	return checked_cast< u16 >( s32( roundf( ( x - offset ) / step ) ) );
+}
+
+template< typename T >
+static void AddBytes( DynamicArray< u8 > * bytes, const T & x ) {
+	bytes->add_many( Span< const u8 >( ( const u8 * ) &x, sizeof( x ) ) );
+}
+
 static bool IsNearlyAxial( Vec3 v ) {
 	for( int i = 0; i < 3; i++ ) {
 		if( Abs( v[ i ] ) >= 0.99999f ) {
@@ -542,7 +861,7 @@ static bool IsNearlyAxial( Vec3 v ) {
 	return false;
 }
 
-static CompiledKDTree GenerateCollisionGeometry( const ParsedEntity & entity ) {
+static CompiledKDTree GenerateCollisionGeometry( const ParsedEntity & entity, size_t binned_sah_above ) {
 	TracyZoneScoped;
 
 	CompiledKDTree kd_tree;
@@ -626,7 +945,7 @@ static CompiledKDTree GenerateCollisionGeometry( const ParsedEntity & entity ) {
 		kd_tree.solidity = SolidBits( kd_tree.solidity | map_brush.solidity );
 	}
 
-	BuildKDTree( &kd_tree, VectorToSpan( brush_bounds ) );
+	BuildKDTree( &kd_tree, VectorToSpan( brush_bounds ), binned_sah_above );
 
 	return kd_tree;
 }
@@ -663,23 +982,49 @@ static constexpr const char * section_names[] = {
 STATIC_ASSERT( ARRAY_COUNT( section_names ) == MapSection_Count );
 
 template< typename T >
-void Pack( DynamicArray< u8 > & packed, MapHeader * header, MapSectionType section, Span< const T > data, size_t * last_alignment ) {
-	assert( packed.size() % alignof( T ) == 0 );
-	assert( alignof( T ) <= *last_alignment );
-	*last_alignment = alignof( T );
+void Pack( ArenaAllocator * arena, DynamicArray< u8 > & packed, MapHeader * header, MapSectionType section, Span< const T > data, bool compress ) {
+	MapSection * packed_section = &header->sections[ section ];
 
 	if( data.n > 0 ) {
-		size_t offset = packed.extend( data.num_bytes() );
-		memcpy( &packed[ offset ], data.ptr, data.num_bytes() );
+		size_t aligned_size = AlignPow2( packed.size(), CDMAP_SECTION_ALIGNMENT );
+		size_t padding = packed.extend( aligned_size - packed.size() );
+		memset( packed.ptr() + padding, 0, packed.size() - padding );
+
+		Span< const u8 > bytes = data.template cast< const u8 >();
+		packed_section->decompressed_size = checked_cast< u32 >( bytes.n );
+		packed_section->compression = MapSectionCompression_None;
+
+		if( compress ) {
+			TracyZoneScopedN( "ZSTD_compress" );
+
+			size_t compressed_max_size = ZSTD_compressBound( bytes.n );
+			u8 * compressed = AllocMany< u8 >( arena, compressed_max_size );
+			size_t compressed_size = ZSTD_compress( compressed, compressed_max_size, bytes.ptr, bytes.n, ZSTD_maxCLevel() );
+			if( ZSTD_isError( compressed_size ) ) {
+				Fatal( "Compression failed: %s", ZSTD_getErrorName( compressed_size ) );
+			}
 
-		header->sections[ section ].offset = checked_cast< u32 >( offset );
-		header->sections[ section ].size = checked_cast< u32 >( data.num_bytes() );
+			if( compressed_size < bytes.n ) {
+				bytes = Span< const u8 >( compressed, compressed_size );
+				packed_section->compression = MapSectionCompression_Zstd;
+			}
+		}
+
+		size_t offset = packed.extend( bytes.n );
+		memcpy( &packed[ offset ], bytes.ptr, bytes.n );
+
+		packed_section->offset = checked_cast< u32 >( offset );
+		packed_section->size = checked_cast< u32 >( bytes.n );
 	}
 
-	ggprint( "{-20} {.2}MB {}\n", section_names[ section ], data.num_bytes() / 1000.0f / 1000.0f, data.n );
+	ggprint( "{-20} {.2}MB {}", section_names[ section ], data.num_bytes() / 1000.0f / 1000.0f, data.n );
+	if( packed_section->compression == MapSectionCompression_Zstd ) {
+		ggprint( " ({.2}MB compressed)", packed_section->size / 1000.0f / 1000.0f );
+	}
+	ggprint( "\n" );
 }
 
-static void WriteCDMap( ArenaAllocator * arena, const char * path, Span< const char > src, const MapData * map, bool compress ) {
+static void WriteCDMap( ArenaAllocator * arena, const char * path, Span< const char > src, const MapData * map, bool compress, bool compress_sections ) {
 	TracyZoneScoped;
 
 	DynamicArray< u8 > packed( arena );
@@ -687,24 +1032,25 @@ static void WriteCDMap( ArenaAllocator * arena, const char * path, Span< const c
 	MapHeader header = { };
 	strcpy( header.magic, "cdmap" );
 	header.format_version = CDMAP_FORMAT_VERSION;
+	header.vertex_encoding = map->vertex_encoding;
 
 	packed.extend( sizeof( header ) );
 	memset( packed.ptr(), 0, packed.size() ); // zero out padding bytes
 
-	size_t last_alignment = alignof( MapHeader );
-	Pack( packed, &header, MapSection_Meshes, map->meshes, &last_alignment );
-	Pack( packed, &header, MapSection_Entities, map->entities, &last_alignment );
-	Pack( packed, &header, MapSection_EntityKeyValues, map->entity_kvs, &last_alignment );
-	Pack( packed, &header, MapSection_Models, map->models, &last_alignment );
-	Pack( packed, &header, MapSection_Nodes, map->nodes, &last_alignment );
-	Pack( packed, &header, MapSection_BrushPlanes, map->brush_planes, &last_alignment );
-	Pack( packed, &header, MapSection_VertexPositions, map->vertex_positions, &last_alignment );
-	Pack( packed, &header, MapSection_VertexNormals, map->vertex_normals, &last_alignment );
-	Pack( packed, &header, MapSection_VertexIndices, map->vertex_indices, &last_alignment );
-	Pack( packed, &header, MapSection_BrushIndices, map->brush_indices, &last_alignment );
-	Pack( packed, &header, MapSection_Brushes, map->brushes, &last_alignment );
-	Pack( packed, &header, MapSection_Source, src, &last_alignment );
-	Pack( packed, &header, MapSection_EntityData, map->entity_data, &last_alignment );
+	Pack( arena, packed, &header, MapSection_Meshes, map->meshes, compress_sections );
+	Pack( arena, packed, &header, MapSection_Entities, map->entities, compress_sections );
+	Pack( arena, packed, &header, MapSection_EntityKeyValues, map->entity_kvs, compress_sections );
+	Pack( arena, packed, &header, MapSection_Models, map->models, compress_sections );
+	Pack( arena, packed, &header, MapSection_Nodes, map->nodes, compress_sections );
+	Pack( arena, packed, &header, MapSection_BrushPlanes, map->brush_planes, compress_sections );
+	Pack( arena, packed, &header, MapSection_VertexPositions, map->vertex_positions, compress_sections );
+	Pack( arena, packed, &header, MapSection_VertexNormals, map->vertex_normals, compress_sections );
+	Pack( arena, packed, &header, MapSection_VertexIndices, map->vertex_indices, compress_sections );
+	Pack( arena, packed, &header, MapSection_BrushIndices, map->brush_indices, compress_sections );
+	Pack( arena, packed, &header, MapSection_Brushes, map->brushes, compress_sections );
+	// tools read the source without knowing about compression, see cdmap.h
+	Pack( arena, packed, &header, MapSection_Source, src, false );
+	Pack( arena, packed, &header, MapSection_EntityData, map->entity_data, compress_sections );
 
 	memcpy( packed.ptr(), &header, sizeof( header ) );
 
@@ -725,31 +1071,30 @@ static void WriteCDMap( ArenaAllocator * arena, const char * path, Span< const c
 	}
 }
 
-static void WriteObj( ArenaAllocator * arena, const char * path, const MapData * map ) {
+// writes the unquantized worldspawn geometry
+static void WriteObj( ArenaAllocator * arena, const char * path, const CompiledEntity & worldspawn ) {
 	DynamicString obj( arena );
 
-	const MapModel * model = &map->models[ 0 ];
-
-	for( size_t i = 0; i < map->vertex_positions.n; i++ ) {
-		Vec3 p = map->vertex_positions[ i ];
-		Vec3 n = map->vertex_normals[ i ];
-		obj.append( "v {} {} {}\n", p.x, p.y, p.z );
-		obj.append( "vn {} {} {}\n", n.x, n.y, n.z );
+	for( const CompiledMesh & mesh : worldspawn.render_geometry ) {
+		for( const InterleavedMapVertex & v : mesh.vertices ) {
+			obj.append( "v {} {} {}\n", v.position.x, v.position.y, v.position.z );
+			obj.append( "vn {} {} {}\n", v.normal.x, v.normal.y, v.normal.z );
+		}
 	}
 
-	for( u32 i = 0; i < model->num_meshes; i++ ) {
-		const MapMesh * mesh = &map->meshes[ i + model->first_mesh ];
-
-		for( u32 j = 0; j < mesh->num_vertices; j += 3 ) {
+	size_t base_vertex = 0;
+	for( const CompiledMesh & mesh : worldspawn.render_geometry ) {
+		for( size_t j = 0; j < mesh.indices.size(); j += 3 ) {
 			obj.append( "f {}//{} {}//{} {}//{}\n",
-				map->vertex_indices[ j + 0 + mesh->first_vertex_index ],
-				map->vertex_indices[ j + 0 + mesh->first_vertex_index ],
-				map->vertex_indices[ j + 1 + mesh->first_vertex_index ],
-				map->vertex_indices[ j + 1 + mesh->first_vertex_index ],
-				map->vertex_indices[ j + 2 + mesh->first_vertex_index ],
-				map->vertex_indices[ j + 2 + mesh->first_vertex_index ]
+				base_vertex + mesh.indices[ j + 0 ],
+				base_vertex + mesh.indices[ j + 0 ],
+				base_vertex + mesh.indices[ j + 1 ],
+				base_vertex + mesh.indices[ j + 1 ],
+				base_vertex + mesh.indices[ j + 2 ],
+				base_vertex + mesh.indices[ j + 2 ]
 			);
 		}
+		base_vertex += mesh.vertices.size();
 	}
 
 	WriteFileOrComplain( arena, path, obj.c_str(), obj.length() );
@@ -773,34 +1118,40 @@ static void SetKey( Span< ParsedKeyValue > kvs, const char * key, Span< const ch
 	}
 }
 
-static bool ParseArg( const char * arg, bool * compress, bool * write_obj ) {
+static bool ParseArg( const char * arg, bool * compress, bool * compress_sections, bool * quantize, bool * write_obj, u64 * binned_sah_above ) {
+	constexpr const char * binned_sah_prefix = "--binned-sah-above=";
+	if( StartsWith( arg, binned_sah_prefix ) ) {
+		return TrySpanToU64( MakeSpan( arg + strlen( binned_sah_prefix ) ), binned_sah_above );
+	}
+
 	*compress = *compress || StrEqual( arg, "--compress" );
+	*compress_sections = *compress_sections || StrEqual( arg, "--compress-sections" );
+	*quantize = *quantize || StrEqual( arg, "--quantize" );
 	*write_obj = *write_obj || StrEqual( arg, "--obj" );
-	return StrEqual( arg, "--compress" ) || StrEqual( arg, "--obj" );
+	return StrEqual( arg, "--compress" ) || StrEqual( arg, "--compress-sections" ) || StrEqual( arg, "--quantize" ) || StrEqual( arg, "--obj" );
 }
 
 int main( int argc, char ** argv ) {
 	bool compress = false;
+	bool compress_sections = false;
+	bool quantize = false;
 	bool write_obj = false;
+	u64 binned_sah_above = 4096; // brushes
 	const char * src_path = NULL;
 
 	{
-		bool ok = true;
+		bool ok = argc >= 2 && argc <= 7;
 
-		if( argc < 2 || argc > 4 ) {
-			ok = false;
+		for( int i = 1; ok && i < argc - 1; i++ ) {
+			ok = ParseArg( argv[ i ], &compress, &compress_sections, &quantize, &write_obj, &binned_sah_above );
 		}
 
-		if( argc == 3 ) {
-			ok = ok && ParseArg( argv[ 1 ], &compress, &write_obj );
-		}
-
-		if( argc == 4 ) {
-			ok = ok && ParseArg( argv[ 2 ], &compress, &write_obj );
-		}
+		// --compress writes a .cdmap.zst for distribution, which gets
+		// decompressed all at once, so compressing sections too is pointless
+		ok = ok && !( compress && compress_sections );
 
 		if( !ok ) {
-			printf( "Usage: %s [--compress] [--obj] <file.map>\n", argv[ 0 ] );
+			printf( "Usage: %s [--compress | --compress-sections] [--quantize] [--obj] [--binned-sah-above=<brushes>] <file.map>\n", argv[ 0 ] );
 			return 1;
 		}
 
@@ -823,6 +1174,9 @@ int main( int argc, char ** argv ) {
 	constexpr size_t arena_size = 1024 * 1024 * 1024; // 1GB
 	ArenaAllocator arena( sys_allocator->allocate( arena_size, 16 ), arena_size );
 
+	InitThreadPool();
+	defer { ShutdownThreadPool(); };
+
 	// parse the .map
 	std::vector< ParsedEntity > entities = ParseEntities( src );
 
@@ -867,7 +1221,7 @@ int main( int argc, char ** argv ) {
 
 			CompiledEntity compiled;
 			compiled.render_geometry = GenerateRenderGeometry( entity );
-			compiled.collision_geometry = GenerateCollisionGeometry( entity ); // TODO: patches
+			compiled.collision_geometry = GenerateCollisionGeometry( entity, binned_sah_above ); // TODO: patches
 
 			for( ParsedKeyValue kv : entity.kvs.span() ) {
 				compiled.key_values.push_back( kv );
@@ -889,31 +1243,88 @@ int main( int argc, char ** argv ) {
 	DynamicArray< u32 > flat_brush_indices( &arena );
 	DynamicArray< Plane > flat_brush_planes( &arena );
 	DynamicArray< MapMesh > flat_meshes( &arena );
-	DynamicArray< Vec3 > flat_vertex_positions( &arena );
-	DynamicArray< Vec3 > flat_vertex_normals( &arena );
-	DynamicArray< u32 > flat_vertex_indices( &arena );
+	DynamicArray< u8 > flat_vertex_positions( &arena );
+	DynamicArray< u8 > flat_vertex_normals( &arena );
+	DynamicArray< u8 > flat_vertex_indices( &arena );
+
+	// indices are relative to each mesh's base vertex, so we only need u32
+	// indices if a single mesh has more than 64k vertices
+	MapVertexEncoding vertex_encoding = quantize ? MapVertexEncoding_Quantized : MapVertexEncoding_Float;
+	{
+		bool u16_indices = true;
+		for( const CompiledEntity & entity : compiled_entities ) {
+			for( const CompiledMesh & mesh : entity.render_geometry ) {
+				u16_indices = u16_indices && mesh.vertices.size() <= size_t( U16_MAX ) + 1;
+			}
+		}
+
+		if( u16_indices ) {
+			vertex_encoding = MapVertexEncoding( vertex_encoding | MapVertexEncoding_U16Indices );
+		}
+	}
 
 	{
 		TracyZoneScopedN( "Flatten render/collision geometry" );
 
+		size_t num_flat_vertices = 0;
+		float max_quantization_error = 0.0f;
+
 		for( CompiledEntity & entity : compiled_entities ) {
 			u32 first_mesh = checked_cast< u32 >( flat_meshes.size() );
+			PositionQuantization quantization = ChoosePositionQuantization( VectorToSpan( entity.render_geometry ) );
 
 			for( const CompiledMesh & mesh : entity.render_geometry ) {
-				MapMesh map_mesh;
+				MapMesh map_mesh = { };
 				map_mesh.material = mesh.material;
-				map_mesh.first_vertex_index = flat_vertex_indices.size();
+				map_mesh.first_vertex_index = checked_cast< u32 >( flat_vertex_indices.size() / MapVertexIndexSize( vertex_encoding ) );
 				map_mesh.num_vertices = mesh.indices.size();
+				map_mesh.base_vertex = checked_cast< u32 >( num_flat_vertices );
+
+				if( quantize ) {
+					map_mesh.position_offset = quantization.offset;
+					map_mesh.position_scale = quantization.step * 65535.0f;
+				}
+
 				flat_meshes.add( map_mesh );
 
-				size_t base_vertex = flat_vertex_positions.size();
 				for( const InterleavedMapVertex & v : mesh.vertices ) {
-					flat_vertex_positions.add( v.position );
-					flat_vertex_normals.add( v.normal );
+					if( quantize ) {
+						u16 position[ 4 ];
+						for( int i = 0; i < 3; i++ ) {
+							position[ i ] = QuantizeCoordinate( v.position[ i ], quantization.offset[ i ], quantization.step );
+
+							// this is what the GPU gets after normalizing
+							float dequantized = map_mesh.position_offset[ i ] + ( position[ i ] / 65535.0f ) * map_mesh.position_scale;
+							max_quantization_error = Max2( max_quantization_error, Abs( dequantized - v.position[ i ] ) );
+						}
+						position[ 3 ] = U16_MAX;
+
+						s8 normal[ 4 ] = {
+							s8( meshopt_quantizeSnorm( v.normal.x, 8 ) ),
+							s8( meshopt_quantizeSnorm( v.normal.y, 8 ) ),
+							s8( meshopt_quantizeSnorm( v.normal.z, 8 ) ),
+							0,
+						};
+
+						AddBytes( &flat_vertex_positions, position );
+						AddBytes( &flat_vertex_normals, normal );
+					}
+					else {
+						AddBytes( &flat_vertex_positions, v.position );
+						AddBytes( &flat_vertex_normals, v.normal );
+					}
 				}
+
 				for( u32 idx : mesh.indices ) {
-					flat_vertex_indices.add( base_vertex + idx );
+					if( ( vertex_encoding & MapVertexEncoding_U16Indices ) != 0 ) {
+						AddBytes( &flat_vertex_indices, u16( idx ) );
+					}
+					else {
+						AddBytes( &flat_vertex_indices, idx );
+					}
 				}
+
+				num_flat_vertices += mesh.vertices.size();
 			}
 
 			size_t base_node = flat_nodes.size();
@@ -955,6 +1366,10 @@ int main( int argc, char ** argv ) {
 				flat_models.add( model );
 			}
 		}
+
+		if( quantize ) {
+			ggprint( "Quantized {} vertices, max position error {.4}\n", num_flat_vertices, max_quantization_error );
+		}
 	}
 
 	{
@@ -990,17 +1405,18 @@ int main( int argc, char ** argv ) {
 	flattened.brushes = flat_brushes.span();
 	flattened.brush_indices = flat_brush_indices.span();
 	flattened.brush_planes = flat_brush_planes.span();
+	flattened.vertex_encoding = vertex_encoding;
 	flattened.meshes = flat_meshes.span();
 	flattened.vertex_positions = flat_vertex_positions.span();
 	flattened.vertex_normals = flat_vertex_normals.span();
 	flattened.vertex_indices = flat_vertex_indices.span();
 
 	const char * cdmap_path = arena( "{}.cdmap", StripExtension( src_path ) );
-	WriteCDMap( &arena, cdmap_path, immutable_src_copy, &flattened, compress );
+	WriteCDMap( &arena, cdmap_path, immutable_src_copy, &flattened, compress, compress_sections );
 
 	if( write_obj ) {
 		const char * obj_path = arena( "{}.obj", StripExtension( src_path ) );
-		WriteObj( &arena, obj_path, &flattened );
+		WriteObj( &arena, obj_path, compiled_entities[ 0 ] );
 	}
 
 	// TODO: generate render geometry
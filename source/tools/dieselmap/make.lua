@@ -5,6 +5,8 @@ bin( "dieselmap", {
 		"source/qcommon/base.cpp",
 		"source/qcommon/fs.cpp",
 		"source/qcommon/hash.cpp",
+		"source/qcommon/threadpool.cpp",
+		"source/qcommon/time.cpp",
 		"source/qcommon/utf8.cpp",
 		"source/qcommon/platform/*_fs.cpp",
 		"source/qcommon/platform/*_sys.cpp",
@@ -18,6 +20,7 @@ bin( "dieselmap", {
 
 	libs = {
 		"ggformat",
+		"ggtime",
 		"tracy",
 		"meshoptimizer",
 		"zstd",
@@ -0,0 +1,209 @@
+#include <stdarg.h>
+
+#include "qcommon/base.h"
+#include "qcommon/rng.h"
+#include "qcommon/time.h"
+#include "client/renderer/draw_sort.h"
+
+#include "nanosort/nanosort.hpp"
+
+/*
+ * measures draw call sorting against the sort-by-shader-pointer it replaced,
+ * and counts how much GL state each ordering makes the backend change, on a
+ * synthetic frame shaped like a busy match: shadow cascades, the depth
+ * prepass and the world pass
+ */
+
+void ShowErrorMessage( const char * msg, const char * file, int line ) {
+	printf( "%s (%s:%d)\n", msg, file, line );
+}
+
+void Com_Printf( const char * format, ... ) {
+	va_list argptr;
+	va_start( argptr, format );
+	vprintf( format, argptr );
+	va_end( argptr );
+}
+
+// same shape as the backend's DrawCall, which is what the old sort moved around
+struct BenchDrawCall {
+	DrawCallKey key;
+	PipelineState pipeline;
+	Mesh mesh;
+	u32 num_vertices;
+	u32 num_instances;
+	u32 first_index;
+	u32 base_vertex;
+};
+
+constexpr size_t MAX_DRAWS = 16384;
+
+static Shader shaders[ 64 ];
+static Texture textures[ 256 ];
+static Mesh meshes[ 512 ];
+
+static BenchDrawCall draws[ MAX_DRAWS ];
+static BenchDrawCall old_sorted[ MAX_DRAWS ];
+static DrawSortItem items[ MAX_DRAWS ];
+static DrawSortItem scratch[ MAX_DRAWS ];
+static size_t num_draws;
+
+static void SetupResources( RNG * rng ) {
+	for( size_t i = 0; i < ARRAY_COUNT( shaders ); i++ ) {
+		shaders[ i ] = { };
+		shaders[ i ].program = checked_cast< u32 >( i + 1 );
+		shaders[ i ].textures[ 0 ] = StringHash( "u_BaseTexture" ).hash;
+	}
+
+	for( size_t i = 0; i < ARRAY_COUNT( textures ); i++ ) {
+		textures[ i ] = { };
+		textures[ i ].texture = checked_cast< u32 >( i + 1 );
+	}
+
+	for( size_t i = 0; i < ARRAY_COUNT( meshes ); i++ ) {
+		Mesh & mesh = meshes[ i ];
+		mesh = { };
+		mesh.vertex_buffers[ VertexAttribute_Position ] = { checked_cast< u32 >( i * 3 + 1 ) };
+		mesh.vertex_buffers[ VertexAttribute_Normal ] = { checked_cast< u32 >( i * 3 + 2 ) };
+		mesh.index_buffer = { checked_cast< u32 >( i * 3 + 3 ) };
+		mesh.vertex_descriptor.attributes[ VertexAttribute_Position ] = VertexAttribute { VertexFormat_Floatx3, VertexAttribute_Position, 0 };
+		mesh.vertex_descriptor.attributes[ VertexAttribute_Normal ] = VertexAttribute { VertexFormat_Floatx3, VertexAttribute_Normal, 0 };
+		mesh.vertex_descriptor.buffer_strides[ VertexAttribute_Position ] = sizeof( Vec3 );
+		mesh.vertex_descriptor.buffer_strides[ VertexAttribute_Normal ] = sizeof( Vec3 );
+		mesh.index_format = Probability( rng, 0.5f ) ? IndexFormat_U16 : IndexFormat_U32;
+		mesh.cw_winding = Probability( rng, 0.1f );
+	}
+}
+
+static void AddDraw( const PipelineState & pipeline, const Mesh & mesh ) {
+	Assert( num_draws < ARRAY_COUNT( draws ) );
+
+	BenchDrawCall & draw = draws[ num_draws ];
+	draw = { };
+	draw.key = MakeDrawCallKey( pipeline, mesh, num_draws );
+	draw.pipeline = pipeline;
+	draw.mesh = mesh;
+	num_draws++;
+}
+
+// entities submit in whatever order the scene gives us, so shaders,
+// materials and models come in interleaved
+static void SetupPass( RNG * rng, size_t n, size_t num_shaders, size_t num_textures, bool alpha_blend ) {
+	num_draws = 0;
+
+	for( size_t i = 0; i < n; i++ ) {
+		size_t model = RandomUniform( rng, 0, ARRAY_COUNT( meshes ) );
+
+		PipelineState pipeline;
+		pipeline.shader = &shaders[ model % num_shaders ];
+		pipeline.cull_face = Probability( rng, 0.05f ) ? CullFace_Disabled : CullFace_Back;
+		if( alpha_blend && Probability( rng, 0.2f ) ) {
+			pipeline.blend_func = BlendFunc_Blend;
+			pipeline.write_depth = false;
+		}
+		if( num_textures > 0 ) {
+			// bind_texture_and_sampler lives with the GL code
+			pipeline.textures[ 0 ] = { StringHash( "u_BaseTexture" ).hash, &textures[ model % num_textures ], Sampler_Standard };
+			pipeline.num_textures = 1;
+		}
+
+		AddDraw( pipeline, meshes[ model ] );
+	}
+}
+
+static bool OldSortDrawCall( const BenchDrawCall & a, const BenchDrawCall & b ) {
+	return a.pipeline.shader < b.pipeline.shader;
+}
+
+struct StateChangeCounts {
+	size_t programs;
+	size_t render_states;
+	size_t textures;
+	size_t meshes;
+};
+
+static StateChangeCounts CountStateChanges( const BenchDrawCall * sorted ) {
+	StateChangeCounts counts = { };
+	DrawCallKey prev = { };
+	for( size_t i = 0; i < num_draws; i++ ) {
+		DrawStateChanges changes = DiffDrawCallKeys( prev, sorted[ i ].key );
+		counts.programs += changes.program ? 1 : 0;
+		counts.render_states += changes.render_state ? 1 : 0;
+		counts.textures += changes.textures ? 1 : 0;
+		counts.meshes += changes.mesh ? 1 : 0;
+		prev = sorted[ i ].key;
+	}
+	return counts;
+}
+
+static void BenchPass( const char * name, u64 seed, size_t n, size_t num_shaders, size_t num_textures, bool alpha_blend ) {
+	constexpr int runs = 200;
+
+	RNG rng = NewRNG( seed, 0 );
+	SetupPass( &rng, n, num_shaders, num_textures, alpha_blend );
+
+	// old: sort the full draw calls by shader pointer, rebind the mesh every draw
+	float old_us = 0.0f;
+	for( int i = 0; i < runs + 1; i++ ) {
+		memcpy( old_sorted, draws, num_draws * sizeof( draws[ 0 ] ) );
+		Time start = Now();
+		nanosort( old_sorted, old_sorted + num_draws, OldSortDrawCall );
+		if( i > 0 ) {
+			old_us += ToSeconds( Now() - start ) * 1000000.0f / runs;
+		}
+	}
+	StateChangeCounts old_counts = CountStateChanges( old_sorted );
+	old_counts.meshes = num_draws;
+
+	// new: building the keys is new per draw work so time it too
+	float key_us = 0.0f;
+	for( int i = 0; i < runs + 1; i++ ) {
+		Time start = Now();
+		for( size_t j = 0; j < num_draws; j++ ) {
+			draws[ j ].key = MakeDrawCallKey( draws[ j ].pipeline, draws[ j ].mesh, j );
+		}
+		if( i > 0 ) {
+			key_us += ToSeconds( Now() - start ) * 1000000.0f / runs;
+		}
+	}
+
+	float new_us = 0.0f;
+	Span< DrawSortItem > sorted;
+	for( int i = 0; i < runs + 1; i++ ) {
+		Time start = Now();
+		for( size_t j = 0; j < num_draws; j++ ) {
+			items[ j ] = DrawSortItem { draws[ j ].key.sort_key, u32( j ) };
+		}
+		sorted = RadixSortDraws( Span< DrawSortItem >( items, num_draws ), Span< DrawSortItem >( scratch, num_draws ) );
+		if( i > 0 ) {
+			new_us += ToSeconds( Now() - start ) * 1000000.0f / runs;
+		}
+	}
+
+	for( size_t i = 0; i < num_draws; i++ ) {
+		old_sorted[ i ] = draws[ sorted[ i ].draw ];
+		if( i > 0 ) {
+			Assert( old_sorted[ i - 1 ].key.sort_key <= old_sorted[ i ].key.sort_key );
+		}
+	}
+	StateChangeCounts new_counts = CountStateChanges( old_sorted );
+
+	printf( "%s, %zu draws\n", name, num_draws );
+	printf( "    sort      old %8.1fus  new %8.1fus (+ %.1fus building keys)\n", old_us, new_us, key_us );
+	printf( "    programs  old %8zu    new %8zu\n", old_counts.programs, new_counts.programs );
+	printf( "    state     old %8zu    new %8zu\n", old_counts.render_states, new_counts.render_states );
+	printf( "    textures  old %8zu    new %8zu\n", old_counts.textures, new_counts.textures );
+	printf( "    meshes    old %8zu    new %8zu\n", old_counts.meshes, new_counts.meshes );
+}
+
+int main( int argc, char ** argv ) {
+	RNG rng = NewRNG( 1, 0 );
+	SetupResources( &rng );
+
+	BenchPass( "shadowmap cascade", 2, 1500, 2, 0, false );
+	BenchPass( "depth prepass", 3, 3000, 4, 0, false );
+	BenchPass( "world", 4, 3000, 40, 200, false );
+	BenchPass( "world, everything", 5, 12000, 64, 256, true );
+
+	return 0;
+}
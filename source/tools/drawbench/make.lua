@@ -0,0 +1,23 @@
+bin( "drawbench", {
+	srcs = {
+		"source/tools/drawbench/drawbench.cpp",
+		"source/client/renderer/draw_sort.cpp",
+		"source/qcommon/allocators.cpp",
+		"source/qcommon/base.cpp",
+		"source/qcommon/hash.cpp",
+		"source/qcommon/rng.cpp",
+		"source/qcommon/time.cpp",
+		"source/qcommon/platform/*_sys.cpp",
+		"source/qcommon/platform/*_threads.cpp",
+		"source/gameshared/q_shared.cpp",
+	},
+
+	libs = {
+		"ggformat",
+		"ggtime",
+		"tracy",
+	},
+
+	windows_ldflags = "ole32.lib shell32.lib user32.lib advapi32.lib",
+	linux_ldflags = "-lm -lpthread",
+} )
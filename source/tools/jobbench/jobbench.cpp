@@ -0,0 +1,314 @@
+#include <stdarg.h>
+
+#include "qcommon/base.h"
+#include "qcommon/threads.h"
+#include "qcommon/threadpool.h"
+#include "qcommon/time.h"
+
+/*
+ * measures the job system against the single mutex ring buffer pool it
+ * replaced, with lots of tiny jobs so the scheduling overhead dominates
+ */
+
+void ShowErrorMessage( const char * msg, const char * file, int line ) {
+	printf( "%s (%s:%d)\n", msg, file, line );
+}
+
+void Com_Printf( const char * format, ... ) {
+	va_list argptr;
+	va_start( argptr, format );
+	vprintf( format, argptr );
+	va_end( argptr );
+}
+
+// the old pool, minus the arenas
+
+struct OldJob {
+	JobCallback callback;
+	void * data;
+};
+
+static OldJob old_jobs[ 4096 ];
+static Mutex * old_jobs_mutex;
+static Semaphore * old_jobs_sem;
+static Semaphore * old_completion_sem;
+static bool old_shutting_down;
+static size_t old_jobs_head;
+static size_t old_jobs_not_started;
+static size_t old_jobs_done;
+
+static Thread * old_workers[ 32 ];
+static u32 old_num_workers;
+
+static void OldThreadPoolWorker( void * data ) {
+	while( true ) {
+		Wait( old_jobs_sem );
+		Lock( old_jobs_mutex );
+
+		if( old_shutting_down ) {
+			Unlock( old_jobs_mutex );
+			break;
+		}
+
+		if( old_jobs_not_started == 0 ) {
+			Unlock( old_jobs_mutex );
+			continue;
+		}
+
+		OldJob * job = &old_jobs[ old_jobs_head % ARRAY_COUNT( old_jobs ) ];
+		old_jobs_head++;
+		old_jobs_not_started--;
+
+		Unlock( old_jobs_mutex );
+
+		job->callback( NULL, job->data );
+
+		Lock( old_jobs_mutex );
+		old_jobs_done++;
+		Unlock( old_jobs_mutex );
+
+		Signal( old_completion_sem );
+	}
+}
+
+static void OldInitThreadPool() {
+	old_shutting_down = false;
+	old_jobs_head = 0;
+	old_jobs_not_started = 0;
+	old_jobs_done = 0;
+	old_jobs_mutex = NewMutex();
+	old_jobs_sem = NewSemaphore();
+	old_completion_sem = NewSemaphore();
+
+	old_num_workers = Min2( GetCoreCount() - 1, u32( ARRAY_COUNT( old_workers ) ) );
+	for( u32 i = 0; i < old_num_workers; i++ ) {
+		old_workers[ i ] = NewThread( OldThreadPoolWorker );
+	}
+}
+
+static void OldShutdownThreadPool() {
+	Lock( old_jobs_mutex );
+	old_shutting_down = true;
+	Unlock( old_jobs_mutex );
+
+	Signal( old_jobs_sem, checked_cast< int >( old_num_workers ) );
+	for( u32 i = 0; i < old_num_workers; i++ ) {
+		JoinThread( old_workers[ i ] );
+	}
+
+	DeleteSemaphore( old_completion_sem );
+	DeleteSemaphore( old_jobs_sem );
+	DeleteMutex( old_jobs_mutex );
+}
+
+static void OldThreadPoolDo( JobCallback callback, void * data ) {
+	Lock( old_jobs_mutex );
+
+	Assert( old_jobs_not_started < ARRAY_COUNT( old_jobs ) );
+
+	OldJob * job = &old_jobs[ ( old_jobs_head + old_jobs_not_started ) % ARRAY_COUNT( old_jobs ) ];
+	job->callback = callback;
+	job->data = data;
+	old_jobs_not_started++;
+
+	Unlock( old_jobs_mutex );
+	Signal( old_jobs_sem );
+}
+
+static void OldThreadPoolFinish() {
+	Lock( old_jobs_mutex );
+
+	while( true ) {
+		if( old_jobs_not_started == 0 ) {
+			while( old_jobs_done != old_jobs_head ) {
+				Unlock( old_jobs_mutex );
+				Wait( old_completion_sem );
+				Lock( old_jobs_mutex );
+			}
+			break;
+		}
+
+		OldJob * job = &old_jobs[ old_jobs_head % ARRAY_COUNT( old_jobs ) ];
+		old_jobs_head++;
+		old_jobs_not_started--;
+
+		Unlock( old_jobs_mutex );
+		job->callback( NULL, job->data );
+		Lock( old_jobs_mutex );
+		old_jobs_done++;
+	}
+
+	Unlock( old_jobs_mutex );
+}
+
+static void OldParallelFor( void * datum, size_t n, size_t stride, JobCallback callback ) {
+	Lock( old_jobs_mutex );
+
+	Assert( n <= ARRAY_COUNT( old_jobs ) - old_jobs_not_started );
+
+	for( size_t i = 0; i < n; i++ ) {
+		OldJob * job = &old_jobs[ ( old_jobs_head + old_jobs_not_started ) % ARRAY_COUNT( old_jobs ) ];
+		job->callback = callback;
+		job->data = ( ( char * ) datum ) + stride * i;
+		old_jobs_not_started++;
+	}
+
+	Unlock( old_jobs_mutex );
+	Signal( old_jobs_sem, checked_cast< int >( n ) );
+
+	OldThreadPoolFinish();
+}
+
+// the benchmarks
+
+struct WorkItem {
+	u32 iterations;
+	u64 result;
+};
+
+static void DoWork( TempAllocator * temp, void * data ) {
+	WorkItem * item = ( WorkItem * ) data;
+	u64 x = item->iterations + 1;
+	for( u32 i = 0; i < item->iterations; i++ ) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+	}
+	item->result = x;
+}
+
+static constexpr size_t MAX_ITEMS = 4096;
+static WorkItem items[ MAX_ITEMS ];
+
+static void SetupItems( size_t n, u32 iterations, bool uneven ) {
+	for( size_t i = 0; i < n; i++ ) {
+		// uneven puts all the expensive items at the end, like a frame where
+		// everyone is fighting in the same corner of the map
+		items[ i ].iterations = uneven && i >= n - n / 16 ? iterations * 64 : iterations;
+		items[ i ].result = 0;
+	}
+}
+
+template< typename F >
+static float BenchMicroseconds( int runs, F && f ) {
+	f(); // warm up
+
+	Time start = Now();
+	for( int i = 0; i < runs; i++ ) {
+		f();
+	}
+	return ToSeconds( Now() - start ) * 1000000.0f / runs;
+}
+
+static void BenchParallelFor( const char * name, size_t n, u32 iterations, bool uneven ) {
+	SetupItems( n, iterations, uneven );
+
+	OldInitThreadPool();
+	float old_us = BenchMicroseconds( 500, [&]() {
+		OldParallelFor( items, n, sizeof( items[ 0 ] ), DoWork );
+	} );
+	OldShutdownThreadPool();
+
+	InitThreadPool();
+	float new_us = BenchMicroseconds( 500, [&]() {
+		ParallelFor( Span< WorkItem >( items, n ), DoWork );
+	} );
+	ShutdownThreadPool();
+
+	printf( "%-32s old %9.1fus  new %9.1fus  %.2fx\n", name, old_us, new_us, old_us / new_us );
+}
+
+static void BenchTinyJobs( size_t n ) {
+	SetupItems( n, 16, false );
+
+	OldInitThreadPool();
+	float old_us = BenchMicroseconds( 200, [&]() {
+		for( size_t i = 0; i < n; i++ ) {
+			OldThreadPoolDo( DoWork, &items[ i ] );
+		}
+		OldThreadPoolFinish();
+	} );
+	OldShutdownThreadPool();
+
+	InitThreadPool();
+	float new_us = BenchMicroseconds( 200, [&]() {
+		for( size_t i = 0; i < n; i++ ) {
+			ThreadPoolDo( DoWork, &items[ i ] );
+		}
+		ThreadPoolFinish();
+	} );
+	ShutdownThreadPool();
+
+	printf( "%-32s old %9.1fus  new %9.1fus  %.2fx\n", "ThreadPoolDo x1000 tiny", old_us, new_us, old_us / new_us );
+}
+
+static void SpawnTinyJobs( TempAllocator * temp, void * data ) {
+	WorkItem * first = ( WorkItem * ) data;
+	JobCounter counter;
+	for( size_t i = 0; i < 64; i++ ) {
+		ThreadPoolDo( DoWork, first + i, &counter );
+	}
+	ThreadPoolWait( &counter );
+}
+
+static void BenchNestedJobs() {
+	// jobs that add jobs, which the old pool can only do by deadlocking
+	SetupItems( MAX_ITEMS, 16, false );
+
+	InitThreadPool();
+	float new_us = BenchMicroseconds( 200, [&]() {
+		JobCounter counter;
+		for( size_t i = 0; i < MAX_ITEMS; i += 64 ) {
+			ThreadPoolDo( SpawnTinyJobs, &items[ i ], &counter );
+		}
+		ThreadPoolWait( &counter );
+	} );
+	ShutdownThreadPool();
+
+	printf( "%-32s                 new %9.1fus\n", "nested 64x64 tiny", new_us );
+}
+
+static void BenchDependencies() {
+	// two stages where the second depends on the first, so everything
+	// waits on counters instead of ThreadPoolFinish
+	SetupItems( MAX_ITEMS, 256, false );
+
+	OldInitThreadPool();
+	float old_us = BenchMicroseconds( 200, [&]() {
+		OldParallelFor( items, MAX_ITEMS / 2, sizeof( items[ 0 ] ), DoWork );
+		OldParallelFor( items + MAX_ITEMS / 2, MAX_ITEMS / 2, sizeof( items[ 0 ] ), DoWork );
+	} );
+	OldShutdownThreadPool();
+
+	InitThreadPool();
+	float new_us = BenchMicroseconds( 200, [&]() {
+		JobCounter first, second;
+		for( size_t i = 0; i < MAX_ITEMS / 2; i += 64 ) {
+			ThreadPoolDo( []( TempAllocator * temp, void * data ) {
+				ParallelFor( Span< WorkItem >( ( WorkItem * ) data, 64 ), DoWork );
+			}, &items[ i ], &first );
+		}
+		for( size_t i = MAX_ITEMS / 2; i < MAX_ITEMS; i += 64 ) {
+			ThreadPoolDoAfter( &first, []( TempAllocator * temp, void * data ) {
+				ParallelFor( Span< WorkItem >( ( WorkItem * ) data, 64 ), DoWork );
+			}, &items[ i ], &second );
+		}
+		ThreadPoolWait( &second );
+	} );
+	ShutdownThreadPool();
+
+	printf( "%-32s old %9.1fus  new %9.1fus  %.2fx\n", "two dependent stages", old_us, new_us, old_us / new_us );
+}
+
+int main( int argc, char ** argv ) {
+	printf( "%u cores\n", GetCoreCount() );
+
+	BenchTinyJobs( 1000 );
+	BenchParallelFor( "ParallelFor 64 small", 64, 256, false );
+	BenchParallelFor( "ParallelFor 4096 tiny", 4096, 16, false );
+	BenchParallelFor( "ParallelFor 4096 uneven", 4096, 256, true );
+	BenchNestedJobs();
+	BenchDependencies();
+
+	return 0;
+}
@@ -0,0 +1,208 @@
+#include "qcommon/base.h"
+#include "qcommon/array.h"
+#include "qcommon/fs.h"
+#include "qcommon/qcommon.h"
+#include "qcommon/net_chan.h"
+#include "qcommon/time.h"
+#include "gameshared/demo.h"
+
+#include "zstd/zstd.h"
+#include "zstd/zdict.h"
+
+/*
+ * trains the shared netchan zstd dictionary from server demos, since those
+ * contain exactly the same messages clients get sent, and measures how much
+ * it helps compared to plain zstd
+ */
+
+static constexpr size_t DICTIONARY_SIZE = 32 * 1024;
+
+struct Samples {
+	NonRAIIDynamicArray< u8 > data;
+	NonRAIIDynamicArray< size_t > sizes;
+};
+
+void ShowErrorMessage( const char * msg, const char * file, int line ) {
+	printf( "%s (%s:%d)\n", msg, file, line );
+}
+
+void Com_Printf( const char * format, ... ) {
+	va_list argptr;
+	va_start( argptr, format );
+	vprintf( format, argptr );
+	va_end( argptr );
+}
+
+static bool AddDemoSamples( Samples * samples, const char * path ) {
+	Span< u8 > demo = ReadFileBinary( sys_allocator, path );
+	if( demo.ptr == NULL ) {
+		printf( "Can't read %s\n", path );
+		return false;
+	}
+	defer { Free( sys_allocator, demo.ptr ); };
+
+	DemoMetadata metadata;
+	if( !ReadDemoMetadata( sys_allocator, &metadata, demo ) ) {
+		printf( "%s isn't a demo\n", path );
+		return false;
+	}
+	defer {
+		Free( sys_allocator, metadata.game_version.ptr );
+		Free( sys_allocator, metadata.server.ptr );
+		Free( sys_allocator, metadata.map.ptr );
+	};
+
+	Span< u8 > decompressed;
+	if( !DecompressDemo( sys_allocator, metadata, &decompressed, demo ) ) {
+		printf( "Can't decompress %s\n", path );
+		return false;
+	}
+	defer { Free( sys_allocator, decompressed.ptr ); };
+
+	size_t cursor = 0;
+	while( cursor + sizeof( u16 ) <= decompressed.n ) {
+		u16 len;
+		memcpy( &len, decompressed.ptr + cursor, sizeof( len ) );
+		cursor += sizeof( len );
+		if( cursor + len > decompressed.n )
+			break;
+
+		Span< const u8 > msg = decompressed.slice( cursor, cursor + len );
+		cursor += len;
+
+		// the serverdata/baselines only get sent once per connection so
+		// don't let them crowd the per-frame stuff out of the dictionary
+		if( msg[ 0 ] == svc_serverdata || msg[ 0 ] == svc_spawnbaseline )
+			continue;
+
+		samples->data.add_many( msg );
+		samples->sizes.add( msg.n );
+	}
+
+	return true;
+}
+
+static bool Train( const char * output_path, const Samples & samples ) {
+	u8 * dictionary = AllocMany< u8 >( sys_allocator, DICTIONARY_SIZE );
+	defer { Free( sys_allocator, dictionary ); };
+
+	size_t dictionary_size = ZDICT_trainFromBuffer( dictionary, DICTIONARY_SIZE, samples.data.ptr(), samples.sizes.ptr(), checked_cast< unsigned >( samples.sizes.size() ) );
+	if( ZDICT_isError( dictionary_size ) ) {
+		printf( "Can't train dictionary: %s\n", ZDICT_getErrorName( dictionary_size ) );
+		return false;
+	}
+
+	if( !WriteFile( sys_allocator, output_path, dictionary, dictionary_size ) ) {
+		printf( "Can't write %s\n", output_path );
+		return false;
+	}
+
+	printf( "Wrote %zu byte dictionary with ID %u to %s\n", dictionary_size, ZDICT_getDictID( dictionary, dictionary_size ), output_path );
+	return true;
+}
+
+struct BenchResult {
+	size_t compressed_bytes;
+	Time time;
+};
+
+static BenchResult Compress( ZSTD_CCtx * zstd, const Samples & samples, Span< ZSTD_CDict * > cdicts ) {
+	static u8 compressed[ ZSTD_COMPRESSBOUND( MAX_MSGLEN ) ];
+	BenchResult result = { };
+
+	size_t cursor = 0;
+	for( size_t size : samples.sizes ) {
+		const u8 * msg = samples.data.ptr() + cursor;
+		cursor += size;
+
+		Time start = Now();
+		size_t compressed_size;
+		if( cdicts.n == 0 ) {
+			compressed_size = ZSTD_compressCCtx( zstd, compressed, sizeof( compressed ), msg, size, ZSTD_CLEVEL_DEFAULT );
+		}
+		else {
+			size_t level = Netchan_CompressionLevel( size );
+			compressed_size = ZSTD_compress_usingCDict( zstd, compressed, sizeof( compressed ), msg, size, cdicts[ level ] );
+		}
+		result.time += Now() - start;
+
+		// the netchan sends messages uncompressed if it doesn't help
+		result.compressed_bytes += ZSTD_isError( compressed_size ) ? size : Min2( compressed_size, size );
+	}
+
+	return result;
+}
+
+static bool Bench( const char * dictionary_path, const Samples & samples ) {
+	Span< u8 > dictionary = ReadFileBinary( sys_allocator, dictionary_path );
+	if( dictionary.ptr == NULL ) {
+		printf( "Can't read %s\n", dictionary_path );
+		return false;
+	}
+	defer { Free( sys_allocator, dictionary.ptr ); };
+
+	ZSTD_CDict * cdicts[ ARRAY_COUNT( NETCHAN_COMPRESSION_LEVELS ) ];
+	for( size_t i = 0; i < ARRAY_COUNT( cdicts ); i++ ) {
+		cdicts[ i ] = ZSTD_createCDict( dictionary.ptr, dictionary.n, NETCHAN_COMPRESSION_LEVELS[ i ].level );
+		if( cdicts[ i ] == NULL ) {
+			Fatal( "ZSTD_createCDict" );
+		}
+	}
+	defer {
+		for( ZSTD_CDict * cdict : cdicts ) {
+			ZSTD_freeCDict( cdict );
+		}
+	};
+
+	ZSTD_CCtx * zstd = ZSTD_createCCtx();
+	if( zstd == NULL ) {
+		Fatal( "ZSTD_createCCtx" );
+	}
+	defer { ZSTD_freeCCtx( zstd ); };
+
+	BenchResult before = Compress( zstd, samples, Span< ZSTD_CDict * >() );
+	BenchResult after = Compress( zstd, samples, Span< ZSTD_CDict * >( cdicts, ARRAY_COUNT( cdicts ) ) );
+
+	float num_samples = float( samples.sizes.size() );
+	float uncompressed_bytes = float( samples.data.size() );
+
+	printf( "%zu packets, %.1f bytes per packet\n", samples.sizes.size(), uncompressed_bytes / num_samples );
+	printf( "before: ratio %.3f, %.1f bytes per packet, %.2fus per packet\n",
+		uncompressed_bytes / before.compressed_bytes, before.compressed_bytes / num_samples, ToSeconds( before.time ) * 1000000.0f / num_samples );
+	printf( "after:  ratio %.3f, %.1f bytes per packet, %.2fus per packet\n",
+		uncompressed_bytes / after.compressed_bytes, after.compressed_bytes / num_samples, ToSeconds( after.time ) * 1000000.0f / num_samples );
+
+	return true;
+}
+
+int main( int argc, char ** argv ) {
+	bool train = argc >= 4 && StrEqual( argv[ 1 ], "train" );
+	bool bench = argc >= 4 && StrEqual( argv[ 1 ], "bench" );
+	if( !train && !bench ) {
+		printf( "Usage: %s train <netchan.zdict> <demos...>\n", argv[ 0 ] );
+		printf( "       %s bench <netchan.zdict> <demos...>\n", argv[ 0 ] );
+		return 1;
+	}
+
+	Samples samples;
+	samples.data.init( sys_allocator );
+	samples.sizes.init( sys_allocator );
+	defer {
+		samples.data.shutdown();
+		samples.sizes.shutdown();
+	};
+
+	for( int i = 3; i < argc; i++ ) {
+		if( !AddDemoSamples( &samples, argv[ i ] ) ) {
+			return 1;
+		}
+	}
+
+	if( samples.sizes.size() == 0 ) {
+		printf( "No packets in those demos\n" );
+		return 1;
+	}
+
+	bool ok = train ? Train( argv[ 2 ], samples ) : Bench( argv[ 2 ], samples );
+	return ok ? 0 : 1;
+}